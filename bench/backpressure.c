@@ -0,0 +1,294 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     backpressure.c
+ *  @brief    Send queue backpressure benchmark for xconn (Linux)
+ *
+ *  One producer on an xloop publishes frames to two consumers over
+ *  loopback: a fast one that reads as quickly as it can and a slow one
+ *  that reads at a fixed rate (-r) through a small receive buffer.
+ *
+ *  Producer modes:
+ *      watermark - sends to a connection only while it is not blocked,
+ *                  XCONN_EV_BLOCKED / XCONN_EV_WRITABLE switch it
+ *      cap       - ignores the watermarks and sends until xconn_send
+ *                  refuses frames at sndq_max, refused frames are dropped
+ *
+ *  fast_mb_s should not depend on the slow consumer, and peak_queued_kb
+ *  (the largest xconn_global_queued seen) stays near the watermark or the
+ *  cap instead of growing with the run time.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/backpressure.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c source/xconn.c \
+ *          -lpthread -o backpressure
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xconn.h"
+#include "bench_common.h"
+
+#define RX_BUF_SIZE     (256 << 10)
+
+static const char *cols[] = {
+    "size", "fast_mb_s", "slow_mb_s", "peak_queued_kb", "blocked", "refused"
+};
+
+static const char *mode_name[] = { "watermark", "cap" };
+
+/* a consumer thread */
+typedef struct consumer {
+    socket_t      fd;
+    double        rate_mb_s;        // 0 for as fast as possible
+    volatile int  stop;
+    int64_t       bytes;
+} consumer;
+
+static void *
+consumer_thread(void *arg)
+{
+    consumer *cs = (consumer *)arg;
+    char     *buf = (char *)malloc(RX_BUF_SIZE);
+    uint64_t  t0 = bench_now_ns();
+    int32_t   chunk = cs->rate_mb_s > 0 ? 16 << 10 : RX_BUF_SIZE;
+    int32_t   n;
+
+    while (buf != NULL && !cs->stop) {
+        if ((n = socket_recv(cs->fd, buf, chunk)) <= 0) {
+            break;
+        }
+        cs->bytes += n;
+        if (cs->rate_mb_s > 0) {
+            // pace: sleep until the bytes read so far are due
+            uint64_t due = t0 + (uint64_t)((double)cs->bytes / (cs->rate_mb_s * 1e6) * 1e9);
+            uint64_t now = bench_now_ns();
+            if (due > now) {
+                usleep((useconds_t)((due - now) / 1000));
+            }
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+static void
+on_frame(xconn *c, const void *data, int32_t len)
+{
+    (void)c;
+    (void)data;
+    (void)len;
+}
+
+static void
+on_event(xconn *c, xconn_event ev, int32_t err)
+{
+    int *failed = (int *)xconn_user(c);
+
+    (void)err;
+    if (ev == XCONN_EV_CLOSED || ev == XCONN_EV_DEAD) {
+        *failed = 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : publish to a fast and a slow consumer for a fixed time
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port, int mode,
+        int32_t size, double slow_rate, double seconds)
+{
+    xloop       *loop = NULL;
+    xconn       *conn[2] = { NULL, NULL };
+    consumer     cs[2];
+    pthread_t    tid[2];
+    socket_opts  opts;
+    xconn_config cfg;
+    xconn_stats  st;
+    char        *frame;
+    uint64_t     t0, end;
+    int64_t      peak = 0, blocked = 0, refused = 0, q;
+    double       v[6];
+    int          i, started = 0, failed = 0, ret = -1;
+
+    memset(cs, 0, sizeof(cs));
+    cs[1].rate_mb_s = slow_rate;
+    socket_opts_init(&opts, SOCKET_PROFILE_DEFAULT);
+    opts.rcvbuf = 64 << 10;
+
+    if ((frame = (char *)calloc(1, size)) == NULL || (loop = xloop_create()) == NULL) {
+        goto out;
+    }
+    xconn_config_init(&cfg);
+    for (i = 0; i < 2; i++) {
+        socket_t srv;
+        cs[i].fd = socket_create_tcp_client_ex(addr, port, i == 1 ? &opts : NULL);
+        if (cs[i].fd == INVALID_SOCKET
+            || (srv = socket_create_tcp_server(listen_fd, 1000)) == INVALID_SOCKET) {
+            goto out;
+        }
+        if ((conn[i] = xconn_create(loop, srv, &cfg, on_frame, on_event, &failed)) == NULL) {
+            socket_close(srv);
+            goto out;
+        }
+    }
+    for (started = 0; started < 2; started++) {
+        if (pthread_create(&tid[started], NULL, consumer_thread, &cs[started]) != 0) {
+            goto out;
+        }
+    }
+
+    t0  = bench_now_ns();
+    end = t0 + (uint64_t)(seconds * 1e9);
+    while (!failed && bench_now_ns() < end) {
+        int sent = 0;
+        for (i = 0; i < 2; i++) {
+            int k;
+            for (k = 0; k < 16; k++) {
+                if (mode == 0 && xconn_blocked(conn[i])) {
+                    break;
+                }
+                if (xconn_send(conn[i], frame, size) != 0) {
+                    break;                  // refused, the frame is dropped
+                }
+                sent++;
+            }
+        }
+        if ((q = xconn_global_queued()) > peak) {
+            peak = q;
+        }
+        xloop_run_once(loop, sent ? 0 : 10);
+    }
+    for (i = 0; i < 2; i++) {
+        cs[i].stop = 1;
+    }
+    if (failed) {
+        goto out;
+    }
+
+    for (i = 0; i < 2; i++) {
+        xconn_get_stats(conn[i], &st);
+        blocked += st.blocked;
+        refused += st.refused;
+    }
+    v[0] = size;
+    v[1] = (double)cs[0].bytes / seconds / 1e6;
+    v[2] = (double)cs[1].bytes / seconds / 1e6;
+    v[3] = (double)peak / 1024;
+    v[4] = (double)blocked;
+    v[5] = (double)refused;
+    bench_report_row(rep, mode_name[mode], v);
+    ret = 0;
+
+out:
+    for (i = 0; i < 2; i++) {
+        cs[i].stop = 1;
+        xconn_close(conn[i]);
+        if (cs[i].fd != INVALID_SOCKET && cs[i].fd != 0) {
+            shutdown(cs[i].fd, SHUT_RDWR);  // wake a consumer blocked in recv
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(tid[i], NULL);
+    }
+    for (i = 0; i < 2; i++) {
+        if (cs[i].fd != INVALID_SOCKET && cs[i].fd != 0) {
+            socket_close(cs[i].fd);
+        }
+    }
+    if (loop != NULL) {
+        xloop_run_once(loop, 0);
+        xloop_destroy(loop);
+    }
+    free(frame);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12022)\n"
+            "  -s sizes   frame sizes             (default 256,4K)\n"
+            "  -r MB/s    slow consumer rate      (default 20)\n"
+            "  -t secs    time per run            (default 2)\n"
+            "  -m modes   watermark,cap           (default both)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     sizes[BENCH_MAX_LIST] = { 256, 4096 };
+    int         n_sizes = 2;
+    int         modes[2] = { 1, 1 };
+    const char *addr = "127.0.0.1";
+    uint16_t    port = 12022;
+    double      rate = 20, seconds = 2;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t    listen_fd;
+    int opt, m, s, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:s:r:t:m:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr    = optarg; break;
+        case 'p': port    = (uint16_t)atoi(optarg); break;
+        case 's': n_sizes = bench_parse_list(optarg, sizes); break;
+        case 'r': rate    = atof(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'm':
+            for (m = 0; m < 2; m++) {
+                modes[m] = strstr(optarg, mode_name[m]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || rate <= 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((listen_fd = socket_create_tcp_listen(addr, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (m = 0; m < 2; m++) {
+        for (s = 0; s < n_sizes && modes[m]; s++) {
+            if (sizes[s] <= 0 || sizes[s] > (1 << 20)) {
+                continue;
+            }
+            if (run_one(&rep, listen_fd, addr, port, m, (int32_t)sizes[s], rate, seconds) != 0) {
+                fprintf(stderr, "[bench] %s size %d failed\n", mode_name[m], (int)sizes[s]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
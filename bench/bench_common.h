@@ -0,0 +1,282 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     bench_common.h
+ *  @brief    Shared helpers for the xsocket benchmarks (Linux)
+ *
+ *  Monotonic clock, latency statistics, command line list parsing and a
+ *  result writer with text, CSV and JSON output.
+ *  Everything is static inline so each benchmark stays a single translation unit
+ *  plus xsocket.c.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __BENCH_COMMON_H__
+#define __BENCH_COMMON_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_MAX_LIST  64              // max entries of a comma list option
+
+// ---------------------------------------------------------------------------
+// Function   : current time of the monotonic clock
+// Return     : nanoseconds since an unspecified starting point
+// ---------------------------------------------------------------------------
+static inline uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : parse a size with an optional K/M/G suffix ("64", "4K", "1M")
+// Return     : the value, or -1 on a malformed string
+// ---------------------------------------------------------------------------
+static inline int64_t
+bench_parse_size(const char *s)
+{
+    char *end;
+    int64_t v = strtoll(s, &end, 10);
+
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    default:  break;
+    }
+    return (end == s || *end != '\0' || v < 0) ? -1 : v;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : parse a comma separated list of sizes ("64,1K,64K")
+// Parameters :
+//      [in ] : s   - the list
+//      [out] : out - parsed values, at most BENCH_MAX_LIST
+// Return     : number of values, or -1 on a malformed list
+// ---------------------------------------------------------------------------
+static inline int
+bench_parse_list(const char *s, int64_t *out)
+{
+    char item[32];
+    int  n = 0;
+
+    while (*s) {
+        size_t k = strcspn(s, ",");
+        if (k == 0 || k >= sizeof(item) || n >= BENCH_MAX_LIST) {
+            return -1;
+        }
+        memcpy(item, s, k);
+        item[k] = '\0';
+        if ((out[n++] = bench_parse_size(item)) < 0) {
+            return -1;
+        }
+        s += k + (s[k] == ',');
+    }
+    return n;
+}
+
+static inline int
+bench_cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* latency distribution of a sorted sample set, all values in nanoseconds */
+typedef struct bench_dist {
+    uint64_t min, p50, p90, p99, p999, max;
+    double   mean;
+} bench_dist;
+
+// ---------------------------------------------------------------------------
+// Function   : sort the samples and compute their distribution
+// Parameters :
+//      [in ] : v - samples (sorted in place)
+//            : n - number of samples
+//      [out] : d - the distribution
+// ---------------------------------------------------------------------------
+static inline void
+bench_dist_compute(uint64_t *v, size_t n, bench_dist *d)
+{
+    double sum = 0;
+    size_t i;
+
+    memset(d, 0, sizeof(*d));
+    if (n == 0) {
+        return;
+    }
+
+    qsort(v, n, sizeof(v[0]), bench_cmp_u64);
+    for (i = 0; i < n; i++) {
+        sum += (double)v[i];
+    }
+
+    d->min  = v[0];
+    d->p50  = v[(n - 1) * 50 / 100];
+    d->p90  = v[(n - 1) * 90 / 100];
+    d->p99  = v[(n - 1) * 99 / 100];
+    d->p999 = v[(n - 1) * 999 / 1000];
+    d->max  = v[n - 1];
+    d->mean = sum / (double)n;
+}
+
+/* growable sample set */
+typedef struct bench_samples {
+    uint64_t *v;
+    size_t    n;
+    size_t    cap;
+} bench_samples;
+
+// ---------------------------------------------------------------------------
+// Function   : append a sample, silently dropped when out of memory
+// ---------------------------------------------------------------------------
+static inline void
+bench_samples_push(bench_samples *s, uint64_t x)
+{
+    if (s->n == s->cap) {
+        size_t    cap = s->cap ? s->cap * 2 : 4096;
+        uint64_t *v   = (uint64_t *)realloc(s->v, cap * sizeof(uint64_t));
+        if (v == NULL) {
+            return;
+        }
+        s->v   = v;
+        s->cap = cap;
+    }
+    s->v[s->n++] = x;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : append all samples of src to dst
+// ---------------------------------------------------------------------------
+static inline void
+bench_samples_merge(bench_samples *dst, const bench_samples *src)
+{
+    size_t i;
+    for (i = 0; i < src->n; i++) {
+        bench_samples_push(dst, src->v[i]);
+    }
+}
+
+static inline void
+bench_samples_free(bench_samples *s)
+{
+    free(s->v);
+    memset(s, 0, sizeof(*s));
+}
+
+// ---------------------------------------------------------------------------
+// result writer: one row per measurement, a leading string column (the tag)
+// followed by numeric columns, printed as an aligned table, CSV or JSON
+
+typedef enum bench_fmt {
+    BENCH_FMT_TEXT = 0,
+    BENCH_FMT_CSV,
+    BENCH_FMT_JSON
+} bench_fmt;
+
+typedef struct bench_report {
+    bench_fmt    fmt;
+    const char  *tag_name;
+    const char **cols;
+    int          ncols;
+    int          rows;
+} bench_report;
+
+// ---------------------------------------------------------------------------
+// Function   : parse an output format name ("text", "csv" or "json")
+// Return     : zero on success, -1 for an unknown name
+// ---------------------------------------------------------------------------
+static inline int
+bench_parse_fmt(const char *s, bench_fmt *fmt)
+{
+    if (strcmp(s, "text") == 0) {
+        *fmt = BENCH_FMT_TEXT;
+    } else if (strcmp(s, "csv") == 0) {
+        *fmt = BENCH_FMT_CSV;
+    } else if (strcmp(s, "json") == 0) {
+        *fmt = BENCH_FMT_JSON;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static inline void
+bench_report_begin(bench_report *r, bench_fmt fmt, const char *tag_name,
+                   const char **cols, int ncols)
+{
+    int i;
+
+    r->fmt      = fmt;
+    r->tag_name = tag_name;
+    r->cols     = cols;
+    r->ncols    = ncols;
+    r->rows     = 0;
+
+    switch (fmt) {
+    case BENCH_FMT_TEXT:
+        printf("%-10s", tag_name);
+        for (i = 0; i < ncols; i++) {
+            printf(" %12s", cols[i]);
+        }
+        printf("\n");
+        break;
+    case BENCH_FMT_CSV:
+        printf("%s", tag_name);
+        for (i = 0; i < ncols; i++) {
+            printf(",%s", cols[i]);
+        }
+        printf("\n");
+        break;
+    case BENCH_FMT_JSON:
+        printf("[");
+        break;
+    }
+}
+
+static inline void
+bench_report_row(bench_report *r, const char *tag, const double *v)
+{
+    int i;
+
+    switch (r->fmt) {
+    case BENCH_FMT_TEXT:
+        printf("%-10s", tag);
+        for (i = 0; i < r->ncols; i++) {
+            printf(" %12.*f", v[i] == (double)(int64_t)v[i] ? 0 : 2, v[i]);
+        }
+        printf("\n");
+        break;
+    case BENCH_FMT_CSV:
+        printf("%s", tag);
+        for (i = 0; i < r->ncols; i++) {
+            printf(",%.15g", v[i]);
+        }
+        printf("\n");
+        break;
+    case BENCH_FMT_JSON:
+        printf("%s\n  {\"%s\": \"%s\"", r->rows ? "," : "", r->tag_name, tag);
+        for (i = 0; i < r->ncols; i++) {
+            printf(", \"%s\": %.15g", r->cols[i], v[i]);
+        }
+        printf("}");
+        break;
+    }
+    r->rows++;
+    fflush(stdout);
+}
+
+static inline void
+bench_report_end(bench_report *r)
+{
+    if (r->fmt == BENCH_FMT_JSON) {
+        printf("%s]\n", r->rows ? "\n" : "");
+    }
+}
+
+#endif // __BENCH_COMMON_H__
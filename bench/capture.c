@@ -0,0 +1,243 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     capture.c
+ *  @brief    Capture journal benchmark: cost of recording a packet (Linux)
+ *
+ *  The receive thread's cost of recording one packet, per record:
+ *      fwrite - fwrite of a record header and the data into a stdio buffer,
+ *               which writes to the file whenever it fills
+ *      write  - one write() system call per record
+ *      xcap   - xcap_write into the memory-mapped journal, the journal
+ *               thread msyncs and rolls over
+ *  The tail columns show the jitter a recorder adds to the receive path.
+ *  Records are written back to back, or paced with -r.  -P sets the files
+ *  xcap keeps prepared, -S has the writer map a file when none is ready
+ *  (stalls) instead of dropping.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/capture.c source/xsocket.c source/xthread.c source/xcap.c \
+ *          -lpthread -o capture
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "xsocket.h"
+#include "xcap.h"
+#include "bench_common.h"
+
+enum { MODE_FWRITE = 0, MODE_WRITE, MODE_XCAP, MODE_COUNT };
+
+static const char *mode_name[] = { "fwrite", "write", "xcap" };
+
+static const char *cols[] = {
+    "size", "records", "mb_s", "p50_ns", "p99_ns", "p999_ns", "max_ns", "dropped", "stalls"
+};
+
+// ---------------------------------------------------------------------------
+// Function   : record count packets of one size with one method
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, int mode, const char *prefix, int32_t size, int64_t count,
+        int64_t rate, int64_t file_size, int32_t prepared, int32_t sync_rollover)
+{
+    bench_samples lat = { 0 };
+    bench_dist    d;
+    xcap_config   cfg;
+    xcap_stats    st = { 0 };
+    xcap         *c = NULL;
+    FILE         *fp = NULL;
+    int           fd = -1;
+    char          path[512];
+    char         *payload;
+    xcap_rec      hdr = { 0 };
+    uint64_t      t0, t1, start, next = 0;
+    uint64_t      gap = rate > 0 ? 1000000000ull / (uint64_t)rate : 0;
+    double        v[9];
+    int64_t       i, dropped = 0;
+    int32_t       stream = 0, ret = -1;
+
+    if ((payload = (char *)malloc(size)) == NULL) {
+        return -1;
+    }
+    memset(payload, 0x5a, size);
+    snprintf(path, sizeof(path), "%s.%s", prefix, mode_name[mode]);
+    switch (mode) {
+    case MODE_FWRITE:
+        fp = fopen(path, "wb");
+        break;
+    case MODE_WRITE:
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        break;
+    default:
+        xcap_config_init(&cfg);
+        cfg.file_size     = file_size;
+        cfg.prepared      = prepared;
+        cfg.sync_rollover = sync_rollover;
+        if ((c = xcap_open(prefix, &cfg)) != NULL) {
+            stream = xcap_add_stream(c, XCAP_MC, "239.1.1.1", 12000);
+        }
+        break;
+    }
+    if ((mode == MODE_FWRITE && fp == NULL) || (mode == MODE_WRITE && fd < 0)
+        || (mode == MODE_XCAP && (c == NULL || stream < 0))) {
+        fprintf(stderr, "[bench] cannot open %s\n", path);
+        goto out;
+    }
+
+    hdr.len  = (uint32_t)size;
+    hdr.size = (uint32_t)(sizeof(hdr) + size);
+    hdr.type = XCAP_MC;
+    start    = bench_now_ns();
+    for (i = 0; i < count; i++) {
+        if (gap > 0) {
+            next = start + (uint64_t)i * gap;
+            while (bench_now_ns() < next) {
+            }
+        }
+        t0 = bench_now_ns();
+        switch (mode) {
+        case MODE_FWRITE:
+            hdr.ts_ns = (int64_t)t0;
+            if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 || fwrite(payload, size, 1, fp) != 1) {
+                dropped++;
+            }
+            break;
+        case MODE_WRITE:
+            hdr.ts_ns = (int64_t)t0;
+            memcpy(payload, &hdr, size < (int32_t)sizeof(hdr) ? size : (int32_t)sizeof(hdr));
+            if (write(fd, payload, size) != size) {
+                dropped++;
+            }
+            break;
+        default:
+            if (xcap_write(c, stream, 0, payload, size) != 0) {
+                dropped++;
+            }
+            break;
+        }
+        t1 = bench_now_ns();
+        bench_samples_push(&lat, t1 - t0);
+    }
+    t1 = bench_now_ns();
+
+    bench_dist_compute(lat.v, lat.n, &d);
+    v[0] = size;
+    v[1] = (double)count;
+    v[2] = (double)count * size / ((double)(t1 - start) / 1e9) / 1e6;
+    v[3] = (double)d.p50;
+    v[4] = (double)d.p99;
+    v[5] = (double)d.p999;
+    v[6] = (double)d.max;
+    v[7] = (double)dropped;
+    v[8] = 0;
+    if (c != NULL) {
+        xcap_get_stats(c, &st);
+        v[8] = (double)st.stalls;
+    }
+    bench_report_row(rep, mode_name[mode], v);
+    ret = 0;
+
+out:
+    if (fp != NULL) {
+        fclose(fp);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (mode != MODE_XCAP) {
+        unlink(path);
+    } else if (c != NULL) {
+        xcap_get_stats(c, &st);
+        xcap_close(c);
+        for (i = 0; i <= st.files; i++) {
+            snprintf(path, sizeof(path), "%s.%06d.xcap", prefix, (int)i);
+            unlink(path);
+        }
+    }
+    bench_samples_free(&lat);
+    free(payload);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -o prefix  journal path prefix     (default /tmp/xcap_bench)\n"
+            "  -s sizes   packet sizes            (default 64,1K)\n"
+            "  -n count   records per run         (default 500000)\n"
+            "  -r rate    records per second      (default 0, back to back)\n"
+            "  -F size    journal file size       (default 64M)\n"
+            "  -P files   xcap files prepared     (default 2)\n"
+            "  -S         xcap maps a file when none is ready\n"
+            "  -m modes   fwrite,write,xcap       (default all)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     sizes[BENCH_MAX_LIST] = { 64, 1024 };
+    int         n_sizes = 2;
+    int         modes[MODE_COUNT] = { 1, 1, 1 };
+    const char *prefix = "/tmp/xcap_bench";
+    int64_t     count = 500000, rate = 0, file_size = (int64_t)64 << 20;
+    int32_t     prepared = 2, sync_rollover = 0;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, m, s, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "o:s:n:r:F:P:Sm:f:h")) != -1) {
+        switch (opt) {
+        case 'o': prefix    = optarg; break;
+        case 's': n_sizes   = bench_parse_list(optarg, sizes); break;
+        case 'n': count     = bench_parse_size(optarg); break;
+        case 'r': rate      = bench_parse_size(optarg); break;
+        case 'F': file_size = bench_parse_size(optarg); break;
+        case 'P': prepared  = atoi(optarg); break;
+        case 'S': sync_rollover = 1; break;
+        case 'm':
+            for (m = 0; m < MODE_COUNT; m++) {
+                modes[m] = strstr(optarg, mode_name[m]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || count <= 0 || rate < 0 || file_size <= 0
+        || prepared < 1 || prepared > XCAP_MAX_PREPARED) {
+        usage(argv[0]);
+        return 1;
+    }
+    socket_set_verbose(0);
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_sizes; s++) {
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (!modes[m] || sizes[s] <= 0 || sizes[s] > (1 << 20)) {
+                continue;
+            }
+            if (run_one(&rep, m, prefix, (int32_t)sizes[s], count, rate, file_size, prepared,
+                        sync_rollover) != 0) {
+                fprintf(stderr, "[bench] %s %d bytes failed\n", mode_name[m], (int)sizes[s]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,390 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     coro_echo.cpp
+ *  @brief    Coroutine echo benchmark for xloop.hpp (Linux, C++20)
+ *
+ *  The loop_echo round trip written with coroutines: one xloop thread
+ *  runs an accepting coroutine, an echo coroutine per accepted socket and
+ *  a client coroutine per connection, which connects with async_connect
+ *  and then awaits a round_trip task (async_send, async_recv) in a loop.
+ *  Every round trip starts a task and two operations, all on the frame
+ *  pool.
+ *
+ *  new counts the calls of the global operator new in the measured time:
+ *  a coroutine frame that is not pooled, or a pool refill.  Once the
+ *  connections are up it must stay 0; the run fails otherwise.
+ *
+ *  Build (the library is C, g++ would compile the .c files as C++):
+ *      gcc -O2 -Isource -c source/xsocket.c source/xloop.c source/xloop_uring.c \
+ *          source/xtimer.c source/xthread.c
+ *      g++ -std=c++20 -O2 -Isource bench/coro_echo.cpp xsocket.o xloop.o xloop_uring.o \
+ *          xtimer.o xthread.o -lpthread -o coro_echo
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <new>
+#include "xsocket.h"
+#include "xloop.hpp"
+#include "bench_common.h"
+
+// ---------------------------------------------------------------------------
+// heap allocations of C++ code, the loop thread only
+
+static int64_t s_news;
+
+void *
+operator new(std::size_t size)
+{
+    void *p;
+
+    s_news++;
+    if ((p = malloc(size != 0 ? size : 1)) == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+void
+operator delete(void *p, std::size_t) noexcept
+{
+    free(p);
+}
+
+static const char *cols[] = {
+    "size", "conns", "seconds", "rtts", "rtt_s", "p50_us", "p99_us", "new"
+};
+
+static const char *backend_name[] = { "auto", "epoll", "uring" };
+
+/* state of one run */
+typedef struct echo_ctx {
+    xloop        *loop;
+    const char   *addr;
+    uint16_t      port;
+    socket_t      listen_fd;
+    int32_t       size;
+    int32_t       conns;
+    char         *slab;             // per connection: client message, server buffer
+    int32_t       connected;
+    int32_t       accepted;
+    int32_t       active;           // coroutines not returned yet
+    int32_t       failed;
+    int32_t       measuring;
+    int32_t       stop;
+    int64_t       rtts;
+    bench_samples rtt;
+} echo_ctx;
+
+// ---------------------------------------------------------------------------
+// server side: accept conns sockets, echo each in a coroutine of its own
+
+static xsocket::task<void>
+echo(echo_ctx *ctx, socket_t fd, char *buf)
+{
+    for (;;) {
+        xsocket::io_result r = co_await xsocket::async_recv(ctx->loop, fd, buf, ctx->size);
+        if (r.value <= 0 || !co_await xsocket::async_send(ctx->loop, fd, buf, r.value)) {
+            break;
+        }
+    }
+    xloop_close(ctx->loop, fd);
+    ctx->active--;
+}
+
+static xsocket::task<void>
+serve(echo_ctx *ctx)
+{
+    while (ctx->accepted < ctx->conns) {
+        xsocket::io_result r = co_await xsocket::async_accept(ctx->loop, ctx->listen_fd);
+        if (!r) {
+            ctx->failed += r.err != ECANCELED;
+            break;
+        }
+        char *buf = ctx->slab + ((size_t)ctx->accepted * 2 + 1) * ctx->size;
+        ctx->accepted++;
+        ctx->active++;
+        xsocket::spawn(echo(ctx, r.value, buf));
+    }
+    ctx->active--;
+}
+
+// ---------------------------------------------------------------------------
+// client side: connect, then one message and its echo per round trip
+
+static xsocket::task<int32_t>
+round_trip(echo_ctx *ctx, socket_t fd, char *buf)
+{
+    int32_t got = 0;
+
+    if (!co_await xsocket::async_send(ctx->loop, fd, buf, ctx->size)) {
+        co_return SOCKET_ERROR;
+    }
+    while (got < ctx->size) {
+        xsocket::io_result r = co_await xsocket::async_recv(ctx->loop, fd, buf + got, ctx->size - got);
+        if (r.value <= 0) {
+            co_return SOCKET_ERROR;
+        }
+        got += r.value;
+    }
+    co_return got;
+}
+
+static xsocket::task<void>
+client(echo_ctx *ctx, char *buf)
+{
+    xsocket::io_result c = co_await xsocket::async_connect(ctx->loop, ctx->addr, ctx->port);
+
+    if (!c) {
+        ctx->failed++;
+        ctx->active--;
+        co_return;
+    }
+    ctx->connected++;
+    while (!ctx->stop) {
+        uint64_t t0 = bench_now_ns();
+        if (co_await round_trip(ctx, c.value, buf) != ctx->size) {
+            ctx->failed += !ctx->stop;
+            break;
+        }
+        if (ctx->measuring) {
+            bench_samples_push(&ctx->rtt, bench_now_ns() - t0);
+            ctx->rtts++;
+        }
+    }
+    xloop_close(ctx->loop, c.value);
+    ctx->active--;
+}
+
+static void
+raise_fd_limit(int32_t conns)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)(2 * conns + 64)) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/* settings shared by all runs */
+typedef struct echo_opts {
+    const char        *addr;
+    uint16_t           port;
+    socket_t           listen_fd;
+    xloop_backend_type backend;
+    double             seconds;
+} echo_opts;
+
+// ---------------------------------------------------------------------------
+// Function   : run the loop until ns_end or until done says so
+// ---------------------------------------------------------------------------
+template <class Done>
+static void
+run_until(echo_ctx *ctx, uint64_t ns_end, Done done)
+{
+    while (!done() && bench_now_ns() < ns_end) {
+        xloop_run_once(ctx->loop, 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : connect and warm up all clients, run the echo for a fixed
+//              time, then let every coroutine return
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const echo_opts *eo, int32_t size, int32_t conns)
+{
+    xloop_config cfg;
+    echo_ctx     ctx;
+    uint64_t     t0, t1;
+    int64_t      news;
+    bench_dist   d;
+    double       v[8];
+    int32_t      i;
+    int          ret = -1;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.addr      = eo->addr;
+    ctx.port      = eo->port;
+    ctx.listen_fd = eo->listen_fd;
+    ctx.size      = size;
+    ctx.conns     = conns;
+
+    xloop_config_init(&cfg);
+    cfg.backend = eo->backend;
+    ctx.loop    = xloop_create_ex(&cfg);
+    ctx.slab    = (char *)calloc((size_t)conns * 2, size);
+    if (ctx.loop == NULL || ctx.slab == NULL) {
+        goto out;
+    }
+
+    ctx.active = 1 + conns;
+    xsocket::spawn(serve(&ctx));
+    for (i = 0; i < conns; i++) {
+        xsocket::spawn(client(&ctx, ctx.slab + (size_t)i * 2 * size));
+    }
+    // the frame pool fills up while the connections come up and warm up
+    run_until(&ctx, bench_now_ns() + 5000000000ull,
+              [&] { return ctx.failed || (ctx.connected == conns && ctx.accepted == conns); });
+    run_until(&ctx, bench_now_ns() + 100000000ull, [&] { return ctx.failed != 0; });
+
+    ctx.measuring = 1;
+    news = s_news;
+    t0   = bench_now_ns();
+    run_until(&ctx, t0 + (uint64_t)(eo->seconds * 1e9), [&] { return ctx.failed != 0; });
+    t1   = bench_now_ns();
+    news = s_news - news;
+    ctx.measuring = 0;
+
+    ctx.stop = 1;
+    run_until(&ctx, bench_now_ns() + 5000000000ull, [&] { return ctx.active == 0; });
+
+    if (ctx.failed || ctx.connected < conns) {
+        goto out;
+    }
+    bench_dist_compute(ctx.rtt.v, ctx.rtt.n, &d);
+    v[0] = size;
+    v[1] = conns;
+    v[2] = (double)(t1 - t0) / 1e9;
+    v[3] = (double)ctx.rtts;
+    v[4] = (double)ctx.rtts / v[2];
+    v[5] = d.p50 / 1e3;
+    v[6] = d.p99 / 1e3;
+    v[7] = (double)news;
+    bench_report_row(rep, xloop_backend_name(ctx.loop), v);
+    if (news != 0) {
+        fprintf(stderr, "[bench] %lld heap allocations in the measured time\n", (long long)news);
+    } else {
+        ret = 0;
+    }
+
+out:
+    if (ctx.active != 0) {
+        fprintf(stderr, "[bench] %d coroutines did not return\n", ctx.active);
+    }
+    if (ctx.loop != NULL) {
+        xloop_detach(ctx.loop, eo->listen_fd);
+    }
+    xloop_destroy(ctx.loop);
+    free(ctx.slab);
+    bench_samples_free(&ctx.rtt);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12034)\n"
+            "  -b list    backends: epoll,uring   (default epoll,uring)\n"
+            "  -s sizes   message sizes           (default 64,1K)\n"
+            "  -c conns   connection counts       (default 1,16,256)\n"
+            "  -t secs    measured time per run   (default 2)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t sizes[BENCH_MAX_LIST] = { 64, 1024 };
+    int64_t conns[BENCH_MAX_LIST] = { 1, 16, 256 };
+    int     n_sizes = 2, n_conns = 3;
+    int     backends[3] = { 0, 1, 1 };
+    bench_fmt fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    echo_opts eo;
+    int opt, b, s, c, bad = 0, failed = 0;
+
+    memset(&eo, 0, sizeof(eo));
+    eo.addr    = "127.0.0.1";
+    eo.port    = 12034;
+    eo.seconds = 2.0;
+
+    while ((opt = getopt(argc, argv, "a:p:b:s:c:t:f:h")) != -1) {
+        switch (opt) {
+        case 'a': eo.addr    = optarg; break;
+        case 'p': eo.port    = (uint16_t)atoi(optarg); break;
+        case 't': eo.seconds = atof(optarg); break;
+        case 's': n_sizes    = bench_parse_list(optarg, sizes); break;
+        case 'c': n_conns    = bench_parse_list(optarg, conns); break;
+        case 'b':
+            for (b = 1; b < 3; b++) {
+                backends[b] = strstr(optarg, backend_name[b]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || n_conns <= 0 || eo.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((eo.listen_fd = socket_create_tcp_listen(eo.addr, eo.port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", eo.addr, eo.port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "backend", cols, sizeof(cols) / sizeof(cols[0]));
+    for (b = 1; b < 3; b++) {
+        xloop_config cfg;
+        xloop *probe;
+
+        if (!backends[b]) {
+            continue;
+        }
+        xloop_config_init(&cfg);
+        cfg.backend = (xloop_backend_type)b;
+        if ((probe = xloop_create_ex(&cfg)) == NULL) {
+            fprintf(stderr, "[bench] backend %s is not available\n", backend_name[b]);
+            continue;
+        }
+        xloop_destroy(probe);
+        eo.backend = (xloop_backend_type)b;
+
+        for (s = 0; s < n_sizes; s++) {
+            for (c = 0; c < n_conns; c++) {
+                if (sizes[s] <= 0 || conns[c] <= 0) {
+                    continue;
+                }
+                raise_fd_limit((int32_t)conns[c]);
+                if (run_one(&rep, &eo, (int32_t)sizes[s], (int32_t)conns[c]) != 0) {
+                    fprintf(stderr, "[bench] %s size %d conns %d failed\n", backend_name[b],
+                            (int)sizes[s], (int)conns[c]);
+                    failed = 1;
+                }
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(eo.listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
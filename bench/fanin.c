@@ -0,0 +1,463 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     fanin.c
+ *  @brief    Many local consumers of multicast: own sockets against xfanin
+ *
+ *  N reader processes consume the same groups, either each with its own
+ *  socket_add_mc sockets (sockets) or through one xfanin daemon running on
+ *  a loop thread of this process (fanin).  The sender, also in this
+ *  process, paces count datagrams round robin over the groups with loop
+ *  back on.  Over loopback the kernel copies each datagram to every socket
+ *  in the sender's system call, so that cost shows in send_cpu_ms.
+ *
+ *  delivered is the share of datagrams that reached the readers in total,
+ *  the cpu columns are milliseconds of user and system time, mem_mb the
+ *  receive buffers granted (rcvbuf_eff) plus, for fanin, the ring.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/fanin.c source/xsocket.c source/xloop.c source/xloop_uring.c \
+ *          source/xtimer.c source/xthread.c source/xfanin.c -lpthread -o fanin
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xfanin.h"
+#include "bench_common.h"
+
+#define MAX_GROUPS      16
+#define IDLE_MS         300         // a reader stops after this long without data
+#define RING_NAME       "xfanin_bench"
+
+enum { MODE_SOCKETS = 0, MODE_FANIN, MODE_COUNT };
+
+static const char *mode_name[] = { "sockets", "fanin" };
+
+static const char *cols[] = {
+    "readers", "sent", "delivered_pct", "lost", "send_cpu_ms", "read_cpu_ms", "daemon_cpu_ms",
+    "total_cpu_ms", "mem_mb"
+};
+
+/* what a reader reports back through the pipe */
+typedef struct reader_result {
+    int64_t received;
+    int64_t lost;
+} reader_result;
+
+/* the settings of all runs */
+typedef struct bench_ctx {
+    const char *ip_if;
+    char        grp[MAX_GROUPS][46];
+    int32_t     ngroups;
+    uint16_t    port;
+    int32_t     size;
+    int64_t     count;
+    int64_t     rate;
+    int32_t     rcvbuf;
+    const char *daemon_cpus;        // placement of the daemon's loop thread
+} bench_ctx;
+
+/* the daemon's loop thread */
+typedef struct daemon_ctx {
+    xloop        *loop;
+    xfanin       *fanin;
+    volatile int  stop;
+    int           placed;           // report the placement after the first round
+    double        cpu_ms;
+} daemon_ctx;
+
+static double
+thread_cpu_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static double
+children_cpu_ms(void)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return (double)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1e3
+         + (double)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e3;
+}
+
+static void *
+daemon_thread(void *arg)
+{
+    daemon_ctx *dc = (daemon_ctx *)arg;
+    double      t0 = thread_cpu_ms();
+    int         k;
+
+    while (!dc->stop) {
+        xloop_run_once(dc->loop, 10);
+        if (dc->placed == 0) {
+            char where[320];
+            fprintf(stderr, "[bench] daemon: %s\n", xthread_placement(where, sizeof(where)));
+            dc->placed = 1;
+        }
+    }
+    dc->cpu_ms = thread_cpu_ms() - t0;
+    // the daemon goes on its loop thread, which also takes back the
+    // cancelled operations
+    xfanin_destroy(dc->fanin);
+    for (k = 0; k < 4; k++) {
+        xloop_run_once(dc->loop, 1);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : a reader process, returns through _exit
+// Parameters :
+//      [in ] : ready - pipe to announce that it has joined
+//            : out   - pipe for the reader_result
+// ---------------------------------------------------------------------------
+static int
+reader_main(const bench_ctx *bc, int mode, int ready, int out)
+{
+    socket_t       fds[MAX_GROUPS];
+    struct pollfd  p[MAX_GROUPS];
+    xfanin_reader *rd = NULL;
+    reader_result  res = { 0, 0 };
+    char          *buf = (char *)malloc(65536);
+    int32_t        g, n, got = 0;
+    char           byte = 1;
+
+    for (g = 0; g < bc->ngroups; g++) {
+        fds[g] = INVALID_SOCKET;
+    }
+    if (mode == MODE_FANIN) {
+        if ((rd = xfanin_reader_open(RING_NAME, 0)) == NULL) {
+            return 1;
+        }
+    } else {
+        for (g = 0; g < bc->ngroups; g++) {
+            if ((fds[g] = socket_add_mc_ex(bc->ip_if, bc->grp[g], bc->port, bc->rcvbuf)) == INVALID_SOCKET) {
+                return 1;
+            }
+            p[g].fd     = fds[g];
+            p[g].events = POLLIN;
+        }
+    }
+    if (buf == NULL || write(ready, &byte, 1) != 1) {
+        return 1;
+    }
+
+    for (;;) {
+        if (mode == MODE_FANIN) {
+            if ((n = xfanin_reader_recv(rd, buf, 65536, NULL, got ? IDLE_MS : 5000)) <= 0) {
+                break;
+            }
+            res.received++;
+            got = 1;
+            continue;
+        }
+        if (poll(p, bc->ngroups, got ? IDLE_MS : 5000) <= 0) {
+            break;
+        }
+        for (g = 0; g < bc->ngroups; g++) {
+            if ((p[g].revents & POLLIN) && socket_udp_mc_recv(fds[g], buf, 65536) > 0) {
+                res.received++;
+                got = 1;
+            }
+        }
+    }
+
+    if (rd != NULL) {
+        xfanin_reader_stats st;
+        xfanin_reader_get_stats(rd, &st);
+        res.lost = st.lost;
+        xfanin_reader_close(rd);
+    }
+    for (g = 0; g < bc->ngroups; g++) {
+        if (fds[g] != INVALID_SOCKET) {
+            socket_close(fds[g]);
+        }
+    }
+    free(buf);
+    return write(out, &res, sizeof(res)) == sizeof(res) ? 0 : 1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : pace the datagrams over the groups
+// Parameters :
+//      [out] : cpu_ms - the sending thread's CPU time
+// Return     : datagrams sent
+// ---------------------------------------------------------------------------
+static int64_t
+send_all(const bench_ctx *bc, double *cpu_ms)
+{
+    socket_t fds[MAX_GROUPS];
+    char    *buf = (char *)calloc(1, bc->size);
+    uint64_t t0, gap = bc->rate > 0 ? 1000000000ull / (uint64_t)bc->rate : 0;
+    int64_t  i, sent = 0;
+    double   c0;
+    int32_t  g, ok = buf != NULL;
+
+    for (g = 0; g < bc->ngroups; g++) {
+        fds[g] = socket_create_mc_ex(bc->ip_if, bc->grp[g], bc->port, 1, 1);
+        ok    &= fds[g] != INVALID_SOCKET;
+    }
+    c0 = thread_cpu_ms();
+    t0 = bench_now_ns();
+    for (i = 0; ok && i < bc->count; i++) {
+        // sleep, not spin, between bursts of 32, so the CPU time is the sending
+        if (gap > 0 && i % 32 == 0) {
+            uint64_t due = t0 + (uint64_t)i * gap, now = bench_now_ns();
+            if (due > now) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000) };
+                nanosleep(&ts, NULL);
+            }
+        }
+        if (socket_send(fds[i % bc->ngroups], buf, bc->size) == bc->size) {
+            sent++;
+        }
+    }
+    *cpu_ms = thread_cpu_ms() - c0;
+    for (g = 0; g < bc->ngroups; g++) {
+        if (fds[g] != INVALID_SOCKET) {
+            socket_close(fds[g]);
+        }
+    }
+    free(buf);
+    return sent;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one run with n readers
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const bench_ctx *bc, int mode, int32_t nreaders, double rcvbuf_eff)
+{
+    xfanin_config cfg;
+    daemon_ctx    dc;
+    pthread_t     tid;
+    reader_result res;
+    pid_t         pids[1024];
+    int           ready[2], out[2], started = 0, status, ret = -1;
+    int32_t       r, g, nready = 0;
+    int64_t       sent = 0, received = 0, lost = 0;
+    double        send_ms = 0, read_ms, c0 = children_cpu_ms(), v[9];
+    char          byte;
+
+    memset(&dc, 0, sizeof(dc));
+    if (pipe(ready) != 0) {
+        return -1;
+    }
+    if (pipe(out) != 0) {
+        close(ready[0]);
+        close(ready[1]);
+        return -1;
+    }
+    xfanin_config_init(&cfg);
+    cfg.rcvbuf = bc->rcvbuf;
+    if (mode == MODE_FANIN) {
+        xloop_config lc;
+
+        xloop_config_init(&lc);
+        lc.affinity.cpus = bc->daemon_cpus;
+        dc.placed        = bc->daemon_cpus == NULL;
+        if ((dc.loop = xloop_create_ex(&lc)) == NULL
+            || (dc.fanin = xfanin_create(dc.loop, RING_NAME, &cfg)) == NULL) {
+            goto out;
+        }
+        for (g = 0; g < bc->ngroups; g++) {
+            if (xfanin_join(dc.fanin, bc->ip_if, bc->grp[g], bc->port) < 0) {
+                goto out;
+            }
+        }
+        if (pthread_create(&tid, NULL, daemon_thread, &dc) != 0) {
+            goto out;
+        }
+        started = 1;
+    }
+
+    for (r = 0; r < nreaders; r++) {
+        if ((pids[r] = fork()) == 0) {
+            close(ready[0]);
+            close(out[0]);
+            _exit(reader_main(bc, mode, ready[1], out[1]));
+        }
+        if (pids[r] < 0) {
+            break;
+        }
+    }
+    nreaders = r;
+    close(ready[1]);
+    close(out[1]);
+    ready[1] = out[1] = -1;
+    while (nready < nreaders && read(ready[0], &byte, 1) == 1) {
+        nready++;
+    }
+    if (nready == nreaders) {
+        sent = send_all(bc, &send_ms);
+    }
+    while (read(out[0], &res, sizeof(res)) == sizeof(res)) {
+        received += res.received;
+        lost     += res.lost;
+    }
+    for (r = 0; r < nreaders; r++) {
+        waitpid(pids[r], &status, 0);
+    }
+    read_ms = children_cpu_ms() - c0;
+    if (started) {
+        dc.stop = 1;
+        pthread_join(tid, NULL);
+        started = 0;
+        dc.fanin = NULL;
+    }
+
+    v[0] = nreaders;
+    v[1] = (double)sent;
+    v[2] = sent > 0 ? 100.0 * (double)received / ((double)sent * nreaders) : 0;
+    v[3] = (double)lost;
+    v[4] = send_ms;
+    v[5] = read_ms;
+    v[6] = dc.cpu_ms;
+    v[7] = send_ms + read_ms + dc.cpu_ms;
+    v[8] = (mode == MODE_FANIN ? bc->ngroups * rcvbuf_eff + (double)cfg.slots * cfg.slot_size
+                               : (double)nreaders * bc->ngroups * rcvbuf_eff) / 1e6;
+    bench_report_row(rep, mode_name[mode], v);
+    ret = nready == nreaders && sent > 0 ? 0 : -1;
+
+out:
+    if (started) {
+        dc.stop = 1;
+        pthread_join(tid, NULL);
+        dc.fanin = NULL;
+    }
+    if (dc.fanin != NULL) {
+        xfanin_destroy(dc.fanin);
+        xloop_run_once(dc.loop, 0);
+    }
+    if (dc.loop != NULL) {
+        xloop_destroy(dc.loop);
+    }
+    if (ready[1] >= 0) {
+        close(ready[1]);            // failed before the readers were forked
+        close(out[1]);
+    }
+    close(ready[0]);
+    close(out[0]);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i addr    interface address       (default 127.0.0.1)\n"
+            "  -g group   first multicast group   (default 239.1.1.104)\n"
+            "  -G n       groups, numbered on     (default 2)\n"
+            "  -p port    multicast port          (default 12029)\n"
+            "  -r list    reader counts           (default 1,4,16)\n"
+            "  -s size    datagram size           (default 256)\n"
+            "  -n count   datagrams per run       (default 50000)\n"
+            "  -R rate    datagrams per second    (default 50000)\n"
+            "  -b bytes   receive buffer, 0 = library default (default 0)\n"
+            "  -C cpus    daemon loop cpu list    (default any)\n"
+            "  -m modes   sockets,fanin           (default both)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t      readers[BENCH_MAX_LIST] = { 1, 4, 16 };
+    int          n_readers = 3;
+    int          modes[MODE_COUNT] = { 1, 1 };
+    const char  *grp = "239.1.1.104";
+    bench_ctx    bc;
+    bench_fmt    fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    struct in_addr a;
+    socket_t     probe;
+    double       rcvbuf_eff = 0;
+    int opt, m, i, g, bad = 0, failed = 0;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.ip_if   = "127.0.0.1";
+    bc.ngroups = 2;
+    bc.port    = 12029;
+    bc.size    = 256;
+    bc.count   = 50000;
+    bc.rate    = 50000;
+
+    while ((opt = getopt(argc, argv, "i:g:G:p:r:s:n:R:b:C:m:f:h")) != -1) {
+        switch (opt) {
+        case 'i': bc.ip_if   = optarg; break;
+        case 'g': grp        = optarg; break;
+        case 'G': bc.ngroups = atoi(optarg); break;
+        case 'p': bc.port    = (uint16_t)atoi(optarg); break;
+        case 'r': n_readers  = bench_parse_list(optarg, readers); break;
+        case 's': bc.size    = (int32_t)bench_parse_size(optarg); break;
+        case 'n': bc.count   = bench_parse_size(optarg); break;
+        case 'R': bc.rate    = bench_parse_size(optarg); break;
+        case 'b': bc.rcvbuf  = (int32_t)bench_parse_size(optarg); break;
+        case 'C': bc.daemon_cpus = optarg; break;
+        case 'm':
+            modes[MODE_SOCKETS] = strstr(optarg, "sockets") != NULL;
+            modes[MODE_FANIN]   = strstr(optarg, "fanin") != NULL;
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_readers <= 0 || bc.ngroups <= 0 || bc.ngroups > MAX_GROUPS || bc.size <= 0
+        || bc.size > 2000 || bc.count <= 0 || bc.rate < 0 || inet_pton(AF_INET, grp, &a) != 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    for (g = 0; g < bc.ngroups; g++) {
+        struct in_addr ga;
+        ga.s_addr = htonl(ntohl(a.s_addr) + (uint32_t)g);
+        inet_ntop(AF_INET, &ga, bc.grp[g], sizeof(bc.grp[g]));
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((probe = socket_add_mc_ex(bc.ip_if, bc.grp[0], bc.port, bc.rcvbuf)) != INVALID_SOCKET) {
+        rcvbuf_eff = socket_get_rcvbuf(probe);
+        socket_close(probe);
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (i = 0; i < n_readers; i++) {
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (!modes[m] || readers[i] <= 0 || readers[i] > 1024) {
+                continue;
+            }
+            if (run_one(&rep, &bc, m, (int32_t)readers[i], rcvbuf_eff) != 0) {
+                fprintf(stderr, "[bench] %s with %d readers failed\n", mode_name[m], (int)readers[i]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
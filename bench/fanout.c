@@ -0,0 +1,324 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     fanout.c
+ *  @brief    Fan-out benchmark: one stream to N TCP subscribers (Linux)
+ *
+ *  One publisher sends the same messages to N subscribers over loopback,
+ *  each subscriber a thread reading as fast as it can.  Publisher modes:
+ *      send   - socket_send of the message on every socket, blocking
+ *      copy   - xconn_send on every connection, one copy per subscriber
+ *      shared - xpub_publish of one xmsg, a reference per subscriber and
+ *               one gathered send per connection and loop round
+ *  The event loop modes publish while no subscriber is over its high
+ *  watermark.
+ *
+ *  msg_s is messages published per second, deliv_mb_s the bytes all
+ *  subscribers received per second, pub_ns the publisher thread CPU time
+ *  per message and subscriber: it should stay flat as subscribers are
+ *  added.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/fanout.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c source/xconn.c source/xpub.c \
+ *          -lpthread -o fanout
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xconn.h"
+#include "xpub.h"
+#include "bench_common.h"
+
+#define RX_BUF_SIZE     (256 << 10)
+#define MAX_SUBS        1024
+
+enum { MODE_SEND = 0, MODE_COPY, MODE_SHARED, MODE_COUNT };
+
+static const char *mode_name[] = { "send", "copy", "shared" };
+
+static const char *cols[] = {
+    "subs", "size", "msg_s", "deliv_mb_s", "pub_ns"
+};
+
+/* a subscriber thread */
+typedef struct sub {
+    socket_t      fd;
+    pthread_t     tid;
+    int64_t       bytes;
+} sub;
+
+static void *
+sub_thread(void *arg)
+{
+    sub  *s = (sub *)arg;
+    char *buf = (char *)malloc(RX_BUF_SIZE);
+    int32_t n;
+
+    while (buf != NULL && (n = socket_recv(s->fd, buf, RX_BUF_SIZE)) > 0) {
+        s->bytes += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+static uint64_t
+thread_cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int32_t copy_blocked;        // copy mode: connections over the watermark
+
+static void
+on_frame(xconn *c, const void *data, int32_t len)
+{
+    (void)c;
+    (void)data;
+    (void)len;
+}
+
+static void
+on_event(xconn *c, xconn_event ev, int32_t err)
+{
+    (void)c;
+    (void)err;
+    if (ev == XCONN_EV_BLOCKED) {
+        copy_blocked++;
+    } else if (ev == XCONN_EV_WRITABLE) {
+        copy_blocked--;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : publish to n subscribers for a fixed time
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port, int mode,
+        int32_t nsubs, int32_t size, double seconds)
+{
+    xloop    *loop = NULL;
+    xpub     *pub  = NULL;
+    xconn    *conn[MAX_SUBS];
+    socket_t  srv[MAX_SUBS];
+    sub      *subs;
+    char     *payload;
+    uint64_t  t0, end, cpu0, cpu;
+    int64_t   msgs = 0, bytes = 0;
+    double    v[5];
+    int32_t   i, started = 0, ret = -1;
+
+    if ((subs = (sub *)calloc(nsubs, sizeof(sub))) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < nsubs; i++) {
+        conn[i] = NULL;
+        srv[i]  = INVALID_SOCKET;
+        subs[i].fd = INVALID_SOCKET;
+    }
+    copy_blocked = 0;
+    if ((payload = (char *)calloc(1, size)) == NULL
+        || (loop = xloop_create()) == NULL || (pub = xpub_create(loop, NULL)) == NULL) {
+        goto out;
+    }
+
+    // connect and hand the server ends to the mode under test
+    for (i = 0; i < nsubs; i++) {
+        if ((subs[i].fd = socket_create_tcp_client(addr, port)) == INVALID_SOCKET
+            || (srv[i] = socket_create_tcp_server(listen_fd, 1000)) == INVALID_SOCKET) {
+            goto out;
+        }
+        if (mode == MODE_COPY) {
+            if ((conn[i] = xconn_create(loop, srv[i], NULL, on_frame, on_event, NULL)) == NULL) {
+                goto out;
+            }
+            srv[i] = INVALID_SOCKET;
+        } else if (mode == MODE_SHARED) {
+            if (xpub_add(pub, srv[i]) != 0) {
+                goto out;
+            }
+            srv[i] = INVALID_SOCKET;
+        }
+    }
+    for (started = 0; started < nsubs; started++) {
+        if (pthread_create(&subs[started].tid, NULL, sub_thread, &subs[started]) != 0) {
+            goto out;
+        }
+    }
+
+    t0   = bench_now_ns();
+    end  = t0 + (uint64_t)(seconds * 1e9);
+    cpu0 = thread_cpu_ns();
+    while (bench_now_ns() < end) {
+        int k;
+        switch (mode) {
+        case MODE_SEND:
+            for (k = 0; k < 16; k++, msgs++) {
+                uint32_t be = htonl((uint32_t)size);
+                char     hdr[XCONN_HDR_SIZE] = { 0 };
+                memcpy(hdr, &be, 4);
+                for (i = 0; i < nsubs; i++) {
+                    socket_send(srv[i], hdr, XCONN_HDR_SIZE);
+                    socket_send(srv[i], payload, size);
+                }
+            }
+            break;
+        case MODE_COPY:
+            for (k = 0; k < 16 && copy_blocked == 0; k++, msgs++) {
+                for (i = 0; i < nsubs; i++) {
+                    xconn_send(conn[i], payload, size);
+                }
+            }
+            xloop_run_once(loop, k ? 0 : 10);
+            break;
+        default:
+            for (k = 0; k < 16 && xpub_blocked(pub) == 0; k++, msgs++) {
+                xpub_send(pub, payload, size);
+            }
+            xloop_run_once(loop, k ? 0 : 10);
+            break;
+        }
+    }
+    cpu = thread_cpu_ns() - cpu0;
+    if (mode == MODE_SHARED && xpub_count(pub) != nsubs) {
+        goto out;
+    }
+    for (i = 0; i < nsubs; i++) {
+        bytes += subs[i].bytes;
+    }
+
+    v[0] = nsubs;
+    v[1] = size;
+    v[2] = (double)msgs / seconds;
+    v[3] = (double)bytes / seconds / 1e6;
+    v[4] = msgs > 0 ? (double)cpu / ((double)msgs * nsubs) : 0;
+    bench_report_row(rep, mode_name[mode], v);
+    ret = 0;
+
+out:
+    // closing the server ends makes the subscribers see EOF
+    xpub_destroy(pub);
+    for (i = 0; i < nsubs; i++) {
+        if (conn[i] != NULL) {
+            xconn_close(conn[i]);
+        }
+        if (srv[i] != INVALID_SOCKET) {
+            socket_close(srv[i]);
+        }
+        if (subs[i].fd != INVALID_SOCKET) {
+            shutdown(subs[i].fd, SHUT_RDWR);
+        }
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(subs[i].tid, NULL);
+    }
+    for (i = 0; i < nsubs; i++) {
+        if (subs[i].fd != INVALID_SOCKET) {
+            socket_close(subs[i].fd);
+        }
+    }
+    if (loop != NULL) {
+        xloop_run_once(loop, 0);
+        xloop_destroy(loop);
+    }
+    free(payload);
+    free(subs);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12023)\n"
+            "  -n subs    subscriber counts       (default 1,4,16,64)\n"
+            "  -s sizes   message sizes           (default 64,1K,16K)\n"
+            "  -t secs    time per run            (default 1)\n"
+            "  -m modes   send,copy,shared        (default all)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     counts[BENCH_MAX_LIST] = { 1, 4, 16, 64 };
+    int64_t     sizes[BENCH_MAX_LIST] = { 64, 1024, 16384 };
+    int         n_counts = 4, n_sizes = 3;
+    int         modes[MODE_COUNT] = { 1, 1, 1 };
+    const char *addr = "127.0.0.1";
+    uint16_t    port = 12023;
+    double      seconds = 1;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t    listen_fd;
+    int opt, m, c, s, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:n:s:t:m:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr     = optarg; break;
+        case 'p': port     = (uint16_t)atoi(optarg); break;
+        case 'n': n_counts = bench_parse_list(optarg, counts); break;
+        case 's': n_sizes  = bench_parse_list(optarg, sizes); break;
+        case 't': seconds  = atof(optarg); break;
+        case 'm':
+            for (m = 0; m < MODE_COUNT; m++) {
+                modes[m] = strstr(optarg, mode_name[m]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_counts <= 0 || n_sizes <= 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((listen_fd = socket_create_tcp_listen(addr, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_sizes; s++) {
+        for (m = 0; m < MODE_COUNT; m++) {
+            for (c = 0; c < n_counts && modes[m]; c++) {
+                if (counts[c] <= 0 || counts[c] > MAX_SUBS || sizes[s] <= 0 || sizes[s] > (1 << 20)) {
+                    continue;
+                }
+                if (run_one(&rep, listen_fd, addr, port, m, (int32_t)counts[c],
+                            (int32_t)sizes[s], seconds) != 0) {
+                    fprintf(stderr, "[bench] %s %d subscribers failed\n", mode_name[m],
+                            (int)counts[c]);
+                    failed = 1;
+                }
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,238 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     heartbeat.c
+ *  @brief    Dead-peer detection benchmark for xconn heartbeats (Linux)
+ *
+ *  For each heartbeat interval and miss count two connections are opened
+ *  over loopback, both watched by an xconn with heartbeats on one loop:
+ *      silent - the peer is a plain socket that never reads or writes, as
+ *               a hung process or a host that vanished without a FIN
+ *      live   - the peer is an idle xconn without heartbeats of its own,
+ *               which only answers the pings
+ *  detect_ms is the time from the start until the silent peer is declared
+ *  dead, expected_ms is interval * misses.  The live connection is kept
+ *  twice as long; false_dead counts live peers wrongly declared dead.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/heartbeat.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c source/xconn.c \
+ *          -lpthread -o heartbeat
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xconn.h"
+#include "bench_common.h"
+
+static const char *cols[] = {
+    "interval_ms", "misses", "expected_ms", "detect_ms", "pings", "false_dead"
+};
+
+/* outcome of one connection */
+typedef struct hb_peer {
+    uint64_t dead_ns;               // 0 while alive
+    int32_t  closed;
+} hb_peer;
+
+static void
+on_frame(xconn *c, const void *data, int32_t len)
+{
+    (void)c;
+    (void)data;
+    (void)len;
+}
+
+static void
+on_event(xconn *c, xconn_event ev, int32_t err)
+{
+    hb_peer *p = (hb_peer *)xconn_user(c);
+
+    (void)err;
+    if (ev == XCONN_EV_DEAD) {
+        p->dead_ns = bench_now_ns();
+    } else if (ev == XCONN_EV_CLOSED) {
+        p->closed = 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open a loopback connection
+// Parameters :
+//      [in ] : listen_fd - the listening socket
+//      [out] : srv, cli  - the two ends
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+open_pair(socket_t listen_fd, const char *addr, uint16_t port, socket_t *srv, socket_t *cli)
+{
+    if ((*cli = socket_create_tcp_client(addr, port)) == INVALID_SOCKET) {
+        return -1;
+    }
+    if ((*srv = socket_create_tcp_server(listen_fd, 1000)) == INVALID_SOCKET) {
+        socket_close(*cli);
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : measure one heartbeat setting
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port,
+        int32_t interval_ms, int32_t misses)
+{
+    xloop       *loop;
+    xconn_config cfg;
+    xconn       *silent = NULL, *live = NULL, *echo = NULL;
+    xconn_stats  st;
+    socket_t     s_srv, s_cli, l_srv, l_cli;
+    hb_peer      p_silent, p_live, p_echo;
+    uint64_t     t0, end;
+    double       v[6];
+    int          ret = -1;
+
+    memset(&p_silent, 0, sizeof(p_silent));
+    memset(&p_live, 0, sizeof(p_live));
+    memset(&p_echo, 0, sizeof(p_echo));
+    if ((loop = xloop_create()) == NULL) {
+        return -1;
+    }
+    if (open_pair(listen_fd, addr, port, &s_srv, &s_cli) != 0) {
+        xloop_destroy(loop);
+        return -1;
+    }
+    if (open_pair(listen_fd, addr, port, &l_srv, &l_cli) != 0) {
+        socket_close(s_srv);
+        socket_close(s_cli);
+        xloop_destroy(loop);
+        return -1;
+    }
+
+    xconn_config_init(&cfg);
+    cfg.hb_interval_ms = interval_ms;
+    cfg.hb_misses      = misses;
+    silent = xconn_create(loop, s_srv, &cfg, on_frame, on_event, &p_silent);
+    live   = xconn_create(loop, l_srv, &cfg, on_frame, on_event, &p_live);
+    echo   = xconn_create(loop, l_cli, NULL, on_frame, on_event, &p_echo);
+    if (silent == NULL || live == NULL || echo == NULL) {
+        goto out;
+    }
+
+    t0  = bench_now_ns();
+    end = t0 + (uint64_t)interval_ms * misses * 2 * 1000000;
+    while (bench_now_ns() < end) {
+        xloop_run_once(loop, 10);
+    }
+    if (p_silent.dead_ns == 0) {
+        goto out;
+    }
+
+    xconn_get_stats(silent, &st);
+    v[0] = interval_ms;
+    v[1] = misses;
+    v[2] = (double)interval_ms * misses;
+    v[3] = (double)(p_silent.dead_ns - t0) / 1e6;
+    v[4] = (double)st.pings_sent;
+    v[5] = (p_live.dead_ns != 0 || p_live.closed) + (p_echo.dead_ns != 0 || p_echo.closed);
+    bench_report_row(rep, "loopback", v);
+    ret = 0;
+
+out:
+    if (silent == NULL) {
+        socket_close(s_srv);
+    }
+    if (live == NULL) {
+        socket_close(l_srv);
+    }
+    if (echo == NULL) {
+        socket_close(l_cli);
+    }
+    xconn_close(silent);
+    xconn_close(live);
+    xconn_close(echo);
+    socket_close(s_cli);
+    xloop_run_once(loop, 0);        // let the canceled operations come back
+    xloop_destroy(loop);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12021)\n"
+            "  -i ms      heartbeat intervals     (default 10,50,100)\n"
+            "  -m misses  miss counts             (default 2,3,5)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     intervals[BENCH_MAX_LIST] = { 10, 50, 100 };
+    int64_t     misses[BENCH_MAX_LIST] = { 2, 3, 5 };
+    int         n_intervals = 3, n_misses = 3;
+    const char *addr = "127.0.0.1";
+    uint16_t    port = 12021;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t    listen_fd;
+    int opt, i, m, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:i:m:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr        = optarg; break;
+        case 'p': port        = (uint16_t)atoi(optarg); break;
+        case 'i': n_intervals = bench_parse_list(optarg, intervals); break;
+        case 'm': n_misses    = bench_parse_list(optarg, misses); break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_intervals <= 0 || n_misses <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((listen_fd = socket_create_tcp_listen(addr, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "link", cols, sizeof(cols) / sizeof(cols[0]));
+    for (i = 0; i < n_intervals; i++) {
+        for (m = 0; m < n_misses; m++) {
+            if (intervals[i] <= 0 || misses[m] <= 0) {
+                continue;
+            }
+            if (run_one(&rep, listen_fd, addr, port, (int32_t)intervals[i],
+                        (int32_t)misses[m]) != 0) {
+                fprintf(stderr, "[bench] interval %d misses %d failed\n",
+                        (int)intervals[i], (int)misses[m]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
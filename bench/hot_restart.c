@@ -0,0 +1,580 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     hot_restart.c
+ *  @brief    Deploying a new server instance: restart against xhandoff (Linux)
+ *
+ *  An echo server (xconn on an xloop) runs in a child process; the client,
+ *  this process, keeps conns connections busy with pipelined requests of
+ *  size bytes, each carrying a sequence number the echo must return.  A
+ *  third of the way into the run a second server instance is deployed,
+ *  which needs warm_ms to get ready (loading, warming caches):
+ *
+ *      restart  - the old instance is killed, the new one warms up and
+ *                 listens; the clients see their connections drop and
+ *                 reconnect until it accepts
+ *      handoff  - the new instance warms up while the old one serves,
+ *                 then takes over the listener and the connections with
+ *                 xhandoff, framing state included
+ *
+ *  max_gap_ms is the longest time a round (a request on every connection
+ *  and its reply) took, reconnects included; lost counts requests whose
+ *  reply never came, bad replies with a wrong sequence number.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/hot_restart.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c source/xconn.c source/xhandoff.c \
+ *          -lpthread -o hot_restart
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xconn.h"
+#include "xhandoff.h"
+#include "bench_common.h"
+
+#define MAX_CONNS       256
+#define CTL_ADDR        "unix:/tmp/xhandoff_bench.sock"
+#define IO_MS           2000        // a reply later than this counts as lost
+
+enum { MODE_RESTART = 0, MODE_HANDOFF, MODE_COUNT };
+
+static const char *mode_name[] = { "restart", "handoff" };
+
+static const char *cols[] = {
+    "conns", "rounds", "rtt_p50_us", "rtt_p99_us", "max_gap_ms", "reconnects", "lost", "bad"
+};
+
+/* the settings of all runs */
+typedef struct bench_ctx {
+    const char *addr;
+    uint16_t    port;
+    int32_t     conns;
+    int32_t     size;
+    int32_t     seconds;
+    int32_t     warm_ms;
+} bench_ctx;
+
+/* one server instance */
+typedef struct server {
+    xloop    *loop;
+    socket_t  lfd;
+    xloop_op  aop;
+    xconn    *conns[MAX_CONNS];
+    int32_t   nconns;
+    int32_t   moving;               // handing off, accept no more
+} server;
+
+static volatile sig_atomic_t g_stop;
+
+static void
+on_term(int sig)
+{
+    (void)sig;
+    g_stop = 1;
+}
+
+static void
+sleep_ms(int32_t ms)
+{
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000 };
+    nanosleep(&ts, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : a listener that binds over the TIME_WAIT sockets the killed
+//              instance left behind, as a restarted server must
+// Return     : the socket, INVALID_SOCKET on error
+// Marks      : the listener of an instance that has just exited may live a
+//              moment longer (its io_uring is torn down in the background),
+//              so EADDRINUSE is retried for a second
+// ---------------------------------------------------------------------------
+static socket_t
+listen_reuse(const char *addr, uint16_t port)
+{
+    struct sockaddr_in sa;
+    socket_t           fd;
+    int                on = 1, tries = 0, rc;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return INVALID_SOCKET;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = inet_addr(addr);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+        close(fd);
+        return INVALID_SOCKET;
+    }
+    while ((rc = bind(fd, (struct sockaddr *)&sa, sizeof(sa))) != 0 && errno == EADDRINUSE
+           && ++tries < 200) {
+        sleep_ms(5);
+    }
+    if (rc != 0 || listen(fd, 1024) != 0) {
+        close(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// ---------------------------------------------------------------------------
+// server side
+
+static void on_conn_event(xconn *c, xconn_event ev, int32_t err);
+
+static void
+on_echo(xconn *c, const void *data, int32_t len)
+{
+    xconn_send(c, data, len);
+}
+
+static void
+forget(server *s, xconn *c)
+{
+    int32_t i;
+
+    for (i = 0; i < s->nconns; i++) {
+        if (s->conns[i] == c) {
+            s->conns[i] = s->conns[--s->nconns];
+            break;
+        }
+    }
+}
+
+static void
+on_conn_event(xconn *c, xconn_event ev, int32_t err)
+{
+    (void)err;
+    if (ev == XCONN_EV_CLOSED || ev == XCONN_EV_DEAD) {
+        forget((server *)xconn_user(c), c);
+        xconn_close(c);
+    }
+}
+
+static void
+add_conn(server *s, socket_t fd, const void *state, int32_t len)
+{
+    socket_opts opts;
+    xconn      *c = NULL;
+
+    socket_opts_init(&opts, SOCKET_PROFILE_LATENCY);
+    socket_set_opts(fd, &opts);
+    if (s->nconns < MAX_CONNS) {
+        c = xconn_resume(s->loop, fd, NULL, state, len, on_echo, on_conn_event, s);
+    }
+    if (c == NULL) {
+        socket_close(fd);
+        return;
+    }
+    s->conns[s->nconns++] = c;
+}
+
+static void
+accept_cb(xloop_op *op, int32_t result)
+{
+    server *s = (server *)op->user;
+
+    if (result < 0) {
+        return;                     // canceled by the handoff
+    }
+    add_conn(s, result, NULL, 0);
+    if (!s->moving) {
+        xloop_accept(s->loop, &s->aop, s->lfd, accept_cb, s);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : hand everything to the new instance waiting on ctl
+// Return     : zero when it took over
+// ---------------------------------------------------------------------------
+static int
+hand_off(server *s, socket_t ctl)
+{
+    xhandoff *h;
+    int32_t   i, n = s->nconns, ret;
+
+    if ((h = xhandoff_accept(ctl, 5000)) == NULL) {
+        return -1;
+    }
+    s->moving = 1;
+    xloop_detach(s->loop, s->lfd);
+    xloop_run_once(s->loop, 0);     // the canceled accept comes back
+    xhandoff_give(h, XHANDOFF_LISTENER, s->lfd, 0, NULL, 0);
+    for (i = 0; i < n; i++) {
+        xhandoff_give_conn(h, s->conns[i], (uint32_t)i);
+    }
+    s->nconns = 0;
+    while (xhandoff_pending(h) > 0) {
+        xloop_run_once(s->loop, 10);
+    }
+    ret = xhandoff_finish(h, 5000);
+    xhandoff_close(h);
+    return ret == 0 ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one server instance, returns through _exit
+// Parameters :
+//      [in ] : gen   - 1 for the first instance, 2 for the deployed one
+//            : go    - pipe the deployment is started through (gen 2)
+//            : ready - pipe to announce that it serves
+// ---------------------------------------------------------------------------
+static int
+server_main(const bench_ctx *bc, int mode, int gen, int go, int ready)
+{
+    server         s;
+    socket_t       ctl = INVALID_SOCKET;
+    xhandoff      *h;
+    xhandoff_item  it;
+    struct pollfd  p;
+    char           byte = 1;
+    int            n;
+
+    memset(&s, 0, sizeof(s));
+    s.lfd = INVALID_SOCKET;
+    signal(SIGTERM, on_term);
+    if ((s.loop = xloop_create()) == NULL) {
+        return 1;
+    }
+    if (gen == 2) {
+        if (read(go, &byte, 1) != 1) {
+            return 1;
+        }
+        if (mode == MODE_HANDOFF) {
+            sleep_ms(bc->warm_ms);  // warms up while the old instance serves
+            if ((h = xhandoff_connect(CTL_ADDR, 5000)) == NULL) {
+                return 1;
+            }
+            while ((n = xhandoff_take(h, &it, 5000)) > 0) {
+                if (it.type == XHANDOFF_LISTENER) {
+                    s.lfd = it.fd;
+                } else {
+                    add_conn(&s, it.fd, it.state, it.len);
+                }
+            }
+            xhandoff_close(h);
+            if (n < 0) {
+                return 1;
+            }
+        } else {
+            sleep_ms(bc->warm_ms);  // the old instance is gone already
+        }
+    }
+    if (s.lfd == INVALID_SOCKET && (s.lfd = listen_reuse(bc->addr, bc->port)) == INVALID_SOCKET) {
+        return 1;
+    }
+    if (gen == 1 && mode == MODE_HANDOFF
+        && (ctl = socket_create_tcp_listen(CTL_ADDR, 0)) == INVALID_SOCKET) {
+        return 1;
+    }
+    if (xloop_accept(s.loop, &s.aop, s.lfd, accept_cb, &s) != 0 || write(ready, &byte, 1) != 1) {
+        return 1;
+    }
+
+    p.fd     = ctl;
+    p.events = POLLIN;
+    while (!g_stop) {
+        xloop_run_once(s.loop, 5);
+        if (ctl != INVALID_SOCKET && poll(&p, 1, 0) == 1) {
+            return hand_off(&s, ctl) == 0 ? 0 : 1;
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// client side
+
+/* a client connection */
+typedef struct client {
+    socket_t fd;
+    uint64_t seq;
+} client;
+
+// ---------------------------------------------------------------------------
+// Function   : connect, retrying while no instance listens
+// Return     : the socket, INVALID_SOCKET when none came up by the deadline
+// ---------------------------------------------------------------------------
+static socket_t
+connect_retry(const bench_ctx *bc, uint64_t deadline)
+{
+    socket_opts opts;
+    socket_t    fd;
+
+    socket_opts_init(&opts, SOCKET_PROFILE_LATENCY);
+    while ((fd = socket_create_tcp_client_ex(bc->addr, bc->port, &opts)) == INVALID_SOCKET
+           && bench_now_ns() < deadline) {
+        sleep_ms(5);
+    }
+    return fd;
+}
+
+static int32_t
+send_all(socket_t fd, const char *p, int32_t len)
+{
+    int32_t off = 0, n;
+
+    while (off < len) {
+        if ((n = (int32_t)send(fd, p + off, len - off, MSG_NOSIGNAL)) <= 0) {
+            return SOCKET_ERROR;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+static int32_t
+recv_all(socket_t fd, char *p, int32_t len)
+{
+    struct pollfd pf;
+    int32_t       off = 0, n;
+
+    pf.fd     = fd;
+    pf.events = POLLIN;
+    while (off < len) {
+        if (poll(&pf, 1, IO_MS) != 1 || (n = (int32_t)recv(fd, p + off, len - off, 0)) <= 0) {
+            return SOCKET_ERROR;
+        }
+        off += n;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one run, the client in this process
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const bench_ctx *bc, int mode)
+{
+    client        cl[MAX_CONNS];
+    bench_samples rtt;
+    bench_dist    d;
+    pid_t         gen1, gen2;
+    int           go[2], ready[2], status, deployed = 0, ret = -1;
+    int32_t       i, frame = XCONN_HDR_SIZE + bc->size;
+    int64_t       rounds = 0, reconnects = 0, lost = 0, bad = 0;
+    uint64_t      t_end, max_gap = 0;
+    char         *req = (char *)calloc(1, frame), *rsp = (char *)calloc(1, frame);
+    uint32_t      be = htonl((uint32_t)bc->size);
+    char          byte;
+    double        v[8];
+
+    memset(&rtt, 0, sizeof(rtt));
+    for (i = 0; i < MAX_CONNS; i++) {
+        cl[i].fd = INVALID_SOCKET;
+    }
+    if (req == NULL || rsp == NULL || pipe(go) != 0) {
+        free(req);
+        free(rsp);
+        return -1;
+    }
+    if (pipe(ready) != 0) {
+        close(go[0]);
+        close(go[1]);
+        free(req);
+        free(rsp);
+        return -1;
+    }
+    memcpy(req, &be, 4);
+    if ((gen1 = fork()) == 0) {
+        close(go[1]);
+        close(ready[0]);
+        _exit(server_main(bc, mode, 1, go[0], ready[1]));
+    }
+    if ((gen2 = fork()) == 0) {
+        close(go[1]);
+        close(ready[0]);
+        _exit(server_main(bc, mode, 2, go[0], ready[1]));
+    }
+    if (gen1 < 0 || gen2 < 0 || read(ready[0], &byte, 1) != 1) {
+        goto out;
+    }
+
+    t_end = bench_now_ns() + (uint64_t)bc->seconds * 1000000000ull;
+    for (i = 0; i < bc->conns; i++) {
+        cl[i].seq = 0;
+        if ((cl[i].fd = connect_retry(bc, t_end)) == INVALID_SOCKET) {
+            goto out;
+        }
+    }
+    while (bench_now_ns() < t_end) {
+        uint64_t t0 = bench_now_ns();
+
+        if (!deployed && t0 + (uint64_t)bc->seconds * 2000000000ull / 3 >= t_end) {
+            deployed = 1;
+            if (mode == MODE_RESTART) {
+                kill(gen1, SIGKILL);
+                waitpid(gen1, &status, 0);
+                gen1 = -1;
+            }
+            if (write(go[1], &byte, 1) != 1) {
+                goto out;
+            }
+        }
+        // pipeline: a request on every connection, then the replies, the
+        // request written in two pieces so some are caught half sent
+        for (i = 0; i < bc->conns; i++) {
+            memcpy(req + XCONN_HDR_SIZE, &cl[i].seq, sizeof(uint64_t));
+            if (send_all(cl[i].fd, req, frame / 2) != 0
+                || send_all(cl[i].fd, req + frame / 2, frame - frame / 2) != 0) {
+                cl[i].seq |= 1ull << 63;        // failed, reconnect below
+            }
+        }
+        for (i = 0; i < bc->conns; i++) {
+            uint64_t seq;
+
+            if (!(cl[i].seq >> 63) && recv_all(cl[i].fd, rsp, frame) == 0) {
+                memcpy(&seq, rsp + XCONN_HDR_SIZE, sizeof(seq));
+                bad += seq != cl[i].seq;
+                cl[i].seq++;
+                continue;
+            }
+            lost++;
+            socket_close(cl[i].fd);
+            cl[i].seq = (cl[i].seq & ~(1ull << 63)) + 1;
+            if ((cl[i].fd = connect_retry(bc, t_end + 5000000000ull)) == INVALID_SOCKET) {
+                goto out;
+            }
+            reconnects++;
+        }
+        rounds++;
+        t0 = bench_now_ns() - t0;
+        bench_samples_push(&rtt, t0);
+        if (t0 > max_gap) {
+            max_gap = t0;
+        }
+    }
+    bench_dist_compute(rtt.v, rtt.n, &d);
+    v[0] = bc->conns;
+    v[1] = (double)rounds;
+    v[2] = (double)d.p50 / 1e3;
+    v[3] = (double)d.p99 / 1e3;
+    v[4] = (double)max_gap / 1e6;
+    v[5] = (double)reconnects;
+    v[6] = (double)lost;
+    v[7] = (double)bad;
+    bench_report_row(rep, mode_name[mode], v);
+    ret = deployed && bad == 0 ? 0 : -1;
+
+out:
+    for (i = 0; i < bc->conns; i++) {
+        if (cl[i].fd != INVALID_SOCKET) {
+            socket_close(cl[i].fd);
+        }
+    }
+    close(go[1]);                   // an instance not deployed yet stops
+    if (gen1 > 0) {
+        kill(gen1, SIGTERM);
+        waitpid(gen1, &status, 0);
+    }
+    if (gen2 > 0) {
+        kill(gen2, SIGTERM);
+        waitpid(gen2, &status, 0);
+    }
+    bench_samples_free(&rtt);
+    close(go[0]);
+    close(ready[0]);
+    close(ready[1]);
+    free(req);
+    free(rsp);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    server address          (default 127.0.0.1)\n"
+            "  -p port    server port             (default 12031)\n"
+            "  -c list    connection counts       (default 16,128)\n"
+            "  -s size    request size            (default 256)\n"
+            "  -t secs    seconds per run         (default 3)\n"
+            "  -w ms      warm-up of a new instance (default 200)\n"
+            "  -m modes   restart,handoff         (default both)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t      conns[BENCH_MAX_LIST] = { 16, 128 };
+    int          n_conns = 2;
+    int          modes[MODE_COUNT] = { 1, 1 };
+    bench_ctx    bc;
+    bench_fmt    fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, m, i, bad = 0, failed = 0;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.addr    = "127.0.0.1";
+    bc.port    = 12031;
+    bc.size    = 256;
+    bc.seconds = 3;
+    bc.warm_ms = 200;
+
+    while ((opt = getopt(argc, argv, "a:p:c:s:t:w:m:f:h")) != -1) {
+        switch (opt) {
+        case 'a': bc.addr    = optarg; break;
+        case 'p': bc.port    = (uint16_t)atoi(optarg); break;
+        case 'c': n_conns    = bench_parse_list(optarg, conns); break;
+        case 's': bc.size    = (int32_t)bench_parse_size(optarg); break;
+        case 't': bc.seconds = atoi(optarg); break;
+        case 'w': bc.warm_ms = atoi(optarg); break;
+        case 'm':
+            modes[MODE_RESTART] = strstr(optarg, "restart") != NULL;
+            modes[MODE_HANDOFF] = strstr(optarg, "handoff") != NULL;
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_conns <= 0 || bc.size < (int32_t)sizeof(uint64_t) || bc.size > (1 << 20)
+        || bc.seconds <= 0 || bc.warm_ms < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    signal(SIGPIPE, SIG_IGN);
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (i = 0; i < n_conns; i++) {
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (!modes[m] || conns[i] <= 0 || conns[i] > MAX_CONNS) {
+                continue;
+            }
+            bc.conns = (int32_t)conns[i];
+            if (run_one(&rep, &bc, m) != 0) {
+                fprintf(stderr, "[bench] %s with %d connections failed\n", mode_name[m], bc.conns);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
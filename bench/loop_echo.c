@@ -0,0 +1,519 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     loop_echo.c
+ *  @brief    Event loop echo benchmark for xsocket (Linux)
+ *
+ *  One xloop thread serves all connections as an echo server, a second
+ *  xloop thread drives the clients: every client connection sends a
+ *  message, waits for the echo and sends again.  Both sides use only
+ *  completion callbacks, one thread each, for any number of connections.
+ *
+ *  Each run is repeated for every loop backend (-b).  With -M the server
+ *  uses multishot accept and multishot receive, with -R all message
+ *  buffers live in one region registered with xloop_register_buffer.
+ *
+ *  rtt_s is the number of completed round trips per second over all
+ *  connections, ops_s the operations completed by the server loop.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/loop_echo.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c -lpthread -o loop_echo
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "bench_common.h"
+
+static const char *cols[] = {
+    "size", "conns", "multi", "fixed", "seconds", "rtts", "rtt_s", "ops_s", "p50_us", "p99_us"
+};
+
+static const char *backend_name[] = { "auto", "epoll", "uring" };
+
+typedef struct echo_ctx echo_ctx;
+
+/* one side of a connection */
+typedef struct echo_conn {
+    echo_ctx *ctx;
+    socket_t  fd;
+    xloop_op  rop;
+    xloop_op  wop;
+    char     *buf;                  // client: message, server: bytes being sent
+    char     *pend;                 // server, multishot: bytes received meanwhile
+    int32_t   got;                  // client: echo bytes, server: bytes in pend
+    int32_t   pending;              // client: send and echo still outstanding
+    int32_t   sending;              // server, multishot: wop in flight
+    uint64_t  t0;
+} echo_conn;
+
+/* state of one run */
+struct echo_ctx {
+    xloop        *srv_loop;
+    xloop        *cli_loop;
+    socket_t      listen_fd;
+    xloop_op      accept_op;
+    int32_t       size;
+    int32_t       conns;
+    int32_t       multi;
+    echo_conn    *srv;              // accepted connections
+    echo_conn    *cli;              // client connections
+    char         *slab;             // all message buffers
+    size_t        slab_len;
+    int32_t       nsrv;
+    int32_t       connected;
+    int32_t       failed;
+    volatile int  stop;
+    int64_t       rtts;
+    int64_t       srv_ops;
+    bench_samples rtt;
+};
+
+// ---------------------------------------------------------------------------
+// server side: accept, then recv -> send the same bytes back -> recv ...
+
+static void srv_recv_cb(xloop_op *op, int32_t result);
+
+static void
+srv_close(echo_conn *c)
+{
+    xloop_close(c->ctx->srv_loop, c->fd);
+    c->fd = INVALID_SOCKET;
+}
+
+static void
+srv_send_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c = (echo_conn *)op->user;
+
+    c->ctx->srv_ops++;
+    if (result < 0 || xloop_recv(c->ctx->srv_loop, &c->rop, c->fd, c->buf, c->ctx->size,
+                                 srv_recv_cb, c) != 0) {
+        if (result != SOCKET_ERROR || op->err != ECANCELED) {
+            srv_close(c);
+        }
+    }
+}
+
+static void
+srv_recv_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c = (echo_conn *)op->user;
+
+    c->ctx->srv_ops++;
+    if (result <= 0 || xloop_send(c->ctx->srv_loop, &c->wop, c->fd, c->buf, result,
+                                  srv_send_cb, c) != 0) {
+        if (result != SOCKET_ERROR || op->err != ECANCELED) {
+            srv_close(c);
+        }
+    }
+}
+
+static void srv_msend_cb(xloop_op *op, int32_t result);
+
+// ---------------------------------------------------------------------------
+// Function   : send what the multishot receive collected, swapping buffers
+// ---------------------------------------------------------------------------
+static void
+srv_flush(echo_conn *c)
+{
+    char *t = c->buf;
+
+    c->buf     = c->pend;
+    c->pend    = t;
+    c->sending = 1;
+    if (xloop_send(c->ctx->srv_loop, &c->wop, c->fd, c->buf, c->got, srv_msend_cb, c) != 0) {
+        c->sending = 0;
+        srv_close(c);
+    }
+    c->got = 0;
+}
+
+static void
+srv_msend_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c = (echo_conn *)op->user;
+
+    c->ctx->srv_ops++;
+    c->sending = 0;
+    if (result < 0) {
+        if (op->err != ECANCELED && c->fd != INVALID_SOCKET) {
+            srv_close(c);
+        }
+    } else if (c->got > 0) {
+        srv_flush(c);
+    }
+}
+
+static void
+srv_multi_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c = (echo_conn *)op->user;
+
+    c->ctx->srv_ops++;
+    if (result <= 0) {
+        if ((result == 0 || op->err != ECANCELED) && c->fd != INVALID_SOCKET) {
+            srv_close(c);
+        }
+        return;
+    }
+    if (c->got + result > 2 * c->ctx->size) {
+        srv_close(c);               // the client sends one message at a time
+        return;
+    }
+    memcpy(c->pend + c->got, op->buf, result);
+    c->got += result;
+    if (!c->sending) {
+        srv_flush(c);
+    }
+}
+
+static void
+accept_cb(xloop_op *op, int32_t result)
+{
+    echo_ctx  *ctx = (echo_ctx *)op->user;
+    echo_conn *c;
+
+    if (result < 0) {
+        return;
+    }
+    if (ctx->nsrv == ctx->conns) {
+        socket_close(result);
+        return;
+    }
+    c      = &ctx->srv[ctx->nsrv++];
+    c->ctx = ctx;
+    c->fd  = result;
+    if (ctx->multi) {
+        xloop_recv_multi(ctx->srv_loop, &c->rop, c->fd, srv_multi_cb, c);
+    } else {
+        xloop_recv(ctx->srv_loop, &c->rop, c->fd, c->buf, ctx->size, srv_recv_cb, c);
+        xloop_accept(ctx->srv_loop, &ctx->accept_op, ctx->listen_fd, accept_cb, ctx);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// client side: send and recv posted together, next round once both are done
+
+static void cli_recv_cb(xloop_op *op, int32_t result);
+
+static void
+cli_ping(echo_conn *c)
+{
+    echo_ctx *ctx = c->ctx;
+
+    c->t0      = bench_now_ns();
+    c->got     = 0;
+    c->pending = 2;
+    if (xloop_send(ctx->cli_loop, &c->wop, c->fd, c->buf, ctx->size, cli_recv_cb, c) != 0
+        || xloop_recv(ctx->cli_loop, &c->rop, c->fd, c->buf, ctx->size, cli_recv_cb, c) != 0) {
+        ctx->failed++;
+    }
+}
+
+static void
+cli_recv_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c   = (echo_conn *)op->user;
+    echo_ctx  *ctx = c->ctx;
+
+    if (result <= 0) {
+        ctx->failed += (result == 0 || op->err != ECANCELED);
+        return;
+    }
+    if (op == &c->rop && (c->got += result) < ctx->size) {
+        xloop_recv(ctx->cli_loop, &c->rop, c->fd, c->buf + c->got, ctx->size - c->got,
+                   cli_recv_cb, c);
+        return;
+    }
+    if (--c->pending > 0) {
+        return;
+    }
+    bench_samples_push(&ctx->rtt, bench_now_ns() - c->t0);
+    ctx->rtts++;
+    if (!ctx->stop) {
+        cli_ping(c);
+    }
+}
+
+static void
+connect_cb(xloop_op *op, int32_t result)
+{
+    echo_conn *c = (echo_conn *)op->user;
+
+    if (result < 0) {
+        c->ctx->failed++;
+        return;
+    }
+    c->fd = result;
+    c->ctx->connected++;
+}
+
+static void *
+loop_thread(void *arg)
+{
+    xloop_run((xloop *)arg);
+    return NULL;
+}
+
+static void
+raise_fd_limit(int32_t conns)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)(2 * conns + 64)) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+/* settings shared by all runs */
+typedef struct echo_opts {
+    const char        *addr;
+    uint16_t           port;
+    socket_t           listen_fd;
+    xloop_backend_type backend;
+    int32_t            multi;
+    int32_t            fixed;
+    double             seconds;
+} echo_opts;
+
+// ---------------------------------------------------------------------------
+// Function   : connect all clients, run the echo for a fixed time
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const echo_opts *eo, int32_t size, int32_t conns)
+{
+    xloop_config cfg;
+    echo_ctx   ctx;
+    pthread_t  srv_tid, cli_tid;
+    uint64_t   t0, t1;
+    bench_dist d;
+    double     v[10];
+    int32_t    i;
+    int        ret = -1;
+
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.listen_fd = eo->listen_fd;
+    ctx.size      = size;
+    ctx.conns     = conns;
+    ctx.multi     = eo->multi;
+
+    xloop_config_init(&cfg);
+    cfg.backend   = eo->backend;
+    ctx.srv_loop  = xloop_create_ex(&cfg);
+    ctx.cli_loop  = xloop_create_ex(&cfg);
+    ctx.srv       = (echo_conn *)calloc(conns, sizeof(echo_conn));
+    ctx.cli       = (echo_conn *)calloc(conns, sizeof(echo_conn));
+    // client message, server send buffer and the multishot double buffer
+    ctx.slab_len  = (size_t)conns * size * 5;
+    ctx.slab      = (char *)calloc(1, ctx.slab_len);
+    if (ctx.srv_loop == NULL || ctx.cli_loop == NULL || ctx.srv == NULL || ctx.cli == NULL
+        || ctx.slab == NULL) {
+        goto out;
+    }
+    for (i = 0; i < conns; i++) {
+        char *p = ctx.slab + (size_t)i * size * 5;
+        ctx.srv[i].fd   = ctx.cli[i].fd = INVALID_SOCKET;
+        ctx.cli[i].buf  = p;
+        ctx.srv[i].buf  = p + size;
+        ctx.srv[i].pend = p + size * 3;
+        ctx.cli[i].ctx  = &ctx;
+    }
+    if (eo->fixed && (xloop_register_buffer(ctx.srv_loop, ctx.slab, ctx.slab_len) != 0
+                      || xloop_register_buffer(ctx.cli_loop, ctx.slab, ctx.slab_len) != 0)) {
+        goto out;
+    }
+
+    // connect every client before the measurement, both loops single-threaded
+    if (eo->multi) {
+        xloop_accept_multi(ctx.srv_loop, &ctx.accept_op, eo->listen_fd, accept_cb, &ctx);
+    } else {
+        xloop_accept(ctx.srv_loop, &ctx.accept_op, eo->listen_fd, accept_cb, &ctx);
+    }
+    for (i = 0; i < conns; i++) {
+        if (xloop_connect(ctx.cli_loop, &ctx.cli[i].wop, eo->addr, eo->port, NULL, connect_cb,
+                          &ctx.cli[i]) != 0) {
+            goto out;
+        }
+    }
+    while ((ctx.connected < conns || ctx.nsrv < ctx.connected) && !ctx.failed) {
+        xloop_run_once(ctx.cli_loop, 1);
+        xloop_run_once(ctx.srv_loop, 1);
+    }
+    if (ctx.failed) {
+        goto out;
+    }
+
+    for (i = 0; i < conns; i++) {
+        cli_ping(&ctx.cli[i]);
+    }
+    t0 = bench_now_ns();
+    if (pthread_create(&srv_tid, NULL, loop_thread, ctx.srv_loop) != 0) {
+        goto out;
+    }
+    if (pthread_create(&cli_tid, NULL, loop_thread, ctx.cli_loop) != 0) {
+        xloop_stop(ctx.srv_loop);
+        pthread_join(srv_tid, NULL);
+        goto out;
+    }
+    usleep((useconds_t)(eo->seconds * 1e6));
+    ctx.stop = 1;
+    xloop_stop(ctx.cli_loop);
+    pthread_join(cli_tid, NULL);
+    t1 = bench_now_ns();
+    xloop_stop(ctx.srv_loop);
+    pthread_join(srv_tid, NULL);
+
+    if (!ctx.failed) {
+        bench_dist_compute(ctx.rtt.v, ctx.rtt.n, &d);
+        v[0] = size;
+        v[1] = conns;
+        v[2] = eo->multi;
+        v[3] = eo->fixed;
+        v[4] = (double)(t1 - t0) / 1e9;
+        v[5] = (double)ctx.rtts;
+        v[6] = (double)ctx.rtts / v[4];
+        v[7] = (double)ctx.srv_ops / v[4];
+        v[8] = d.p50 / 1e3;
+        v[9] = d.p99 / 1e3;
+        bench_report_row(rep, xloop_backend_name(ctx.srv_loop), v);
+        ret = 0;
+    }
+
+out:
+    for (i = 0; ctx.srv != NULL && ctx.cli != NULL && i < conns; i++) {
+        if (ctx.cli[i].fd != INVALID_SOCKET) {
+            xloop_close(ctx.cli_loop, ctx.cli[i].fd);
+        }
+        if (ctx.srv[i].fd != INVALID_SOCKET) {
+            xloop_close(ctx.srv_loop, ctx.srv[i].fd);
+        }
+    }
+    if (ctx.srv_loop != NULL) {
+        xloop_detach(ctx.srv_loop, eo->listen_fd);
+    }
+    xloop_destroy(ctx.srv_loop);
+    xloop_destroy(ctx.cli_loop);
+    free(ctx.srv);
+    free(ctx.cli);
+    free(ctx.slab);
+    bench_samples_free(&ctx.rtt);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12019)\n"
+            "  -b list    backends: epoll,uring   (default epoll,uring)\n"
+            "  -s sizes   message sizes           (default 64,1K)\n"
+            "  -c conns   connection counts       (default 1,16,256,1024)\n"
+            "  -t secs    measured time per run   (default 2)\n"
+            "  -M         multishot accept and receive on the server\n"
+            "  -R         register the message buffers\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t sizes[BENCH_MAX_LIST] = { 64, 1024 };
+    int64_t conns[BENCH_MAX_LIST] = { 1, 16, 256, 1024 };
+    int     n_sizes = 2, n_conns = 4;
+    int     backends[3] = { 0, 1, 1 };
+    bench_fmt fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    echo_opts eo;
+    int opt, b, s, c, bad = 0, failed = 0;
+
+    memset(&eo, 0, sizeof(eo));
+    eo.addr    = "127.0.0.1";
+    eo.port    = 12019;
+    eo.seconds = 2.0;
+
+    while ((opt = getopt(argc, argv, "a:p:b:s:c:t:MRf:h")) != -1) {
+        switch (opt) {
+        case 'a': eo.addr    = optarg; break;
+        case 'p': eo.port    = (uint16_t)atoi(optarg); break;
+        case 't': eo.seconds = atof(optarg); break;
+        case 'M': eo.multi   = 1; break;
+        case 'R': eo.fixed   = 1; break;
+        case 's': n_sizes    = bench_parse_list(optarg, sizes); break;
+        case 'c': n_conns    = bench_parse_list(optarg, conns); break;
+        case 'b':
+            for (b = 1; b < 3; b++) {
+                backends[b] = strstr(optarg, backend_name[b]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || n_conns <= 0 || eo.seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((eo.listen_fd = socket_create_tcp_listen(eo.addr, eo.port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", eo.addr, eo.port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "backend", cols, sizeof(cols) / sizeof(cols[0]));
+    for (b = 1; b < 3; b++) {
+        xloop_config cfg;
+        xloop *probe;
+
+        if (!backends[b]) {
+            continue;
+        }
+        xloop_config_init(&cfg);
+        cfg.backend = (xloop_backend_type)b;
+        if ((probe = xloop_create_ex(&cfg)) == NULL) {
+            fprintf(stderr, "[bench] backend %s is not available\n", backend_name[b]);
+            continue;
+        }
+        xloop_destroy(probe);
+        eo.backend = (xloop_backend_type)b;
+
+        for (s = 0; s < n_sizes; s++) {
+            for (c = 0; c < n_conns; c++) {
+                if (sizes[s] <= 0 || conns[c] <= 0) {
+                    continue;
+                }
+                raise_fd_limit((int32_t)conns[c]);
+                if (run_one(&rep, &eo, (int32_t)sizes[s], (int32_t)conns[c]) != 0) {
+                    fprintf(stderr, "[bench] %s size %d conns %d failed\n", backend_name[b],
+                            (int)sizes[s], (int)conns[c]);
+                    failed = 1;
+                }
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(eo.listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
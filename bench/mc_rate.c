@@ -0,0 +1,301 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     mc_rate.c
+ *  @brief    Multicast packet-rate and loss benchmark for xsocket (Linux)
+ *
+ *  A sender thread (socket_create_mc_ex with loop back on) paces sequence
+ *  numbered packets onto a group, a receiver thread (socket_add_mc_ex)
+ *  counts them.  For each packet size and send rate the receive buffer is
+ *  grown through the given sizes until no packet is lost, which gives the
+ *  smallest buffer for zero loss at that rate.
+ *
+ *  Rows tagged "run" are single measurements, rows tagged "zero_loss" repeat
+ *  the first loss-free run of a size/rate pair (rcvbuf = -1 when none was).
+ *  Buffers above net.core.rmem_max need CAP_NET_ADMIN (SO_RCVBUFFORCE);
+ *  compare rcvbuf with rcvbuf_eff, which is what the kernel granted.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/mc_rate.c source/xsocket.c -lpthread -o mc_rate
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "xsocket.h"
+#include "bench_common.h"
+
+#define MAX_PACKET      65507       // largest UDP payload over IPv4
+#define DRAIN_TIMEOUT   200000000ull  // ns without data before the receiver gives up
+
+static const char *cols[] = {
+    "size", "rate", "rcvbuf", "rcvbuf_eff", "sent", "received", "lost",
+    "loss_pct", "tx_pps", "rx_pps"
+};
+
+/* one packet size/rate/buffer measurement */
+typedef struct run_ctx {
+    const char       *ip_if;
+    const char       *ip_grp;
+    uint16_t          port;
+    int32_t           size;
+    int64_t           rate;         // packets per second, 0 for no pacing
+    int64_t           count;
+    int32_t           rcvbuf;
+    int64_t           delay_ns;     // simulated processing per packet
+    socket_t          rx_fd;
+    volatile int      tx_done;
+    volatile int64_t  sent;
+    int64_t           received;
+    uint64_t          tx_ns;
+    uint64_t          rx_ns;
+} run_ctx;
+
+// ---------------------------------------------------------------------------
+// Function   : pace count packets onto the group
+// ---------------------------------------------------------------------------
+static void *
+sender_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    char *buf = (char *)calloc(1, rc->size < 8 ? 8 : rc->size);
+    socket_t fd = socket_create_mc_ex(rc->ip_if, rc->ip_grp, rc->port, 1, 1);
+    uint64_t t0, gap = rc->rate > 0 ? 1000000000ull / (uint64_t)rc->rate : 0;
+    int64_t i;
+
+    if (buf == NULL || fd == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot create the multicast sender\n");
+        free(buf);
+        rc->tx_done = 1;
+        return NULL;
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < rc->count; i++) {
+        uint64_t seq = (uint64_t)i;
+        if (gap) {
+            uint64_t due = t0 + (uint64_t)i * gap;
+            while (bench_now_ns() < due) {
+                // spin, sleeping is far too coarse for the pacing
+            }
+        }
+        memcpy(buf, &seq, sizeof(seq));
+        while (socket_send(fd, buf, rc->size) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != EINTR) {
+                goto out;
+            }
+        }
+        rc->sent++;
+    }
+out:
+    rc->tx_ns   = bench_now_ns() - t0;
+    rc->tx_done = 1;
+    socket_close(fd);
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : count packets until the sender is done and the socket drained
+// ---------------------------------------------------------------------------
+static void *
+receiver_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    char *buf = (char *)malloc(MAX_PACKET);
+    uint64_t first = 0, last = 0, idle_since = 0;
+
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        int32_t len = socket_udp_mc_recv(rc->rx_fd, buf, MAX_PACKET);
+        uint64_t now = bench_now_ns();
+
+        if (len >= 0) {
+            if (rc->received++ == 0) {
+                first = now;
+            }
+            last       = now;
+            idle_since = 0;
+            if (rc->delay_ns > 0) {
+                while (bench_now_ns() < now + (uint64_t)rc->delay_ns) {
+                    // simulated consumer work
+                }
+            }
+            continue;
+        }
+        if (!rc->tx_done) {
+            continue;
+        }
+        if (rc->received == rc->sent) {
+            break;
+        }
+        if (idle_since == 0) {
+            idle_since = now;
+        } else if (now - idle_since > DRAIN_TIMEOUT) {
+            break;
+        }
+    }
+
+    rc->rx_ns = last - first;
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run one measurement and report it
+// Return     : packets lost, or -1 on failure
+// ---------------------------------------------------------------------------
+static int64_t
+run_one(bench_report *rep, run_ctx *rc, double *v)
+{
+    pthread_t tx, rx;
+
+    rc->tx_done  = 0;
+    rc->sent     = 0;
+    rc->received = 0;
+    rc->tx_ns    = 0;
+    rc->rx_ns    = 0;
+
+    rc->rx_fd = socket_add_mc_ex(rc->ip_if, rc->ip_grp, rc->port, rc->rcvbuf);
+    if (rc->rx_fd == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot join %s on %s\n", rc->ip_grp, rc->ip_if);
+        return -1;
+    }
+    if (pthread_create(&rx, NULL, receiver_thread, rc) != 0) {
+        socket_close(rc->rx_fd);
+        return -1;
+    }
+    if (pthread_create(&tx, NULL, sender_thread, rc) != 0) {
+        rc->tx_done = 1;
+        pthread_join(rx, NULL);
+        socket_close(rc->rx_fd);
+        return -1;
+    }
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+
+    v[0] = rc->size;
+    v[1] = (double)rc->rate;
+    v[2] = rc->rcvbuf;
+    v[3] = socket_get_rcvbuf(rc->rx_fd);
+    v[4] = (double)rc->sent;
+    v[5] = (double)rc->received;
+    v[6] = (double)(rc->sent - rc->received);
+    v[7] = rc->sent ? 100.0 * v[6] / v[4] : 0;
+    v[8] = rc->tx_ns ? v[4] * 1e9 / (double)rc->tx_ns : 0;
+    v[9] = rc->rx_ns ? v[5] * 1e9 / (double)rc->rx_ns : 0;
+    bench_report_row(rep, "run", v);
+
+    socket_close(rc->rx_fd);
+    return rc->sent == 0 ? -1 : rc->sent - rc->received;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i addr    interface address         (default 127.0.0.1)\n"
+            "  -g addr    multicast group           (default 239.1.1.101)\n"
+            "  -p port    multicast port            (default 12014)\n"
+            "  -s sizes   packet sizes              (default 64,256,1K,1400,8K)\n"
+            "  -r rates   packets/s, 0 = unpaced    (default 10000,100000,1000000,0)\n"
+            "  -b sizes   receive buffers, ascending (default 256K,1M,4M,16M,64M,128M)\n"
+            "  -n count   packets per run           (default 100000)\n"
+            "  -d ns      receiver work per packet  (default 0)\n"
+            "  -f format  text, csv or json         (default csv)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t sizes[BENCH_MAX_LIST] = { 64, 256, 1 << 10, 1400, 8 << 10 };
+    int64_t rates[BENCH_MAX_LIST] = { 10000, 100000, 1000000, 0 };
+    int64_t bufs[BENCH_MAX_LIST]  = { 256 << 10, 1 << 20, 4 << 20, 16 << 20, 64 << 20, 128 << 20 };
+    int     n_sizes = 5, n_rates = 4, n_bufs = 6;
+    bench_fmt fmt = BENCH_FMT_CSV;
+    bench_report rep;
+    run_ctx rc;
+    int opt, s, r, b, failed = 0;
+
+    memset(&rc, 0, sizeof(rc));
+    rc.ip_if  = "127.0.0.1";
+    rc.ip_grp = "239.1.1.101";
+    rc.port   = 12014;
+    rc.count  = 100000;
+
+    while ((opt = getopt(argc, argv, "i:g:p:s:r:b:n:d:f:h")) != -1) {
+        switch (opt) {
+        case 'i': rc.ip_if    = optarg; break;
+        case 'g': rc.ip_grp   = optarg; break;
+        case 'p': rc.port     = (uint16_t)atoi(optarg); break;
+        case 'n': rc.count    = atoll(optarg); break;
+        case 'd': rc.delay_ns = atoll(optarg); break;
+        case 's': n_sizes = bench_parse_list(optarg, sizes); break;
+        case 'r': n_rates = bench_parse_list(optarg, rates); break;
+        case 'b': n_bufs  = bench_parse_list(optarg, bufs);  break;
+        case 'f':
+            if (bench_parse_fmt(optarg, &fmt) != 0) {
+                n_sizes = -1;
+            }
+            break;
+        default:
+            n_sizes = -1;
+            break;
+        }
+    }
+    if (n_sizes <= 0 || n_rates <= 0 || n_bufs <= 0 || rc.count <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);          // keep stdout machine readable
+
+    bench_report_begin(&rep, fmt, "kind", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_sizes; s++) {
+        if (sizes[s] < 8 || sizes[s] > MAX_PACKET) {
+            continue;
+        }
+        for (r = 0; r < n_rates; r++) {
+            double v[10], zero[10];
+            int found = 0, err = 0;
+
+            rc.size = (int32_t)sizes[s];
+            rc.rate = rates[r];
+            for (b = 0; b < n_bufs && !found; b++) {
+                int64_t lost;
+                rc.rcvbuf = (int32_t)(bufs[b] > INT32_MAX ? INT32_MAX : bufs[b]);
+                if ((lost = run_one(&rep, &rc, v)) < 0) {
+                    failed = err = 1;
+                    break;
+                }
+                if (lost == 0) {
+                    memcpy(zero, v, sizeof(v));
+                    found = 1;
+                }
+            }
+            if (err) {
+                continue;
+            }
+            if (!found) {
+                memcpy(zero, v, sizeof(v));
+                zero[2] = zero[3] = -1;
+            }
+            bench_report_row(&rep, "zero_loss", zero);
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,362 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     relay.c
+ *  @brief    Per-hop latency benchmark of the multicast/TCP relays (Linux)
+ *
+ *  A paced sender stamps every message with its send time and a receiver
+ *  thread records the one-way latency, all over loopback:
+ *      mc      - multicast sender to multicast receiver, no relay
+ *      tcp     - framed TCP sender to TCP receiver, no relay
+ *      mc_tcp  - multicast into xrelay_mc_to_tcp, TCP subscriber out
+ *      tcp_mc  - TCP producer into xrelay_tcp_to_mc, multicast receiver out
+ *  The relay runs its own loop thread.  added_p50_us is what the relay
+ *  adds over the two plain hops it joins: p50 - p50(mc) - p50(tcp).
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/relay.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c source/xconn.c source/xpub.c \
+ *          source/xrelay.c -lpthread -o relay
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xrelay.h"
+#include "bench_common.h"
+
+#define MAX_MSG         8192
+#define IDLE_MS         300         // receiver gives up after this long without data
+
+enum { PATH_MC = 0, PATH_TCP, PATH_MC_TCP, PATH_TCP_MC, PATH_COUNT };
+
+static const char *path_name[] = { "mc", "tcp", "mc_tcp", "tcp_mc" };
+
+static const char *cols[] = {
+    "size", "rate", "sent", "received", "p50_us", "p99_us", "max_us", "added_p50_us"
+};
+
+/* one measurement */
+typedef struct run_ctx {
+    int           path;
+    int32_t       size;
+    int64_t       rate;
+    int64_t       count;
+    socket_t      tx_fd;            // multicast or TCP sender
+    int           tx_tcp;
+    socket_t      rx_fd;            // multicast or TCP receiver
+    int           rx_tcp;
+    int64_t       sent;
+    bench_samples lat;
+    xloop        *loop;             // relay paths
+    xrelay       *relay;
+    volatile int  stop;
+} run_ctx;
+
+static int
+wait_readable(socket_t fd, int ms)
+{
+    struct pollfd p;
+    p.fd     = fd;
+    p.events = POLLIN;
+    return poll(&p, 1, ms) > 0;
+}
+
+static void *
+rx_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    char     buf[MAX_MSG + 8];
+    uint64_t t_sent;
+    int64_t  got = 0;
+
+    while (got < rc->count && wait_readable(rc->rx_fd, IDLE_MS)) {
+        const char *payload = buf;
+        if (rc->rx_tcp) {
+            uint32_t be;
+            int32_t  len;
+            if (recv(rc->rx_fd, buf, 8, MSG_WAITALL) != 8) {
+                break;
+            }
+            memcpy(&be, buf, 4);
+            len = (int32_t)ntohl(be);
+            if (len > MAX_MSG || recv(rc->rx_fd, buf, len, MSG_WAITALL) != len) {
+                break;
+            }
+        } else if (recv(rc->rx_fd, buf, sizeof(buf), 0) < 8) {
+            continue;
+        }
+        memcpy(&t_sent, payload, sizeof(t_sent));
+        bench_samples_push(&rc->lat, bench_now_ns() - t_sent);
+        got++;
+    }
+    return NULL;
+}
+
+static void *
+tx_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    char     buf[MAX_MSG + 8];
+    char    *payload = rc->tx_tcp ? buf + 8 : buf;
+    int32_t  len = rc->tx_tcp ? rc->size + 8 : rc->size;
+    uint64_t t0 = bench_now_ns(), now;
+    uint32_t be = htonl((uint32_t)rc->size);
+    int64_t  i;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &be, 4);            // frame header for the TCP senders
+    for (i = 0; i < rc->count; i++) {
+        uint64_t due = t0 + (uint64_t)(i * 1e9 / rc->rate);
+        while ((now = bench_now_ns()) < due) {
+            if (due - now > 100000) {
+                usleep(50);
+            }
+        }
+        memcpy(payload, &now, sizeof(now));
+        if (socket_send(rc->tx_fd, buf, len) == len) {
+            rc->sent++;
+        }
+    }
+    return NULL;
+}
+
+static void *
+loop_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    int k;
+
+    while (!rc->stop) {
+        xloop_run_once(rc->loop, 10);
+    }
+    // the relay goes on its loop thread, which also takes back the
+    // cancelled operations
+    xrelay_destroy(rc->relay);
+    rc->relay = NULL;
+    for (k = 0; k < 4; k++) {
+        xloop_run_once(rc->loop, 1);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open the sockets (and the relay) of one path
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+open_path(run_ctx *rc, const char *ip_if, const char *grp, uint16_t port,
+          socket_t listen_fd)
+{
+    socket_opts opts;
+    uint16_t    tcp_port = port, mc_in = port + 1, mc_out = port + 2;
+
+    socket_opts_init(&opts, SOCKET_PROFILE_LATENCY);
+    rc->tx_tcp = rc->path == PATH_TCP || rc->path == PATH_TCP_MC;
+    rc->rx_tcp = rc->path == PATH_TCP || rc->path == PATH_MC_TCP;
+
+    switch (rc->path) {
+    case PATH_MC:
+        rc->rx_fd = socket_add_mc_ex(ip_if, grp, mc_in, 0);
+        rc->tx_fd = socket_create_mc_ex(ip_if, grp, mc_in, 1, 1);
+        break;
+    case PATH_TCP:
+        rc->tx_fd = socket_create_tcp_client_ex(ip_if, tcp_port, &opts);
+        rc->rx_fd = socket_create_tcp_server_ex(listen_fd, 1000, &opts);
+        break;
+    case PATH_MC_TCP:
+        rc->relay = xrelay_mc_to_tcp(rc->loop, ip_if, grp, mc_in, listen_fd, NULL);
+        rc->tx_fd = socket_create_mc_ex(ip_if, grp, mc_in, 1, 1);
+        rc->rx_fd = socket_create_tcp_client_ex(ip_if, tcp_port, &opts);
+        break;
+    default: {
+        xrelay_config cfg;
+        xrelay_config_init(&cfg);
+        cfg.mc_loop = 1;
+        rc->rx_fd = socket_add_mc_ex(ip_if, grp, mc_out, 0);
+        rc->relay = xrelay_tcp_to_mc(rc->loop, listen_fd, ip_if, grp, mc_out, &cfg);
+        rc->tx_fd = socket_create_tcp_client_ex(ip_if, tcp_port, &opts);
+        break;
+    }
+    }
+    if (rc->tx_fd == INVALID_SOCKET || rc->rx_fd == INVALID_SOCKET
+        || (rc->path >= PATH_MC_TCP && rc->relay == NULL)) {
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : measure one path at one size and rate
+// Parameters :
+//      [out] : p50 - the median latency in ns
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, run_ctx *rc, const char *ip_if, const char *grp, uint16_t port,
+        socket_t listen_fd, const double *base, double *p50)
+{
+    pthread_t  tx, rx, lt;
+    int        lt_started = 0, ret = -1;
+    bench_dist d;
+    double     v[8];
+
+    rc->tx_fd = rc->rx_fd = INVALID_SOCKET;
+    rc->sent  = 0;
+    rc->stop  = 0;
+    rc->lat.n = 0;
+    rc->loop  = NULL;
+    rc->relay = NULL;
+
+    if (rc->path >= PATH_MC_TCP && (rc->loop = xloop_create()) == NULL) {
+        return -1;
+    }
+    if (open_path(rc, ip_if, grp, port, listen_fd) != 0) {
+        goto out;
+    }
+    if (rc->loop != NULL) {
+        if (pthread_create(&lt, NULL, loop_thread, rc) != 0) {
+            goto out;
+        }
+        lt_started = 1;
+        usleep(100000);             // the relay accepts its peer
+    }
+    if (pthread_create(&rx, NULL, rx_thread, rc) != 0) {
+        goto out;
+    }
+    if (pthread_create(&tx, NULL, tx_thread, rc) != 0) {
+        socket_close(rc->rx_fd);
+        pthread_join(rx, NULL);
+        rc->rx_fd = INVALID_SOCKET;
+        goto out;
+    }
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+
+    bench_dist_compute(rc->lat.v, rc->lat.n, &d);
+    *p50 = d.p50;
+    v[0] = rc->size;
+    v[1] = (double)rc->rate;
+    v[2] = (double)rc->sent;
+    v[3] = (double)rc->lat.n;
+    v[4] = d.p50 / 1e3;
+    v[5] = d.p99 / 1e3;
+    v[6] = d.max / 1e3;
+    v[7] = rc->path >= PATH_MC_TCP && base[PATH_MC] > 0 && base[PATH_TCP] > 0
+         ? (d.p50 - base[PATH_MC] - base[PATH_TCP]) / 1e3 : 0;
+    bench_report_row(rep, path_name[rc->path], v);
+    ret = rc->lat.n > 0 ? 0 : -1;
+
+out:
+    rc->stop = 1;
+    if (lt_started) {
+        pthread_join(lt, NULL);
+    }
+    if (rc->tx_fd != INVALID_SOCKET) {
+        socket_close(rc->tx_fd);
+    }
+    if (rc->rx_fd != INVALID_SOCKET) {
+        socket_close(rc->rx_fd);
+    }
+    if (rc->loop != NULL) {
+        if (rc->relay != NULL) {
+            xrelay_destroy(rc->relay);
+            xloop_run_once(rc->loop, 0);
+        }
+        xloop_destroy(rc->loop);
+    }
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i addr    interface address       (default 127.0.0.1)\n"
+            "  -g addr    multicast group         (default 239.1.1.102)\n"
+            "  -p port    TCP port, multicast uses the next two (default 12024)\n"
+            "  -s sizes   message sizes, >= 8     (default 64,1K)\n"
+            "  -r rate    messages per second     (default 10000)\n"
+            "  -n count   messages per run        (default 20000)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     sizes[BENCH_MAX_LIST] = { 64, 1024 };
+    int         n_sizes = 2;
+    const char *ip_if = "127.0.0.1";
+    const char *grp = "239.1.1.102";
+    uint16_t    port = 12024;
+    int64_t     rate = 10000, count = 20000;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t    listen_fd;
+    run_ctx     rc;
+    int opt, s, p, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "i:g:p:s:r:n:f:h")) != -1) {
+        switch (opt) {
+        case 'i': ip_if   = optarg; break;
+        case 'g': grp     = optarg; break;
+        case 'p': port    = (uint16_t)atoi(optarg); break;
+        case 's': n_sizes = bench_parse_list(optarg, sizes); break;
+        case 'r': rate    = bench_parse_size(optarg); break;
+        case 'n': count   = bench_parse_size(optarg); break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || rate <= 0 || count <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((listen_fd = socket_create_tcp_listen(ip_if, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", ip_if, port);
+        return 1;
+    }
+
+    memset(&rc, 0, sizeof(rc));
+    bench_report_begin(&rep, fmt, "path", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_sizes; s++) {
+        double base[PATH_COUNT] = { 0 };
+        if (sizes[s] < 8 || sizes[s] > MAX_MSG) {
+            continue;
+        }
+        for (p = 0; p < PATH_COUNT; p++) {
+            rc.path  = p;
+            rc.size  = (int32_t)sizes[s];
+            rc.rate  = rate;
+            rc.count = count;
+            if (run_one(&rep, &rc, ip_if, grp, port, listen_fd, base, &base[p]) != 0) {
+                fprintf(stderr, "[bench] %s size %d failed\n", path_name[p], (int)sizes[s]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+    bench_samples_free(&rc.lat);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
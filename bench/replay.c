@@ -0,0 +1,307 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     replay.c
+ *  @brief    Replay pacing benchmark: how exactly xreplay keeps the timing
+ *
+ *  A journal of count multicast datagrams with random (exponential) gaps
+ *  at the given mean rate is written with xcap, then replayed by xreplay
+ *  at each speed to a receiver thread on this host over loopback.  Every
+ *  datagram carries its kernel receive time (socket_recv_ts), so the
+ *  receiver's own scheduling does not count; err_* is how far each
+ *  arrival lies from its recorded offset (scaled by the speed) relative
+ *  to the first one, late_max_us the latest xreplay started a send.
+ *  Speed 0 replays as fast as possible, only its rate is of interest.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/replay.c source/xsocket.c source/xthread.c source/xcap.c \
+ *          source/xreplay.c -lpthread -lm -o replay
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "xsocket.h"
+#include "xcap.h"
+#include "xreplay.h"
+#include "bench_common.h"
+
+static const char *cols[] = {
+    "speed", "records", "received", "rec_s", "err_p50_us", "err_p99_us", "err_max_us",
+    "late_max_us"
+};
+
+/* the receiving side of one replay */
+typedef struct rx_ctx {
+    socket_t      fd;
+    int64_t       count;
+    int64_t      *arrival;          // kernel receive time per record index, 0 when lost
+    int64_t       received;
+    volatile int  done;             // the replay has ended
+} rx_ctx;
+
+static void *
+rx_thread(void *arg)
+{
+    rx_ctx       *rx = (rx_ctx *)arg;
+    char          buf[65536];
+    struct pollfd p;
+    int64_t       ts;
+    int32_t       n, idx;
+
+    p.fd     = rx->fd;
+    p.events = POLLIN;
+    for (;;) {
+        if (poll(&p, 1, 200) <= 0) {
+            if (rx->done) {
+                break;              // idle after the end
+            }
+            continue;
+        }
+        if ((n = socket_recv_ts(rx->fd, buf, sizeof(buf), &ts)) < (int32_t)sizeof(idx)) {
+            continue;
+        }
+        memcpy(&idx, buf, sizeof(idx));
+        if (idx >= 0 && idx < rx->count && rx->arrival[idx] == 0) {
+            rx->arrival[idx] = ts;
+            rx->received++;
+        }
+        if (rx->received == rx->count) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : write the synthetic journal
+// Parameters :
+//      [out] : ts - the recorded time of every datagram
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+make_journal(const char *prefix, const char *grp, uint16_t port, int64_t count, int32_t size,
+             int64_t rate, int64_t *ts)
+{
+    xcap_config cfg;
+    xcap       *c;
+    char       *payload;
+    int64_t     i, t = 1000000000;
+    int32_t     stream, idx, ret = 0;
+
+    xcap_config_init(&cfg);
+    cfg.file_size = (int64_t)16 << 20;
+    if ((payload = (char *)calloc(1, size)) == NULL) {
+        return -1;
+    }
+    if ((c = xcap_open(prefix, &cfg)) == NULL
+        || (stream = xcap_add_stream(c, XCAP_MC, grp, port)) < 0) {
+        xcap_close(c);
+        free(payload);
+        return -1;
+    }
+    srand(1);
+    for (i = 0; i < count && ret == 0; i++) {
+        double u = ((double)rand() + 1) / ((double)RAND_MAX + 2);
+        t    += (int64_t)(-log(u) * 1e9 / (double)rate);
+        ts[i] = t;
+        idx   = (int32_t)i;
+        memcpy(payload, &idx, sizeof(idx));
+        ret   = xcap_write(c, stream, t, payload, size);
+        if (ret != 0) {
+            usleep(1000);           // let the journal thread prepare a file, then retry
+            ret = xcap_write(c, stream, t, payload, size);
+        }
+    }
+    xcap_close(c);
+    free(payload);
+    return ret;
+}
+
+static void
+remove_journal(const char *prefix)
+{
+    char path[512];
+    int  i;
+
+    for (i = 0; i < 10000; i++) {
+        snprintf(path, sizeof(path), "%s.%06d.xcap", prefix, i);
+        if (unlink(path) != 0) {
+            break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : replay the journal once at one speed
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const char *prefix, const char *ip_if, const char *grp,
+        uint16_t port, double speed, int32_t spin_us, int64_t count, const int64_t *ts)
+{
+    xreplay_config cfg;
+    xreplay_stats  st;
+    xreplay       *rp;
+    rx_ctx         rx;
+    pthread_t      tid;
+    bench_samples  err = { 0 };
+    bench_dist     d = { 0 };
+    uint64_t       t0, t1;
+    int64_t        i, first = -1;
+    double         v[8];
+
+    memset(&rx, 0, sizeof(rx));
+    rx.count = count;
+    if ((rx.arrival = (int64_t *)calloc(count, sizeof(int64_t))) == NULL) {
+        return -1;
+    }
+    if ((rx.fd = socket_add_mc_ex(ip_if, grp, port, 0)) == INVALID_SOCKET
+        || socket_set_rx_timestamp(rx.fd, 1) != 0) {
+        if (rx.fd != INVALID_SOCKET) {
+            socket_close(rx.fd);
+        }
+        free(rx.arrival);
+        return -1;
+    }
+    xreplay_config_init(&cfg);
+    cfg.speed   = speed;
+    cfg.spin_us = spin_us;
+    cfg.ip_if   = ip_if;
+    if ((rp = xreplay_open(prefix, &cfg)) == NULL || pthread_create(&tid, NULL, rx_thread, &rx) != 0) {
+        xreplay_close(rp);
+        socket_close(rx.fd);
+        free(rx.arrival);
+        return -1;
+    }
+
+    t0 = bench_now_ns();
+    xreplay_run(rp);
+    t1 = bench_now_ns();
+    rx.done = 1;
+    pthread_join(tid, NULL);
+    xreplay_get_stats(rp, &st);
+
+    // errors against the first received datagram
+    for (i = 0; i < count && speed > 0; i++) {
+        if (rx.arrival[i] == 0) {
+            continue;
+        }
+        if (first < 0) {
+            first = i;
+            continue;
+        }
+        {
+            int64_t want = (int64_t)((double)(ts[i] - ts[first]) / speed);
+            int64_t got  = rx.arrival[i] - rx.arrival[first];
+            bench_samples_push(&err, (uint64_t)(got > want ? got - want : want - got));
+        }
+    }
+    bench_dist_compute(err.v, err.n, &d);
+
+    v[0] = speed;
+    v[1] = (double)st.records;
+    v[2] = (double)rx.received;
+    v[3] = (double)st.records / ((double)(t1 - t0) / 1e9);
+    v[4] = d.p50 / 1e3;
+    v[5] = d.p99 / 1e3;
+    v[6] = d.max / 1e3;
+    v[7] = st.late_max_ns / 1e3;
+    bench_report_row(rep, speed > 0 ? "paced" : "max", v);
+
+    bench_samples_free(&err);
+    xreplay_close(rp);
+    socket_close(rx.fd);
+    free(rx.arrival);
+    return 0;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i addr    interface address       (default 127.0.0.1)\n"
+            "  -g group   multicast group         (default 239.1.1.103)\n"
+            "  -p port    multicast port          (default 12027)\n"
+            "  -o prefix  journal path prefix     (default /tmp/xreplay_bench)\n"
+            "  -n count   datagrams               (default 20000)\n"
+            "  -s size    datagram size           (default 256)\n"
+            "  -r rate    mean recorded rate /s   (default 20000)\n"
+            "  -x speeds  replay speeds, 0 = max  (default 1,4,0)\n"
+            "  -w us      spin before each send   (default 50)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     speeds[BENCH_MAX_LIST] = { 1, 4, 0 };
+    int         n_speeds = 3;
+    const char *ip_if = "127.0.0.1", *grp = "239.1.1.103", *prefix = "/tmp/xreplay_bench";
+    uint16_t    port = 12027;
+    int64_t     count = 20000, rate = 20000, size = 256, spin = 50;
+    int64_t    *ts;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, s, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "i:g:p:o:n:s:r:x:w:f:h")) != -1) {
+        switch (opt) {
+        case 'i': ip_if    = optarg; break;
+        case 'g': grp      = optarg; break;
+        case 'p': port     = (uint16_t)atoi(optarg); break;
+        case 'o': prefix   = optarg; break;
+        case 'n': count    = bench_parse_size(optarg); break;
+        case 's': size     = bench_parse_size(optarg); break;
+        case 'r': rate     = bench_parse_size(optarg); break;
+        case 'x': n_speeds = bench_parse_list(optarg, speeds); break;
+        case 'w': spin     = bench_parse_size(optarg); break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_speeds <= 0 || count <= 0 || rate <= 0 || spin < 0
+        || size < (int64_t)sizeof(int32_t) || size > 65507) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((ts = (int64_t *)malloc(count * sizeof(int64_t))) == NULL
+        || make_journal(prefix, grp, port, count, (int32_t)size, rate, ts) != 0) {
+        fprintf(stderr, "[bench] cannot write journal %s\n", prefix);
+        remove_journal(prefix);
+        free(ts);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_speeds; s++) {
+        if (speeds[s] < 0) {
+            continue;
+        }
+        if (run_one(&rep, prefix, ip_if, grp, port, (double)speeds[s], (int32_t)spin, count, ts) != 0) {
+            fprintf(stderr, "[bench] speed %d failed\n", (int)speeds[s]);
+            failed = 1;
+        }
+    }
+    bench_report_end(&rep);
+
+    remove_journal(prefix);
+    free(ts);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
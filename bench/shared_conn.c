@@ -0,0 +1,387 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     shared_conn.c
+ *  @brief    Many threads on one TCP connection: mutex against xoutq (Linux)
+ *
+ *  producers threads send msgs messages of size bytes between them on one
+ *  loopback connection, read by a receiver thread that checks each
+ *  message is whole and that every producer's sequence numbers come in
+ *  order:
+ *
+ *      mutex - socket_send under a pthread mutex, as the callers do now
+ *      xoutq - xoutq_send, an I/O thread drains the queue onto the
+ *              (non-blocking) socket with gathered writes
+ *
+ *  send_p50/p99 is the time a producer spends in the send call, msgs_s
+ *  the rate until the receiver has everything, writes the send system
+ *  calls on the connection (xoutq counts its own; under the mutex it is
+ *  one per message).  bad counts cut or reordered messages.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/shared_conn.c source/xsocket.c source/xoutq.c \
+ *          -lpthread -o shared_conn
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xoutq.h"
+#include "bench_common.h"
+
+#define MAX_PRODUCERS   64
+#define MIN_SIZE        16          // the header below
+
+enum { MODE_MUTEX = 0, MODE_XOUTQ, MODE_COUNT };
+
+static const char *mode_name[] = { "mutex", "xoutq" };
+
+static const char *cols[] = {
+    "producers", "size", "msgs", "msgs_s", "MB_s", "send_p50_ns", "send_p99_ns", "writes", "bad"
+};
+
+/* the start of every message, the rest is filled with the producer id */
+typedef struct msg_hdr {
+    uint32_t len;
+    uint32_t producer;
+    uint64_t seq;
+} msg_hdr;
+
+/* one run */
+typedef struct run_ctx {
+    int              mode;
+    socket_t         fd;            // the sending end
+    socket_t         rfd;           // the receiving end
+    pthread_mutex_t  lock;
+    xoutq           *q;
+    int32_t          size;
+    int64_t          per_producer;
+    int64_t          expected;
+    volatile int     stop;          // the producers are done
+    int64_t          received;
+    int64_t          bad;
+    int64_t          writes;
+    uint64_t         t_done;        // when the receiver had everything
+} run_ctx;
+
+/* one producer */
+typedef struct producer {
+    run_ctx       *rc;
+    pthread_t      tid;
+    uint32_t       id;
+    int            failed;
+    bench_samples  lat;
+} producer;
+
+// ---------------------------------------------------------------------------
+// Function   : socket_send until all of len is out, under the mutex
+// ---------------------------------------------------------------------------
+static int32_t
+locked_send(run_ctx *rc, const char *buf, int32_t len)
+{
+    int32_t done = 0, n;
+
+    pthread_mutex_lock(&rc->lock);
+    while (done < len) {
+        if ((n = socket_send(rc->fd, (char *)buf + done, len - done)) <= 0) {
+            break;
+        }
+        done += n;
+    }
+    rc->writes++;
+    pthread_mutex_unlock(&rc->lock);
+    return done == len ? len : SOCKET_ERROR;
+}
+
+static void *
+producer_thread(void *arg)
+{
+    producer *p  = (producer *)arg;
+    run_ctx  *rc = p->rc;
+    char     *buf = (char *)malloc((size_t)rc->size);
+    msg_hdr  *h   = (msg_hdr *)buf;
+    int64_t   i;
+
+    if (buf == NULL) {
+        p->failed = 1;
+        return NULL;
+    }
+    memset(buf, (int)(p->id & 0xff), (size_t)rc->size);
+    h->len      = (uint32_t)rc->size;
+    h->producer = p->id;
+    for (i = 0; i < rc->per_producer; i++) {
+        uint64_t t0 = bench_now_ns();
+        int32_t  n;
+
+        h->seq = (uint64_t)i;
+        n = rc->mode == MODE_XOUTQ ? xoutq_send(rc->q, buf, rc->size) : locked_send(rc, buf, rc->size);
+        bench_samples_push(&p->lat, bench_now_ns() - t0);
+        if (n != rc->size) {
+            p->failed = 1;
+            break;
+        }
+    }
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : drain the queue until the producers are done and it is empty
+// ---------------------------------------------------------------------------
+static void *
+io_thread(void *arg)
+{
+    run_ctx    *rc = (run_ctx *)arg;
+    xoutq_stats st;
+
+    for (;;) {
+        int stop = rc->stop;        // read before the drain: nothing comes after it
+
+        if (xoutq_drain(rc->q) < 0) {
+            break;
+        }
+        if (stop && !xoutq_blocked(rc->q)) {
+            break;
+        }
+        if (xoutq_wait(rc->q, 10) < 0) {
+            break;
+        }
+    }
+    xoutq_get_stats(rc->q, &st);
+    rc->writes = st.writes;
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : read the stream and check the messages
+// ---------------------------------------------------------------------------
+static void *
+receiver_thread(void *arg)
+{
+    run_ctx  *rc = (run_ctx *)arg;
+    uint64_t  next[MAX_PRODUCERS];
+    char     *buf = (char *)malloc(1 << 20);
+    int32_t   have = 0, n, pos;
+
+    memset(next, 0, sizeof(next));
+    while (buf != NULL && rc->received < rc->expected) {
+        if ((n = socket_recv(rc->rfd, buf + have, (1 << 20) - have)) <= 0) {
+            break;
+        }
+        have += n;
+        for (pos = 0; have - pos >= rc->size; pos += rc->size) {
+            msg_hdr *h = (msg_hdr *)(buf + pos);
+            char     c = (char)(h->producer & 0xff);
+
+            if (h->len != (uint32_t)rc->size || h->producer >= MAX_PRODUCERS
+                || h->seq != next[h->producer] || buf[pos + rc->size - 1] != c) {
+                rc->bad++;
+            } else {
+                next[h->producer]++;
+            }
+            rc->received++;
+        }
+        memmove(buf, buf + pos, (size_t)(have - pos));
+        have -= pos;
+    }
+    rc->t_done = bench_now_ns();
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : connect a pair over loopback
+// ---------------------------------------------------------------------------
+static int
+connect_pair(socket_t lfd, uint16_t port, socket_t *fd, socket_t *rfd)
+{
+    socket_opts o;
+
+    socket_opts_init(&o, SOCKET_PROFILE_LATENCY);
+    if ((*fd = socket_create_tcp_client("127.0.0.1", port)) == INVALID_SOCKET) {
+        return -1;
+    }
+    if ((*rfd = socket_create_tcp_server(lfd, 1000)) == INVALID_SOCKET) {
+        socket_close(*fd);
+        return -1;
+    }
+    socket_set_opts(*fd, &o);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one run with the given number of producers
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t lfd, uint16_t port, int mode, int32_t producers,
+        int32_t size, int64_t msgs)
+{
+    producer  *p = (producer *)calloc((size_t)producers, sizeof(producer));
+    run_ctx    rc;
+    pthread_t  rtid, iotid;
+    bench_samples lat;
+    bench_dist d;
+    uint64_t   t0;
+    int        i, started = 0, failed = 0;
+    double     v[9], secs;
+
+    if (p == NULL) {
+        return -1;
+    }
+    memset(&rc, 0, sizeof(rc));
+    memset(&lat, 0, sizeof(lat));
+    rc.mode         = mode;
+    rc.size         = size;
+    rc.per_producer = msgs / producers;
+    rc.expected     = rc.per_producer * producers;
+    pthread_mutex_init(&rc.lock, NULL);
+    if (connect_pair(lfd, port, &rc.fd, &rc.rfd) != 0) {
+        free(p);
+        return -1;
+    }
+    if (mode == MODE_XOUTQ) {
+        fcntl(rc.fd, F_SETFL, fcntl(rc.fd, F_GETFL) | O_NONBLOCK);
+        if ((rc.q = xoutq_create(rc.fd, NULL)) == NULL
+            || pthread_create(&iotid, NULL, io_thread, &rc) != 0) {
+            failed = 1;
+        }
+    }
+    if (failed || pthread_create(&rtid, NULL, receiver_thread, &rc) != 0) {
+        failed = 1;
+        goto out;
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < producers; i++) {
+        p[i].rc = &rc;
+        p[i].id = (uint32_t)i;
+        if (pthread_create(&p[i].tid, NULL, producer_thread, &p[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(p[i].tid, NULL);
+        failed |= p[i].failed;
+        bench_samples_merge(&lat, &p[i].lat);
+        bench_samples_free(&p[i].lat);
+    }
+    rc.stop = 1;
+    if (mode == MODE_XOUTQ) {
+        pthread_join(iotid, NULL);
+    }
+    if (started < producers || failed) {
+        shutdown(rc.fd, SHUT_RDWR); // the receiver waits for what never comes
+        failed = 1;
+    }
+    pthread_join(rtid, NULL);
+
+    if (!failed) {
+        secs = (double)(rc.t_done - t0) / 1e9;
+        bench_dist_compute(lat.v, lat.n, &d);
+        v[0] = producers;
+        v[1] = size;
+        v[2] = (double)rc.received;
+        v[3] = (double)rc.received / secs;
+        v[4] = (double)rc.received * size / secs / 1e6;
+        v[5] = d.p50;
+        v[6] = d.p99;
+        v[7] = (double)rc.writes;
+        v[8] = (double)rc.bad;
+        bench_report_row(rep, mode_name[mode], v);
+        failed = rc.received != rc.expected || rc.bad != 0;
+    }
+
+out:
+    if (mode == MODE_XOUTQ && rc.q != NULL) {
+        xoutq_close(rc.q);
+    }
+    bench_samples_free(&lat);
+    socket_close(rc.fd);
+    socket_close(rc.rfd);
+    pthread_mutex_destroy(&rc.lock);
+    free(p);
+    return failed ? -1 : 0;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m modes   mutex,xoutq               (default both)\n"
+            "  -c counts  producer thread counts    (default 1,4,16)\n"
+            "  -s size    message size, >= 16       (default 64)\n"
+            "  -n msgs    messages per run          (default 400000)\n"
+            "  -p port    loopback listen port      (default 12033)\n"
+            "  -f format  text, csv or json         (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t   counts[BENCH_MAX_LIST] = { 1, 4, 16 };
+    int       n_counts = 3, modes[MODE_COUNT] = { 1, 1 };
+    int32_t   size = 64;
+    int64_t   msgs = 400000;
+    uint16_t  port = 12033;
+    bench_fmt fmt  = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t  lfd;
+    int opt, m, c, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "m:c:s:n:p:f:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            modes[MODE_MUTEX] = strstr(optarg, "mutex") != NULL;
+            modes[MODE_XOUTQ] = strstr(optarg, "xoutq") != NULL;
+            break;
+        case 'c': n_counts = bench_parse_list(optarg, counts); break;
+        case 's': size     = (int32_t)bench_parse_size(optarg); break;
+        case 'n': msgs     = bench_parse_size(optarg); break;
+        case 'p': port     = (uint16_t)atoi(optarg); break;
+        case 'f': bad |= bench_parse_fmt(optarg, &fmt) != 0; break;
+        default:  bad = 1; break;
+        }
+    }
+    if (bad || n_counts <= 0 || size < MIN_SIZE || size > (1 << 19) || msgs <= 0
+        || (!modes[MODE_MUTEX] && !modes[MODE_XOUTQ])) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((lfd = socket_create_tcp_listen("127.0.0.1", port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on 127.0.0.1:%d\n", port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (c = 0; c < n_counts; c++) {
+        if (counts[c] <= 0 || counts[c] > MAX_PRODUCERS || counts[c] > msgs) {
+            continue;
+        }
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (modes[m] && run_one(&rep, lfd, port, m, (int32_t)counts[c], size, msgs) != 0) {
+                fprintf(stderr, "[bench] %s with %d producers failed\n", mode_name[m], (int)counts[c]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(lfd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
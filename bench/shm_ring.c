@@ -0,0 +1,310 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     shm_ring.c
+ *  @brief    Same-host hops between processes: xshm rings against Unix sockets
+ *
+ *  A child process is forked per mode and connected over:
+ *      shm      - xshm, consumers spin for -w microseconds before sleeping
+ *      shm_wake - xshm with no spin, every hop goes through an eventfd
+ *      unixseq  - a "unixseq:<path>" socket, one message per frame
+ *  For each frame size a ping-pong gives the round-trip time (hop_p50 is
+ *  half of it), then a one-way stream for a fixed time, acknowledged by
+ *  the child at the end, gives the rate.  The spin needs a free core per
+ *  side; on a single CPU both sides take turns and the spin only costs.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/shm_ring.c source/xsocket.c source/xshm.c -lpthread -o shm_ring
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "xsocket.h"
+#include "xshm.h"
+#include "bench_common.h"
+
+enum { MODE_SHM = 0, MODE_SHM_WAKE, MODE_UNIXSEQ, MODE_COUNT };
+
+static const char *mode_name[] = { "shm", "shm_wake", "unixseq" };
+
+static const char *cols[] = {
+    "size", "hop_p50_ns", "rtt_p50_ns", "rtt_p99_ns", "rtt_max_ns", "msg_s", "wakeups"
+};
+
+/* first byte of every frame: what the child does with it */
+enum { OP_PING = 'P', OP_DATA = 'D', OP_END = 'E', OP_QUIT = 'Q' };
+
+/* one end of a connection, either transport */
+typedef struct peer {
+    xshm     *shm;
+    socket_t  fd;
+} peer;
+
+static int32_t
+peer_send(peer *l, const char *buf, int32_t len)
+{
+    return l->shm != NULL ? xshm_send(l->shm, buf, len) : socket_send(l->fd, (char *)buf, len);
+}
+
+static int32_t
+peer_recv(peer *l, char *buf, int32_t len)
+{
+    return l->shm != NULL ? xshm_recv(l->shm, buf, len, -1) : socket_recv(l->fd, buf, len);
+}
+
+static void
+peer_close(peer *l)
+{
+    if (l->shm != NULL) {
+        xshm_close(l->shm);
+    } else if (l->fd != INVALID_SOCKET) {
+        socket_close(l->fd);
+    }
+}
+
+/* the child: echo pings, sink data, acknowledge the end of a stream */
+static int
+child_main(int mode, const char *addr, int32_t spin_us)
+{
+    xshm_config cfg;
+    peer        l = { NULL, INVALID_SOCKET };
+    char       *buf = (char *)malloc(1 << 20);
+    int32_t     n;
+
+    xshm_config_init(&cfg);
+    cfg.spin_us = mode == MODE_SHM ? spin_us : 0;
+    if (mode == MODE_UNIXSEQ) {
+        l.fd = socket_create_tcp_client(addr, 0);
+    } else {
+        l.shm = xshm_connect(addr, &cfg);
+    }
+    if (buf == NULL || (l.shm == NULL && l.fd == INVALID_SOCKET)) {
+        free(buf);
+        return 1;
+    }
+    while ((n = peer_recv(&l, buf, 1 << 20)) > 0 && buf[0] != OP_QUIT) {
+        if ((buf[0] == OP_PING || buf[0] == OP_END) && peer_send(&l, buf, buf[0] == OP_END ? 1 : n) <= 0) {
+            break;
+        }
+    }
+    peer_close(&l);
+    free(buf);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : ping-pong then stream at one frame size
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_size(bench_report *rep, peer *l, int mode, int32_t size, int64_t iters, double seconds)
+{
+    bench_samples rtt = { 0 };
+    bench_dist    d;
+    xshm_stats    st0, st1;
+    char         *buf;
+    uint64_t      t0, t1, end;
+    int64_t       i, msgs = 0;
+    double        v[7];
+    int           ret = -1;
+
+    if ((buf = (char *)calloc(1, size)) == NULL) {
+        return -1;
+    }
+    memset(&st0, 0, sizeof(st0));
+    memset(&st1, 0, sizeof(st1));
+    if (l->shm != NULL) {
+        xshm_get_stats(l->shm, &st0);
+    }
+
+    for (i = 0; i < iters; i++) {
+        buf[0] = OP_PING;
+        t0 = bench_now_ns();
+        if (peer_send(l, buf, size) != size || peer_recv(l, buf, size) != size) {
+            goto out;
+        }
+        bench_samples_push(&rtt, bench_now_ns() - t0);
+    }
+
+    buf[0] = OP_DATA;
+    t0  = bench_now_ns();
+    end = t0 + (uint64_t)(seconds * 1e9);
+    while (bench_now_ns() < end) {
+        int k;
+        for (k = 0; k < 64; k++, msgs++) {
+            if (peer_send(l, buf, size) != size) {
+                goto out;
+            }
+        }
+    }
+    buf[0] = OP_END;
+    if (peer_send(l, buf, 1) != 1 || peer_recv(l, buf, size) != 1) {
+        goto out;
+    }
+    t1 = bench_now_ns();
+    if (l->shm != NULL) {
+        xshm_get_stats(l->shm, &st1);
+    }
+
+    bench_dist_compute(rtt.v, rtt.n, &d);
+    v[0] = size;
+    v[1] = d.p50 / 2;
+    v[2] = d.p50;
+    v[3] = d.p99;
+    v[4] = d.max;
+    v[5] = (double)msgs / ((double)(t1 - t0) / 1e9);
+    v[6] = (double)(st1.wakeups - st0.wakeups);
+    bench_report_row(rep, mode_name[mode], v);
+    ret = 0;
+
+out:
+    bench_samples_free(&rtt);
+    free(buf);
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : fork the child of one mode and run every size against it
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_mode(bench_report *rep, int mode, const char *path, int32_t spin_us, const int64_t *sizes,
+         int n_sizes, int64_t iters, double seconds)
+{
+    xshm_config cfg;
+    peer        l = { NULL, INVALID_SOCKET };
+    char        addr[256];
+    socket_t    listen_fd;
+    pid_t       pid;
+    int         s, status, ret = 0;
+    char        quit = OP_QUIT;
+
+    snprintf(addr, sizeof(addr), "%s:%s", mode == MODE_UNIXSEQ ? "unixseq" : "unix", path);
+    if ((listen_fd = socket_create_tcp_listen(addr, 0)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s\n", addr);
+        return -1;
+    }
+    if ((pid = fork()) == 0) {
+        socket_close(listen_fd);
+        _exit(child_main(mode, addr, spin_us));
+    }
+
+    xshm_config_init(&cfg);
+    cfg.spin_us = mode == MODE_SHM ? spin_us : 0;
+    if (mode == MODE_UNIXSEQ) {
+        l.fd = socket_create_tcp_server(listen_fd, 2000);
+    } else {
+        l.shm = xshm_accept(listen_fd, 2000, &cfg);
+    }
+    socket_close(listen_fd);
+    unlink(path);
+    if (pid < 0 || (l.shm == NULL && l.fd == INVALID_SOCKET)) {
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+        }
+        peer_close(&l);
+        return -1;
+    }
+
+    for (s = 0; s < n_sizes; s++) {
+        // a seqpacket message must fit the socket buffer
+        if (sizes[s] < 8 || sizes[s] > (l.shm != NULL ? xshm_max_frame(l.shm) : 65536)) {
+            continue;
+        }
+        if (run_size(rep, &l, mode, (int32_t)sizes[s], iters, seconds) != 0) {
+            fprintf(stderr, "[bench] %s %d bytes failed\n", mode_name[mode], (int)sizes[s]);
+            ret = -1;
+            break;
+        }
+    }
+    peer_send(&l, &quit, 1);
+    peer_close(&l);
+    waitpid(pid, &status, 0);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -u path    Unix socket path        (default /tmp/xshm_bench.sock)\n"
+            "  -s sizes   frame sizes, >= 8       (default 64,1K,16K)\n"
+            "  -n iters   ping-pong frames        (default 20000)\n"
+            "  -t secs    stream time per run     (default 1)\n"
+            "  -w us      shm spin before sleep   (default 50)\n"
+            "  -m modes   shm,shm_wake,unixseq    (default all)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     sizes[BENCH_MAX_LIST] = { 64, 1024, 16384 };
+    int         n_sizes = 3;
+    int         modes[MODE_COUNT] = { 1, 1, 1 };
+    const char *path = "/tmp/xshm_bench.sock";
+    int64_t     iters = 20000, spin = 50;
+    double      seconds = 1;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, m, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "u:s:n:t:w:m:f:h")) != -1) {
+        switch (opt) {
+        case 'u': path    = optarg; break;
+        case 's': n_sizes = bench_parse_list(optarg, sizes); break;
+        case 'n': iters   = bench_parse_size(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'w': spin    = bench_parse_size(optarg); break;
+        case 'm':
+            for (m = 0; m < MODE_COUNT; m++) {
+                modes[m] = 0;
+            }
+            // "shm" is a prefix of "shm_wake", match whole names
+            {
+                char list[256], *tok, *save;
+                snprintf(list, sizeof(list), "%s", optarg);
+                for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                    for (m = 0; m < MODE_COUNT; m++) {
+                        modes[m] |= strcmp(tok, mode_name[m]) == 0;
+                    }
+                }
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || iters <= 0 || seconds <= 0 || spin < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    signal(SIGPIPE, SIG_IGN);
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (m = 0; m < MODE_COUNT; m++) {
+        if (modes[m] && run_mode(&rep, m, path, (int32_t)spin, sizes, n_sizes, iters, seconds) != 0) {
+            failed = 1;
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
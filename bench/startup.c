@@ -0,0 +1,350 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     startup.c
+ *  @brief    Process startup: joins and connects one by one against xstartup (Linux)
+ *
+ *  A process starts by joining groups multicast groups and connecting to
+ *  upstreams servers, then reports how long it took until it was ready:
+ *
+ *      sequential - socket_add_mc for each group, then
+ *                   socket_create_tcp_client for each upstream, a refused
+ *                   one tried again every 100 ms until the deadline
+ *      bulk       - xstartup_run over all of them
+ *
+ *  The upstreams connect to a local listener, which opens late_ms (-l)
+ *  after the start, as when services are started together.  Upstreams
+ *  that are down (-d) connect to an address nobody answers ARP for, so
+ *  each connect fails only after the neighbour timeout, about 3 s; this
+ *  needs an interface on that subnet, e.g. the veth pair of xdp_rx.c:
+ *
+ *      ip link add xv0 type veth peer name xv1
+ *      ip addr add 10.77.0.1/24 dev xv0 && ip link set xv0 up && ip link set xv1 up
+ *      ./startup -d 2 -D 10.77.0.9
+ *
+ *  ready_ms is the time until the last item was ready, total_ms the
+ *  time until the startup gave up on the rest.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/startup.c source/xsocket.c source/xstartup.c \
+ *          -lpthread -o startup
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xstartup.h"
+#include "bench_common.h"
+
+#define MAX_ITEMS       4096
+#define RETRY_MS        100
+
+enum { MODE_SEQUENTIAL = 0, MODE_BULK, MODE_COUNT };
+
+static const char *mode_name[] = { "sequential", "bulk" };
+
+static const char *cols[] = {
+    "groups", "upstreams", "dead", "ready", "failed", "ready_ms", "total_ms"
+};
+
+/* the settings of all runs */
+typedef struct bench_ctx {
+    const char  *ip_if;             // for the joins and the listener
+    const char  *dead_addr;
+    uint16_t     port;
+    int32_t      groups;
+    int32_t      dead;
+    int32_t      late_ms;
+    int32_t      ms_timeout;
+} bench_ctx;
+
+/* the local upstream listener, accepting until stopped */
+typedef struct upstream {
+    const bench_ctx *bc;
+    pthread_t        tid;
+    socket_t         lfd;           // INVALID_SOCKET until open
+    volatile int     stop;
+    int              failed;
+} upstream;
+
+static void
+sleep_ms(int32_t ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000;
+    nanosleep(&ts, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : listen with SO_REUSEADDR, the port is reopened for every run
+// ---------------------------------------------------------------------------
+static socket_t
+listen_reuse(const char *addr, uint16_t port)
+{
+    struct sockaddr_in sa;
+    socket_t           fd;
+    int                on = 1, tries = 0, rc;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+        return INVALID_SOCKET;
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = inet_addr(addr);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0) {
+        close(fd);
+        return INVALID_SOCKET;
+    }
+    while ((rc = bind(fd, (struct sockaddr *)&sa, sizeof(sa))) != 0 && errno == EADDRINUSE
+           && ++tries < 200) {
+        sleep_ms(5);
+    }
+    if (rc != 0 || listen(fd, MAX_ITEMS) != 0) {
+        close(fd);
+        return INVALID_SOCKET;
+    }
+    return fd;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open the listener after late_ms, unless it is open, and
+//              accept until stopped
+// ---------------------------------------------------------------------------
+static void *
+upstream_thread(void *arg)
+{
+    upstream *up = (upstream *)arg;
+    socket_t  fd;
+
+    if (up->lfd == INVALID_SOCKET) {
+        sleep_ms(up->bc->late_ms);
+        if ((up->lfd = listen_reuse(up->bc->ip_if, up->bc->port)) == INVALID_SOCKET) {
+            up->failed = 1;
+            return NULL;
+        }
+    }
+    while (!up->stop) {
+        if ((fd = socket_create_tcp_server(up->lfd, 50)) != INVALID_SOCKET) {
+            socket_close(fd);
+        }
+    }
+    socket_close(up->lfd);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : fill in the items: the groups, the live upstreams, the dead
+// Return     : the number of items
+// ---------------------------------------------------------------------------
+static int32_t
+make_items(const bench_ctx *bc, int32_t upstreams, xstartup_item *items, char (*grp)[20])
+{
+    int32_t i, n = 0;
+
+    for (i = 0; i < bc->groups; i++, n++) {
+        snprintf(grp[i], sizeof(grp[i]), "239.1.%d.%d", 2 + i / 250, 1 + i % 250);
+        memset(&items[n], 0, sizeof(items[n]));
+        items[n].kind  = XSTARTUP_GROUP;
+        items[n].ip_if = bc->ip_if;
+        items[n].addr  = grp[i];
+        items[n].port  = bc->port;
+    }
+    for (i = 0; i < upstreams + bc->dead; i++, n++) {
+        memset(&items[n], 0, sizeof(items[n]));
+        items[n].kind = XSTARTUP_UPSTREAM;
+        items[n].addr = i < upstreams ? bc->ip_if : bc->dead_addr;
+        items[n].port = bc->port;
+    }
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : start up the way most processes do, one item after another
+// ---------------------------------------------------------------------------
+static void
+run_sequential(const bench_ctx *bc, xstartup_item *items, int32_t n)
+{
+    int64_t t0 = socket_now_ns(), deadline = t0 + (int64_t)bc->ms_timeout * 1000000;
+    int32_t i;
+
+    for (i = 0; i < n; i++) {
+        xstartup_item *it = &items[i];
+
+        it->err = ETIMEDOUT;
+        while (socket_now_ns() < deadline) {
+            errno = 0;
+            it->attempts++;
+            it->fd = it->kind == XSTARTUP_GROUP
+                   ? socket_add_mc_ex(it->ip_if, it->addr, it->port, it->rcvbuf)
+                   : socket_create_tcp_client(it->addr, it->port);
+            if (it->fd != INVALID_SOCKET) {
+                it->err = 0;
+                break;
+            }
+            it->err = errno != 0 ? errno : EINVAL;
+            if (it->kind == XSTARTUP_GROUP || it->err != ECONNREFUSED) {
+                break;
+            }
+            sleep_ms(RETRY_MS);
+        }
+        it->elapsed_ns = socket_now_ns() - t0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one startup with the given number of live upstreams
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const bench_ctx *bc, int mode, int32_t upstreams)
+{
+    static xstartup_item items[MAX_ITEMS];
+    static char          grp[MAX_ITEMS][20];
+    upstream             up;
+    int64_t              t0, t1, last = 0;
+    int32_t              n, i, ready = 0;
+    double               v[7];
+
+    memset(&up, 0, sizeof(up));
+    up.bc  = bc;
+    up.lfd = INVALID_SOCKET;
+    n = make_items(bc, upstreams, items, grp);
+    if (bc->late_ms == 0 && (up.lfd = listen_reuse(bc->ip_if, bc->port)) == INVALID_SOCKET) {
+        return -1;
+    }
+    if (pthread_create(&up.tid, NULL, upstream_thread, &up) != 0) {
+        if (up.lfd != INVALID_SOCKET) {
+            socket_close(up.lfd);
+        }
+        return -1;
+    }
+
+    t0 = socket_now_ns();
+    if (mode == MODE_BULK) {
+        xstartup_config cfg;
+
+        xstartup_config_init(&cfg);
+        cfg.retry_ms = RETRY_MS;
+        if (xstartup_run(items, n, bc->ms_timeout, &cfg) < 0) {
+            n = 0;
+        }
+    } else {
+        run_sequential(bc, items, n);
+    }
+    t1 = socket_now_ns();
+
+    for (i = 0; i < n; i++) {
+        if (items[i].err == 0) {
+            ready++;
+            last = items[i].elapsed_ns > last ? items[i].elapsed_ns : last;
+            socket_close(items[i].fd);
+        }
+    }
+    up.stop = 1;
+    pthread_join(up.tid, NULL);
+    if (up.failed || n == 0) {
+        return -1;
+    }
+
+    v[0] = bc->groups;
+    v[1] = upstreams;
+    v[2] = bc->dead;
+    v[3] = ready;
+    v[4] = n - ready;
+    v[5] = (double)last / 1e6;
+    v[6] = (double)(t1 - t0) / 1e6;
+    bench_report_row(rep, mode_name[mode], v);
+    return 0;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -m modes   sequential,bulk           (default both)\n"
+            "  -i addr    interface and listener    (default 127.0.0.1)\n"
+            "  -p port    group and listener port   (default 12032)\n"
+            "  -g count   groups to join            (default 64)\n"
+            "  -u counts  upstream counts           (default 16,64,256)\n"
+            "  -l ms      listener opens after      (default 0)\n"
+            "  -d count   upstreams that are down   (default 0)\n"
+            "  -D addr    address of those          (default 10.77.0.9)\n"
+            "  -T ms      startup deadline          (default 5000)\n"
+            "  -f format  text, csv or json         (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t   ups[BENCH_MAX_LIST] = { 16, 64, 256 };
+    int       n_ups = 3, modes[MODE_COUNT] = { 1, 1 };
+    bench_fmt fmt   = BENCH_FMT_TEXT;
+    bench_report rep;
+    bench_ctx bc;
+    int opt, m, u, bad = 0, failed = 0;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.ip_if      = "127.0.0.1";
+    bc.dead_addr  = "10.77.0.9";
+    bc.port       = 12032;
+    bc.groups     = 64;
+    bc.ms_timeout = 5000;
+
+    while ((opt = getopt(argc, argv, "m:i:p:g:u:l:d:D:T:f:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            modes[MODE_SEQUENTIAL] = strstr(optarg, "seq") != NULL;
+            modes[MODE_BULK]       = strstr(optarg, "bulk") != NULL;
+            break;
+        case 'i': bc.ip_if      = optarg; break;
+        case 'p': bc.port       = (uint16_t)atoi(optarg); break;
+        case 'g': bc.groups     = atoi(optarg); break;
+        case 'u': n_ups         = bench_parse_list(optarg, ups); break;
+        case 'l': bc.late_ms    = atoi(optarg); break;
+        case 'd': bc.dead       = atoi(optarg); break;
+        case 'D': bc.dead_addr  = optarg; break;
+        case 'T': bc.ms_timeout = atoi(optarg); break;
+        case 'f': bad |= bench_parse_fmt(optarg, &fmt) != 0; break;
+        default:  bad = 1; break;
+        }
+    }
+    if (bad || n_ups <= 0 || bc.groups < 0 || bc.dead < 0 || bc.late_ms < 0
+        || bc.ms_timeout <= 0 || (!modes[MODE_SEQUENTIAL] && !modes[MODE_BULK])) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (u = 0; u < n_ups; u++) {
+        if (ups[u] < 0 || bc.groups + ups[u] + bc.dead > MAX_ITEMS) {
+            continue;
+        }
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (modes[m] && run_one(&rep, &bc, m, (int32_t)ups[u]) != 0) {
+                fprintf(stderr, "[bench] %s with %d upstreams failed\n", mode_name[m], (int)ups[u]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
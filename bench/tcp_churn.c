@@ -0,0 +1,309 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     tcp_churn.c
+ *  @brief    TCP connection-churn benchmark for xsocket (Linux)
+ *
+ *  Client threads open and close connections to a local listener as fast
+ *  as they can.  Per connection:
+ *
+ *      client                              acceptor
+ *      t0 = now
+ *      socket_create_tcp_client  ------->  socket_create_tcp_server
+ *      (connect latency)                   send 1 byte, recv t0
+ *      send t0                             accept latency = accepted - t0
+ *      recv 1 byte (time to first byte)    close
+ *      close
+ *
+ *  Clients close with SO_LINGER 0 by default, so no TIME_WAIT state piles
+ *  up on the ephemeral ports during the run.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/tcp_churn.c source/xsocket.c -lpthread \
+ *          -o tcp_churn
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "bench_common.h"
+
+#define MAX_THREADS     1024
+
+static const char *cols[] = {
+    "threads", "seconds", "conns", "conns_s", "failed",
+    "connect_p50_us", "connect_p99_us", "accept_p50_us", "accept_p99_us",
+    "ttfb_p50_us", "ttfb_p99_us"
+};
+
+/* settings and stop flag shared by all threads */
+typedef struct churn_cfg {
+    const char   *addr;
+    uint16_t      port;
+    socket_t      listen_fd;
+    int           linger0;
+    volatile int  stop;             // stops the clients
+    volatile int  stop_accept;      // stops the acceptors once the clients are done
+} churn_cfg;
+
+/* per thread results, merged after the run */
+typedef struct churn_thread {
+    churn_cfg     *cfg;
+    pthread_t      tid;
+    int64_t        conns;
+    int64_t        failed;
+    bench_samples  connect;
+    bench_samples  accept;
+    bench_samples  ttfb;
+} churn_thread;
+
+// ---------------------------------------------------------------------------
+// Function   : accept connections, greet them and measure the accept latency
+// ---------------------------------------------------------------------------
+static void *
+acceptor_thread(void *arg)
+{
+    churn_thread *th = (churn_thread *)arg;
+    char greet = 'x';
+
+    while (!th->cfg->stop_accept) {
+        uint64_t t0, accepted;
+        int32_t  got = 0, n;
+        socket_t fd = socket_create_tcp_server(th->cfg->listen_fd, 100);
+
+        if (fd == INVALID_SOCKET) {
+            continue;               // timeout, or another acceptor won the race
+        }
+        accepted = bench_now_ns();
+
+        if (socket_send(fd, &greet, 1) == 1) {
+            while (got < (int32_t)sizeof(t0)) {
+                if ((n = socket_recv(fd, (char *)&t0 + got, (int32_t)sizeof(t0) - got)) <= 0) {
+                    break;
+                }
+                got += n;
+            }
+        }
+        if (got == (int32_t)sizeof(t0)) {
+            bench_samples_push(&th->accept, accepted - t0);
+            th->conns++;
+        } else {
+            th->failed++;
+        }
+        socket_close(fd);
+    }
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : connect, exchange the greeting and close, in a loop
+// ---------------------------------------------------------------------------
+static void *
+client_thread(void *arg)
+{
+    churn_thread *th = (churn_thread *)arg;
+    struct linger lg;
+    char greet;
+
+    lg.l_onoff  = 1;
+    lg.l_linger = 0;
+
+    while (!th->cfg->stop) {
+        uint64_t t0 = bench_now_ns(), t1;
+        socket_t fd = socket_create_tcp_client(th->cfg->addr, th->cfg->port);
+
+        if (fd == INVALID_SOCKET) {
+            th->failed++;
+            continue;
+        }
+        t1 = bench_now_ns();
+
+        if (socket_send(fd, (char *)&t0, (int32_t)sizeof(t0)) == (int32_t)sizeof(t0)
+            && socket_recv(fd, &greet, 1) == 1) {
+            bench_samples_push(&th->ttfb, bench_now_ns() - t0);
+            bench_samples_push(&th->connect, t1 - t0);
+            th->conns++;
+        } else {
+            th->failed++;
+        }
+
+        if (th->cfg->linger0) {
+            setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        }
+        socket_close(fd);
+    }
+    return NULL;
+}
+
+static void
+percentiles(bench_samples *s, double *p50, double *p99)
+{
+    bench_dist d;
+
+    bench_dist_compute(s->v, s->n, &d);
+    *p50 = d.p50 / 1e3;
+    *p99 = d.p99 / 1e3;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run the given number of client threads for a fixed time
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, churn_cfg *cfg, int n_clients, int n_acceptors, double seconds)
+{
+    churn_thread *th = (churn_thread *)calloc(n_clients + n_acceptors, sizeof(churn_thread));
+    bench_samples connect, accept, ttfb;
+    int64_t conns = 0, failed = 0;
+    uint64_t t0, t1;
+    double v[11];
+    int i, started = 0;
+
+    if (th == NULL) {
+        return -1;
+    }
+    memset(&connect, 0, sizeof(connect));
+    memset(&accept, 0, sizeof(accept));
+    memset(&ttfb, 0, sizeof(ttfb));
+
+    cfg->stop        = 0;
+    cfg->stop_accept = 0;
+    for (i = 0; i < n_clients + n_acceptors; i++) {
+        th[i].cfg = cfg;
+        if (pthread_create(&th[i].tid, NULL,
+                           i < n_acceptors ? acceptor_thread : client_thread, &th[i]) != 0) {
+            break;
+        }
+        started++;
+    }
+    t0 = bench_now_ns();
+    if (started == n_clients + n_acceptors) {
+        usleep((useconds_t)(seconds * 1e6));
+    }
+    t1 = bench_now_ns();
+    cfg->stop = 1;
+
+    // clients first: they may still wait for a greeting from the acceptors
+    for (i = n_acceptors; i < started; i++) {
+        pthread_join(th[i].tid, NULL);
+    }
+    cfg->stop_accept = 1;
+    for (i = 0; i < started && i < n_acceptors; i++) {
+        pthread_join(th[i].tid, NULL);
+    }
+
+    for (i = 0; i < started; i++) {
+        if (i >= n_acceptors) {
+            conns  += th[i].conns;
+            failed += th[i].failed;
+        }
+        bench_samples_merge(&connect, &th[i].connect);
+        bench_samples_merge(&accept, &th[i].accept);
+        bench_samples_merge(&ttfb, &th[i].ttfb);
+        bench_samples_free(&th[i].connect);
+        bench_samples_free(&th[i].accept);
+        bench_samples_free(&th[i].ttfb);
+    }
+    free(th);
+
+    if (started == n_clients + n_acceptors) {
+        v[0] = n_clients;
+        v[1] = (double)(t1 - t0) / 1e9;
+        v[2] = (double)conns;
+        v[3] = (double)conns / v[1];
+        v[4] = (double)failed;
+        percentiles(&connect, &v[5], &v[6]);
+        percentiles(&accept, &v[7], &v[8]);
+        percentiles(&ttfb, &v[9], &v[10]);
+        bench_report_row(rep, "tcp", v);
+    }
+
+    bench_samples_free(&connect);
+    bench_samples_free(&accept);
+    bench_samples_free(&ttfb);
+    return started == n_clients + n_acceptors ? 0 : -1;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address          (default 127.0.0.1)\n"
+            "  -p port    listen port               (default 12015)\n"
+            "  -c counts  client thread counts      (default 1,2,4,8,16)\n"
+            "  -A count   acceptor threads          (default 1)\n"
+            "  -t secs    measured time per count   (default 2)\n"
+            "  -L         plain close, keep TIME_WAIT (default SO_LINGER 0)\n"
+            "  -f format  text, csv or json         (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t counts[BENCH_MAX_LIST] = { 1, 2, 4, 8, 16 };
+    int     n_counts  = 5;
+    int     acceptors = 1;
+    double  seconds   = 2.0;
+    bench_fmt fmt     = BENCH_FMT_TEXT;
+    bench_report rep;
+    churn_cfg cfg;
+    int opt, c, failed = 0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.addr    = "127.0.0.1";
+    cfg.port    = 12015;
+    cfg.linger0 = 1;
+
+    while ((opt = getopt(argc, argv, "a:p:c:A:t:Lf:h")) != -1) {
+        switch (opt) {
+        case 'a': cfg.addr    = optarg; break;
+        case 'p': cfg.port    = (uint16_t)atoi(optarg); break;
+        case 'A': acceptors   = atoi(optarg); break;
+        case 't': seconds     = atof(optarg); break;
+        case 'L': cfg.linger0 = 0; break;
+        case 'c': n_counts    = bench_parse_list(optarg, counts); break;
+        case 'f':
+            if (bench_parse_fmt(optarg, &fmt) != 0) {
+                n_counts = -1;
+            }
+            break;
+        default:
+            n_counts = -1;
+            break;
+        }
+    }
+    if (n_counts <= 0 || acceptors <= 0 || acceptors > MAX_THREADS || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);          // connect failures are counted, not printed
+    cfg.listen_fd = socket_create_tcp_listen(cfg.addr, cfg.port);
+    if (cfg.listen_fd == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", cfg.addr, cfg.port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "proto", cols, sizeof(cols) / sizeof(cols[0]));
+    for (c = 0; c < n_counts; c++) {
+        if (counts[c] <= 0 || counts[c] > MAX_THREADS) {
+            continue;
+        }
+        failed |= run_one(&rep, &cfg, (int)counts[c], acceptors, seconds);
+    }
+    bench_report_end(&rep);
+
+    socket_close(cfg.listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
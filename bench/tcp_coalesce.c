@@ -0,0 +1,329 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     tcp_coalesce.c
+ *  @brief    Small-message write coalescing benchmark for xsocket (Linux)
+ *
+ *  A producer sends fixed size messages over loopback, each stamped with
+ *  its send time; a receiver thread parses the stream and records the
+ *  one-way latency of every message.  Each combination of send mode,
+ *  message size and send rate runs on a fresh connection.
+ *
+ *  Send modes:
+ *      nodelay - one socket_send per message, TCP_NODELAY
+ *      nagle   - one socket_send per message, Nagle's algorithm on
+ *      xwbuf   - xwbuf_send per message over TCP_NODELAY, flushed by the
+ *                threshold (-T) or the deadline (-d)
+ *
+ *  sends_msg is the number of send() calls per message and msgs_send its
+ *  inverse, the messages carried by one send(); with a rate (-r)
+ *  the producer paces itself and calls xwbuf_poll while it waits.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/tcp_coalesce.c source/xsocket.c source/xwbuf.c \
+ *          -lpthread -o tcp_coalesce
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xwbuf.h"
+#include "bench_common.h"
+
+#define RX_BUF_SIZE     (256 << 10)
+
+typedef enum tx_mode {
+    TX_NODELAY = 0,
+    TX_NAGLE,
+    TX_XWBUF,
+    TX_MODE_NUM
+} tx_mode;
+
+static const char *tx_mode_name[TX_MODE_NUM] = { "nodelay", "nagle", "xwbuf" };
+
+static const char *cols[] = {
+    "size", "rate", "msgs", "msgs_s", "mb_s", "sends_msg", "msgs_send", "p50_us", "p99_us", "max_us"
+};
+
+/* coalescing parameters */
+typedef struct coalesce_cfg {
+    int32_t capacity;
+    int32_t threshold;
+    int32_t deadline_us;
+} coalesce_cfg;
+
+/* the receiving side of a run */
+typedef struct receiver {
+    socket_t      listen_fd;
+    int32_t       size;
+    int64_t       msgs;
+    int64_t       got;
+    uint64_t      done_ns;          // arrival time of the last message
+    bench_samples lat;
+} receiver;
+
+// ---------------------------------------------------------------------------
+// Function   : accept one connection and time every message on it
+// ---------------------------------------------------------------------------
+static void *
+receiver_thread(void *arg)
+{
+    receiver *rx  = (receiver *)arg;
+    char     *buf = (char *)malloc(RX_BUF_SIZE);
+    int32_t   have = 0, n, off;
+    socket_t  fd;
+
+    fd = socket_create_tcp_server(rx->listen_fd, 5000);
+    if (fd == INVALID_SOCKET || buf == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    while (rx->got < rx->msgs) {
+        if ((n = socket_recv(fd, buf + have, RX_BUF_SIZE - have)) <= 0) {
+            break;
+        }
+        have += n;
+
+        for (off = 0; have - off >= rx->size; off += rx->size) {
+            uint64_t t0, now = bench_now_ns();
+            memcpy(&t0, buf + off, sizeof(t0));
+            bench_samples_push(&rx->lat, now - t0);
+            rx->done_ns = now;
+            rx->got++;
+        }
+        memmove(buf, buf + off, have - off);
+        have -= off;
+    }
+
+    socket_close(fd);
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : write a whole message with plain socket_send calls
+// Return     : number of send() calls, or -1 on error
+// ---------------------------------------------------------------------------
+static int64_t
+send_direct(socket_t fd, char *msg, int32_t size)
+{
+    int64_t calls = 0;
+    int32_t done  = 0, n;
+
+    while (done < size) {
+        calls++;
+        if ((n = socket_send(fd, msg + done, size - done)) <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return calls;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run one mode, size and rate on a fresh connection
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, tx_mode mode, const coalesce_cfg *cc, socket_t listen_fd,
+        const char *addr, uint16_t port, int32_t size, int64_t rate, int64_t msgs)
+{
+    socket_opts opts;
+    receiver    rx;
+    pthread_t   tid;
+    xwbuf      *wb = NULL;
+    char       *msg;
+    socket_t    fd;
+    bench_dist  d;
+    int64_t     i, calls = 0, n;
+    uint64_t    t0 = 0, next, gap, now;
+    double      v[10], secs;
+    int         ret = 0;
+
+    memset(&rx, 0, sizeof(rx));
+    rx.size = size;
+    rx.msgs = msgs;
+    rx.listen_fd = listen_fd;
+    if (pthread_create(&tid, NULL, receiver_thread, &rx) != 0) {
+        return -1;
+    }
+
+    socket_opts_init(&opts, SOCKET_PROFILE_DEFAULT);
+    opts.nodelay = (mode != TX_NAGLE);
+    fd  = socket_create_tcp_client_ex(addr, port, &opts);
+    msg = (char *)calloc(1, size);
+    if (fd != INVALID_SOCKET && mode == TX_XWBUF) {
+        wb = xwbuf_create(fd, cc->capacity, cc->threshold, cc->deadline_us);
+    }
+    if (fd == INVALID_SOCKET || msg == NULL || (mode == TX_XWBUF && wb == NULL)) {
+        ret = -1;
+        goto out;
+    }
+
+    gap  = rate > 0 ? 1000000000ull / (uint64_t)rate : 0;
+    t0   = bench_now_ns();
+    next = t0;
+    for (i = 0; i < msgs; i++) {
+        if (gap) {
+            while (bench_now_ns() < next) {
+                if (wb != NULL && xwbuf_poll(wb) < 0) {
+                    ret = -1;
+                    goto out;
+                }
+            }
+            next += gap;
+        }
+
+        now = bench_now_ns();
+        memcpy(msg, &now, sizeof(now));
+        if (wb != NULL) {
+            n = xwbuf_send(wb, msg, size) == size ? 0 : -1;
+        } else {
+            calls += (n = send_direct(fd, msg, size));
+        }
+        if (n < 0) {
+            ret = -1;
+            goto out;
+        }
+    }
+    if (wb != NULL) {
+        xwbuf_stats st;
+        if (xwbuf_flush(wb) != 0) {
+            ret = -1;
+            goto out;
+        }
+        xwbuf_get_stats(wb, &st);
+        calls = st.syscalls;
+    }
+
+out:
+    if (ret != 0 && fd != INVALID_SOCKET) {
+        shutdown(fd, SHUT_RDWR);    // wake the receiver
+    }
+    pthread_join(tid, NULL);
+    xwbuf_destroy(wb);
+    free(msg);
+    if (fd != INVALID_SOCKET) {
+        socket_close(fd);
+    }
+
+    if (ret == 0 && rx.got == msgs) {
+        secs = (double)(rx.done_ns - t0) / 1e9;
+        bench_dist_compute(rx.lat.v, rx.lat.n, &d);
+        v[0] = size;
+        v[1] = (double)rate;
+        v[2] = (double)msgs;
+        v[3] = (double)msgs / secs;
+        v[4] = (double)msgs * size / secs / 1e6;
+        v[5] = (double)calls / (double)msgs;
+        v[6] = calls ? (double)msgs / (double)calls : 0;
+        v[7] = d.p50 / 1e3;
+        v[8] = d.p99 / 1e3;
+        v[9] = d.max / 1e3;
+        bench_report_row(rep, tx_mode_name[mode], v);
+    } else {
+        ret = -1;
+    }
+    bench_samples_free(&rx.lat);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address            (default 127.0.0.1)\n"
+            "  -p port    listen port                 (default 12016)\n"
+            "  -m modes   nodelay,nagle,xwbuf         (default all)\n"
+            "  -s sizes   message sizes, >= 8         (default 16,64,256)\n"
+            "  -r rates   messages per second, 0 = as fast as possible (default 0,100000)\n"
+            "  -n count   messages per run            (default 200000)\n"
+            "  -c bytes   xwbuf capacity              (default 64K)\n"
+            "  -T bytes   xwbuf flush threshold       (default 16K)\n"
+            "  -d usec    xwbuf flush deadline        (default 50)\n"
+            "  -f format  text, csv or json           (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t sizes[BENCH_MAX_LIST] = { 16, 64, 256 };
+    int64_t rates[BENCH_MAX_LIST] = { 0, 100000 };
+    int     n_sizes = 3, n_rates = 2;
+    int     modes[TX_MODE_NUM] = { 1, 1, 1 };
+    int64_t msgs = 200000;
+    const char *addr = "127.0.0.1";
+    uint16_t port = 12016;
+    coalesce_cfg cc = { 64 << 10, 16 << 10, 50 };
+    bench_fmt fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t listen_fd;
+    int opt, m, s, r, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:m:s:r:n:c:T:d:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr           = optarg; break;
+        case 'p': port           = (uint16_t)atoi(optarg); break;
+        case 'n': msgs           = bench_parse_size(optarg); break;
+        case 'c': cc.capacity    = (int32_t)bench_parse_size(optarg); break;
+        case 'T': cc.threshold   = (int32_t)bench_parse_size(optarg); break;
+        case 'd': cc.deadline_us = atoi(optarg); break;
+        case 's': n_sizes        = bench_parse_list(optarg, sizes); break;
+        case 'r': n_rates        = bench_parse_list(optarg, rates); break;
+        case 'm':
+            memset(modes, 0, sizeof(modes));
+            for (m = 0; m < TX_MODE_NUM; m++) {
+                modes[m] = strstr(optarg, tx_mode_name[m]) != NULL;
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || n_rates <= 0 || msgs <= 0 || cc.capacity <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+    if ((listen_fd = socket_create_tcp_listen(addr, port)) == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (r = 0; r < n_rates; r++) {
+        for (s = 0; s < n_sizes; s++) {
+            if (sizes[s] < (int64_t)sizeof(uint64_t) || sizes[s] > RX_BUF_SIZE) {
+                continue;
+            }
+            for (m = 0; m < TX_MODE_NUM; m++) {
+                if (modes[m] && run_one(&rep, (tx_mode)m, &cc, listen_fd, addr, port,
+                                        (int32_t)sizes[s], rates[r], msgs) != 0) {
+                    fprintf(stderr, "[bench] %s size %d rate %lld failed\n", tx_mode_name[m],
+                            (int)sizes[s], (long long)rates[r]);
+                    failed = 1;
+                }
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
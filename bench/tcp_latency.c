@@ -0,0 +1,419 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     tcp_latency.c
+ *  @brief    TCP ping-pong latency benchmark for xsocket (Linux)
+ *
+ *  A client thread sends a message over loopback, an echo thread returns it
+ *  and the round-trip time is recorded.  Each combination of receive mode
+ *  and message size is run on a fresh connection, with a warm-up phase that
+ *  is not recorded.
+ *
+ *  Receive modes:
+ *      blocking - blocking socket_recv
+ *      busypoll - socket_spin_recv: spin for the budget (-b), then epoll;
+ *                 the kernel busy polls each receive for -k microseconds
+ *      epoll    - non-blocking socket, epoll_wait before each socket_recv
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/tcp_latency.c source/xsocket.c source/xthread.c \
+ *          -lpthread -o tcp_latency
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "xsocket.h"
+#include "xthread.h"
+#include "bench_common.h"
+
+typedef enum rx_mode {
+    RX_BLOCKING = 0,
+    RX_BUSYPOLL,
+    RX_EPOLL,
+    RX_MODE_NUM
+} rx_mode;
+
+static const char *rx_mode_name[RX_MODE_NUM] = { "blocking", "busypoll", "epoll" };
+
+static const char *cols[] = {
+    "size", "iters", "min_us", "mean_us", "p50_us", "p90_us", "p99_us", "p99.9_us", "max_us"
+};
+
+static const char *profile_name[] = { "default", "latency", "throughput" };
+
+/* one side of a ping-pong connection */
+typedef struct peer {
+    socket_t fd;
+    int      epfd;
+    rx_mode  mode;
+    int      quickack;              // re-arm TCP_QUICKACK after every message
+    socket_spin *sp;                // RX_BUSYPOLL
+} peer;
+
+/* parameters of the echo thread */
+typedef struct echo_arg {
+    socket_t           listen_fd;
+    rx_mode            mode;
+    int32_t            size;
+    const socket_opts *opts;
+    int32_t            spin_us;
+    int32_t            busy_poll_us;
+    const xthread_affinity *aff;
+    int                ok;
+} echo_arg;
+
+// ---------------------------------------------------------------------------
+// Function   : prepare a connected socket for the selected receive mode
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+peer_init(peer *p, socket_t fd, rx_mode mode, const socket_opts *opts, int32_t spin_us,
+          int32_t busy_poll_us)
+{
+    struct epoll_event ev;
+
+    p->fd       = fd;
+    p->epfd     = -1;
+    p->mode     = mode;
+    p->quickack = opts->quickack;
+    p->sp       = NULL;
+
+    if (mode == RX_BLOCKING) {
+        return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    }
+    if (mode == RX_BUSYPOLL) {
+        return (p->sp = socket_spin_create_ex(fd, spin_us, busy_poll_us)) != NULL ? 0 : -1;
+    }
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) != 0) {
+        return -1;
+    }
+    if (mode == RX_EPOLL) {
+        if ((p->epfd = epoll_create1(0)) < 0) {
+            return -1;
+        }
+        ev.events  = EPOLLIN;
+        ev.data.fd = fd;
+        return epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev);
+    }
+    return 0;
+}
+
+static void
+peer_close(peer *p)
+{
+    if (p->epfd >= 0) {
+        close(p->epfd);
+    }
+    socket_spin_close(p->sp);
+    socket_close(p->fd);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : receive exactly len bytes
+// Return     : len on success, 0 when the peer closed, -1 on error
+// ---------------------------------------------------------------------------
+static int32_t
+peer_recv_full(peer *p, char *buf, int32_t len)
+{
+    struct epoll_event ev;
+    int32_t got = 0;
+
+    while (got < len) {
+        int32_t n = p->sp ? socket_spin_recv(p->sp, buf + got, len - got, -1)
+                          : socket_recv(p->fd, buf + got, len - got);
+        if (n > 0) {
+            got += n;
+            continue;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+        if (p->mode == RX_EPOLL && epoll_wait(p->epfd, &ev, 1, -1) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+    if (p->quickack) {
+        socket_set_quickack(p->fd, 1);
+    }
+    return got;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : send exactly len bytes, spinning on a full non-blocking socket
+// Return     : len on success, -1 on error
+// ---------------------------------------------------------------------------
+static int32_t
+peer_send_full(peer *p, char *buf, int32_t len)
+{
+    int32_t sent = 0;
+
+    while (sent < len) {
+        int32_t n = socket_send(p->fd, buf + sent, len - sent);
+        if (n > 0) {
+            sent += n;
+        } else if (n < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+            return -1;
+        }
+    }
+    return sent;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : echo every message back until the client closes
+// ---------------------------------------------------------------------------
+static void *
+echo_thread(void *arg)
+{
+    echo_arg *ea = (echo_arg *)arg;
+    char *buf = (char *)malloc(ea->size);
+    socket_t fd;
+    peer p;
+
+    if (ea->aff != NULL) {
+        char where[320];
+        fprintf(stderr, "[bench] echo: %s\n", xthread_placement(where, sizeof(where)));
+    }
+
+    fd = socket_create_tcp_server_ex(ea->listen_fd, 5000, ea->opts);
+    if (buf == NULL || fd == INVALID_SOCKET) {
+        free(buf);
+        return NULL;
+    }
+    if (peer_init(&p, fd, ea->mode, ea->opts, ea->spin_us, ea->busy_poll_us) == 0) {
+        while (peer_recv_full(&p, buf, ea->size) > 0) {
+            if (peer_send_full(&p, buf, ea->size) < 0) {
+                break;
+            }
+        }
+        ea->ok = 1;
+    }
+    peer_close(&p);
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run one mode/size combination and report its distribution
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port, rx_mode mode,
+        int32_t size, int64_t warmup, int64_t iters, const socket_opts *opts, int32_t spin_us,
+        int32_t busy_poll_us, const xthread_affinity *echo_aff)
+{
+    uint64_t *samples = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)iters);
+    char *buf = (char *)malloc(size);
+    echo_arg ea;
+    pthread_t tid;
+    bench_dist d;
+    socket_t fd;
+    int64_t i;
+    peer p;
+    int ret = -1;
+
+    if (samples == NULL || buf == NULL) {
+        goto out;
+    }
+    memset(buf, 'x', size);
+
+    ea.listen_fd = listen_fd;
+    ea.mode      = mode;
+    ea.size      = size;
+    ea.opts      = opts;
+    ea.spin_us   = spin_us;
+    ea.busy_poll_us = busy_poll_us;
+    ea.aff       = echo_aff;
+    ea.ok        = 0;
+    if (xthread_create(&tid, ea.aff, "echo", echo_thread, &ea) != 0) {
+        goto out;
+    }
+
+    fd = socket_create_tcp_client_ex(addr, port, opts);
+    if (fd == INVALID_SOCKET) {
+        pthread_join(tid, NULL);
+        goto out;
+    }
+    if (peer_init(&p, fd, mode, opts, spin_us, busy_poll_us) != 0) {
+        peer_close(&p);
+        pthread_join(tid, NULL);
+        goto out;
+    }
+
+    for (i = -warmup; i < iters; i++) {
+        uint64_t t0 = bench_now_ns();
+        if (peer_send_full(&p, buf, size) < 0 || peer_recv_full(&p, buf, size) <= 0) {
+            break;
+        }
+        if (i >= 0) {
+            samples[i] = bench_now_ns() - t0;
+        }
+    }
+
+    peer_close(&p);             // client closes first, the listen port stays free
+    pthread_join(tid, NULL);
+
+    if (i == iters && ea.ok) {
+        double v[9];
+        bench_dist_compute(samples, (size_t)iters, &d);
+        v[0] = size;
+        v[1] = (double)iters;
+        v[2] = d.min / 1e3;
+        v[3] = d.mean / 1e3;
+        v[4] = d.p50 / 1e3;
+        v[5] = d.p90 / 1e3;
+        v[6] = d.p99 / 1e3;
+        v[7] = d.p999 / 1e3;
+        v[8] = d.max / 1e3;
+        bench_report_row(rep, rx_mode_name[mode], v);
+        ret = 0;
+    } else {
+        fprintf(stderr, "[bench] %s size %d: connection failed after %lld messages\n",
+                rx_mode_name[mode], size, (long long)(i + warmup));
+    }
+
+out:
+    free(samples);
+    free(buf);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address         (default 127.0.0.1)\n"
+            "  -p port    listen port              (default 12012)\n"
+            "  -s sizes   message sizes, e.g. 64,1K (default 16,64,256,1K,4K,16K)\n"
+            "  -w count   warm-up round trips      (default 1000)\n"
+            "  -n count   measured round trips     (default 100000)\n"
+            "  -m modes   blocking,busypoll,epoll  (default all)\n"
+            "  -o profile socket option preset: default, latency, throughput\n"
+            "  -b usec    busypoll spin budget     (default 50)\n"
+            "  -k usec    kernel busy poll         (default 50, 0 for off)\n"
+            "  -C cpus    client thread cpu list   (default any)\n"
+            "  -E cpus    echo thread cpu list     (default any)\n"
+            "  -f format  text, csv or json        (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *addr = "127.0.0.1";
+    uint16_t port    = 12012;
+    int64_t sizes[BENCH_MAX_LIST] = { 16, 64, 256, 1 << 10, 4 << 10, 16 << 10 };
+    int     n_sizes  = 6;
+    int64_t warmup   = 1000;
+    int64_t iters    = 100000;
+    int     modes[RX_MODE_NUM] = { 1, 1, 1 };
+    int32_t spin_us  = 50;
+    int32_t busy_poll_us = SOCKET_BUSY_POLL_US;
+    xthread_affinity client_aff, echo_aff, *echo_aff_p = &echo_aff;
+    bench_fmt fmt = BENCH_FMT_TEXT;
+    socket_profile profile = SOCKET_PROFILE_DEFAULT;
+    socket_opts opts;
+    bench_report rep;
+    socket_t listen_fd;
+    int opt, m, s, failed = 0;
+
+    xthread_affinity_init(&client_aff);
+    xthread_affinity_init(&echo_aff);
+    while ((opt = getopt(argc, argv, "a:p:s:w:n:m:o:b:k:C:E:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr   = optarg; break;
+        case 'p': port   = (uint16_t)atoi(optarg); break;
+        case 'w': warmup = atoll(optarg); break;
+        case 'n': iters  = atoll(optarg); break;
+        case 'b': spin_us = atoi(optarg); break;
+        case 'k': busy_poll_us = atoi(optarg); break;
+        case 'C': client_aff.cpus = optarg; break;
+        case 'E': echo_aff.cpus   = optarg; break;
+        case 'o':
+            for (m = 0; m < 3 && strcmp(optarg, profile_name[m]) != 0; m++) {
+            }
+            if (m == 3) {
+                usage(argv[0]);
+                return 1;
+            }
+            profile = (socket_profile)m;
+            break;
+        case 'f':
+            if (bench_parse_fmt(optarg, &fmt) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 's':
+            if ((n_sizes = bench_parse_list(optarg, sizes)) <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            memset(modes, 0, sizeof(modes));
+            for (m = 0; m < RX_MODE_NUM; m++) {
+                modes[m] = strstr(optarg, rx_mode_name[m]) != NULL;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (iters <= 0 || warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);          // keep stdout for the results
+    if (client_aff.cpus != NULL) {
+        char where[320];
+        xthread_apply(&client_aff, "client");
+        fprintf(stderr, "[bench] client: %s\n", xthread_placement(where, sizeof(where)));
+    }
+    if (echo_aff.cpus == NULL) {
+        echo_aff_p = NULL;
+    }
+    socket_opts_init(&opts, profile);
+    listen_fd = socket_create_tcp_listen_ex(addr, port, &opts);
+    if (listen_fd == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (m = 0; m < RX_MODE_NUM; m++) {
+        if (!modes[m]) {
+            continue;
+        }
+        for (s = 0; s < n_sizes; s++) {
+            if (sizes[s] <= 0 || sizes[s] > INT32_MAX) {
+                continue;
+            }
+            failed |= run_one(&rep, listen_fd, addr, port, (rx_mode)m, (int32_t)sizes[s],
+                              warmup, iters, &opts, spin_us, busy_poll_us, echo_aff_p);
+        }
+    }
+
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,347 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     tcp_throughput.c
+ *  @brief    TCP throughput sweep benchmark for xsocket (Linux)
+ *
+ *  For every combination of message size and connection count, a sender
+ *  thread pushes whole messages with socket_send over all client
+ *  connections and a receiver thread drains the accepted connections with
+ *  socket_recv, both multiplexed with epoll.  Only the bytes received
+ *  during the measured interval are counted.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/tcp_throughput.c source/xsocket.c -lpthread \
+ *          -o tcp_throughput
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include "xsocket.h"
+#include "bench_common.h"
+
+#define EPOLL_BATCH     256
+#define RECV_BUF_SIZE   (1 << 20)
+
+static const char *cols[] = {
+    "size", "conns", "seconds", "bytes", "msgs", "gbit_s", "msgs_s"
+};
+
+/* state shared by the sender and receiver of one run */
+typedef struct run_ctx {
+    socket_t         *cli;          // client sockets, written by the sender
+    socket_t         *srv;          // accepted sockets, read by the receiver
+    int32_t          *sent;         // bytes of the current message already sent
+    int               conns;
+    int32_t           size;
+    char             *msg;
+    volatile int      stop;
+    volatile uint64_t rx_bytes;     // bytes received since the start
+} run_ctx;
+
+static int
+set_nonblock(socket_t fd)
+{
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
+static int
+epoll_add_all(socket_t *fds, int n, uint32_t events)
+{
+    struct epoll_event ev;
+    int epfd, i;
+
+    if ((epfd = epoll_create1(0)) < 0) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        ev.events   = events;
+        ev.data.u32 = (uint32_t)i;
+        if (set_nonblock(fds[i]) != 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) != 0) {
+            close(epfd);
+            return -1;
+        }
+    }
+    return epfd;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : write whole messages on every writable client connection
+// ---------------------------------------------------------------------------
+static void *
+sender_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    struct epoll_event ev[EPOLL_BATCH];
+    int epfd, n, i;
+
+    if ((epfd = epoll_add_all(rc->cli, rc->conns, EPOLLOUT)) < 0) {
+        rc->stop = 1;
+        return NULL;
+    }
+
+    while (!rc->stop) {
+        n = epoll_wait(epfd, ev, EPOLL_BATCH, 100);
+        for (i = 0; i < n; i++) {
+            int c = (int)ev[i].data.u32;
+            for (;;) {
+                int32_t off = rc->sent[c];
+                int32_t len = socket_send(rc->cli[c], rc->msg + off, rc->size - off);
+                if (len <= 0) {
+                    break;          // EAGAIN: wait for the next EPOLLOUT
+                }
+                rc->sent[c] = (off + len == rc->size) ? 0 : off + len;
+            }
+        }
+    }
+    close(epfd);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : drain every readable accepted connection
+// ---------------------------------------------------------------------------
+static void *
+receiver_thread(void *arg)
+{
+    run_ctx *rc = (run_ctx *)arg;
+    struct epoll_event ev[EPOLL_BATCH];
+    char *buf = (char *)malloc(RECV_BUF_SIZE);
+    uint64_t bytes = 0;
+    int epfd, n, i;
+
+    if (buf == NULL || (epfd = epoll_add_all(rc->srv, rc->conns, EPOLLIN)) < 0) {
+        free(buf);
+        rc->stop = 1;
+        return NULL;
+    }
+
+    while (!rc->stop) {
+        n = epoll_wait(epfd, ev, EPOLL_BATCH, 100);
+        for (i = 0; i < n; i++) {
+            socket_t fd = rc->srv[ev[i].data.u32];
+            int32_t  len;
+            while ((len = socket_recv(fd, buf, RECV_BUF_SIZE)) > 0) {
+                bytes += (uint64_t)len;
+            }
+        }
+        rc->rx_bytes = bytes;
+    }
+    close(epfd);
+    free(buf);
+    return NULL;
+}
+
+static void
+close_all(socket_t *fds, int n)
+{
+    int i;
+    for (i = 0; i < n; i++) {
+        if (fds[i] != INVALID_SOCKET) {
+            socket_close(fds[i]);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open conns connections, push data for the given duration and
+//              report the receive rate
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port,
+        int32_t size, int conns, double warmup_s, double seconds)
+{
+    run_ctx rc;
+    pthread_t tx, rx;
+    uint64_t t0, t1, b0, b1;
+    double v[7], dt;
+    int i, ret = -1;
+
+    memset(&rc, 0, sizeof(rc));
+    rc.conns = conns;
+    rc.size  = size;
+    rc.cli   = (socket_t *)malloc(sizeof(socket_t) * conns);
+    rc.srv   = (socket_t *)malloc(sizeof(socket_t) * conns);
+    rc.sent  = (int32_t *)calloc(conns, sizeof(int32_t));
+    rc.msg   = (char *)malloc(size);
+    if (rc.cli == NULL || rc.srv == NULL || rc.sent == NULL || rc.msg == NULL) {
+        goto out;
+    }
+    memset(rc.msg, 'x', size);
+    for (i = 0; i < conns; i++) {
+        rc.cli[i] = rc.srv[i] = INVALID_SOCKET;
+    }
+
+    // connect one by one and accept right away, the listen backlog is small
+    for (i = 0; i < conns; i++) {
+        rc.cli[i] = socket_create_tcp_client(addr, port);
+        if (rc.cli[i] == INVALID_SOCKET) {
+            fprintf(stderr, "[bench] connect %d/%d failed\n", i + 1, conns);
+            goto close;
+        }
+        rc.srv[i] = socket_create_tcp_server(listen_fd, 5000);
+        if (rc.srv[i] == INVALID_SOCKET) {
+            fprintf(stderr, "[bench] accept %d/%d failed\n", i + 1, conns);
+            goto close;
+        }
+    }
+
+    if (pthread_create(&rx, NULL, receiver_thread, &rc) != 0) {
+        goto close;
+    }
+    if (pthread_create(&tx, NULL, sender_thread, &rc) != 0) {
+        rc.stop = 1;
+        pthread_join(rx, NULL);
+        goto close;
+    }
+
+    usleep((useconds_t)(warmup_s * 1e6));
+    t0 = bench_now_ns();
+    b0 = rc.rx_bytes;
+    usleep((useconds_t)(seconds * 1e6));
+    t1 = bench_now_ns();
+    b1 = rc.rx_bytes;
+    rc.stop = 1;
+    pthread_join(tx, NULL);
+    pthread_join(rx, NULL);
+
+    dt   = (double)(t1 - t0) / 1e9;
+    v[0] = size;
+    v[1] = conns;
+    v[2] = dt;
+    v[3] = (double)(b1 - b0);
+    v[4] = (double)((b1 - b0) / (uint64_t)size);
+    v[5] = v[3] * 8 / dt / 1e9;
+    v[6] = v[4] / dt;
+    bench_report_row(rep, "tcp", v);
+    ret = 0;
+
+close:
+    close_all(rc.cli, conns);       // clients close first, the listen port stays free
+    close_all(rc.srv, conns);
+out:
+    free(rc.cli);
+    free(rc.srv);
+    free(rc.sent);
+    free(rc.msg);
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : raise the descriptor limit, each connection costs two fds
+// ---------------------------------------------------------------------------
+static void
+raise_nofile(int conns)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)(2 * conns + 64)) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    listen port             (default 12013)\n"
+            "  -s sizes   message sizes           (default 64,256,1K,4K,16K,64K,256K,1M)\n"
+            "  -c conns   connection counts       (default 1,4,16,64,256,1024)\n"
+            "  -t secs    measured time per point (default 1)\n"
+            "  -w secs    warm-up time per point  (default 0.2)\n"
+            "  -f format  text, csv or json       (default csv)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *addr = "127.0.0.1";
+    uint16_t port    = 12013;
+    int64_t sizes[BENCH_MAX_LIST] = { 64, 256, 1 << 10, 4 << 10, 16 << 10, 64 << 10, 256 << 10, 1 << 20 };
+    int64_t conns[BENCH_MAX_LIST] = { 1, 4, 16, 64, 256, 1024 };
+    int     n_sizes  = 8;
+    int     n_conns  = 6;
+    double  seconds  = 1.0;
+    double  warmup   = 0.2;
+    bench_fmt fmt    = BENCH_FMT_CSV;
+    bench_report rep;
+    socket_t listen_fd;
+    int opt, s, c, failed = 0;
+    int64_t max_conns = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:s:c:t:w:f:h")) != -1) {
+        switch (opt) {
+        case 'a': addr    = optarg; break;
+        case 'p': port    = (uint16_t)atoi(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'w': warmup  = atof(optarg); break;
+        case 's':
+            if ((n_sizes = bench_parse_list(optarg, sizes)) <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            if ((n_conns = bench_parse_list(optarg, conns)) <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'f':
+            if (bench_parse_fmt(optarg, &fmt) != 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (seconds <= 0 || warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (c = 0; c < n_conns; c++) {
+        max_conns = conns[c] > max_conns ? conns[c] : max_conns;
+    }
+    raise_nofile((int)max_conns);
+
+    socket_startup();
+    listen_fd = socket_create_tcp_listen(addr, port);
+    if (listen_fd == INVALID_SOCKET) {
+        fprintf(stderr, "[bench] cannot listen on %s:%d\n", addr, port);
+        return 1;
+    }
+
+    bench_report_begin(&rep, fmt, "proto", cols, sizeof(cols) / sizeof(cols[0]));
+    for (s = 0; s < n_sizes; s++) {
+        for (c = 0; c < n_conns; c++) {
+            if (sizes[s] <= 0 || sizes[s] > INT32_MAX || conns[c] <= 0 || conns[c] > 65536) {
+                continue;
+            }
+            failed |= run_one(&rep, listen_fd, addr, port, (int32_t)sizes[s],
+                              (int)conns[c], warmup, seconds);
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_close(listen_fd);
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     timer_wheel.c
+ *  @brief    Timer wheel benchmark for xsocket (Linux)
+ *
+ *  For each timer count, one timer per simulated connection:
+ *      start_ns  - xtimer_start of every timer, idle timeouts of 1 ms..60 s
+ *      rearm_ns  - moving every pending timer to a new due time, as on
+ *                  traffic that resets an idle timeout
+ *      stop_ns   - xtimer_stop of every pending timer
+ *      expire_ns - xtimer_advance cost per fired timer, due times spread
+ *                  over one second of simulated time
+ *  all per timer.  Then every timer is started on an xloop with a random
+ *  delay of 1..200 ms and late_* is how long after its due time each
+ *  callback ran.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/timer_wheel.c source/xsocket.c source/xloop.c \
+ *          source/xloop_uring.c source/xtimer.c source/xthread.c -lpthread -o timer_wheel
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include "xsocket.h"
+#include "xloop.h"
+#include "xtimer.h"
+#include "bench_common.h"
+
+static const char *cols[] = {
+    "timers", "start_ns", "rearm_ns", "stop_ns", "expire_ns",
+    "late_p50_us", "late_p99_us", "late_max_us"
+};
+
+/* a timer with its due time, for the lateness run */
+typedef struct bench_timer {
+    xtimer   t;
+    uint64_t due_ns;
+} bench_timer;
+
+static bench_samples late;
+static int64_t       fired;
+
+static void
+count_cb(xtimer *t)
+{
+    (void)t;
+    fired++;
+}
+
+static void
+late_cb(xtimer *t)
+{
+    bench_timer *bt = (bench_timer *)t->user;
+    uint64_t     now = bench_now_ns();
+
+    bench_samples_push(&late, now > bt->due_ns ? now - bt->due_ns : 0);
+    fired++;
+}
+
+static uint32_t
+rnd(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+    return *s;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : time the wheel operations on n timers
+// Parameters :
+//      [in ] : timers - n timers
+//            : n      - timer count
+//      [out] : v      - start_ns, rearm_ns, stop_ns, expire_ns
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_ops(bench_timer *timers, int32_t n, double *v)
+{
+    xtimer_wheel *w;
+    uint64_t t0;
+    uint32_t seed = 12345;
+    int64_t  ms;
+    int32_t  i;
+
+    if ((w = xtimer_wheel_create(1000, 0)) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        xtimer_init(&timers[i].t, count_cb, &timers[i]);
+    }
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++) {
+        xtimer_start(w, &timers[i].t, 1000 + (int64_t)(rnd(&seed) % 60000000));
+    }
+    v[0] = (double)(bench_now_ns() - t0) / n;
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++) {
+        xtimer_start(w, &timers[i].t, 1000 + (int64_t)(rnd(&seed) % 60000000));
+    }
+    v[1] = (double)(bench_now_ns() - t0) / n;
+
+    t0 = bench_now_ns();
+    for (i = 0; i < n; i++) {
+        xtimer_stop(w, &timers[i].t);
+    }
+    v[2] = (double)(bench_now_ns() - t0) / n;
+
+    // simulated time, one advance per millisecond
+    for (i = 0; i < n; i++) {
+        xtimer_start(w, &timers[i].t, 1000 + (int64_t)(rnd(&seed) % 1000000));
+    }
+    fired = 0;
+    t0 = bench_now_ns();
+    for (ms = 1; ms <= 1001; ms++) {
+        xtimer_advance(w, ms * 1000000);
+    }
+    v[3] = (double)(bench_now_ns() - t0) / n;
+
+    xtimer_wheel_destroy(w);
+    return fired == n ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run n timers on an event loop and record their lateness
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_loop(bench_timer *timers, int32_t n, double *v)
+{
+    xloop     *loop;
+    bench_dist d;
+    uint32_t   seed = 54321;
+    int32_t    i;
+
+    if ((loop = xloop_create()) == NULL) {
+        return -1;
+    }
+    late.n = 0;
+    fired  = 0;
+    xloop_run_once(loop, 0);        // start the round the delays count from
+    for (i = 0; i < n; i++) {
+        int64_t delay_us = 1000 + (int64_t)(rnd(&seed) % 199000);
+        xtimer_init(&timers[i].t, late_cb, &timers[i]);
+        timers[i].due_ns = bench_now_ns() + delay_us * 1000;
+        xloop_timer_start(loop, &timers[i].t, delay_us);
+    }
+    while (fired < n) {
+        if (xloop_run_once(loop, 1000) < 0) {
+            break;
+        }
+    }
+    xloop_destroy(loop);
+
+    bench_dist_compute(late.v, late.n, &d);
+    v[0] = d.p50 / 1e3;
+    v[1] = d.p99 / 1e3;
+    v[2] = d.max / 1e3;
+    return fired == n ? 0 : -1;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -n counts  timer counts            (default 1K,100K,1M)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t counts[BENCH_MAX_LIST] = { 1000, 100000, 1000000 };
+    int     n_counts = 3;
+    bench_fmt fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, c, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "n:f:h")) != -1) {
+        switch (opt) {
+        case 'n':
+            n_counts = bench_parse_list(optarg, counts);
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_counts <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    socket_set_verbose(0);
+
+    bench_report_begin(&rep, fmt, "test", cols, sizeof(cols) / sizeof(cols[0]));
+    for (c = 0; c < n_counts; c++) {
+        int32_t      n = (int32_t)counts[c];
+        bench_timer *timers;
+        double       v[8];
+
+        if (n <= 0 || (timers = (bench_timer *)calloc(n, sizeof(bench_timer))) == NULL) {
+            continue;
+        }
+        v[0] = n;
+        if (run_ops(timers, n, v + 1) != 0 || run_loop(timers, n, v + 5) != 0) {
+            fprintf(stderr, "[bench] %d timers failed\n", n);
+            failed = 1;
+        } else {
+            bench_report_row(&rep, "wheel", v);
+        }
+        free(timers);
+    }
+    bench_report_end(&rep);
+    bench_samples_free(&late);
+    return failed ? 1 : 0;
+}
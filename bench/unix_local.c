@@ -0,0 +1,281 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     unix_local.c
+ *  @brief    Same-host transports: loopback TCP against Unix domain sockets
+ *
+ *  The same code runs over each transport; only the address string given
+ *  to socket_create_tcp_listen/client changes:
+ *      tcp     - 127.0.0.1:port, SOCKET_PROFILE_LATENCY
+ *      unix    - "unix:<path>", stream
+ *      unixseq - "unixseq:<path>", seqpacket
+ *  For each message size a ping-pong gives the round-trip time, then a
+ *  one-way stream for a fixed time gives the throughput.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/unix_local.c source/xsocket.c -lpthread -o unix_local
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "bench_common.h"
+
+enum { MODE_TCP = 0, MODE_UNIX, MODE_UNIXSEQ, MODE_COUNT };
+
+static const char *mode_name[] = { "tcp", "unix", "unixseq" };
+
+static const char *cols[] = {
+    "size", "rtt_p50_us", "rtt_p99_us", "rtt_max_us", "msg_s", "mb_s"
+};
+
+/* the serving side of one run */
+typedef struct srv_ctx {
+    socket_t fd;
+    int32_t  size;
+    int64_t  iters;                 // ping-pong messages to echo, then sink the stream
+    int64_t  bytes;                 // received in the stream phase
+} srv_ctx;
+
+static int
+recv_full(socket_t fd, char *buf, int32_t len)
+{
+    int32_t got = 0, n;
+
+    while (got < len) {
+        if ((n = socket_recv(fd, buf + got, len - got)) <= 0) {
+            return -1;
+        }
+        got += n;
+    }
+    return 0;
+}
+
+static int
+send_full(socket_t fd, char *buf, int32_t len)
+{
+    int32_t done = 0, n;
+
+    while (done < len) {
+        if ((n = socket_send(fd, buf + done, len - done)) <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static void *
+srv_thread(void *arg)
+{
+    srv_ctx *s = (srv_ctx *)arg;
+    char    *buf = (char *)malloc(s->size);
+    int64_t  i;
+    int32_t  n;
+
+    for (i = 0; buf != NULL && i < s->iters; i++) {
+        if (recv_full(s->fd, buf, s->size) != 0 || send_full(s->fd, buf, s->size) != 0) {
+            break;
+        }
+    }
+    while (buf != NULL && (n = socket_recv(s->fd, buf, s->size)) > 0) {
+        s->bytes += n;
+    }
+    free(buf);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : ping-pong then stream over one transport at one size
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, socket_t listen_fd, const char *addr, uint16_t port, int mode,
+        int32_t size, int64_t iters, double seconds)
+{
+    socket_opts   opts;
+    srv_ctx       srv;
+    pthread_t     tid;
+    bench_samples rtt = { 0 };
+    bench_dist    d;
+    socket_t      cli;
+    char         *buf;
+    uint64_t      t0, end;
+    int64_t       i, msgs = 0;
+    double        v[6];
+    int           ret = -1;
+
+    socket_opts_init(&opts, mode == MODE_TCP ? SOCKET_PROFILE_LATENCY : SOCKET_PROFILE_DEFAULT);
+    memset(&srv, 0, sizeof(srv));
+    srv.size  = size;
+    srv.iters = iters;
+    if ((buf = (char *)calloc(1, size)) == NULL) {
+        return -1;
+    }
+    if ((cli = socket_create_tcp_client_ex(addr, port, &opts)) == INVALID_SOCKET) {
+        free(buf);
+        return -1;
+    }
+    if ((srv.fd = socket_create_tcp_server_ex(listen_fd, 1000, &opts)) == INVALID_SOCKET
+        || pthread_create(&tid, NULL, srv_thread, &srv) != 0) {
+        if (srv.fd != INVALID_SOCKET) {
+            socket_close(srv.fd);
+        }
+        socket_close(cli);
+        free(buf);
+        return -1;
+    }
+
+    for (i = 0; i < iters; i++) {
+        t0 = bench_now_ns();
+        if (send_full(cli, buf, size) != 0 || recv_full(cli, buf, size) != 0) {
+            goto out;
+        }
+        bench_samples_push(&rtt, bench_now_ns() - t0);
+    }
+
+    t0  = bench_now_ns();
+    end = t0 + (uint64_t)(seconds * 1e9);
+    while (bench_now_ns() < end) {
+        int k;
+        for (k = 0; k < 64; k++, msgs++) {
+            if (send_full(cli, buf, size) != 0) {
+                goto out;
+            }
+        }
+    }
+    shutdown(cli, SHUT_WR);
+    pthread_join(tid, NULL);
+    tid = 0;
+
+    bench_dist_compute(rtt.v, rtt.n, &d);
+    v[0] = size;
+    v[1] = d.p50 / 1e3;
+    v[2] = d.p99 / 1e3;
+    v[3] = d.max / 1e3;
+    v[4] = (double)msgs / seconds;
+    v[5] = (double)srv.bytes / seconds / 1e6;
+    bench_report_row(rep, mode_name[mode], v);
+    ret = 0;
+
+out:
+    if (tid != 0) {
+        shutdown(cli, SHUT_RDWR);
+        pthread_join(tid, NULL);
+    }
+    socket_close(cli);
+    socket_close(srv.fd);
+    bench_samples_free(&rtt);
+    free(buf);
+    return ret;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -a addr    loopback address        (default 127.0.0.1)\n"
+            "  -p port    TCP port                (default 12028)\n"
+            "  -u path    Unix socket path        (default /tmp/xsocket_bench.sock)\n"
+            "  -s sizes   message sizes           (default 64,1K,16K)\n"
+            "  -n iters   ping-pong messages      (default 20000)\n"
+            "  -t secs    stream time per run     (default 1)\n"
+            "  -m modes   tcp,unix,unixseq        (default all)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t     sizes[BENCH_MAX_LIST] = { 64, 1024, 16384 };
+    int         n_sizes = 3;
+    int         modes[MODE_COUNT] = { 1, 1, 1 };
+    const char *ip = "127.0.0.1", *path = "/tmp/xsocket_bench.sock";
+    char        addr[MODE_COUNT][256];
+    uint16_t    port = 12028;
+    int64_t     iters = 20000;
+    double      seconds = 1;
+    bench_fmt   fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    socket_t    listen_fd;
+    int opt, m, s, bad = 0, failed = 0;
+
+    while ((opt = getopt(argc, argv, "a:p:u:s:n:t:m:f:h")) != -1) {
+        switch (opt) {
+        case 'a': ip      = optarg; break;
+        case 'p': port    = (uint16_t)atoi(optarg); break;
+        case 'u': path    = optarg; break;
+        case 's': n_sizes = bench_parse_list(optarg, sizes); break;
+        case 'n': iters   = bench_parse_size(optarg); break;
+        case 't': seconds = atof(optarg); break;
+        case 'm':
+            for (m = 0; m < MODE_COUNT; m++) {
+                modes[m] = 0;
+            }
+            // "unix" is a prefix of "unixseq", match whole names
+            {
+                char list[256], *tok, *save;
+                snprintf(list, sizeof(list), "%s", optarg);
+                for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+                    for (m = 0; m < MODE_COUNT; m++) {
+                        modes[m] |= strcmp(tok, mode_name[m]) == 0;
+                    }
+                }
+            }
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || iters <= 0 || seconds <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    snprintf(addr[MODE_TCP], sizeof(addr[0]), "%s", ip);
+    snprintf(addr[MODE_UNIX], sizeof(addr[0]), "unix:%s", path);
+    snprintf(addr[MODE_UNIXSEQ], sizeof(addr[0]), "unixseq:%s", path);
+
+    socket_startup();
+    socket_set_verbose(0);
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (m = 0; m < MODE_COUNT; m++) {
+        if (!modes[m]) {
+            continue;
+        }
+        if ((listen_fd = socket_create_tcp_listen(addr[m], port)) == INVALID_SOCKET) {
+            fprintf(stderr, "[bench] cannot listen on %s\n", addr[m]);
+            failed = 1;
+            continue;
+        }
+        for (s = 0; s < n_sizes; s++) {
+            if (sizes[s] <= 0 || sizes[s] > (1 << 20)) {
+                continue;
+            }
+            if (run_one(&rep, listen_fd, addr[m], port, m, (int32_t)sizes[s], iters, seconds) != 0) {
+                fprintf(stderr, "[bench] %s %d bytes failed\n", mode_name[m], (int)sizes[s]);
+                failed = 1;
+            }
+        }
+        socket_close(listen_fd);
+        if (m != MODE_TCP) {
+            unlink(path);
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,315 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xdp_rx.c
+ *  @brief    Multicast receive: socket_add_mc against the xxdp AF_XDP engine
+ *
+ *  A sender thread paces count datagrams to one group from interface
+ *  ip_src; the receiver takes them on interface ip_if, either with a
+ *  socket_add_mc socket (socket, poll plus non-blocking recv until empty)
+ *  or with an xxdp engine that copies each payload out in xxdp_poll (xdp).
+ *  Both ends live in this process; a veth pair puts an interface between
+ *  them (-i 127.0.0.1 -S 127.0.0.1 runs over loopback instead):
+ *
+ *      ip link add xv0 type veth peer name xv1
+ *      ip addr add 10.77.0.1/24 dev xv0
+ *      ip addr add 10.77.0.2/24 dev xv1
+ *      ip link set xv0 up; ip link set xv1 up
+ *      sysctl -w net.ipv4.conf.xv1.accept_local=1 net.ipv4.conf.xv1.rp_filter=0 \
+ *                net.ipv4.conf.all.rp_filter=0
+ *
+ *  The sysctls let the stack accept datagrams from an address of its own
+ *  for the socket runs; xdp takes them before that check.  Needs root.
+ *
+ *  The cpu columns are milliseconds of user and system time: send_cpu_ms
+ *  of the sending thread, which also runs the veth receive softirq and,
+ *  in generic mode, the XDP program; rx_cpu_ms of the receiving thread.
+ *  ns_per_pkt is their sum over the datagrams received.
+ *
+ *  Build:
+ *      gcc -O2 -Isource bench/xdp_rx.c source/xsocket.c source/xxdp.c -lpthread -o xdp_rx
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xsocket.h"
+#include "xxdp.h"
+#include "bench_common.h"
+
+#define IDLE_MS         300         // the receiver stops after this long without data
+
+enum { MODE_SOCKET = 0, MODE_XDP, MODE_COUNT };
+
+static const char *mode_name[] = { "socket", "xdp" };
+
+static const char *cols[] = {
+    "size", "sent", "received", "loss_pct", "rx_pps", "send_cpu_ms", "rx_cpu_ms", "ns_per_pkt"
+};
+
+/* the settings of all runs */
+typedef struct bench_ctx {
+    const char *ip_if;
+    const char *ip_src;
+    const char *grp;
+    uint16_t    port;
+    int64_t     count;
+    int64_t     rate;
+} bench_ctx;
+
+/* the receiving thread */
+typedef struct rx_ctx {
+    int         mode;
+    socket_t    fd;
+    xxdp       *x;
+    char       *buf;
+    int64_t     received;
+    uint64_t    first_ns;
+    uint64_t    last_ns;
+    double      cpu_ms;
+} rx_ctx;
+
+static double
+thread_cpu_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void
+on_frame(void *user, const void *data, int32_t len, uint32_t grp, uint16_t port)
+{
+    rx_ctx *rc = (rx_ctx *)user;
+
+    (void)grp;
+    (void)port;
+    memcpy(rc->buf, data, (size_t)len);
+    rc->received++;
+}
+
+static void *
+rx_thread(void *arg)
+{
+    rx_ctx        *rc = (rx_ctx *)arg;
+    struct pollfd  p;
+    double         c0 = thread_cpu_ms();
+
+    p.fd     = rc->mode == MODE_XDP ? xxdp_fd(rc->x) : rc->fd;
+    p.events = POLLIN;
+    for (;;) {
+        int64_t before = rc->received;
+
+        if (rc->mode == MODE_XDP) {
+            xxdp_poll(rc->x, on_frame, rc, 0);
+        } else {
+            while (recv(rc->fd, rc->buf, 65536, MSG_DONTWAIT) > 0) {
+                rc->received++;
+            }
+        }
+        if (rc->received != before) {
+            if (before == 0) {
+                rc->first_ns = bench_now_ns();
+            }
+            rc->last_ns = bench_now_ns();
+            continue;
+        }
+        if (poll(&p, 1, rc->received > 0 ? IDLE_MS : 5000) <= 0) {
+            break;
+        }
+    }
+    rc->cpu_ms = thread_cpu_ms() - c0;
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : pace the datagrams to the group
+// Parameters :
+//      [out] : cpu_ms - the sending thread's CPU time
+// Return     : datagrams sent
+// ---------------------------------------------------------------------------
+static int64_t
+send_all(const bench_ctx *bc, int32_t size, double *cpu_ms)
+{
+    socket_t fd  = socket_create_mc_ex(bc->ip_src, bc->grp, bc->port, 1, 1);
+    char    *buf = (char *)calloc(1, size);
+    uint64_t t0, gap = bc->rate > 0 ? 1000000000ull / (uint64_t)bc->rate : 0;
+    int64_t  i, sent = 0;
+    double   c0;
+
+    c0 = thread_cpu_ms();
+    t0 = bench_now_ns();
+    for (i = 0; fd != INVALID_SOCKET && buf != NULL && i < bc->count; i++) {
+        // sleep, not spin, between bursts of 32, so the CPU time is the sending
+        if (gap > 0 && i % 32 == 0) {
+            uint64_t due = t0 + (uint64_t)i * gap, now = bench_now_ns();
+            if (due > now) {
+                struct timespec ts = { (time_t)((due - now) / 1000000000), (long)((due - now) % 1000000000) };
+                nanosleep(&ts, NULL);
+            }
+        }
+        if (socket_send(fd, buf, size) == size) {
+            sent++;
+        }
+    }
+    *cpu_ms = thread_cpu_ms() - c0;
+    if (fd != INVALID_SOCKET) {
+        socket_close(fd);
+    }
+    free(buf);
+    return sent;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one run with datagrams of size bytes
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int
+run_one(bench_report *rep, const bench_ctx *bc, int mode, int32_t size)
+{
+    rx_ctx    rc;
+    pthread_t tid;
+    int64_t   sent;
+    double    send_ms = 0, secs, v[8];
+
+    memset(&rc, 0, sizeof(rc));
+    rc.mode = mode;
+    rc.fd   = INVALID_SOCKET;
+    if ((rc.buf = (char *)malloc(65536)) == NULL) {
+        return -1;
+    }
+    if (mode == MODE_XDP) {
+        if ((rc.x = xxdp_open(bc->ip_if, NULL)) == NULL
+            || xxdp_add_mc(rc.x, bc->ip_if, bc->grp, bc->port) != 0) {
+            goto fail;
+        }
+    } else if ((rc.fd = socket_add_mc(bc->ip_if, bc->grp, bc->port)) == INVALID_SOCKET) {
+        goto fail;
+    }
+    if (pthread_create(&tid, NULL, rx_thread, &rc) != 0) {
+        goto fail;
+    }
+    sent = send_all(bc, size, &send_ms);
+    pthread_join(tid, NULL);
+
+    secs = rc.last_ns > rc.first_ns ? (double)(rc.last_ns - rc.first_ns) / 1e9 : 0;
+    v[0] = size;
+    v[1] = (double)sent;
+    v[2] = (double)rc.received;
+    v[3] = sent > 0 ? 100.0 * (double)(sent - rc.received) / (double)sent : 0;
+    v[4] = secs > 0 ? (double)rc.received / secs : 0;
+    v[5] = send_ms;
+    v[6] = rc.cpu_ms;
+    v[7] = rc.received > 0 ? (send_ms + rc.cpu_ms) * 1e6 / (double)rc.received : 0;
+    bench_report_row(rep, mode_name[mode], v);
+
+    if (rc.x != NULL) {
+        xxdp_close(rc.x);
+    }
+    if (rc.fd != INVALID_SOCKET) {
+        socket_close(rc.fd);
+    }
+    free(rc.buf);
+    return sent > 0 && rc.received > 0 ? 0 : -1;
+
+fail:
+    if (rc.x != NULL) {
+        xxdp_close(rc.x);
+    }
+    if (rc.fd != INVALID_SOCKET) {
+        socket_close(rc.fd);
+    }
+    free(rc.buf);
+    return -1;
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -i addr    receiving interface     (default 10.77.0.2)\n"
+            "  -S addr    sending interface       (default 10.77.0.1)\n"
+            "  -g group   multicast group         (default 239.1.1.105)\n"
+            "  -p port    multicast port          (default 12030)\n"
+            "  -s list    datagram sizes          (default 64,512,1400)\n"
+            "  -n count   datagrams per run       (default 200000)\n"
+            "  -R rate    datagrams per second, 0 = unpaced (default 100000)\n"
+            "  -m modes   socket,xdp              (default both)\n"
+            "  -f format  text, csv or json       (default text)\n",
+            prog);
+}
+
+int
+main(int argc, char **argv)
+{
+    int64_t      sizes[BENCH_MAX_LIST] = { 64, 512, 1400 };
+    int          n_sizes = 3;
+    int          modes[MODE_COUNT] = { 1, 1 };
+    bench_ctx    bc;
+    bench_fmt    fmt = BENCH_FMT_TEXT;
+    bench_report rep;
+    int opt, m, i, bad = 0, failed = 0;
+
+    memset(&bc, 0, sizeof(bc));
+    bc.ip_if  = "10.77.0.2";
+    bc.ip_src = "10.77.0.1";
+    bc.grp    = "239.1.1.105";
+    bc.port   = 12030;
+    bc.count  = 200000;
+    bc.rate   = 100000;
+
+    while ((opt = getopt(argc, argv, "i:S:g:p:s:n:R:m:f:h")) != -1) {
+        switch (opt) {
+        case 'i': bc.ip_if  = optarg; break;
+        case 'S': bc.ip_src = optarg; break;
+        case 'g': bc.grp    = optarg; break;
+        case 'p': bc.port   = (uint16_t)atoi(optarg); break;
+        case 's': n_sizes   = bench_parse_list(optarg, sizes); break;
+        case 'n': bc.count  = bench_parse_size(optarg); break;
+        case 'R': bc.rate   = bench_parse_size(optarg); break;
+        case 'm':
+            modes[MODE_SOCKET] = strstr(optarg, "socket") != NULL;
+            modes[MODE_XDP]    = strstr(optarg, "xdp") != NULL;
+            break;
+        case 'f':
+            bad |= bench_parse_fmt(optarg, &fmt) != 0;
+            break;
+        default:
+            bad = 1;
+            break;
+        }
+    }
+    if (bad || n_sizes <= 0 || bc.count <= 0 || bc.rate < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    socket_startup();
+    socket_set_verbose(0);
+
+    bench_report_begin(&rep, fmt, "mode", cols, sizeof(cols) / sizeof(cols[0]));
+    for (i = 0; i < n_sizes; i++) {
+        for (m = 0; m < MODE_COUNT; m++) {
+            if (!modes[m] || sizes[i] < 8 || sizes[i] > 1472) {
+                continue;
+            }
+            if (run_one(&rep, &bc, m, (int32_t)sizes[i]) != 0) {
+                fprintf(stderr, "[bench] %s with %d bytes failed\n", mode_name[m], (int)sizes[i]);
+                failed = 1;
+            }
+        }
+    }
+    bench_report_end(&rep);
+
+    socket_cleanup();
+    return failed ? 1 : 0;
+}
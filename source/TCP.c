@@ -6,6 +6,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include "xsocket.h"
+#include "xthread.h"
 
 #include <errno.h>
 #include <stdlib.h>
@@ -40,6 +41,9 @@ static const int   i_self_port = 1012;
 
 #define BUF_SIZE  4096
 
+/* СϢ/Ӧ𣬹رNagleӳACK */
+static socket_opts s_tcp_opts;
+
 // 鲥ͣ
 void* snd(void *arg)
 {
@@ -49,7 +53,7 @@ void* snd(void *arg)
 
 #if TEST_TCP
     socket_t client_sock = INVALID_SOCKET;
-    socket_t tcp_sock = socket_create_tcp_listen(s_server_addr, i_server_port);
+    socket_t tcp_sock = socket_create_tcp_listen_ex(s_server_addr, i_server_port, &s_tcp_opts);
 
     printf_s("[server] TCP listen socket: %d\n", tcp_sock);
     printf_s("[server] waiting for connect\n");
@@ -60,7 +64,7 @@ void* snd(void *arg)
 
     for (;;) {
         ms_sleep(100);
-        client_sock = socket_create_tcp_server(tcp_sock, 1000);
+        client_sock = socket_create_tcp_server_ex(tcp_sock, 1000, &s_tcp_opts);
 
         if (client_sock != INVALID_SOCKET) {
             printf_s("[server] TCP server: new link: %d\n", client_sock);
@@ -81,11 +85,11 @@ void* snd(void *arg)
 #endif
                 int send = 1;
                 sprintf_s(buf, "msg: $d\n", send);
-                len = socket_send(client_sock, buf, BUF_SIZE);
+                len = socket_send(client_sock, buf, (int32_t)strlen(buf));
                 if (len == -1)
                 {
                     printf_s("[server] waiting for connect\n");
-                    client_sock = socket_create_tcp_server(tcp_sock, 1000);
+                    client_sock = socket_create_tcp_server_ex(tcp_sock, 1000, &s_tcp_opts);
                 }
                 if (len > -1)
                 {
@@ -113,7 +117,7 @@ void* snd(void *arg)
 
         sprintf_s(buf, BUF_SIZE, "msg: %d, xxxxx", count++);
 
-        len = socket_send(mc_sock, buf, BUF_SIZE);
+        len = socket_send(mc_sock, buf, (int32_t)strlen(buf));
         printf("UDP sent    [%d]: \"%s\"\n", len, buf);
     }
 #endif
@@ -126,7 +130,7 @@ void* rcv(void*arg)
     char buf[BUF_SIZE + 1];
     int len;
 #if TEST_TCP
-    socket_t tcp_socket = socket_create_tcp_client(s_server_addr, i_server_port);
+    socket_t tcp_socket = socket_create_tcp_client_ex(s_server_addr, i_server_port, &s_tcp_opts);
 
     printf_s("[client] TCP socket: %d\n", tcp_socket);
 
@@ -140,35 +144,47 @@ void* rcv(void*arg)
         }
         else
         {
-            tcp_socket = socket_create_tcp_client(s_server_addr, i_server_port);
+            tcp_socket = socket_create_tcp_client_ex(s_server_addr, i_server_port, &s_tcp_opts);
         }
     }
     socket_close(tcp_socket);
 #else
     socket_t  udp_client_socket = socket_add_mc(s_self_addr, s_cast_addr, i_cast_port);
+    /* 50usȴתռCPU */
+    socket_spin *spin = socket_spin_create(udp_client_socket, 50);
 
     printf("[client] UDP socket: %d\n", udp_client_socket);
 
     for (;;) {
-        len = socket_udp_mc_recv(udp_client_socket, buf, BUF_SIZE);
+        len = socket_spin_recv(spin, buf, BUF_SIZE, -1);
         if (len >= 0) {
             buf[len] = '\0';
             printf("UDP received[%d]: \"%s\"\n", len, buf);
         }
     }
+    socket_spin_close(spin);
     socket_close(udp_client_socket);
 #endif
     pthread_exit((void *)0);
 }
 
 
-int main()
+/* ÷: TCP [շ̰߳󶨵CPUб "2-3"] */
+int main(int argc, char **argv)
 {
     pthread_t id[2];
+    xthread_affinity aff;
+
+    xthread_affinity_init(&aff);
+    if (argc > 1) {
+        aff.cpus = argv[1];
+    }
+
     socket_startup();
-   // pthread_create(&id[0], NULL, snd, NULL);
+    socket_opts_init(&s_tcp_opts, SOCKET_PROFILE_LATENCY);
+   // xthread_create(&id[0], &aff, "snd", snd, NULL);
     ms_sleep(20);
-    pthread_create(&id[1], NULL, rcv, NULL);
+    xthread_create(&id[1], &aff, "rcv", rcv, NULL);
     //pthread_join(id[0], NULL);
     pthread_join(id[1], NULL);
 
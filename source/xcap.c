@@ -0,0 +1,714 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xcap.c
+ *  @brief    Memory-mapped capture journal of received packets (Linux)
+ *
+ *  The writer owns the current file; the journal thread owns everything
+ *  else.  They meet at two points only:
+ *      ready   - prepared files, filled in by the journal thread and taken
+ *                by the writer at rollover (single producer/consumer ring)
+ *      retired - full files, pushed by the writer and popped, synced and
+ *                closed by the journal thread (lock-free stack)
+ *  Files are created under a mutex, so that a writer mapping one itself
+ *  (sync_rollover) takes the number after the ones in the ring.
+ *  The writer publishes its progress in jfile.used, which the journal
+ *  thread msyncs up to.  Only the journal thread unmaps, so a file it is
+ *  syncing cannot go away under it.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xcap.h"
+#include "xsocket_int.h"
+
+#define REC_ALIGN       8
+#define MIN_FILE_SIZE   (1 << 16)
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+/* one mapped journal file */
+typedef struct jfile {
+    struct jfile *link;             // retired stack
+    char         *base;
+    int64_t       size;
+    int64_t       used;             // bytes written, published by the writer
+    int64_t       synced;           // bytes msynced, journal thread only
+    uint32_t      seq;
+    int           fd;
+    char          path[1];
+} jfile;
+
+/* a journal being read */
+struct xcap_reader {
+    char            *prefix;
+    char            *base;          // mapping of the current file, NULL before the first
+    int64_t          size;
+    int64_t          off;           // next record
+    uint32_t         seq;           // number of the next file
+    int64_t          journal_id;    // of file 0, 0 for journals written before it was kept
+    xcap_stream_def *streams;
+    int32_t          nstreams;
+};
+
+struct xcap {
+    xcap_config      cfg;
+    char            *prefix;
+    jfile           *cur;           // writer
+    jfile          **ready;         // ring of cfg.prepared prepared files
+    uint32_t         rd_head;       // next to take, writer
+    uint32_t         rd_tail;       // next to fill, journal thread
+    jfile           *retired;
+    uint32_t         seq;           // number of the next file to prepare, under mk
+    int64_t          journal_id;
+    xcap_stream_def *streams;
+    int32_t          nstreams;
+    int32_t          page;
+    int32_t          stop;
+    pthread_t        tid;
+    pthread_mutex_t  lock;          // journal thread sleep only
+    pthread_cond_t   cond;
+    pthread_mutex_t  mk;            // file creation
+    xcap_stats       stats;
+};
+
+void
+xcap_config_init(xcap_config *cfg)
+{
+    cfg->file_size     = (int64_t)256 << 20;
+    cfg->sync_ms       = 100;
+    cfg->durable       = 0;
+    cfg->prepared      = 2;
+    cfg->sync_rollover = 0;
+    xthread_affinity_init(&cfg->affinity);
+}
+
+static int64_t
+realtime_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t
+rec_size(int32_t len)
+{
+    return ((int64_t)sizeof(xcap_rec) + len + REC_ALIGN - 1) & ~(int64_t)(REC_ALIGN - 1);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : fault the pages of a file in for writing
+// Marks      : MAP_POPULATE maps shared pages read-only, the first store to
+//              each would still fault in the writer; touch them here instead
+//              where MADV_POPULATE_WRITE (Linux 5.14) is missing
+// ---------------------------------------------------------------------------
+static void
+prefault(jfile *f, int32_t page)
+{
+    int64_t off;
+
+    if (madvise(f->base, (size_t)f->size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+    for (off = 0; off < f->size; off += page) {
+        ((volatile char *)f->base)[off] = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create, preallocate and map the next journal file
+// Return     : the file, NULL on error
+// Marks      : the pages are faulted in here, not by the writer's memcpy,
+//              unless the writer maps the file itself (populate = 0)
+// ---------------------------------------------------------------------------
+static jfile *
+file_create(xcap *c, int32_t populate)
+{
+    size_t         plen = strlen(c->prefix) + 16;
+    jfile         *f;
+    xcap_file_hdr *h;
+    int            err;
+
+    if ((f = (jfile *)calloc(1, sizeof(jfile) + plen)) == NULL) {
+        return NULL;
+    }
+    f->seq  = c->seq;
+    f->size = c->cfg.file_size;
+    snprintf(f->path, plen + 1, "%s.%06u.xcap", c->prefix, f->seq);
+
+    if ((f->fd = open(f->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        xs_printf("[xcap] cannot create %s: %s\n", f->path, strerror(errno));
+        free(f);
+        return NULL;
+    }
+    // real blocks, so a full disk fails here and not as SIGBUS in the writer
+    if ((err = posix_fallocate(f->fd, 0, f->size)) != 0
+        && (err != EOPNOTSUPP || ftruncate(f->fd, f->size) != 0)) {
+        xs_printf("[xcap] cannot allocate %s: %s\n", f->path, strerror(err));
+        goto fail;
+    }
+    f->base = (char *)mmap(NULL, (size_t)f->size, PROT_READ | PROT_WRITE, MAP_SHARED, f->fd, 0);
+    if (f->base == MAP_FAILED) {
+        xs_printf("[xcap] cannot map %s: %s\n", f->path, strerror(errno));
+        goto fail;
+    }
+    if (populate) {
+        prefault(f, c->page);
+    }
+
+    h = (xcap_file_hdr *)f->base;
+    memcpy(h->magic, XCAP_MAGIC, sizeof(h->magic));
+    h->hdr_size   = sizeof(xcap_file_hdr);
+    h->seq        = f->seq;
+    h->created_ns = realtime_ns();
+    h->file_size  = f->size;
+    if (c->journal_id == 0) {
+        c->journal_id = h->created_ns;  // file 0, made by xcap_open
+    }
+    h->journal_id = c->journal_id;
+    f->used       = sizeof(xcap_file_hdr);
+    c->seq++;
+    return f;
+
+fail:
+    close(f->fd);
+    unlink(f->path);
+    free(f);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : flush a retired file and give its resources back
+// Marks      : the file is cut to the bytes it holds
+// ---------------------------------------------------------------------------
+static void
+file_retire(xcap *c, jfile *f, int32_t keep)
+{
+    int64_t used = __atomic_load_n(&f->used, __ATOMIC_ACQUIRE);
+
+    msync(f->base, (size_t)used, c->cfg.durable ? MS_SYNC : MS_ASYNC);
+    munmap(f->base, (size_t)f->size);
+    if (keep) {
+        if (ftruncate(f->fd, used) != 0) {
+            xs_printf("[xcap] cannot truncate %s: %s\n", f->path, strerror(errno));
+        }
+    } else {
+        unlink(f->path);
+    }
+    close(f->fd);
+    free(f);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : take the oldest prepared file, writer only
+// Return     : the file, NULL when the ring is empty
+// ---------------------------------------------------------------------------
+static jfile *
+take_ready(xcap *c)
+{
+    uint32_t head = c->rd_head;
+    jfile   *f;
+
+    if (head == __atomic_load_n(&c->rd_tail, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    f = c->ready[head % c->cfg.prepared];
+    __atomic_store_n(&c->rd_head, head + 1, __ATOMIC_RELEASE);
+    return f;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : fill the ring of prepared files, journal thread only
+// Marks      : one file per hold of the mutex, a writer mapping its own
+//              waits for one file at most
+// ---------------------------------------------------------------------------
+static void
+prepare(xcap *c)
+{
+    uint32_t tail;
+    jfile   *f;
+
+    for (;;) {
+        pthread_mutex_lock(&c->mk);
+        tail = c->rd_tail;
+        if (tail - __atomic_load_n(&c->rd_head, __ATOMIC_ACQUIRE) >= (uint32_t)c->cfg.prepared
+            || (f = file_create(c, 1)) == NULL) {
+            pthread_mutex_unlock(&c->mk);
+            return;
+        }
+        c->ready[tail % c->cfg.prepared] = f;
+        __atomic_store_n(&c->rd_tail, tail + 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&c->mk);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : the journal thread
+// Marks      : prepares the next files, msyncs the current one and retires
+//              the full ones, every sync_ms or when the writer asks
+// ---------------------------------------------------------------------------
+static void *
+journal_thread(void *arg)
+{
+    xcap           *c = (xcap *)arg;
+    jfile          *f;
+    struct timespec ts;
+    int32_t         stop;
+
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        if (!c->stop) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += (long)(c->cfg.sync_ms % 1000) * 1000000;
+            ts.tv_sec  += c->cfg.sync_ms / 1000 + ts.tv_nsec / 1000000000;
+            ts.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&c->cond, &c->lock, &ts);
+        }
+        stop = c->stop;
+        pthread_mutex_unlock(&c->lock);
+
+        if (!stop) {
+            prepare(c);
+        }
+
+        // the current file: from the last synced page to what is written
+        f = __atomic_load_n(&c->cur, __ATOMIC_ACQUIRE);
+        if (f != NULL) {
+            int64_t used  = __atomic_load_n(&f->used, __ATOMIC_ACQUIRE);
+            int64_t start = f->synced & ~(int64_t)(c->page - 1);
+            if (used > f->synced) {
+                msync(f->base + start, (size_t)(used - start), MS_ASYNC);
+                f->synced = used;
+                __atomic_add_fetch(&c->stats.syncs, 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        f = __atomic_exchange_n(&c->retired, NULL, __ATOMIC_ACQUIRE);
+        while (f != NULL) {
+            jfile *link = f->link;
+            file_retire(c, f, 1);
+            f = link;
+        }
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : append one record to the current file
+// Return     : zero on success, SOCKET_ERROR when it does not fit
+// Marks      : the size goes in last (release), after the data and header
+// ---------------------------------------------------------------------------
+static int32_t
+append(jfile *f, int32_t type, int32_t stream, int64_t ts_ns, const void *data, int32_t len)
+{
+    int64_t   size = rec_size(len);
+    xcap_rec *r;
+
+    if (f->used + size > f->size) {
+        return SOCKET_ERROR;
+    }
+    r = (xcap_rec *)(f->base + f->used);
+    if (len > 0) {
+        memcpy(r + 1, data, len);
+    }
+    r->len    = (uint32_t)len;
+    r->type   = (uint16_t)type;
+    r->stream = (uint16_t)stream;
+    r->ts_ns  = ts_ns;
+    __atomic_store_n(&r->size, (uint32_t)size, __ATOMIC_RELEASE);
+    __atomic_store_n(&f->used, f->used + size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : move the writer to the next prepared file
+// Return     : zero on success, SOCKET_ERROR when none is ready
+// Marks      : the new file starts with all stream definitions; with
+//              sync_rollover a missing file is mapped here, after the one
+//              the journal thread may be creating
+// ---------------------------------------------------------------------------
+static int32_t
+rollover(xcap *c)
+{
+    jfile  *f = take_ready(c);
+    jfile  *old = c->cur;
+    int64_t now;
+    int32_t i;
+
+    if (f == NULL) {
+        pthread_cond_signal(&c->cond);  // the journal thread is behind
+        if (!c->cfg.sync_rollover) {
+            return SOCKET_ERROR;
+        }
+        pthread_mutex_lock(&c->mk);
+        if ((f = take_ready(c)) == NULL) {
+            f = file_create(c, 0);
+        }
+        pthread_mutex_unlock(&c->mk);
+        if (f == NULL) {
+            return SOCKET_ERROR;
+        }
+        __atomic_add_fetch(&c->stats.stalls, 1, __ATOMIC_RELAXED);
+    }
+    now = realtime_ns();
+    for (i = 0; i < c->nstreams; i++) {
+        append(f, XCAP_STREAM, i, now, &c->streams[i], sizeof(xcap_stream_def));
+    }
+    __atomic_store_n(&c->cur, f, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&c->stats.files, 1, __ATOMIC_RELAXED);
+
+    do {
+        old->link = __atomic_load_n(&c->retired, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(&c->retired, &old->link, old, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    pthread_cond_signal(&c->cond);      // prepare the one after
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : remove the files of an earlier journal with the same prefix
+// Marks      : from file 0 up to the first number missing; a reader would
+//              otherwise walk on from the new files into the old ones
+// ---------------------------------------------------------------------------
+static void
+remove_old(const char *prefix)
+{
+    char     path[4096];
+    uint32_t seq;
+
+    for (seq = 0;; seq++) {
+        snprintf(path, sizeof(path), "%s.%06u.xcap", prefix, seq);
+        if (unlink(path) != 0) {
+            break;
+        }
+    }
+    if (seq > 0) {
+        xs_printf("[xcap] removed %u files of an earlier journal %s\n", seq, prefix);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open a capture journal
+// Parameters :
+//      [in ] : prefix - path of the files without the .000000.xcap suffix
+//            : cfg    - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the journal, NULL on error
+// ---------------------------------------------------------------------------
+xcap *
+xcap_open(const char *prefix, const xcap_config *cfg)
+{
+    xcap *c;
+
+    if ((c = (xcap *)calloc(1, sizeof(xcap))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        c->cfg = *cfg;
+    } else {
+        xcap_config_init(&c->cfg);
+    }
+    if (c->cfg.file_size < MIN_FILE_SIZE) {
+        c->cfg.file_size = MIN_FILE_SIZE;
+    }
+    if (c->cfg.sync_ms <= 0) {
+        c->cfg.sync_ms = 1;
+    }
+    if (c->cfg.prepared < 1 || c->cfg.prepared > XCAP_MAX_PREPARED) {
+        c->cfg.prepared = c->cfg.prepared < 1 ? 1 : XCAP_MAX_PREPARED;
+    }
+    c->page = (int32_t)sysconf(_SC_PAGESIZE);
+    remove_old(prefix);
+    if ((c->prefix = strdup(prefix)) == NULL
+        || (c->ready = (jfile **)calloc(c->cfg.prepared, sizeof(jfile *))) == NULL
+        || (c->cur = file_create(c, 1)) == NULL) {
+        free(c->ready);
+        free(c->prefix);
+        free(c);
+        return NULL;
+    }
+    c->stats.files = 1;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    pthread_mutex_init(&c->mk, NULL);
+    if (xthread_create(&c->tid, &c->cfg.affinity, "xcap", journal_thread, c) != 0) {
+        file_retire(c, c->cur, 0);
+        pthread_mutex_destroy(&c->mk);
+        pthread_cond_destroy(&c->cond);
+        pthread_mutex_destroy(&c->lock);
+        free(c->ready);
+        free(c->prefix);
+        free(c);
+        return NULL;
+    }
+    xs_printf("[xcap] journal %s, files of %lld bytes\n", prefix, (long long)c->cfg.file_size);
+    return c;
+}
+
+int32_t
+xcap_add_stream(xcap *c, xcap_type type, const char *addr, uint16_t port)
+{
+    xcap_stream_def *streams, *d;
+
+    if ((type != XCAP_MC && type != XCAP_TCP) || c->nstreams == XCAP_MAX_STREAMS) {
+        return SOCKET_ERROR;
+    }
+    streams = (xcap_stream_def *)realloc(c->streams, (c->nstreams + 1) * sizeof(xcap_stream_def));
+    if (streams == NULL) {
+        return SOCKET_ERROR;
+    }
+    c->streams = streams;
+    d = &streams[c->nstreams];
+    memset(d, 0, sizeof(*d));
+    d->type = (uint16_t)type;
+    d->port = port;
+    snprintf(d->addr, sizeof(d->addr), "%s", addr != NULL ? addr : "");
+
+    if (append(c->cur, XCAP_STREAM, c->nstreams, realtime_ns(), d, sizeof(*d)) != 0
+        && (rollover(c) != 0
+            || append(c->cur, XCAP_STREAM, c->nstreams, realtime_ns(), d, sizeof(*d)) != 0)) {
+        return SOCKET_ERROR;
+    }
+    return c->nstreams++;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : append received data to the journal
+// Parameters :
+//      [in ] : c      - the journal
+//            : stream - number from xcap_add_stream
+//            : ts_ns  - receive time in CLOCK_REALTIME nanoseconds, 0 for now
+//            : data   - the datagram or frame
+//            : len    - its length
+//      [out] : none
+// Return     : zero on success, SOCKET_ERROR when the record was dropped
+// Marks      : without a prepared file at rollover the record is dropped
+//              and counted, or with sync_rollover the file is mapped here
+// ---------------------------------------------------------------------------
+int32_t
+xcap_write(xcap *c, int32_t stream, int64_t ts_ns, const void *data, int32_t len)
+{
+    int32_t type;
+
+    if (stream < 0 || stream >= c->nstreams || len < 0) {
+        return SOCKET_ERROR;
+    }
+    type = c->streams[stream].type;
+    if (ts_ns == 0) {
+        ts_ns = realtime_ns();
+    }
+    if (append(c->cur, type, stream, ts_ns, data, len) != 0
+        && (rollover(c) != 0 || append(c->cur, type, stream, ts_ns, data, len) != 0)) {
+        __atomic_add_fetch(&c->stats.dropped, 1, __ATOMIC_RELAXED);
+        return SOCKET_ERROR;
+    }
+    __atomic_store_n(&c->stats.records, c->stats.records + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&c->stats.bytes, c->stats.bytes + len, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int32_t
+xcap_recv(xcap *c, int32_t stream, socket_t fd, void *data, int32_t len)
+{
+    int64_t ts_ns;
+    int32_t n = socket_recv_ts(fd, data, len, &ts_ns);
+
+    if (n > 0) {
+        xcap_write(c, stream, ts_ns, data, n);
+    }
+    return n;
+}
+
+void
+xcap_get_stats(xcap *c, xcap_stats *stats)
+{
+    stats->records = __atomic_load_n(&c->stats.records, __ATOMIC_RELAXED);
+    stats->bytes   = __atomic_load_n(&c->stats.bytes, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&c->stats.dropped, __ATOMIC_RELAXED);
+    stats->files   = __atomic_load_n(&c->stats.files, __ATOMIC_RELAXED);
+    stats->stalls  = __atomic_load_n(&c->stats.stalls, __ATOMIC_RELAXED);
+    stats->syncs   = __atomic_load_n(&c->stats.syncs, __ATOMIC_RELAXED);
+}
+
+void
+xcap_close(xcap *c)
+{
+    jfile *f;
+
+    if (c == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    c->stop = 1;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    pthread_join(c->tid, NULL);
+
+    // the journal thread has retired the full files, the rest is ours
+    file_retire(c, c->cur, 1);
+    while ((f = take_ready(c)) != NULL) {
+        file_retire(c, f, 0);       // prepared, never written
+    }
+    pthread_mutex_destroy(&c->mk);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->lock);
+    free(c->streams);
+    free(c->ready);
+    free(c->prefix);
+    free(c);
+}
+
+// ---------------------------------------------------------------------------
+// reading
+
+// ---------------------------------------------------------------------------
+// Function   : map the next file of a journal being read
+// Return     : zero on success, SOCKET_ERROR when there is no such file
+// ---------------------------------------------------------------------------
+static int32_t
+reader_next_file(xcap_reader *rd)
+{
+    char           path[4096];
+    struct stat    st;
+    xcap_file_hdr *h;
+    char          *base;
+    int            fd;
+
+    if (rd->base != NULL) {
+        munmap(rd->base, (size_t)rd->size);
+        rd->base = NULL;
+    }
+    snprintf(path, sizeof(path), "%s.%06u.xcap", rd->prefix, rd->seq);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return SOCKET_ERROR;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(xcap_file_hdr)) {
+        close(fd);
+        return SOCKET_ERROR;
+    }
+    base = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return SOCKET_ERROR;
+    }
+    h = (xcap_file_hdr *)base;
+    if (memcmp(h->magic, XCAP_MAGIC, sizeof(h->magic)) != 0 || h->hdr_size < sizeof(xcap_file_hdr)
+        || h->hdr_size > (uint64_t)st.st_size) {
+        xs_printf("[xcap] %s is not a journal file\n", path);
+        munmap(base, (size_t)st.st_size);
+        return SOCKET_ERROR;
+    }
+    if (rd->seq == 0) {
+        rd->journal_id = h->journal_id;
+    } else if (h->journal_id != rd->journal_id) {
+        xs_printf("[xcap] %s belongs to another journal\n", path);
+        munmap(base, (size_t)st.st_size);
+        return SOCKET_ERROR;
+    }
+    madvise(base, (size_t)st.st_size, MADV_SEQUENTIAL);
+    rd->base = base;
+    rd->size = st.st_size;
+    rd->off  = h->hdr_size;
+    rd->seq++;
+    return 0;
+}
+
+xcap_reader *
+xcap_reader_open(const char *prefix)
+{
+    xcap_reader *rd;
+
+    if ((rd = (xcap_reader *)calloc(1, sizeof(xcap_reader))) == NULL) {
+        return NULL;
+    }
+    if ((rd->prefix = strdup(prefix)) == NULL || reader_next_file(rd) != 0) {
+        xcap_reader_close(rd);
+        return NULL;
+    }
+    return rd;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : the next record of the journal
+// Parameters :
+//      [in ] : rd - the reader
+//      [out] : none
+// Return     : the record, its data follows it; NULL at the end
+// Marks      : a record that does not fit its file ends the file, as a
+//              zero size does; the stream definitions are kept on the way
+// ---------------------------------------------------------------------------
+const xcap_rec *
+xcap_reader_next(xcap_reader *rd)
+{
+    const xcap_rec *r;
+
+    while (rd->base != NULL) {
+        r = (const xcap_rec *)(rd->base + rd->off);
+        if (rd->off + (int64_t)sizeof(xcap_rec) > rd->size || r->size < sizeof(xcap_rec)
+            || rd->off + r->size > rd->size || r->len > r->size - sizeof(xcap_rec)) {
+            if (reader_next_file(rd) != 0) {
+                break;
+            }
+            continue;
+        }
+        rd->off += r->size;
+        if (r->type == XCAP_STREAM && r->len >= sizeof(xcap_stream_def)) {
+            if (r->stream >= rd->nstreams) {
+                int32_t          n = r->stream + 1;
+                xcap_stream_def *streams = (xcap_stream_def *)realloc(rd->streams,
+                                                                      n * sizeof(xcap_stream_def));
+                if (streams == NULL) {
+                    return NULL;
+                }
+                memset(streams + rd->nstreams, 0, (n - rd->nstreams) * sizeof(xcap_stream_def));
+                rd->streams  = streams;
+                rd->nstreams = n;
+            }
+            memcpy(&rd->streams[r->stream], r + 1, sizeof(xcap_stream_def));
+            rd->streams[r->stream].addr[sizeof(rd->streams[0].addr) - 1] = '\0';
+        }
+        return r;
+    }
+    return NULL;
+}
+
+const xcap_stream_def *
+xcap_reader_stream(xcap_reader *rd, int32_t stream)
+{
+    if (stream < 0 || stream >= rd->nstreams || rd->streams[stream].type == XCAP_STREAM) {
+        return NULL;
+    }
+    return &rd->streams[stream];
+}
+
+void
+xcap_reader_close(xcap_reader *rd)
+{
+    if (rd == NULL) {
+        return;
+    }
+    if (rd->base != NULL) {
+        munmap(rd->base, (size_t)rd->size);
+    }
+    free(rd->streams);
+    free(rd->prefix);
+    free(rd);
+}
@@ -0,0 +1,163 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xcap.h
+ *  @brief    Memory-mapped capture journal of received packets (Linux)
+ *
+ *  Every multicast datagram or TCP frame given to the journal is appended,
+ *  with its kernel receive time, to a preallocated file that is mapped
+ *  into memory: recording costs the receive thread one memcpy and no
+ *  system call.  A journal thread of its own keeps the next files prepared
+ *  ahead of time, msyncs what was written and retires full files, so
+ *  neither disk writes nor rollover show up as receive jitter.
+ *
+ *  When the writer fills files faster than the journal thread can prepare
+ *  them, a rollover finds none ready: the record is dropped and counted,
+ *  or with sync_rollover the writer maps the file itself and waits for it
+ *  (counted as a stall).  A longer burst is absorbed by more prepared
+ *  files, a sustained rate above the disk's by neither.
+ *
+ *  The files are <prefix>.000000.xcap, <prefix>.000001.xcap, ...  Each
+ *  starts with an xcap_file_hdr and the definitions of all streams, then
+ *  holds records aligned to 8 bytes.  The size of a record is written
+ *  last, so a reader mapping a live file stops at the first zero size.
+ *  A retired file is truncated to the bytes it holds.  xcap_open removes
+ *  the files an earlier run left with the same prefix, and a reader stops
+ *  at a file of another run (journal_id) all the same.
+ *
+ *  The calls other than xcap_get_stats are made by one writer thread;
+ *  threads receiving on their own record into journals of their own.
+ *
+ *  xcap_reader walks a finished journal through read-only mappings, file
+ *  after file, for replay and audit tools.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XCAP_H__
+#define __XCAP_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+#include "xthread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XCAP_MAGIC          "XCAP0001"
+#define XCAP_MAX_STREAMS    65535
+#define XCAP_MAX_PREPARED   16
+
+typedef struct xcap xcap;
+typedef struct xcap_reader xcap_reader;
+
+/* what a record holds */
+typedef enum xcap_type {
+    XCAP_STREAM = 0,                // a stream definition, data is an xcap_stream_def
+    XCAP_MC,                        // a multicast datagram
+    XCAP_TCP                        // a TCP frame (or a chunk of a raw TCP stream)
+} xcap_type;
+
+/* start of every journal file */
+typedef struct xcap_file_hdr {
+    char     magic[8];              // XCAP_MAGIC
+    uint32_t hdr_size;              // offset of the first record
+    uint32_t seq;                   // number of the file in the journal
+    int64_t  created_ns;            // CLOCK_REALTIME
+    int64_t  file_size;             // preallocated size
+    int64_t  journal_id;            // created_ns of file 0, the same in all files of a run
+    int64_t  reserved[3];
+} xcap_file_hdr;
+
+/* one record, followed by len bytes of data and the padding to 8 bytes */
+typedef struct xcap_rec {
+    uint32_t size;                  // whole record with padding, written last; 0 ends the file
+    uint32_t len;                   // data bytes
+    uint16_t type;                  // xcap_type
+    uint16_t stream;                // stream the data arrived on
+    uint32_t reserved;
+    int64_t  ts_ns;                 // receive time, CLOCK_REALTIME nanoseconds
+} xcap_rec;
+
+/* data of an XCAP_STREAM record: where a stream was received from */
+typedef struct xcap_stream_def {
+    uint16_t type;                  // XCAP_MC or XCAP_TCP
+    uint16_t port;                  // multicast port, or TCP port of the peer
+    char     addr[60];              // multicast group, or TCP address of the peer
+} xcap_stream_def;
+
+/* journal settings, see xcap_config_init for the defaults */
+typedef struct xcap_config {
+    int64_t file_size;              // bytes per file
+    int32_t sync_ms;                // period of the journal thread's msync
+    int32_t durable;                // wait for the disk (MS_SYNC) when a file is retired
+    int32_t prepared;               // files kept ready ahead of the writer, 1 to XCAP_MAX_PREPARED
+    int32_t sync_rollover;          // with none ready, map the next file in the writer, not drop
+    xthread_affinity affinity;      // placement of the journal thread
+} xcap_config;
+
+/* counters of a journal */
+typedef struct xcap_stats {
+    int64_t records;                // records written
+    int64_t bytes;                  // data bytes written
+    int64_t dropped;                // records lost: no file ready, or larger than a file
+    int64_t files;                  // files started
+    int64_t stalls;                 // rollovers that mapped the file in the writer
+    int64_t syncs;                  // msync calls of the journal thread
+} xcap_stats;
+
+/* defaults: files of 256 MB, 2 prepared ahead, drop when none is ready,
+ * msync every 100 ms, no MS_SYNC, journal thread anywhere
+ */
+void xcap_config_init(xcap_config *cfg);
+
+/* create the first file and start the journal thread; cfg NULL for the
+ * defaults; NULL on error
+ */
+xcap *xcap_open(const char *prefix, const xcap_config *cfg);
+
+/* define a stream, type XCAP_MC or XCAP_TCP; returns its number for
+ * xcap_write, SOCKET_ERROR on error
+ */
+int32_t xcap_add_stream(xcap *c, xcap_type type, const char *addr, uint16_t port);
+
+/* append data received on a stream; ts_ns is the receive time in
+ * CLOCK_REALTIME nanoseconds, 0 for now.  Zero on success, SOCKET_ERROR
+ * when the record was dropped.  Blocks only with sync_rollover, at a
+ * rollover that finds no file prepared
+ */
+int32_t xcap_write(xcap *c, int32_t stream, int64_t ts_ns, const void *data, int32_t len);
+
+/* socket_recv_ts on fd and record what arrived; the socket should have
+ * socket_set_rx_timestamp.  Returns like socket_recv
+ */
+int32_t xcap_recv(xcap *c, int32_t stream, socket_t fd, void *data, int32_t len);
+
+/* a copy of the counters, from any thread
+ */
+void xcap_get_stats(xcap *c, xcap_stats *stats);
+
+/* stop the journal thread, sync and truncate the files
+ */
+void xcap_close(xcap *c);
+
+/* read the journal written with prefix, from its first file on; NULL when
+ * there is none
+ */
+xcap_reader *xcap_reader_open(const char *prefix);
+
+/* the next record, stream definitions included, with its data right after
+ * it; valid until the next call.  NULL at the end of the journal
+ */
+const xcap_rec *xcap_reader_next(xcap_reader *rd);
+
+/* the definition of a stream read so far, NULL when unknown
+ */
+const xcap_stream_def *xcap_reader_stream(xcap_reader *rd, int32_t stream);
+
+void xcap_reader_close(xcap_reader *rd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XCAP_H__
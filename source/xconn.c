@@ -0,0 +1,916 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xconn.c
+ *  @brief    Framed TCP connection on the xsocket event loop (Linux)
+ *
+ *  One receive is always posted into the receive buffer; the frames it
+ *  completes are dispatched and a partial frame is moved to the front.
+ *  Outgoing frames are queued while the previous batch is being sent and
+ *  the two swap when the send completes.  The queue is a list of segments:
+ *  copied frames are appended to a byte buffer and neighbours share one
+ *  segment, a shared frame (xmsg) is a segment of its own that holds a
+ *  reference.  Shared frames up to COPY_SIZE are copied all the same, an
+ *  iovec entry costs the kernel more than copying them.  A batch goes out
+ *  as one gathered send, one iovec per segment.  Both batches count as
+ *  queued for the watermarks; the global count is shared by all loops and
+ *  kept with atomic operations.
+ *
+ *  The loop holds on to the operations embedded in the connection until
+ *  their callbacks run, so xconn_close only marks the connection and the
+ *  last callback frees it.
+ *
+ *  xconn_detach lets the batch in flight finish, then cancels the receive
+ *  and waits for it like xconn_close; the state it hands over is a small
+ *  header, the received bytes not yet parsed and the queued frames as
+ *  one byte string.  xconn_resume puts them back into the buffers.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "xconn.h"
+#include "xsocket_int.h"
+
+struct xmsg {
+    int32_t refs;
+    int32_t len;                    // payload length
+    char    frame[];                // header and payload
+};
+
+/* a piece of the send queue */
+typedef struct seg {
+    xmsg   *m;                      // shared frame, NULL for copied bytes
+    int32_t off;                    // copied bytes: offset in the byte buffer
+    int32_t len;
+} seg;
+
+/* one batch of the send queue */
+typedef struct sendq {
+    char   *buf;                    // copied frames
+    int32_t buf_len;
+    int32_t buf_cap;
+    seg    *segs;
+    int32_t nseg;
+    int32_t seg_cap;
+    int32_t bytes;                  // all segments
+} sendq;
+
+struct xconn {
+    xloop          *loop;
+    socket_t        fd;
+    xconn_config    cfg;
+    xconn_frame_cb  on_frame;
+    xconn_event_cb  on_event;
+    void           *user;
+    xconn_detach_cb on_detach;
+    void           *detach_arg;
+
+    xloop_op        rop;
+    char           *rbuf;
+    int32_t         rcap;
+    int32_t         rlen;
+
+    xloop_op        wop;
+    sendq           out;            // frames queued meanwhile
+    sendq           snd;            // frames being sent
+    struct iovec   *iov;            // of snd
+    int32_t         iov_cap;
+    int32_t         sending;
+    int32_t         queued;         // out.bytes + snd.bytes
+    int32_t         blocked;
+
+    xtimer          hb;
+    int32_t         rx_seen;        // bytes received this interval
+    int32_t         tx_seen;        // data frames sent this interval
+    int32_t         missed;         // silent intervals in a row
+
+    int32_t         ops;            // operations held by the loop
+    int32_t         busy;           // callbacks of this connection running
+    int32_t         failed;
+    int32_t         closing;
+    int32_t         detaching;
+    int32_t         rx_stopped;     // the receive is canceled
+    xconn_stats     stats;
+};
+
+/* head of the state from xconn_detach, followed by the bytes */
+typedef struct conn_state {
+    uint32_t magic;
+    uint32_t rx_len;                // received, not parsed
+    uint32_t tx_len;                // queued frames
+    uint32_t reserved;
+} conn_state;
+
+#define SHRINK_SIZE     (64 << 10)  // send buffers larger than this are freed once drained
+#define SHRINK_SEGS     1024        // segment lists longer than this likewise
+#define COPY_SIZE       512         // shared frames up to this size are copied
+#define STATE_MAGIC     0x58435331u // "XCS1"
+
+static int64_t g_queued;            // bytes queued by all connections
+static int64_t g_limit;             // 0 for no limit
+
+void
+xconn_config_init(xconn_config *cfg)
+{
+    cfg->max_frame       = 1 << 20;
+    cfg->rbuf_size       = 64 << 10;
+    cfg->hb_interval_ms  = 0;
+    cfg->hb_misses       = 3;
+    cfg->user_timeout_ms = 0;
+    cfg->sndq_high       = 1 << 20;
+    cfg->sndq_low        = 256 << 10;
+    cfg->sndq_max        = 8 << 20;
+}
+
+void
+xconn_set_global_limit(int64_t bytes)
+{
+    __atomic_store_n(&g_limit, bytes > 0 ? bytes : 0, __ATOMIC_RELAXED);
+}
+
+int64_t
+xconn_global_queued(void)
+{
+    return __atomic_load_n(&g_queued, __ATOMIC_RELAXED);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : account queued bytes, n negative when they leave the queue
+// ---------------------------------------------------------------------------
+static void
+account(xconn *c, int32_t n)
+{
+    c->queued += n;
+    __atomic_add_fetch(&g_queued, n, __ATOMIC_RELAXED);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : empty a batch, dropping its frame references
+// Marks      : large buffers are freed, so an idle connection stays small
+// ---------------------------------------------------------------------------
+static void
+sendq_reset(sendq *q)
+{
+    int32_t i;
+
+    for (i = 0; i < q->nseg; i++) {
+        xmsg_unref(q->segs[i].m);
+    }
+    q->nseg    = 0;
+    q->buf_len = 0;
+    q->bytes   = 0;
+    if (q->buf_cap > SHRINK_SIZE) {
+        free(q->buf);
+        q->buf     = NULL;
+        q->buf_cap = 0;
+    }
+    if (q->seg_cap > SHRINK_SEGS) {
+        free(q->segs);
+        q->segs    = NULL;
+        q->seg_cap = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : get a new segment at the end of a batch
+// Return     : the segment, NULL when out of memory
+// ---------------------------------------------------------------------------
+static seg *
+sendq_add(sendq *q)
+{
+    if (q->nseg == q->seg_cap) {
+        int32_t cap = q->seg_cap ? q->seg_cap * 2 : 16;
+        seg    *p   = (seg *)realloc(q->segs, cap * sizeof(seg));
+        if (p == NULL) {
+            return NULL;
+        }
+        q->segs    = p;
+        q->seg_cap = cap;
+    }
+    return &q->segs[q->nseg++];
+}
+
+static void hand_over(xconn *c);
+
+static void
+maybe_free(xconn *c)
+{
+    if (c->ops > 0 || c->busy > 0) {
+        return;
+    }
+    if (c->detaching && !c->closing) {
+        hand_over(c);
+        return;
+    }
+    if (!c->closing) {
+        return;
+    }
+    account(c, -c->queued);
+    sendq_reset(&c->out);
+    sendq_reset(&c->snd);
+    free(c->out.buf);
+    free(c->out.segs);
+    free(c->snd.buf);
+    free(c->snd.segs);
+    free(c->iov);
+    free(c->rbuf);
+    free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : close the socket after an error and tell the user
+// Marks      : the pending operations come back with ECANCELED
+// ---------------------------------------------------------------------------
+static void
+fail(xconn *c, xconn_event ev, int32_t err)
+{
+    if (c->failed || c->closing) {
+        return;
+    }
+    xs_printf("[xconn] connection %d %s, error %d\n", c->fd,
+              ev == XCONN_EV_DEAD ? "dead" : "closed", err);
+    c->failed = 1;
+    account(c, -c->queued);         // never sent now
+    xloop_timer_stop(c->loop, &c->hb);
+    xloop_close(c->loop, c->fd);
+    c->fd = INVALID_SOCKET;
+    if (!c->detaching) {
+        c->on_event(c, ev, err);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : cancel the receive of a detaching connection once no batch
+//              is in flight any more
+// Marks      : the socket is forgotten by the loop, not closed
+// ---------------------------------------------------------------------------
+static void
+stop_rx(xconn *c)
+{
+    if (c->sending || c->failed || c->rx_stopped) {
+        return;
+    }
+    c->rx_stopped = 1;
+    xloop_detach(c->loop, c->fd);
+}
+
+static void send_cb(xloop_op *op, int32_t result);
+
+// ---------------------------------------------------------------------------
+// Function   : send the queued frames, unless a send is in flight
+// Marks      : the queued batch becomes the one being sent, the emptied
+//              batch takes new frames
+// ---------------------------------------------------------------------------
+static void
+flush(xconn *c)
+{
+    sendq   t = c->snd;
+    int32_t i;
+
+    if (c->sending || c->out.nseg == 0 || c->failed || c->closing || c->detaching) {
+        return;
+    }
+    if (c->out.nseg > c->iov_cap) {
+        struct iovec *iov = (struct iovec *)realloc(c->iov, c->out.nseg * sizeof(struct iovec));
+        if (iov == NULL) {
+            fail(c, XCONN_EV_CLOSED, ENOMEM);
+            return;
+        }
+        c->iov     = iov;
+        c->iov_cap = c->out.nseg;
+    }
+    c->snd = c->out;
+    c->out = t;
+    for (i = 0; i < c->snd.nseg; i++) {
+        seg *s = &c->snd.segs[i];
+        c->iov[i].iov_base = s->m != NULL ? s->m->frame : c->snd.buf + s->off;
+        c->iov[i].iov_len  = (size_t)s->len;
+    }
+
+    if (xloop_sendv(c->loop, &c->wop, c->fd, c->iov, c->snd.nseg, send_cb, c) != 0) {
+        fail(c, XCONN_EV_CLOSED, errno);
+        return;
+    }
+    c->sending = 1;
+    c->ops++;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : check a data frame against the send queue limits
+// Return     : zero when it fits, SOCKET_ERROR with errno ENOBUFS otherwise
+// ---------------------------------------------------------------------------
+static int32_t
+admit(xconn *c, int32_t size)
+{
+    int64_t limit = __atomic_load_n(&g_limit, __ATOMIC_RELAXED);
+
+    if (c->queued + size > c->cfg.sndq_max
+        || (limit > 0 && __atomic_load_n(&g_queued, __ATOMIC_RELAXED) + size > limit)) {
+        c->stats.refused++;
+        errno = ENOBUFS;
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : append one frame to the send buffer
+// Return     : zero on success, SOCKET_ERROR with errno ENOBUFS when a data
+//              frame is over the limits, or ENOMEM
+// Marks      : PING and PONG always pass, they keep the link alive
+// ---------------------------------------------------------------------------
+static int32_t
+queue_frame(xconn *c, xconn_frame_type type, const void *data, int32_t len)
+{
+    sendq   *q    = &c->out;
+    int32_t  size = XCONN_HDR_SIZE + len;
+    int32_t  need = q->buf_len + size;
+    uint32_t be   = htonl((uint32_t)len);
+    seg     *s    = q->nseg > 0 ? &q->segs[q->nseg - 1] : NULL;
+    char    *p;
+
+    if (type == XCONN_FRAME_DATA && admit(c, size) != 0) {
+        return SOCKET_ERROR;
+    }
+    if (need > q->buf_cap) {
+        int32_t cap = q->buf_cap ? q->buf_cap : 4096;
+        while (cap < need) {
+            cap *= 2;
+        }
+        if ((p = (char *)realloc(q->buf, cap)) == NULL) {
+            errno = ENOMEM;
+            return SOCKET_ERROR;
+        }
+        q->buf     = p;
+        q->buf_cap = cap;
+    }
+    // extend the last segment when it ends where this frame starts
+    if (s == NULL || s->m != NULL || s->off + s->len != q->buf_len) {
+        if ((s = sendq_add(q)) == NULL) {
+            errno = ENOMEM;
+            return SOCKET_ERROR;
+        }
+        s->m   = NULL;
+        s->off = q->buf_len;
+        s->len = 0;
+    }
+    p = q->buf + q->buf_len;
+    memcpy(p, &be, 4);
+    p[4] = (char)type;
+    p[5] = p[6] = p[7] = 0;
+    if (len > 0) {
+        memcpy(p + XCONN_HDR_SIZE, data, len);
+    }
+    s->len     += size;
+    q->buf_len  = need;
+    q->bytes   += size;
+    account(c, size);
+    flush(c);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : append a reference to a shared frame to the send queue
+// Return     : zero on success, SOCKET_ERROR with errno ENOBUFS or ENOMEM
+// ---------------------------------------------------------------------------
+static int32_t
+queue_msg(xconn *c, xmsg *m)
+{
+    int32_t size = XCONN_HDR_SIZE + m->len;
+    seg    *s;
+
+    if (admit(c, size) != 0) {
+        return SOCKET_ERROR;
+    }
+    if ((s = sendq_add(&c->out)) == NULL) {
+        errno = ENOMEM;
+        return SOCKET_ERROR;
+    }
+    s->m   = xmsg_ref(m);
+    s->off = 0;
+    s->len = size;
+    c->out.bytes += size;
+    account(c, size);
+    flush(c);
+    return 0;
+}
+
+static void
+send_cb(xloop_op *op, int32_t result)
+{
+    xconn *c = (xconn *)op->user;
+
+    c->ops--;
+    c->sending = 0;
+    c->busy++;
+    if (result < 0) {
+        fail(c, XCONN_EV_CLOSED, op->err);
+    } else {
+        c->stats.bytes_out += result;
+        account(c, -c->snd.bytes);
+        sendq_reset(&c->snd);
+        flush(c);
+        if (c->detaching) {
+            stop_rx(c);
+        } else if (c->blocked && c->queued <= c->cfg.sndq_low && !c->failed && !c->closing) {
+            c->blocked = 0;
+            c->on_event(c, XCONN_EV_WRITABLE, 0);
+        }
+    }
+    c->busy--;
+    maybe_free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : dispatch the complete frames in the receive buffer
+// Return     : zero on success, SOCKET_ERROR after a protocol error
+// Marks      : a partial frame is moved to the front, the buffer grows when
+//              the frame does not fit; stops after the frame whose callback
+//              detached the connection, the rest goes with it
+// ---------------------------------------------------------------------------
+static int32_t
+parse(xconn *c)
+{
+    int32_t off = 0;
+
+    while (c->rlen - off >= XCONN_HDR_SIZE) {
+        const char *p = c->rbuf + off;
+        uint32_t    be;
+        int32_t     len;
+
+        memcpy(&be, p, 4);
+        if (ntohl(be) > (uint32_t)c->cfg.max_frame) {
+            fail(c, XCONN_EV_CLOSED, EMSGSIZE);
+            return SOCKET_ERROR;
+        }
+        len = (int32_t)ntohl(be);
+        if (c->rlen - off < XCONN_HDR_SIZE + len) {
+            break;
+        }
+        off += XCONN_HDR_SIZE + len;
+
+        switch ((xconn_frame_type)(uint8_t)p[4]) {
+        case XCONN_FRAME_DATA:
+            c->stats.frames_in++;
+            c->on_frame(c, p + XCONN_HDR_SIZE, len);
+            break;
+        case XCONN_FRAME_PING:
+            c->stats.pongs_sent++;
+            queue_frame(c, XCONN_FRAME_PONG, NULL, 0);
+            break;
+        default:
+            break;                  // PONG only proves the peer is alive
+        }
+        if (c->failed || c->closing) {
+            return SOCKET_ERROR;
+        }
+        if (c->detaching) {
+            break;                  // the rest is the next owner's
+        }
+    }
+
+    if (off > 0) {
+        memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+        c->rlen -= off;
+    }
+    if (c->rlen >= XCONN_HDR_SIZE) {
+        uint32_t be;
+        int32_t  need;
+        char    *p;
+
+        memcpy(&be, c->rbuf, 4);
+        need = XCONN_HDR_SIZE + (int32_t)ntohl(be);
+        if (need > c->rcap) {
+            if ((p = (char *)realloc(c->rbuf, need)) == NULL) {
+                fail(c, XCONN_EV_CLOSED, ENOMEM);
+                return SOCKET_ERROR;
+            }
+            c->rbuf = p;
+            c->rcap = need;
+        }
+    }
+    return 0;
+}
+
+static void recv_cb(xloop_op *op, int32_t result);
+
+// ---------------------------------------------------------------------------
+// Function   : post the receive behind the bytes in the receive buffer
+// Marks      : not once a frame callback detached the connection, the loop
+//              has forgotten the socket then
+// ---------------------------------------------------------------------------
+static void
+rearm(xconn *c)
+{
+    if (c->detaching) {
+        return;
+    }
+    if (xloop_recv(c->loop, &c->rop, c->fd, c->rbuf + c->rlen, c->rcap - c->rlen,
+                   recv_cb, c) != 0) {
+        fail(c, XCONN_EV_CLOSED, errno);
+    } else {
+        c->ops++;
+    }
+}
+
+static void
+recv_cb(xloop_op *op, int32_t result)
+{
+    xconn *c = (xconn *)op->user;
+
+    c->ops--;
+    c->busy++;
+    if (c->failed || c->closing) {
+        // canceled
+    } else if (c->detaching && (result > 0 || (result < 0 && op->err == ECANCELED))) {
+        // keep what arrived for the next owner, without parsing it
+        result   = result > 0 ? result : op->done;
+        c->rlen += result;
+        c->stats.bytes_in += result;
+    } else if (result <= 0) {
+        fail(c, XCONN_EV_CLOSED, result == 0 ? 0 : op->err);
+    } else {
+        c->rx_seen = 1;
+        c->rlen   += result;
+        c->stats.bytes_in += result;
+        if (parse(c) == 0) {
+            rearm(c);
+        }
+    }
+    c->busy--;
+    maybe_free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : dispatch the frames a resumed connection brought along, then
+//              start receiving
+// ---------------------------------------------------------------------------
+static void
+resume_cb(xloop_op *op, int32_t result)
+{
+    xconn *c = (xconn *)op->user;
+
+    (void)result;
+    c->ops--;
+    c->busy++;
+    if (!c->failed && !c->closing && !c->detaching && parse(c) == 0) {
+        rearm(c);
+    }
+    c->busy--;
+    maybe_free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : heartbeat tick: count silent intervals, ping when idle
+// ---------------------------------------------------------------------------
+static void
+hb_cb(xtimer *t)
+{
+    xconn *c = (xconn *)t->user;
+
+    c->busy++;
+    if (c->rx_seen) {
+        c->missed = 0;
+    } else if (++c->missed >= c->cfg.hb_misses) {
+        fail(c, XCONN_EV_DEAD, ETIMEDOUT);
+    }
+    if (!c->failed) {
+        if (!c->rx_seen || !c->tx_seen) {
+            c->stats.pings_sent++;
+            queue_frame(c, XCONN_FRAME_PING, NULL, 0);
+        }
+        c->rx_seen = 0;
+        c->tx_seen = 0;
+        if (!c->failed) {
+            xloop_timer_start(c->loop, &c->hb, (int64_t)c->cfg.hb_interval_ms * 1000);
+        }
+    }
+    c->busy--;
+    maybe_free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wrap a connected TCP socket in a framed connection
+// Parameters :
+//      [in ] : loop     - the event loop
+//            : fd       - a connected TCP socket, owned by the connection
+//            : cfg      - the settings, NULL for the defaults
+//            : on_frame - data frame callback
+//            : on_event - failure callback
+//            : user     - caller context
+//      [out] : none
+// Return     : the connection, NULL on error
+// ---------------------------------------------------------------------------
+xconn *
+xconn_create(xloop *loop, socket_t fd, const xconn_config *cfg,
+             xconn_frame_cb on_frame, xconn_event_cb on_event, void *user)
+{
+    return xconn_resume(loop, fd, cfg, NULL, 0, on_frame, on_event, user);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : continue a connection from the state of xconn_detach
+// Parameters :
+//      [in ] : state - the state, NULL for a new connection
+//            : len   - its length
+//            : the others as xconn_create
+//      [out] : none
+// Return     : the connection, NULL on error
+// Marks      : frames received before the handover are dispatched in the
+//              next loop round, the queued ones are sent right away
+// ---------------------------------------------------------------------------
+xconn *
+xconn_resume(xloop *loop, socket_t fd, const xconn_config *cfg, const void *state, int32_t len,
+             xconn_frame_cb on_frame, xconn_event_cb on_event, void *user)
+{
+    conn_state  st;
+    const char *p = (const char *)state + sizeof(conn_state);
+    xconn      *c;
+
+    memset(&st, 0, sizeof(st));
+    if (state != NULL) {
+        if (len < (int32_t)sizeof(conn_state)) {
+            return NULL;
+        }
+        memcpy(&st, state, sizeof(st));
+        if (st.magic != STATE_MAGIC || st.rx_len > INT32_MAX - st.tx_len
+            || (int64_t)sizeof(conn_state) + st.rx_len + st.tx_len != len) {
+            xs_printf("[xconn] bad connection state for %d\n", fd);
+            return NULL;
+        }
+    }
+    if ((c = (xconn *)calloc(1, sizeof(xconn))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        c->cfg = *cfg;
+    } else {
+        xconn_config_init(&c->cfg);
+    }
+    if (c->cfg.max_frame <= 0 || c->cfg.hb_interval_ms < 0 || c->cfg.hb_misses <= 0
+        || c->cfg.sndq_low < 0 || c->cfg.sndq_low > c->cfg.sndq_high
+        || c->cfg.sndq_high > c->cfg.sndq_max) {
+        free(c);
+        return NULL;
+    }
+    if (c->cfg.rbuf_size < XCONN_HDR_SIZE) {
+        c->cfg.rbuf_size = XCONN_HDR_SIZE;
+    }
+    c->loop     = loop;
+    c->fd       = fd;
+    c->on_frame = on_frame;
+    c->on_event = on_event;
+    c->user     = user;
+    c->rcap     = c->cfg.rbuf_size > (int32_t)st.rx_len ? c->cfg.rbuf_size : (int32_t)st.rx_len;
+    if ((c->rbuf = (char *)malloc(c->rcap)) == NULL) {
+        free(c);
+        return NULL;
+    }
+    if (st.rx_len > 0) {
+        memcpy(c->rbuf, p, st.rx_len);
+        c->rlen = (int32_t)st.rx_len;
+    }
+    if (st.tx_len > 0) {
+        seg *s;
+        if ((c->out.buf = (char *)malloc(st.tx_len)) == NULL || (s = sendq_add(&c->out)) == NULL) {
+            free(c->out.buf);
+            free(c->rbuf);
+            free(c);
+            return NULL;
+        }
+        memcpy(c->out.buf, p + st.rx_len, st.tx_len);
+        s->m   = NULL;
+        s->off = 0;
+        s->len = (int32_t)st.tx_len;
+        c->out.buf_len = c->out.buf_cap = c->out.bytes = (int32_t)st.tx_len;
+    }
+
+    if (c->cfg.user_timeout_ms > 0) {
+        socket_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.user_timeout_ms = c->cfg.user_timeout_ms;
+        if (socket_set_opts(fd, &opts) != 0) {
+            xs_printf("[xconn] TCP_USER_TIMEOUT not set on %d\n", fd);
+        }
+    }
+    if (c->rlen > 0) {
+        xloop_defer(loop, &c->rop, resume_cb, c);
+    } else if (xloop_recv(loop, &c->rop, fd, c->rbuf, c->rcap, recv_cb, c) != 0) {
+        free(c->out.buf);
+        free(c->out.segs);
+        free(c->rbuf);
+        free(c);
+        return NULL;
+    }
+    c->ops = 1;
+    account(c, c->out.bytes);
+    flush(c);
+
+    xtimer_init(&c->hb, hb_cb, c);
+    if (c->cfg.hb_interval_ms > 0) {
+        xloop_timer_start(loop, &c->hb, (int64_t)c->cfg.hb_interval_ms * 1000);
+    }
+    return c;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : give the socket and the state of a detached connection to
+//              the callback and free the rest
+// Marks      : the socket is INVALID_SOCKET when the connection failed
+//              meanwhile, or when there is no memory for the state
+// ---------------------------------------------------------------------------
+static void
+hand_over(xconn *c)
+{
+    conn_state st;
+    char      *state = NULL, *p;
+    int32_t    len = 0, i;
+
+    if (!c->failed) {
+        st.magic    = STATE_MAGIC;
+        st.rx_len   = (uint32_t)c->rlen;
+        st.tx_len   = (uint32_t)c->out.bytes;
+        st.reserved = 0;
+        len = (int32_t)sizeof(st) + c->rlen + c->out.bytes;
+        if ((state = (char *)malloc(len)) == NULL) {
+            socket_close(c->fd);
+            c->fd = INVALID_SOCKET;
+            len   = 0;
+        } else {
+            memcpy(state, &st, sizeof(st));
+            memcpy(state + sizeof(st), c->rbuf, c->rlen);
+            p = state + sizeof(st) + c->rlen;
+            for (i = 0; i < c->out.nseg; i++) {
+                const seg *s = &c->out.segs[i];
+                memcpy(p, s->m != NULL ? s->m->frame : c->out.buf + s->off, s->len);
+                p += s->len;
+            }
+        }
+    }
+    c->closing = 1;
+    c->busy++;
+    c->on_detach(c->detach_arg, c->fd, state, len);
+    c->busy--;
+    free(state);
+    maybe_free(c);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : count a queued data frame and report the high watermark
+// ---------------------------------------------------------------------------
+static void
+sent_data(xconn *c)
+{
+    c->tx_seen = 1;
+    c->stats.frames_out++;
+
+    if (!c->blocked && c->queued >= c->cfg.sndq_high && !c->failed) {
+        c->blocked = 1;
+        c->stats.blocked++;
+        c->busy++;
+        c->on_event(c, XCONN_EV_BLOCKED, 0);
+        c->busy--;
+        maybe_free(c);
+    }
+}
+
+int32_t
+xconn_send(xconn *c, const void *data, int32_t len)
+{
+    if (c->failed || c->closing || c->detaching || len < 0 || len > c->cfg.max_frame) {
+        return SOCKET_ERROR;
+    }
+    if (queue_frame(c, XCONN_FRAME_DATA, data, len) != 0) {
+        return SOCKET_ERROR;
+    }
+    sent_data(c);
+    return 0;
+}
+
+int32_t
+xconn_send_msg(xconn *c, xmsg *m)
+{
+    if (c->failed || c->closing || c->detaching || m == NULL || m->len > c->cfg.max_frame) {
+        return SOCKET_ERROR;
+    }
+    if (XCONN_HDR_SIZE + m->len <= COPY_SIZE) {
+        if (queue_frame(c, XCONN_FRAME_DATA, m->frame + XCONN_HDR_SIZE, m->len) != 0) {
+            return SOCKET_ERROR;
+        }
+    } else if (queue_msg(c, m) != 0) {
+        return SOCKET_ERROR;
+    }
+    sent_data(c);
+    return 0;
+}
+
+int32_t
+xconn_detach(xconn *c, xconn_detach_cb cb, void *arg)
+{
+    if (c->failed || c->closing || c->detaching || cb == NULL) {
+        return SOCKET_ERROR;
+    }
+    xloop_timer_stop(c->loop, &c->hb);
+    c->detaching  = 1;
+    c->on_detach  = cb;
+    c->detach_arg = arg;
+    stop_rx(c);
+    maybe_free(c);
+    return 0;
+}
+
+void
+xconn_close(xconn *c)
+{
+    if (c == NULL || c->closing) {
+        return;
+    }
+    xloop_timer_stop(c->loop, &c->hb);
+    if (!c->failed) {
+        xloop_close(c->loop, c->fd);
+        c->fd = INVALID_SOCKET;
+    }
+    c->closing = 1;
+    maybe_free(c);
+}
+
+int32_t
+xconn_queued(xconn *c)
+{
+    return c->queued;
+}
+
+int32_t
+xconn_blocked(xconn *c)
+{
+    return c->blocked;
+}
+
+socket_t
+xconn_fd(xconn *c)
+{
+    return c->fd;
+}
+
+void *
+xconn_user(xconn *c)
+{
+    return c->user;
+}
+
+void
+xconn_get_stats(xconn *c, xconn_stats *stats)
+{
+    *stats = c->stats;
+}
+
+xmsg *
+xmsg_alloc(int32_t len)
+{
+    uint32_t be = htonl((uint32_t)len);
+    xmsg    *m;
+
+    if (len < 0 || (m = (xmsg *)malloc(sizeof(xmsg) + XCONN_HDR_SIZE + (size_t)len)) == NULL) {
+        return NULL;
+    }
+    m->refs = 1;
+    m->len  = len;
+    memcpy(m->frame, &be, 4);
+    m->frame[4] = (char)XCONN_FRAME_DATA;
+    m->frame[5] = m->frame[6] = m->frame[7] = 0;
+    return m;
+}
+
+void *
+xmsg_data(xmsg *m)
+{
+    return m->frame + XCONN_HDR_SIZE;
+}
+
+int32_t
+xmsg_len(const xmsg *m)
+{
+    return m->len;
+}
+
+xmsg *
+xmsg_ref(xmsg *m)
+{
+    __atomic_add_fetch(&m->refs, 1, __ATOMIC_RELAXED);
+    return m;
+}
+
+void
+xmsg_unref(xmsg *m)
+{
+    if (m != NULL && __atomic_sub_fetch(&m->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(m);
+    }
+}
@@ -0,0 +1,219 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xconn.h
+ *  @brief    Framed TCP connection on the xsocket event loop (Linux)
+ *
+ *  A connection carries length-prefixed frames over a connected TCP
+ *  socket.  Every frame starts with an 8 byte header:
+ *
+ *      0   4   payload length, big-endian
+ *      4   1   frame type (xconn_frame_type)
+ *      5   3   reserved, zero
+ *
+ *  Data frames are handed to the frame callback whole; the other types
+ *  are handled by the connection itself.
+ *
+ *  Shared frames: an xmsg holds one data frame, header included, with a
+ *  reference count.  It is built once and queued to any number of
+ *  connections with xconn_send_msg, which only takes a reference; each
+ *  connection sends its queue with one gathered write, so publishing to
+ *  many consumers costs no copy per consumer.
+ *
+ *  Heartbeats: with hb_interval_ms set, every interval in which nothing
+ *  was sent or nothing was received the connection sends a PING frame,
+ *  which the peer answers with PONG.  A peer from which nothing at all
+ *  arrived for hb_misses intervals in a row is declared dead, so a dead
+ *  host is noticed after interval * misses instead of the minutes TCP
+ *  retransmission takes.  Only one side needs heartbeats enabled, PONG
+ *  replies are always sent.  user_timeout_ms additionally sets
+ *  TCP_USER_TIMEOUT, so the kernel drops the link when sent data stays
+ *  unacknowledged that long.
+ *
+ *  Flow control: frames that cannot be written at once wait in the
+ *  connection's send queue.  When the queued bytes reach sndq_high the
+ *  connection reports XCONN_EV_BLOCKED, when they drain to sndq_low
+ *  XCONN_EV_WRITABLE, so a producer can throttle per consumer.  Past
+ *  sndq_max, or past the process-wide limit of xconn_set_global_limit,
+ *  xconn_send refuses the frame with ENOBUFS and the connection stays
+ *  usable, so one slow consumer cannot take all the memory.
+ *
+ *  Handover: xconn_detach stops a connection without closing its socket
+ *  and hands the socket over together with the framing state, the bytes
+ *  received but not dispatched and the frames not sent yet.  xconn_resume
+ *  continues the connection from that state, in another loop or another
+ *  process (see xhandoff.h), so the peer notices nothing.
+ *
+ *  All calls are made on the loop thread, except the global limit
+ *  functions.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XCONN_H__
+#define __XCONN_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+#include "xloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XCONN_HDR_SIZE  8
+
+typedef struct xconn xconn;
+typedef struct xmsg  xmsg;
+
+typedef enum xconn_frame_type {
+    XCONN_FRAME_DATA = 0,
+    XCONN_FRAME_PING,
+    XCONN_FRAME_PONG
+} xconn_frame_type;
+
+typedef enum xconn_event {
+    XCONN_EV_CLOSED = 0,            // the peer closed the connection, or an error (err)
+    XCONN_EV_DEAD,                  // heartbeat: nothing received for hb_misses intervals
+    XCONN_EV_BLOCKED,               // the send queue reached sndq_high
+    XCONN_EV_WRITABLE               // a blocked send queue drained to sndq_low
+} xconn_event;
+
+/* connection settings, see xconn_config_init for the defaults */
+typedef struct xconn_config {
+    int32_t max_frame;              // largest payload accepted
+    int32_t rbuf_size;              // initial receive buffer, grows up to one frame
+    int32_t hb_interval_ms;         // heartbeat interval, 0 for none
+    int32_t hb_misses;              // silent intervals before the peer is dead
+    int32_t user_timeout_ms;        // TCP_USER_TIMEOUT, 0 to leave it
+    int32_t sndq_high;              // queued bytes that report BLOCKED
+    int32_t sndq_low;               // queued bytes that report WRITABLE again
+    int32_t sndq_max;               // queued bytes beyond which frames are refused
+} xconn_config;
+
+/* counters of a connection */
+typedef struct xconn_stats {
+    int64_t frames_in;              // data frames received
+    int64_t frames_out;             // data frames queued
+    int64_t bytes_in;
+    int64_t bytes_out;
+    int64_t pings_sent;
+    int64_t pongs_sent;
+    int64_t blocked;                // BLOCKED events
+    int64_t refused;                // frames refused by sndq_max or the global limit
+} xconn_stats;
+
+/* a data frame arrived; data is valid during the callback only */
+typedef void (*xconn_frame_cb)(xconn *c, const void *data, int32_t len);
+
+/* XCONN_EV_CLOSED and XCONN_EV_DEAD: the connection failed, the socket is
+ * closed already and the callback (or later code) frees the connection
+ * with xconn_close.  XCONN_EV_BLOCKED and XCONN_EV_WRITABLE report the
+ * send queue crossing its watermarks, err is zero
+ */
+typedef void (*xconn_event_cb)(xconn *c, xconn_event ev, int32_t err);
+
+/* the socket and state of a detached connection; fd is INVALID_SOCKET when
+ * the connection failed meanwhile.  state is valid during the callback only
+ */
+typedef void (*xconn_detach_cb)(void *arg, socket_t fd, const void *state, int32_t len);
+
+/* defaults: 1 MB frames, 64 KB receive buffer, no heartbeats (3 misses
+ * once an interval is set), no TCP_USER_TIMEOUT, send queue watermarks
+ * 1 MB / 256 KB, at most 8 MB queued
+ */
+void xconn_config_init(xconn_config *cfg);
+
+/* wrap a connected TCP socket, which the connection owns from now on;
+ * cfg NULL for the defaults; NULL on error (the socket is left open)
+ */
+xconn *xconn_create(xloop *loop, socket_t fd, const xconn_config *cfg,
+                    xconn_frame_cb on_frame, xconn_event_cb on_event, void *user);
+
+/* wrap a socket of a detached connection, state and len as passed to the
+ * xconn_detach_cb; frames received before the handover are dispatched in
+ * the next loop round, queued frames are sent.  NULL on error, including
+ * a state that is not one (the socket is left open)
+ */
+xconn *xconn_resume(xloop *loop, socket_t fd, const xconn_config *cfg, const void *state, int32_t len,
+                    xconn_frame_cb on_frame, xconn_event_cb on_event, void *user);
+
+/* queue one data frame, the payload is copied; zero on success,
+ * SOCKET_ERROR when the connection failed or len is out of range, or with
+ * errno ENOBUFS when the frame does not fit the send queue limits
+ */
+int32_t xconn_send(xconn *c, const void *data, int32_t len);
+
+/* queue a shared data frame: the connection takes its own reference and
+ * drops it once the frame is sent; same results as xconn_send
+ */
+int32_t xconn_send_msg(xconn *c, xmsg *m);
+
+/* stop the connection without closing the socket: the batch being sent
+ * goes out, nothing is received or dispatched any more and xconn_send
+ * fails.  Then cb gets the socket, which the caller owns from now on, and
+ * the state, and the connection is freed; no other callback runs.  Zero
+ * when started, SOCKET_ERROR when the connection failed or is detaching
+ */
+int32_t xconn_detach(xconn *c, xconn_detach_cb cb, void *arg);
+
+/* close the socket and free the connection; no callback runs afterwards,
+ * the memory goes once the loop has given back the pending operations
+ */
+void xconn_close(xconn *c);
+
+/* bytes in the send queue, including those being sent
+ */
+int32_t xconn_queued(xconn *c);
+
+/* non-zero between XCONN_EV_BLOCKED and XCONN_EV_WRITABLE
+ */
+int32_t xconn_blocked(xconn *c);
+
+/* limit the bytes queued by all connections of the process together,
+ * 0 for no limit (the default); may be called from any thread
+ */
+void xconn_set_global_limit(int64_t bytes);
+
+/* bytes queued by all connections of the process
+ */
+int64_t xconn_global_queued(void);
+
+/* the socket, INVALID_SOCKET once the connection failed
+ */
+socket_t xconn_fd(xconn *c);
+
+/* the user pointer passed to xconn_create
+ */
+void *xconn_user(xconn *c);
+
+/* a copy of the counters
+ */
+void xconn_get_stats(xconn *c, xconn_stats *stats);
+
+/* a shared data frame for len payload bytes, with one reference held by
+ * the caller; the payload is filled in through xmsg_data before the frame
+ * is queued and not changed afterwards; NULL on error
+ */
+xmsg *xmsg_alloc(int32_t len);
+
+/* the payload of a frame
+ */
+void *xmsg_data(xmsg *m);
+
+/* the payload length of a frame
+ */
+int32_t xmsg_len(const xmsg *m);
+
+/* take another reference, m is returned; may be called from any thread
+ */
+xmsg *xmsg_ref(xmsg *m);
+
+/* drop a reference, the last one frees the frame; may be called from any
+ * thread, m may be NULL
+ */
+void xmsg_unref(xmsg *m);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XCONN_H__
@@ -0,0 +1,607 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xfanin.c
+ *  @brief    Multicast fan-in: receive each group once for all local readers (Linux)
+ *
+ *  Ring: a header page with the stream table and the published count
+ *  (head), then slots of slot_size bytes.  Datagram n goes to slot
+ *  n % slots.  Each slot is a seqlock: the daemon sets its seq to 0,
+ *  writes the datagram and sets seq to n + 1, then publishes head.  A
+ *  reader copies the datagram out and checks seq again; when it changed
+ *  the daemon has lapped the reader and the datagram counts as lost.
+ *
+ *  Daemon: like xrelay, one receive is posted per group to wait for
+ *  traffic, then the socket is drained with recvmmsg straight into the
+ *  next slots, so a burst costs one system call per batch and no copy.
+ *  An oversized datagram leaves an empty (skip) slot behind.
+ *
+ *  Readers only write to the header, to count themselves as sleepers;
+ *  the slots are mapped read-only.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "xfanin.h"
+#include "xsocket_int.h"
+
+#define XFANIN_MAGIC    0x314e494e414658ULL     // "XFANIN1"
+#define SLOT_HDR        ((int32_t)sizeof(slot))
+#define SLOT_SKIP       1           // no datagram in this slot
+#define DRAIN_BATCHES   4           // recvmmsg calls per wake-up, then other groups get a turn
+
+typedef struct slot {
+    uint64_t seq;                   // datagram number + 1 when written, 0 while it is written
+    uint32_t len;
+    uint16_t stream;
+    uint16_t flags;
+    int64_t  ts_ns;                 // CLOCK_REALTIME at receive
+} slot;
+
+/* the first page(s) of the ring file */
+typedef struct ring_hdr {
+    uint64_t          magic;
+    uint32_t          slots;
+    uint32_t          slot_size;
+    uint32_t          data_off;
+    uint32_t          nstreams;     // entries of streams in use, set after the entry
+    xfanin_stream_def streams[XFANIN_MAX_STREAMS];
+    uint64_t          head __attribute__((aligned(64)));    // datagrams published
+    uint32_t          futex;        // low bits of head, sleeping readers wait on it
+    uint32_t          closed;       // the daemon has gone
+    uint32_t          waiters __attribute__((aligned(64))); // readers sleeping on futex
+} ring_hdr;
+
+/* one joined group of the daemon */
+typedef struct group {
+    xfanin   *f;
+    socket_t  fd;
+    int32_t   stream;
+    xloop_op  rop;                  // waits for the first datagram of a burst
+    char     *buf;                  // its buffer, a slot payload and one byte
+} group;
+
+struct xfanin {
+    xloop          *loop;
+    xfanin_config   cfg;
+    char            path[256];
+    ring_hdr       *hdr;
+    size_t          size;
+    char           *data;
+    uint64_t        head;
+    uint64_t        mask;
+    int32_t         payload;        // slot_size less the slot header
+    group          *groups[XFANIN_MAX_STREAMS];
+    int32_t         ngroups;
+    struct mmsghdr *msgs;
+    struct iovec   *iov;
+    int32_t         ops;            // operations held by the loop
+    int32_t         closing;
+    xfanin_stats    stats;
+};
+
+struct xfanin_reader {
+    ring_hdr            *hdr;       // read-write, only waiters is written
+    size_t               hdr_size;
+    const char          *map;       // the whole file read-only
+    size_t               size;
+    const char          *data;
+    uint64_t             mask;
+    uint32_t             slot_size;
+    uint64_t             next;      // number of the next datagram to read
+    int32_t              spin_us;
+    int32_t              filtered;
+    uint8_t              want[XFANIN_MAX_STREAMS];
+    xfanin_reader_stats  stats;
+};
+
+static long
+futex(uint32_t *addr, int op, uint32_t val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, addr, op, val, ts, NULL, 0);
+}
+
+static int64_t
+now_realtime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+xfanin_config_init(xfanin_config *cfg)
+{
+    cfg->slots     = 16384;
+    cfg->slot_size = 2048;
+    cfg->batch     = 64;
+    cfg->rcvbuf    = 0;
+}
+
+// ---------------------------------------------------------------------------
+// daemon
+
+static slot *
+slot_at(xfanin *f, uint64_t n)
+{
+    return (slot *)(f->data + (size_t)(n & f->mask) * f->cfg.slot_size);
+}
+
+/* take a slot away from the readers before it is written */
+static void
+slot_begin(slot *s)
+{
+    __atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+slot_commit(xfanin *f, slot *s, uint64_t n, int32_t len, int32_t stream, int64_t ts)
+{
+    if (len > f->payload) {
+        f->stats.dropped++;
+        s->len   = 0;
+        s->flags = SLOT_SKIP;
+    } else {
+        f->stats.datagrams++;
+        f->stats.bytes += len;
+        s->len   = (uint32_t)len;
+        s->flags = 0;
+    }
+    s->stream = (uint16_t)stream;
+    s->ts_ns  = ts;
+    __atomic_store_n(&s->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+/* make the written slots visible and wake the readers that sleep */
+static void
+publish(xfanin *f)
+{
+    __atomic_store_n(&f->hdr->head, f->head, __ATOMIC_RELEASE);
+    __atomic_store_n(&f->hdr->futex, (uint32_t)f->head, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&f->hdr->waiters, __ATOMIC_RELAXED) != 0) {
+        futex(&f->hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+        f->stats.wakeups++;
+    }
+}
+
+static void
+maybe_free(xfanin *f)
+{
+    int32_t i;
+
+    if (!f->closing || f->ops > 0) {
+        return;
+    }
+    for (i = 0; i < f->ngroups; i++) {
+        free(f->groups[i]->buf);
+        free(f->groups[i]);
+    }
+    if (f->hdr != NULL) {
+        munmap(f->hdr, f->size);
+    }
+    free(f->msgs);
+    free(f->iov);
+    free(f);
+}
+
+static void
+rx_cb(xloop_op *op, int32_t result)
+{
+    group  *g = (group *)op->user;
+    xfanin *f = g->f;
+    int64_t ts;
+    int32_t b, i, n;
+
+    f->ops--;
+    if (f->closing) {
+        maybe_free(f);
+        return;
+    }
+    ts = now_realtime();
+    if (result >= 0) {
+        slot *s = slot_at(f, f->head);
+        f->stats.syscalls++;
+        slot_begin(s);
+        if (result <= f->payload) {
+            memcpy(s + 1, g->buf, result);
+        }
+        slot_commit(f, s, f->head++, result, g->stream, ts);
+        publish(f);
+    } else {
+        xs_printf("[xfanin] multicast receive error %d\n", op->err);
+    }
+
+    // drain what else is queued straight into the ring, a batch per call
+    for (b = 0; b < DRAIN_BATCHES; b++) {
+        for (i = 0; i < f->cfg.batch; i++) {
+            slot *s = slot_at(f, f->head + i);
+            slot_begin(s);
+            f->iov[i].iov_base = s + 1;
+            f->iov[i].iov_len  = (size_t)f->payload;
+        }
+        if ((n = recvmmsg(g->fd, f->msgs, f->cfg.batch, MSG_DONTWAIT, NULL)) <= 0) {
+            break;
+        }
+        f->stats.syscalls++;
+        ts = now_realtime();
+        for (i = 0; i < n; i++) {
+            int32_t len = (int32_t)f->msgs[i].msg_len;
+            if (f->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                len = f->payload + 1;   // counted as oversized
+            }
+            slot_commit(f, slot_at(f, f->head), f->head, len, g->stream, ts);
+            f->head++;
+        }
+        publish(f);
+        if (n < f->cfg.batch) {
+            break;
+        }
+    }
+
+    if (xloop_recv(f->loop, &g->rop, g->fd, g->buf, f->payload + 1, rx_cb, g) != 0) {
+        xs_printf("[xfanin] cannot wait on multicast socket %d\n", g->fd);
+        return;
+    }
+    f->ops++;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create the ring file and the daemon
+// Parameters :
+//      [in ] : loop - the event loop
+//            : name - the ring is /dev/shm/<name>
+//            : cfg  - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the daemon, NULL on error
+// Marks      : the file is built under a temporary name and renamed over
+//              the old one, so readers never attach to a half-made ring
+// ---------------------------------------------------------------------------
+xfanin *
+xfanin_create(xloop *loop, const char *name, const xfanin_config *cfg)
+{
+    xfanin  *f;
+    char     tmp[280];
+    uint32_t off = (sizeof(ring_hdr) + 4095) & ~4095u;
+    int      fd = -1;
+    int32_t  i;
+
+    if ((f = (xfanin *)calloc(1, sizeof(xfanin))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        f->cfg = *cfg;
+    } else {
+        xfanin_config_init(&f->cfg);
+    }
+    f->loop    = loop;
+    f->mask    = (uint64_t)f->cfg.slots - 1;
+    f->payload = f->cfg.slot_size - SLOT_HDR;
+    f->closing = 1;                 // until it is complete, for maybe_free
+    snprintf(f->path, sizeof(f->path), "/dev/shm/%s", name);
+    snprintf(tmp, sizeof(tmp), "%s.%d", f->path, (int)getpid());
+    if (f->cfg.slots <= 0 || (f->cfg.slots & (f->cfg.slots - 1)) != 0 || f->cfg.batch <= 0
+        || f->cfg.slots < 2 * f->cfg.batch || f->cfg.slot_size % 8 != 0
+        || f->payload < 64 || f->payload > 65507 || strchr(name, '/') != NULL) {
+        xs_printf("[xfanin] bad ring settings for %s\n", name);
+        maybe_free(f);
+        return NULL;
+    }
+    if ((f->msgs = (struct mmsghdr *)calloc(f->cfg.batch, sizeof(struct mmsghdr))) == NULL
+        || (f->iov = (struct iovec *)calloc(f->cfg.batch, sizeof(struct iovec))) == NULL) {
+        maybe_free(f);
+        return NULL;
+    }
+    for (i = 0; i < f->cfg.batch; i++) {
+        f->msgs[i].msg_hdr.msg_iov    = &f->iov[i];
+        f->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    f->size = off + (size_t)f->cfg.slots * f->cfg.slot_size;
+    if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0
+        || ftruncate(fd, (off_t)f->size) != 0
+        || (f->hdr = (ring_hdr *)mmap(NULL, f->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        xs_printf("[xfanin] cannot create %s: %s\n", tmp, strerror(errno));
+        f->hdr = NULL;
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        maybe_free(f);
+        return NULL;
+    }
+    close(fd);
+#ifdef MADV_POPULATE_WRITE
+    madvise(f->hdr, f->size, MADV_POPULATE_WRITE);  // best effort, the first lap faults otherwise
+#endif
+    f->data           = (char *)f->hdr + off;
+    f->hdr->slots     = (uint32_t)f->cfg.slots;
+    f->hdr->slot_size = (uint32_t)f->cfg.slot_size;
+    f->hdr->data_off  = off;
+    __atomic_store_n(&f->hdr->magic, XFANIN_MAGIC, __ATOMIC_RELEASE);
+    if (rename(tmp, f->path) != 0) {
+        xs_printf("[xfanin] cannot create %s: %s\n", f->path, strerror(errno));
+        unlink(tmp);
+        maybe_free(f);
+        return NULL;
+    }
+    f->closing = 0;
+    return f;
+}
+
+int32_t
+xfanin_join(xfanin *f, const char *ip_if, const char *ip_grp, uint16_t port)
+{
+    group   *g;
+    int32_t  id = f->ngroups;
+
+    if (id >= XFANIN_MAX_STREAMS || (g = (group *)calloc(1, sizeof(group))) == NULL) {
+        return SOCKET_ERROR;
+    }
+    g->f      = f;
+    g->stream = id;
+    if ((g->buf = (char *)malloc(f->payload + 1)) == NULL
+        || (g->fd = socket_add_mc_ex(ip_if, ip_grp, port, f->cfg.rcvbuf)) == INVALID_SOCKET) {
+        free(g->buf);
+        free(g);
+        return SOCKET_ERROR;
+    }
+    if (xloop_recv(f->loop, &g->rop, g->fd, g->buf, f->payload + 1, rx_cb, g) != 0) {
+        socket_close(g->fd);
+        free(g->buf);
+        free(g);
+        return SOCKET_ERROR;
+    }
+    f->ops++;
+    f->groups[f->ngroups++] = g;
+
+    f->hdr->streams[id].port = port;
+    snprintf(f->hdr->streams[id].grp, sizeof(f->hdr->streams[id].grp), "%s", ip_grp);
+    __atomic_store_n(&f->hdr->nstreams, (uint32_t)f->ngroups, __ATOMIC_RELEASE);
+    xs_printf("[xfanin] stream %d is %s:%d\n", id, ip_grp, port);
+    return id;
+}
+
+void
+xfanin_get_stats(xfanin *f, xfanin_stats *stats)
+{
+    *stats = f->stats;
+}
+
+void
+xfanin_destroy(xfanin *f)
+{
+    int32_t i;
+
+    if (f == NULL || f->closing) {
+        return;
+    }
+    f->closing = 1;
+    for (i = 0; i < f->ngroups; i++) {
+        xloop_close(f->loop, f->groups[i]->fd);
+        f->groups[i]->fd = INVALID_SOCKET;
+    }
+    __atomic_store_n(&f->hdr->closed, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&f->hdr->futex, 1, __ATOMIC_SEQ_CST);
+    futex(&f->hdr->futex, FUTEX_WAKE, INT_MAX, NULL);
+    unlink(f->path);
+    maybe_free(f);
+}
+
+// ---------------------------------------------------------------------------
+// reader
+
+xfanin_reader *
+xfanin_reader_open(const char *name, int32_t spin_us)
+{
+    xfanin_reader *rd;
+    const ring_hdr *h;
+    struct stat    st;
+    char           path[280];
+    int            fd;
+
+    snprintf(path, sizeof(path), "/dev/shm/%s", name);
+    if ((rd = (xfanin_reader *)calloc(1, sizeof(xfanin_reader))) == NULL) {
+        return NULL;
+    }
+    if ((fd = open(path, O_RDWR | O_CLOEXEC)) < 0) {
+        xs_printf("[xfanin] cannot open %s: %s\n", path, strerror(errno));
+        free(rd);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ring_hdr)
+        || (rd->map = (const char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        free(rd);
+        return NULL;
+    }
+    rd->size = (size_t)st.st_size;
+    h        = (const ring_hdr *)rd->map;
+    if (h->magic != XFANIN_MAGIC || h->slots == 0 || (h->slots & (h->slots - 1)) != 0
+        || h->slot_size < sizeof(slot) || h->data_off < sizeof(ring_hdr)
+        || h->data_off + (uint64_t)h->slots * h->slot_size > rd->size
+        || (rd->hdr = (ring_hdr *)mmap(NULL, h->data_off, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        xs_printf("[xfanin] %s is not a ring\n", path);
+        munmap((void *)rd->map, rd->size);
+        close(fd);
+        free(rd);
+        return NULL;
+    }
+    close(fd);
+    rd->hdr_size  = h->data_off;
+    rd->data      = rd->map + h->data_off;
+    rd->mask      = h->slots - 1;
+    rd->slot_size = h->slot_size;
+    rd->spin_us   = spin_us;
+    rd->next      = __atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE);
+    return rd;
+}
+
+int32_t
+xfanin_reader_join(xfanin_reader *rd, const char *ip_grp, uint16_t port)
+{
+    uint32_t i, n = __atomic_load_n(&rd->hdr->nstreams, __ATOMIC_ACQUIRE);
+
+    for (i = 0; i < n && i < XFANIN_MAX_STREAMS; i++) {
+        if (rd->hdr->streams[i].port == port && strcmp(rd->hdr->streams[i].grp, ip_grp) == 0) {
+            rd->want[i]  = 1;
+            rd->filtered = 1;
+            return (int32_t)i;
+        }
+    }
+    return SOCKET_ERROR;
+}
+
+const xfanin_stream_def *
+xfanin_reader_stream(xfanin_reader *rd, int32_t stream)
+{
+    if (stream < 0 || (uint32_t)stream >= __atomic_load_n(&rd->hdr->nstreams, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    return &rd->hdr->streams[stream];
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait for datagram rd->next or the end of the daemon
+// Return     : zero when there is something to read, SOCKET_ERROR on timeout
+// Marks      : spins for spin_us, then counts itself in waiters and sleeps
+//              on the futex unless head moved after it was counted
+// ---------------------------------------------------------------------------
+static int32_t
+reader_wait(xfanin_reader *rd, int32_t ms_timeout)
+{
+    ring_hdr *h        = rd->hdr;
+    int64_t   now      = socket_now_ns();
+    int64_t   deadline = ms_timeout < 0 ? INT64_MAX : now + (int64_t)ms_timeout * 1000000;
+    int64_t   spin_end = now + (int64_t)rd->spin_us * 1000;
+
+    if (spin_end > deadline) {
+        spin_end = deadline;
+    }
+    for (;;) {
+        if (__atomic_load_n(&h->head, __ATOMIC_ACQUIRE) != rd->next
+            || __atomic_load_n(&h->closed, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        if (now < spin_end) {
+            cpu_relax();
+            now = socket_now_ns();
+            continue;
+        }
+        if (now >= deadline) {
+            return SOCKET_ERROR;
+        }
+        {
+            struct timespec ts, *pts = NULL;
+            uint32_t        w;
+
+            __atomic_add_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+            w = __atomic_load_n(&h->futex, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&h->head, __ATOMIC_SEQ_CST) == rd->next
+                && !__atomic_load_n(&h->closed, __ATOMIC_SEQ_CST)) {
+                if (deadline != INT64_MAX) {
+                    ts.tv_sec  = (deadline - now) / 1000000000;
+                    ts.tv_nsec = (deadline - now) % 1000000000;
+                    pts        = &ts;
+                }
+                rd->stats.sleeps++;
+                futex(&h->futex, FUTEX_WAIT, w, pts);
+            }
+            __atomic_sub_fetch(&h->waiters, 1, __ATOMIC_SEQ_CST);
+        }
+        now = socket_now_ns();
+    }
+}
+
+int32_t
+xfanin_reader_recv(xfanin_reader *rd, void *data, int32_t len, int32_t *stream, int32_t ms_timeout)
+{
+    const slot *s;
+    uint64_t    head, seq;
+    uint32_t    n, st, flags;
+    int32_t     c;
+
+    for (;;) {
+        head = __atomic_load_n(&rd->hdr->head, __ATOMIC_ACQUIRE);
+        if (rd->next == head) {
+            if (__atomic_load_n(&rd->hdr->closed, __ATOMIC_ACQUIRE)) {
+                return 0;
+            }
+            if (reader_wait(rd, ms_timeout) != 0) {
+                return SOCKET_ERROR;
+            }
+            continue;
+        }
+        if (head - rd->next > rd->mask + 1) {
+            // lapped, skip to the oldest datagram still in the ring
+            rd->stats.lost += head - rd->next - (rd->mask + 1);
+            rd->next        = head - (rd->mask + 1);
+        }
+
+        s   = (const slot *)(rd->data + (size_t)(rd->next & rd->mask) * rd->slot_size);
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq != rd->next + 1) {
+            rd->stats.lost++;       // overwritten since head was read
+            rd->next++;
+            continue;
+        }
+        n     = s->len;
+        st    = s->stream;
+        flags = s->flags;
+        if ((flags & SLOT_SKIP) || (rd->filtered && !rd->want[st & (XFANIN_MAX_STREAMS - 1)])) {
+            rd->next++;
+            continue;
+        }
+        if (n > rd->slot_size - sizeof(slot)) {
+            n = 0;                  // torn, the seq check below catches it
+        }
+        c = (int32_t)n < len ? (int32_t)n : len;
+        memcpy(data, s + 1, (size_t)c);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq) {
+            rd->stats.lost++;
+            rd->next++;
+            continue;
+        }
+        rd->next++;
+        rd->stats.datagrams++;
+        if (stream != NULL) {
+            *stream = (int32_t)st;
+        }
+        return c;
+    }
+}
+
+void
+xfanin_reader_get_stats(xfanin_reader *rd, xfanin_reader_stats *stats)
+{
+    *stats = rd->stats;
+}
+
+void
+xfanin_reader_close(xfanin_reader *rd)
+{
+    if (rd == NULL) {
+        return;
+    }
+    munmap(rd->hdr, rd->hdr_size);
+    munmap((void *)rd->map, rd->size);
+    free(rd);
+}
@@ -0,0 +1,131 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xfanin.h
+ *  @brief    Multicast fan-in: receive each group once for all local readers (Linux)
+ *
+ *  Instead of every process on a host joining the groups it needs, with a
+ *  receive buffer of its own and a copy of every datagram in the kernel,
+ *  one daemon joins each group once and writes the datagrams into a
+ *  broadcast ring in shared memory (/dev/shm/<name>).  Any number of
+ *  reader processes attach to it by name and read it without locks; they
+ *  write to it only to announce that they sleep.  The daemon never waits
+ *  for a reader, a reader that falls a whole ring behind loses the oldest
+ *  datagrams and counts them.
+ *
+ *  The ring has fixed slots of slot_size bytes; a datagram that does not
+ *  fit is dropped by the daemon.  Idle readers spin for spin_us, then
+ *  sleep on a futex in the ring that the daemon wakes only while someone
+ *  sleeps on it.
+ *
+ *  daemon, on its loop thread:
+ *      xfanin *f = xfanin_create(loop, "feeds", NULL);
+ *      xfanin_join(f, "10.0.0.5", "239.1.1.50", 12000);
+ *
+ *  reader, any process on the host:
+ *      xfanin_reader *rd = xfanin_reader_open("feeds", 0);
+ *      xfanin_reader_join(rd, "239.1.1.50", 12000);
+ *      n = xfanin_reader_recv(rd, buf, sizeof(buf), &stream, -1);
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XFANIN_H__
+#define __XFANIN_H__
+
+#include <stdint.h>
+#include "xloop.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XFANIN_MAX_STREAMS  256
+
+typedef struct xfanin xfanin;
+typedef struct xfanin_reader xfanin_reader;
+
+/* ring settings, see xfanin_config_init for the defaults; the daemon runs
+ * on the thread of its loop, placed by the affinity of xloop_config */
+typedef struct xfanin_config {
+    int32_t slots;                  // number of slots, a power of two
+    int32_t slot_size;              // bytes per slot, the largest datagram is 24 less
+    int32_t batch;                  // datagrams per recvmmsg
+    int32_t rcvbuf;                 // receive buffer of each group, 0 for the default
+} xfanin_config;
+
+/* counters of the daemon */
+typedef struct xfanin_stats {
+    int64_t datagrams;              // datagrams written to the ring
+    int64_t bytes;
+    int64_t dropped;                // larger than a slot
+    int64_t syscalls;               // recvmmsg calls that moved datagrams
+    int64_t wakeups;                // futex wakes of sleeping readers
+} xfanin_stats;
+
+/* a group carried by the ring */
+typedef struct xfanin_stream_def {
+    uint16_t port;
+    char     grp[46];
+} xfanin_stream_def;
+
+/* counters of a reader */
+typedef struct xfanin_reader_stats {
+    int64_t datagrams;              // datagrams returned
+    int64_t lost;                   // overwritten before they were read
+    int64_t sleeps;                 // futex waits after the spin
+} xfanin_reader_stats;
+
+/* defaults: 16384 slots of 2048 bytes (32 MB), batches of 64
+ */
+void xfanin_config_init(xfanin_config *cfg);
+
+/* create the ring /dev/shm/<name>, replacing a stale one; cfg NULL for the
+ * defaults; NULL on error
+ */
+xfanin *xfanin_create(xloop *loop, const char *name, const xfanin_config *cfg);
+
+/* join ip_grp:port on interface ip_if and write its datagrams to the
+ * ring; returns the stream number, SOCKET_ERROR on error
+ */
+int32_t xfanin_join(xfanin *f, const char *ip_if, const char *ip_grp, uint16_t port);
+
+/* a copy of the counters
+ */
+void xfanin_get_stats(xfanin *f, xfanin_stats *stats);
+
+/* leave the groups, tell the readers and remove the name; readers keep
+ * their mapping.  The memory goes once the loop has given back the
+ * pending operations
+ */
+void xfanin_destroy(xfanin *f);
+
+/* attach to the ring name, reading from the next datagram on; spin_us
+ * before sleeping when the ring is empty; NULL on error
+ */
+xfanin_reader *xfanin_reader_open(const char *name, int32_t spin_us);
+
+/* receive only ip_grp:port, may be called for several groups; without it
+ * all streams are received; the stream number, SOCKET_ERROR when the
+ * daemon does not carry the group
+ */
+int32_t xfanin_reader_join(xfanin_reader *rd, const char *ip_grp, uint16_t port);
+
+/* the group of a stream, NULL when there is none
+ */
+const xfanin_stream_def *xfanin_reader_stream(xfanin_reader *rd, int32_t stream);
+
+/* receive one datagram into data (cut to len), stream gets its stream
+ * number (may be NULL); waits up to ms_timeout (-1 forever); returns the
+ * bytes copied, 0 when the daemon has gone, SOCKET_ERROR on timeout
+ */
+int32_t xfanin_reader_recv(xfanin_reader *rd, void *data, int32_t len, int32_t *stream,
+                           int32_t ms_timeout);
+
+void xfanin_reader_get_stats(xfanin_reader *rd, xfanin_reader_stats *stats);
+
+void xfanin_reader_close(xfanin_reader *rd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XFANIN_H__
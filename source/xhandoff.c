@@ -0,0 +1,475 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xhandoff.c
+ *  @brief    Hot restart: hand sockets and connections to a new instance (Linux)
+ *
+ *  The control connection is a Unix stream socket.  Every message is a
+ *  16-byte header (magic, type, tag, state length) followed by the state;
+ *  the descriptor of an item rides on the header as SCM_RIGHTS.  The
+ *  receiver reads the header and the state with exact lengths, never
+ *  past the end of a message, so the descriptor arrives with the first
+ *  read of its header.
+ *
+ *      new -> old  HELLO   tag is the protocol version
+ *      old -> new  item    LISTENER, CONN or SOCKET with one descriptor
+ *      old -> new  END
+ *      new -> old  ACK
+ *
+ *  Both sides use non-blocking calls and poll against a deadline, so a
+ *  stuck peer costs a timeout, not a hang.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xhandoff.h"
+#include "xsocket_int.h"
+
+#define HANDOFF_MAGIC   0x58484f31u // "XHO1"
+#define HANDOFF_VERSION 1
+#define MSG_HELLO       0x10
+#define MSG_END         0x11
+#define MSG_ACK         0x12
+#define IO_MS           5000        // for items passed from loop callbacks
+#define MAX_STATE       (64 << 20)
+#define MAX_FDS         4           // room for descriptors a bad peer sends along
+
+/* the head of every message */
+typedef struct msg_hdr {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t tag;
+    uint32_t len;                   // state bytes that follow
+} msg_hdr;
+
+struct xhandoff {
+    socket_t       fd;              // control connection
+    int32_t        pending;         // connections being detached
+    int32_t        failed;
+    int32_t        closed;
+    int32_t        done;            // END sent or received
+    char          *buf;             // state of the last item taken
+    int32_t        cap;
+    xhandoff_stats stats;
+};
+
+/* a connection on its way out */
+typedef struct give_ctx {
+    xhandoff *h;
+    uint32_t  tag;
+} give_ctx;
+
+// ---------------------------------------------------------------------------
+// Function   : the deadline of a timeout, 0 for none
+// ---------------------------------------------------------------------------
+static int64_t
+deadline_of(int32_t ms_timeout)
+{
+    return ms_timeout < 0 ? 0 : socket_now_ns() + (int64_t)ms_timeout * 1000000;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait until the control socket is ready for events
+// Return     : zero when ready, SOCKET_ERROR on error or at the deadline
+// ---------------------------------------------------------------------------
+static int32_t
+wait_io(socket_t fd, short events, int64_t deadline)
+{
+    struct pollfd p;
+    int           ms = -1, n;
+
+    p.fd     = fd;
+    p.events = events;
+    if (deadline != 0) {
+        int64_t left = deadline - socket_now_ns();
+        if (left <= 0) {
+            errno = ETIMEDOUT;
+            return SOCKET_ERROR;
+        }
+        ms = (int)((left + 999999) / 1000000);
+    }
+    while ((n = poll(&p, 1, ms)) < 0 && errno == EINTR) {
+    }
+    if (n == 0) {
+        errno = ETIMEDOUT;
+    }
+    return n > 0 ? 0 : SOCKET_ERROR;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : send one message
+// Parameters :
+//      [in ] : fd    - descriptor to pass, -1 for none
+//            : state - bytes after the header
+// Return     : zero on success, SOCKET_ERROR on error or timeout
+// Marks      : the descriptor goes with the first bytes, a short send is
+//              continued without it
+// ---------------------------------------------------------------------------
+static int32_t
+send_msg(socket_t sock, uint32_t type, uint32_t tag, int fd, const void *state, int32_t len,
+         int32_t ms_timeout)
+{
+    msg_hdr         hdr;
+    char            cbuf[CMSG_SPACE(sizeof(int))];
+    struct iovec    iov[2];
+    struct msghdr   msg;
+    struct cmsghdr *cm;
+    int64_t         deadline = deadline_of(ms_timeout);
+    size_t          total = sizeof(hdr) + (size_t)len, off = 0;
+    ssize_t         n;
+
+    hdr.magic = HANDOFF_MAGIC;
+    hdr.type  = type;
+    hdr.tag   = tag;
+    hdr.len   = (uint32_t)len;
+    while (off < total) {
+        int k = 0;
+
+        memset(&msg, 0, sizeof(msg));
+        if (off < sizeof(hdr)) {
+            iov[k].iov_base = (char *)&hdr + off;
+            iov[k].iov_len  = sizeof(hdr) - off;
+            k++;
+        }
+        if (len > 0) {
+            size_t skip = off > sizeof(hdr) ? off - sizeof(hdr) : 0;
+            iov[k].iov_base = (char *)state + skip;
+            iov[k].iov_len  = (size_t)len - skip;
+            k++;
+        }
+        msg.msg_iov    = iov;
+        msg.msg_iovlen = k;
+        if (off == 0 && fd >= 0) {
+            memset(cbuf, 0, sizeof(cbuf));
+            msg.msg_control    = cbuf;
+            msg.msg_controllen = sizeof(cbuf);
+            cm             = CMSG_FIRSTHDR(&msg);
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type  = SCM_RIGHTS;
+            cm->cmsg_len   = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+        }
+        if ((n = sendmsg(sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT)) >= 0) {
+            off += (size_t)n;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (wait_io(sock, POLLOUT, deadline) != 0) {
+                return SOCKET_ERROR;
+            }
+        } else if (errno != EINTR) {
+            return SOCKET_ERROR;
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : receive exactly len bytes
+// Parameters :
+//      [out] : fdp - the descriptor that came along, may be NULL; it is
+//                    set only when one arrives
+// Return     : zero on success, SOCKET_ERROR on error, timeout or when the
+//              peer closed
+// Marks      : descriptors beyond the first are closed
+// ---------------------------------------------------------------------------
+static int32_t
+recv_exact(socket_t sock, void *data, int32_t len, int *fdp, int64_t deadline)
+{
+    char            cbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cm;
+    int32_t         got = 0;
+    ssize_t         n;
+
+    while (got < len) {
+        memset(&msg, 0, sizeof(msg));
+        iov.iov_base       = (char *)data + got;
+        iov.iov_len        = (size_t)(len - got);
+        msg.msg_iov        = &iov;
+        msg.msg_iovlen     = 1;
+        msg.msg_control    = cbuf;
+        msg.msg_controllen = sizeof(cbuf);
+        if ((n = recvmsg(sock, &msg, MSG_DONTWAIT | MSG_CMSG_CLOEXEC)) > 0) {
+            for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+                int    fds[MAX_FDS];
+                size_t i, nfds;
+
+                if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+                    continue;
+                }
+                nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                memcpy(fds, CMSG_DATA(cm), (nfds < MAX_FDS ? nfds : MAX_FDS) * sizeof(int));
+                for (i = 0; i < nfds && i < MAX_FDS; i++) {
+                    if (fdp != NULL && *fdp < 0) {
+                        *fdp = fds[i];
+                    } else {
+                        close(fds[i]);
+                    }
+                }
+            }
+            got += (int32_t)n;
+        } else if (n == 0) {
+            errno = ECONNRESET;
+            return SOCKET_ERROR;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (wait_io(sock, POLLIN, deadline) != 0) {
+                return SOCKET_ERROR;
+            }
+        } else if (errno != EINTR) {
+            return SOCKET_ERROR;
+        }
+    }
+    return 0;
+}
+
+static xhandoff *
+handoff_new(socket_t sock)
+{
+    xhandoff *h;
+
+    if ((h = (xhandoff *)calloc(1, sizeof(xhandoff))) == NULL) {
+        socket_close(sock);
+        return NULL;
+    }
+    h->fd = sock;
+    return h;
+}
+
+static void
+handoff_free(xhandoff *h)
+{
+    free(h->buf);
+    free(h);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait for the new instance on the control listener
+// Parameters :
+//      [in ] : listen_fd  - listener on a "unix:" address
+//            : ms_timeout - for the connection and its greeting
+//      [out] : none
+// Return     : the handoff, NULL on error or timeout
+// ---------------------------------------------------------------------------
+xhandoff *
+xhandoff_accept(socket_t listen_fd, int32_t ms_timeout)
+{
+    int64_t  deadline = deadline_of(ms_timeout);
+    socket_t sock;
+    msg_hdr  hdr;
+
+    if ((sock = socket_create_tcp_server(listen_fd, ms_timeout)) == INVALID_SOCKET) {
+        return NULL;
+    }
+    if (recv_exact(sock, &hdr, sizeof(hdr), NULL, deadline) != 0
+        || hdr.magic != HANDOFF_MAGIC || hdr.type != MSG_HELLO || hdr.len != 0) {
+        xs_printf("[xhandoff] no greeting from the new instance\n");
+        socket_close(sock);
+        return NULL;
+    }
+    if (hdr.tag != HANDOFF_VERSION) {
+        xs_printf("[xhandoff] the new instance speaks version %u, not %d\n", hdr.tag, HANDOFF_VERSION);
+        socket_close(sock);
+        return NULL;
+    }
+    return handoff_new(sock);
+}
+
+int32_t
+xhandoff_give(xhandoff *h, xhandoff_type type, socket_t fd, uint32_t tag,
+              const void *state, int32_t len)
+{
+    if (h->failed || h->done || h->closed || fd == INVALID_SOCKET
+        || type < XHANDOFF_LISTENER || type > XHANDOFF_SOCKET
+        || len < 0 || len > MAX_STATE || (len > 0 && state == NULL)) {
+        return SOCKET_ERROR;
+    }
+    if (send_msg(h->fd, (uint32_t)type, tag, fd, state, len, IO_MS) != 0) {
+        xs_printf("[xhandoff] cannot pass socket %d: %s\n", fd, strerror(errno));
+        h->failed = 1;
+        return SOCKET_ERROR;
+    }
+    h->stats.items++;
+    h->stats.conns += type == XHANDOFF_CONN;
+    h->stats.state_bytes += len;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : pass a connection that xconn_detach has stopped
+// Marks      : this instance's descriptor is closed either way, the
+//              socket lives on in the new instance
+// ---------------------------------------------------------------------------
+static void
+conn_ready(void *arg, socket_t fd, const void *state, int32_t len)
+{
+    give_ctx *g = (give_ctx *)arg;
+    xhandoff *h = g->h;
+
+    h->pending--;
+    if (fd == INVALID_SOCKET) {
+        h->stats.lost++;
+    } else {
+        if (!h->closed) {
+            xhandoff_give(h, XHANDOFF_CONN, fd, g->tag, state, len);
+        }
+        socket_close(fd);
+    }
+    free(g);
+    if (h->closed && h->pending == 0) {
+        handoff_free(h);
+    }
+}
+
+int32_t
+xhandoff_give_conn(xhandoff *h, xconn *c, uint32_t tag)
+{
+    give_ctx *g;
+
+    if (h->failed || h->done || h->closed || (g = (give_ctx *)malloc(sizeof(give_ctx))) == NULL) {
+        return SOCKET_ERROR;
+    }
+    g->h   = h;
+    g->tag = tag;
+    h->pending++;
+    if (xconn_detach(c, conn_ready, g) != 0) {
+        h->pending--;
+        free(g);
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+int32_t
+xhandoff_pending(xhandoff *h)
+{
+    return h->pending;
+}
+
+int32_t
+xhandoff_finish(xhandoff *h, int32_t ms_timeout)
+{
+    msg_hdr hdr;
+
+    if (h->failed || h->done || h->closed || h->pending > 0) {
+        return SOCKET_ERROR;
+    }
+    h->done = 1;
+    if (send_msg(h->fd, MSG_END, 0, -1, NULL, 0, ms_timeout) != 0
+        || recv_exact(h->fd, &hdr, sizeof(hdr), NULL, deadline_of(ms_timeout)) != 0
+        || hdr.magic != HANDOFF_MAGIC || hdr.type != MSG_ACK) {
+        xs_printf("[xhandoff] the new instance did not acknowledge the handoff\n");
+        h->failed = 1;
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : connect to the old instance and greet it
+// Parameters :
+//      [in ] : addr       - its control address, "unix:/path"
+//            : ms_timeout - for the greeting
+//      [out] : none
+// Return     : the handoff, NULL on error or timeout
+// ---------------------------------------------------------------------------
+xhandoff *
+xhandoff_connect(const char *addr, int32_t ms_timeout)
+{
+    socket_t sock;
+
+    if ((sock = socket_create_tcp_client(addr, 0)) == INVALID_SOCKET) {
+        return NULL;
+    }
+    if (send_msg(sock, MSG_HELLO, HANDOFF_VERSION, -1, NULL, 0, ms_timeout) != 0) {
+        xs_printf("[xhandoff] cannot greet %s: %s\n", addr, strerror(errno));
+        socket_close(sock);
+        return NULL;
+    }
+    return handoff_new(sock);
+}
+
+int32_t
+xhandoff_take(xhandoff *h, xhandoff_item *item, int32_t ms_timeout)
+{
+    int64_t deadline = deadline_of(ms_timeout);
+    msg_hdr hdr;
+    int     fd = -1;
+
+    if (h->done) {
+        return 0;
+    }
+    if (h->failed || h->closed) {
+        return SOCKET_ERROR;
+    }
+    if (recv_exact(h->fd, &hdr, sizeof(hdr), &fd, deadline) != 0
+        || hdr.magic != HANDOFF_MAGIC || hdr.len > MAX_STATE) {
+        goto fail;
+    }
+    if (hdr.type == MSG_END) {
+        h->done = 1;
+        if (fd >= 0) {
+            close(fd);
+        }
+        return send_msg(h->fd, MSG_ACK, 0, -1, NULL, 0, ms_timeout) == 0 ? 0 : SOCKET_ERROR;
+    }
+    if (fd < 0 || hdr.type < XHANDOFF_LISTENER || hdr.type > XHANDOFF_SOCKET) {
+        goto fail;
+    }
+    if ((int32_t)hdr.len > h->cap) {
+        char *p = (char *)realloc(h->buf, hdr.len);
+        if (p == NULL) {
+            goto fail;
+        }
+        h->buf = p;
+        h->cap = (int32_t)hdr.len;
+    }
+    if (recv_exact(h->fd, h->buf, (int32_t)hdr.len, NULL, deadline) != 0) {
+        goto fail;
+    }
+    item->type  = (xhandoff_type)hdr.type;
+    item->tag   = hdr.tag;
+    item->fd    = fd;
+    item->state = h->buf;
+    item->len   = (int32_t)hdr.len;
+    h->stats.items++;
+    h->stats.conns += hdr.type == XHANDOFF_CONN;
+    h->stats.state_bytes += hdr.len;
+    return 1;
+
+fail:
+    xs_printf("[xhandoff] handoff broken off: %s\n", strerror(errno));
+    if (fd >= 0) {
+        close(fd);
+    }
+    h->failed = 1;
+    return SOCKET_ERROR;
+}
+
+void
+xhandoff_get_stats(xhandoff *h, xhandoff_stats *stats)
+{
+    *stats = h->stats;
+}
+
+void
+xhandoff_close(xhandoff *h)
+{
+    if (h == NULL || h->closed) {
+        return;
+    }
+    socket_close(h->fd);
+    h->fd     = INVALID_SOCKET;
+    h->closed = 1;
+    if (h->pending == 0) {
+        handoff_free(h);
+    }
+}
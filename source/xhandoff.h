@@ -0,0 +1,124 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xhandoff.h
+ *  @brief    Hot restart: hand sockets and connections to a new instance (Linux)
+ *
+ *  A new instance of a server takes over the listening sockets and the
+ *  open connections of the running one, so a deploy neither drops a
+ *  connection nor leaves a gap in which nobody accepts.  The old instance
+ *  listens on a control address ("unix:/run/app.handoff"); the new one
+ *  connects to it, and the old instance passes each socket with
+ *  SCM_RIGHTS together with its state, then an end marker, which the new
+ *  instance acknowledges before the old one exits.
+ *
+ *  Framed connections (xconn) travel with their framing state: received
+ *  bytes not dispatched yet and frames not sent yet are carried over, so
+ *  no frame is lost or cut.  Listeners and other sockets travel with an
+ *  optional blob of the caller's own state.
+ *
+ *  old instance, on its loop thread, once the control listener is readable:
+ *      xhandoff *h = xhandoff_accept(ctl, 5000);
+ *      xloop_detach(loop, lfd);                    // stop accepting
+ *      xhandoff_give(h, XHANDOFF_LISTENER, lfd, 0, NULL, 0);
+ *      for each connection: xhandoff_give_conn(h, c, id);
+ *      while (xhandoff_pending(h) > 0) xloop_run_once(loop, 10);
+ *      if (xhandoff_finish(h, 5000) == 0) exit
+ *
+ *  new instance, before it would open its own sockets:
+ *      xhandoff *h = xhandoff_connect("unix:/run/app.handoff", 5000);
+ *      while ((n = xhandoff_take(h, &it, 5000)) > 0)
+ *          XHANDOFF_CONN: xconn_resume(loop, it.fd, cfg, it.state, it.len, ...)
+ *
+ *  The old instance keeps its own copy of a listener and closes it after
+ *  xhandoff_finish; a connection given with xhandoff_give_conn is gone
+ *  from the old instance once it has been sent.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XHANDOFF_H__
+#define __XHANDOFF_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+#include "xconn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xhandoff xhandoff;
+
+typedef enum xhandoff_type {
+    XHANDOFF_LISTENER = 1,          // a listening socket
+    XHANDOFF_CONN,                  // an xconn connection, state from xconn_detach
+    XHANDOFF_SOCKET                 // any other socket, state is the caller's
+} xhandoff_type;
+
+/* one socket received by xhandoff_take */
+typedef struct xhandoff_item {
+    xhandoff_type type;
+    uint32_t      tag;              // the caller's number, passed through
+    socket_t      fd;               // owned by the receiver from now on
+    const void   *state;            // valid until the next xhandoff_take
+    int32_t       len;
+} xhandoff_item;
+
+/* counters of a handoff, on either side */
+typedef struct xhandoff_stats {
+    int64_t items;                  // sockets passed
+    int64_t conns;                  // of them xconn connections
+    int64_t state_bytes;
+    int64_t lost;                   // connections that failed while detaching
+} xhandoff_stats;
+
+/* old instance: accept the new instance on the control listener (created
+ * with socket_create_tcp_listen on a "unix:" address); NULL on error or
+ * timeout
+ */
+xhandoff *xhandoff_accept(socket_t listen_fd, int32_t ms_timeout);
+
+/* pass a socket with len bytes of state (may be 0); the caller keeps its
+ * own descriptor.  Zero on success, SOCKET_ERROR on error
+ */
+int32_t xhandoff_give(xhandoff *h, xhandoff_type type, socket_t fd, uint32_t tag,
+                      const void *state, int32_t len);
+
+/* detach a connection and pass it once its batch in flight has been sent;
+ * runs through the loop of c, see xhandoff_pending.  Zero when started,
+ * SOCKET_ERROR on error (the connection is left alone)
+ */
+int32_t xhandoff_give_conn(xhandoff *h, xconn *c, uint32_t tag);
+
+/* connections given that have not been passed yet
+ */
+int32_t xhandoff_pending(xhandoff *h);
+
+/* send the end marker and wait up to ms_timeout for the new instance to
+ * acknowledge it; zero when the new instance has taken everything over,
+ * SOCKET_ERROR otherwise
+ */
+int32_t xhandoff_finish(xhandoff *h, int32_t ms_timeout);
+
+/* new instance: connect to the old instance's control address; NULL on
+ * error or timeout
+ */
+xhandoff *xhandoff_connect(const char *addr, int32_t ms_timeout);
+
+/* receive the next socket, waiting up to ms_timeout; 1 with item filled
+ * in, 0 after the end marker (acknowledged), SOCKET_ERROR on error or
+ * timeout
+ */
+int32_t xhandoff_take(xhandoff *h, xhandoff_item *item, int32_t ms_timeout);
+
+void xhandoff_get_stats(xhandoff *h, xhandoff_stats *stats);
+
+/* close the control connection; connections still being detached are
+ * closed when they are ready instead of passed
+ */
+void xhandoff_close(xhandoff *h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XHANDOFF_H__
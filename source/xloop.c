@@ -0,0 +1,849 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xloop.c
+ *  @brief    Event loop with completion callbacks for xsocket (Linux)
+ *
+ *  The loop core and the epoll backend.
+ *
+ *  epoll: every socket is registered once, edge-triggered for both
+ *  directions, so posting and completing operations costs no epoll_ctl.
+ *  An operation is tried at once when its socket was last seen ready and
+ *  queued when the call would block; edges drain the queues.
+ *
+ *  Completed operations go to a list whose callbacks run at the end of each
+ *  loop round, never from inside the posting call.  Multishot operations
+ *  call back once per result while their socket is drained.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "xloop_int.h"
+
+#define MAX_EVENTS  256             // events taken per epoll_wait
+#define WAKE_TAG    ((uint64_t)-1)  // epoll data of the eventfd, no socket has it
+
+/* state of the epoll backend */
+typedef struct ep_state {
+    int      epfd;
+    char    *scratch;               // multishot receive buffer
+    int32_t *kick;                  // sockets with a multishot operation to start
+    int32_t  nkick;
+    int32_t  cap_kick;
+} ep_state;
+
+/* result of try_op */
+enum {
+    TRY_BLOCKED = 0,                // would block, keep it queued
+    TRY_DONE,                       // completed, pop it
+    TRY_GONE                        // removed by its own callback
+};
+
+// ---------------------------------------------------------------------------
+// loop core
+
+void
+xloop_config_init(xloop_config *cfg)
+{
+    cfg->backend       = XLOOP_BACKEND_AUTO;
+    cfg->entries       = 1024;
+    cfg->buf_count     = 256;
+    cfg->buf_size      = 16 << 10;
+    cfg->timer_tick_us = 1000;
+    xthread_affinity_init(&cfg->affinity);
+}
+
+xloop *
+xloop_create(void)
+{
+    return xloop_create_ex(NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create an event loop
+// Parameters :
+//      [in ] : cfg - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the loop, or NULL on error
+// Marks      : AUTO tries io_uring first and falls back to epoll
+// ---------------------------------------------------------------------------
+xloop *
+xloop_create_ex(const xloop_config *cfg)
+{
+    xloop *loop;
+
+    if ((loop = (xloop *)calloc(1, sizeof(xloop))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        loop->cfg = *cfg;
+    } else {
+        xloop_config_init(&loop->cfg);
+    }
+    if (loop->cfg.buf_count <= 0 || (loop->cfg.buf_count & (loop->cfg.buf_count - 1)) != 0
+        || loop->cfg.buf_count > 32768 || loop->cfg.buf_size <= 0 || loop->cfg.entries <= 0) {
+        free(loop);
+        return NULL;
+    }
+    // the CPU list is applied later by the loop thread, keep a copy of it
+    if (loop->cfg.affinity.cpus != NULL && (loop->cpus = strdup(loop->cfg.affinity.cpus)) == NULL) {
+        free(loop);
+        return NULL;
+    }
+    loop->cfg.affinity.cpus = loop->cpus;
+    if ((loop->timers = xtimer_wheel_create(loop->cfg.timer_tick_us, socket_now_ns())) == NULL) {
+        free(loop->cpus);
+        free(loop);
+        return NULL;
+    }
+    if ((loop->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        xtimer_wheel_destroy(loop->timers);
+        free(loop->cpus);
+        free(loop);
+        return NULL;
+    }
+    pthread_mutex_init(&loop->lock, NULL);
+
+    switch (loop->cfg.backend) {
+    case XLOOP_BACKEND_URING:
+        loop->be = &xloop_backend_uring;
+        break;
+    case XLOOP_BACKEND_EPOLL:
+        loop->be = &xloop_backend_epoll;
+        break;
+    default:
+        loop->be = &xloop_backend_uring;
+        if (loop->be->init(loop) == 0) {
+            return loop;
+        }
+        loop->be = &xloop_backend_epoll;
+        break;
+    }
+    if (loop->be->init(loop) == 0) {
+        return loop;
+    }
+
+    pthread_mutex_destroy(&loop->lock);
+    close(loop->evfd);
+    xtimer_wheel_destroy(loop->timers);
+    free(loop->cpus);
+    free(loop);
+    return NULL;
+}
+
+void
+xloop_destroy(xloop *loop)
+{
+    if (loop == NULL) {
+        return;
+    }
+    loop->be->fini(loop);
+    close(loop->evfd);
+    pthread_mutex_destroy(&loop->lock);
+    xtimer_wheel_destroy(loop->timers);
+    free(loop->fds);
+    free(loop->cpus);
+    free(loop);
+}
+
+const char *
+xloop_backend_name(xloop *loop)
+{
+    return loop->be->name;
+}
+
+xloop_fd *
+xloop_get_fd(xloop *loop, socket_t fd)
+{
+    if ((int)fd < 0) {
+        return NULL;
+    }
+    if ((int32_t)fd >= loop->nfds) {
+        int32_t   n = loop->nfds ? loop->nfds : 64;
+        xloop_fd *fds;
+
+        while (n <= (int32_t)fd) {
+            n *= 2;
+        }
+        if ((fds = (xloop_fd *)realloc(loop->fds, n * sizeof(xloop_fd))) == NULL) {
+            return NULL;
+        }
+        memset(fds + loop->nfds, 0, (n - loop->nfds) * sizeof(xloop_fd));
+        loop->fds  = fds;
+        loop->nfds = n;
+    }
+    return &loop->fds[fd];
+}
+
+xloop_fd *
+xloop_find_fd(xloop *loop, socket_t fd)
+{
+    if ((int)fd < 0 || (int32_t)fd >= loop->nfds || !loop->fds[fd].registered) {
+        return NULL;
+    }
+    return &loop->fds[fd];
+}
+
+// ---------------------------------------------------------------------------
+// Function   : get the state of a socket, switching it to non-blocking mode
+//              on first use
+// Return     : the state, or NULL on error
+// ---------------------------------------------------------------------------
+static xloop_fd *
+use_fd(xloop *loop, socket_t fd)
+{
+    xloop_fd *f = xloop_get_fd(loop, fd);
+    int flags;
+
+    if (f == NULL || f->registered) {
+        return f;
+    }
+    if ((flags = fcntl(fd, F_GETFL, 0)) < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return NULL;
+    }
+    return f;
+}
+
+static void
+set_op(xloop_op *op, xloop_op_type type, socket_t fd, void *buf, int32_t len,
+       xloop_cb cb, void *user)
+{
+    op->type   = type;
+    op->fd     = fd;
+    op->buf    = buf;
+    op->len    = len;
+    op->done   = 0;
+    op->result = 0;
+    op->err    = 0;
+    op->flags  = 0;
+    op->cb     = cb;
+    op->user   = user;
+    op->next   = NULL;
+}
+
+static int32_t
+submit(xloop *loop, xloop_op *op)
+{
+    if (use_fd(loop, op->fd) == NULL) {
+        return SOCKET_ERROR;
+    }
+    return loop->be->submit(loop, op);
+}
+
+int32_t
+xloop_recv(xloop *loop, xloop_op *op, socket_t fd, void *buf, int32_t len,
+           xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_RECV, fd, buf, len, cb, user);
+    return submit(loop, op);
+}
+
+int32_t
+xloop_send(xloop *loop, xloop_op *op, socket_t fd, const void *buf, int32_t len,
+           xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_SEND, fd, (void *)buf, len, cb, user);
+    return submit(loop, op);
+}
+
+int32_t
+xloop_sendv(xloop *loop, xloop_op *op, socket_t fd, struct iovec *iov, int32_t iovcnt,
+            xloop_cb cb, void *user)
+{
+    if (iovcnt < 0 || (iovcnt > 0 && iov == NULL)) {
+        errno = EINVAL;
+        return SOCKET_ERROR;
+    }
+    set_op(op, XLOOP_OP_SENDV, fd, iov, iovcnt, cb, user);
+    xloop_iov_advance(op, 0);       // drop leading empty entries
+    return submit(loop, op);
+}
+
+int32_t
+xloop_accept(xloop *loop, xloop_op *op, socket_t listen_fd, xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_ACCEPT, listen_fd, NULL, 0, cb, user);
+    return submit(loop, op);
+}
+
+int32_t
+xloop_recv_multi(xloop *loop, xloop_op *op, socket_t fd, xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_RECV_MULTI, fd, NULL, loop->cfg.buf_size, cb, user);
+    return submit(loop, op);
+}
+
+int32_t
+xloop_accept_multi(xloop *loop, xloop_op *op, socket_t listen_fd, xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_ACCEPT_MULTI, listen_fd, NULL, 0, cb, user);
+    return submit(loop, op);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : start a non-blocking connect to a TCP server
+// Parameters :
+//      [in ] : loop          - the loop
+//            : op            - the operation
+//            : s_server_addr - the IP address of the server
+//            : port          - the port of the server
+//            : opts          - socket options, NULL for none
+//            : cb, user      - completion callback and its context
+//      [out] : none
+// Return     : zero when posted, SOCKET_ERROR on error
+// Marks      : a connect refused at once still completes through cb; the
+//              backend waits for the socket to become writable
+// ---------------------------------------------------------------------------
+int32_t
+xloop_connect(xloop *loop, xloop_op *op, const char *s_server_addr, const uint16_t port,
+              const socket_opts *opts, xloop_cb cb, void *user)
+{
+    socket_t fd;
+    int32_t  err;
+
+    if ((fd = socket_connect_nb(s_server_addr, port, opts, &err)) == INVALID_SOCKET) {
+        return SOCKET_ERROR;
+    }
+    set_op(op, XLOOP_OP_CONNECT, fd, NULL, 0, cb, user);
+
+    if (err == 0) {
+        if (submit(loop, op) != 0) {
+            close(fd);
+            return SOCKET_ERROR;
+        }
+        return 0;
+    }
+    op->fd = INVALID_SOCKET;
+    xloop_complete(loop, op, SOCKET_ERROR, err);
+    close(fd);
+    return 0;
+}
+
+int32_t
+xloop_register_buffer(xloop *loop, void *base, size_t len)
+{
+    return loop->be->register_buffer(loop, base, len);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : cancel the operations of a socket and forget it
+// Parameters :
+//      [in ] : loop - the loop
+//            : fd   - the socket
+//      [out] : none
+// Return     : none
+// Marks      : queued operations complete with ECANCELED in this round,
+//              operations the kernel holds (io_uring) once it gives them back
+// ---------------------------------------------------------------------------
+void
+xloop_detach(xloop *loop, socket_t fd)
+{
+    xloop_fd *f = xloop_find_fd(loop, fd);
+    xloop_op *op;
+
+    if (f == NULL) {
+        return;
+    }
+    loop->be->detach(loop, fd);
+
+    while ((op = queue_pop(&f->rq)) != NULL) {
+        if (!(op->flags & XLOOP_F_INFLIGHT)) {
+            xloop_complete(loop, op, SOCKET_ERROR, ECANCELED);
+        }
+    }
+    while ((op = queue_pop(&f->wq)) != NULL) {
+        if (op->type == XLOOP_OP_CONNECT) {
+            close(op->fd);          // never handed out
+        }
+        if (!(op->flags & XLOOP_F_INFLIGHT)) {
+            xloop_complete(loop, op, SOCKET_ERROR, ECANCELED);
+        }
+    }
+    memset(f, 0, sizeof(*f));
+}
+
+void
+xloop_close(xloop *loop, socket_t fd)
+{
+    xloop_fd *f = xloop_find_fd(loop, fd);
+    int connecting = 0;
+
+    // a pending connect owns its socket, xloop_detach closes it
+    if (f != NULL && f->wq.head != NULL) {
+        connecting = f->wq.head->type == XLOOP_OP_CONNECT;
+    }
+    xloop_detach(loop, fd);
+    if (!connecting) {
+        socket_close(fd);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : hand an operation over to the loop thread
+// Return     : zero on success, SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+int32_t
+xloop_post(xloop *loop, xloop_op *op, xloop_cb cb, void *user)
+{
+    uint64_t one = 1;
+    int      wake;
+
+    set_op(op, XLOOP_OP_POST, INVALID_SOCKET, NULL, 0, cb, user);
+
+    pthread_mutex_lock(&loop->lock);
+    wake = loop->posted.head == NULL;
+    queue_push(&loop->posted, op);
+    pthread_mutex_unlock(&loop->lock);
+
+    // one wake-up per batch, the loop takes the whole list
+    if (wake && write(loop->evfd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+void
+xloop_defer(xloop *loop, xloop_op *op, xloop_cb cb, void *user)
+{
+    set_op(op, XLOOP_OP_POST, INVALID_SOCKET, NULL, 0, cb, user);
+    xloop_complete(loop, op, 0, 0);
+}
+
+void
+xloop_take_posted(xloop *loop)
+{
+    uint64_t  v;
+    xloop_op *op;
+
+    if (read(loop->evfd, &v, sizeof(v)) < 0) {
+        // nothing to read, a post raced with the previous round
+    }
+    pthread_mutex_lock(&loop->lock);
+    op = loop->posted.head;
+    loop->posted.head = loop->posted.tail = NULL;
+    pthread_mutex_unlock(&loop->lock);
+
+    while (op != NULL) {
+        xloop_op *next = op->next;
+        xloop_complete(loop, op, 0, 0);
+        op = next;
+    }
+}
+
+void
+xloop_timer_start(xloop *loop, xtimer *t, int64_t delay_us)
+{
+    xtimer_start(loop->timers, t, delay_us);
+}
+
+void
+xloop_timer_stop(xloop *loop, xtimer *t)
+{
+    xtimer_stop(loop->timers, t);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : one round of the loop: wait, run ready operations, callbacks
+// Parameters :
+//      [in ] : loop       - the loop
+//            : ms_timeout - maximum wait in milliseconds, -1 for ever
+//      [out] : none
+// Return     : number of callbacks run, SOCKET_ERROR on error
+// Marks      : callbacks completed during this round run in the next one,
+//              so a callback that reposts at once cannot starve the sockets;
+//              the wait ends early for the next timer, the timers that are
+//              due run right after it
+// ---------------------------------------------------------------------------
+int32_t
+xloop_run_once(xloop *loop, int32_t ms_timeout)
+{
+    op_queue ready;
+    xloop_op *op;
+    int64_t  next_us;
+    int32_t  count = 0;
+
+    if (!loop->placed) {
+        loop->placed = 1;           // on the thread that runs the loop
+        xthread_apply(&loop->cfg.affinity, "xloop");
+    }
+    if (loop->done.head != NULL) {
+        ms_timeout = 0;
+    }
+    if ((next_us = xtimer_next_us(loop->timers, socket_now_ns())) >= 0) {
+        int64_t ms = (next_us + 999) / 1000;
+        if (ms_timeout < 0 || ms < ms_timeout) {
+            ms_timeout = (int32_t)ms;
+        }
+    }
+    if (loop->be->wait(loop, ms_timeout) < 0) {
+        return SOCKET_ERROR;
+    }
+    count += xtimer_advance(loop->timers, socket_now_ns());
+
+    ready = loop->done;
+    loop->done.head = loop->done.tail = NULL;
+    while ((op = queue_pop(&ready)) != NULL) {
+        op->cb(op, op->result);
+        count++;
+    }
+    return count;
+}
+
+int32_t
+xloop_run(xloop *loop)
+{
+    while (!loop->stop) {
+        if (xloop_run_once(loop, -1) < 0) {
+            return SOCKET_ERROR;
+        }
+    }
+    loop->stop = 0;
+    return 0;
+}
+
+void
+xloop_stop(xloop *loop)
+{
+    uint64_t one = 1;
+
+    loop->stop = 1;
+    if (write(loop->evfd, &one, sizeof(one)) < 0) {
+        // the counter is full, the loop is awake anyway
+    }
+}
+
+// ---------------------------------------------------------------------------
+// epoll backend
+
+static int32_t
+ep_init(xloop *loop)
+{
+    struct epoll_event ev;
+    ep_state *ep;
+
+    if ((ep = (ep_state *)calloc(1, sizeof(ep_state))) == NULL) {
+        return -1;
+    }
+    ep->epfd    = epoll_create1(EPOLL_CLOEXEC);
+    ep->scratch = (char *)malloc(loop->cfg.buf_size);
+    if (ep->epfd < 0 || ep->scratch == NULL) {
+        goto fail;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u64 = WAKE_TAG;
+    if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, loop->evfd, &ev) != 0) {
+        goto fail;
+    }
+    loop->be_data = ep;
+    return 0;
+
+fail:
+    if (ep->epfd >= 0) {
+        close(ep->epfd);
+    }
+    free(ep->scratch);
+    free(ep);
+    return -1;
+}
+
+static void
+ep_fini(xloop *loop)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+
+    close(ep->epfd);
+    free(ep->scratch);
+    free(ep->kick);
+    free(ep);
+}
+
+static int
+ep_still_head(xloop *loop, xloop_op *op)
+{
+    xloop_fd *f = xloop_find_fd(loop, op->fd);
+    return f != NULL && f->rq.head == op;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run an operation as far as the socket allows
+// Return     : TRY_BLOCKED, TRY_DONE or TRY_GONE
+// ---------------------------------------------------------------------------
+static int
+ep_try(xloop *loop, xloop_op *op)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+    int n;
+
+    for (;;) {
+        switch (op->type) {
+        case XLOOP_OP_RECV:
+            n = (int)recv(op->fd, op->buf, op->len, 0);
+            break;
+        case XLOOP_OP_ACCEPT:
+            n = accept4(op->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            break;
+        case XLOOP_OP_SEND:
+            n = (int)send(op->fd, (char *)op->buf + op->done, op->len - op->done, MSG_NOSIGNAL);
+            if (n >= 0 && (op->done += n) < op->len) {
+                continue;           // short write, the rest may still fit
+            }
+            n = n >= 0 ? op->len : n;
+            break;
+        case XLOOP_OP_SENDV: {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov    = (struct iovec *)op->buf;
+            msg.msg_iovlen = op->len < IOV_MAX ? op->len : IOV_MAX;
+            n = op->len > 0 ? (int)sendmsg(op->fd, &msg, MSG_NOSIGNAL) : 0;
+            if (n >= 0 && xloop_iov_advance(op, (size_t)n)) {
+                continue;           // short write or more than IOV_MAX entries
+            }
+            n = n >= 0 ? op->done : n;
+            break;
+        }
+        case XLOOP_OP_RECV_MULTI:
+            if ((n = (int)recv(op->fd, ep->scratch, loop->cfg.buf_size, 0)) > 0) {
+                op->buf = ep->scratch;
+                op->cb(op, n);
+                if (!ep_still_head(loop, op)) {
+                    return TRY_GONE;
+                }
+                continue;
+            }
+            break;
+        case XLOOP_OP_ACCEPT_MULTI:
+            if ((n = accept4(op->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                op->cb(op, n);
+                if (!ep_still_head(loop, op)) {
+                    return TRY_GONE;
+                }
+                continue;
+            }
+            break;
+        case XLOOP_OP_CONNECT: {
+            // SO_ERROR stays 0 while the handshake runs, so the socket must
+            // be writable (or failed) before it is read
+            struct pollfd p = { op->fd, POLLOUT, 0 };
+            socklen_t sl = sizeof(n);
+            if (poll(&p, 1, 0) == 0) {
+                return TRY_BLOCKED;
+            }
+            if (getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &n, &sl) != 0) {
+                n = errno;
+            }
+            if (n == EINPROGRESS || n == EALREADY) {
+                return TRY_BLOCKED;
+            }
+            if (n != 0) {
+                xloop_fd *f = &loop->fds[op->fd];
+                f->registered = f->readable = f->writable = 0;
+                close(op->fd);      // closing removes it from the epoll set
+                xloop_complete(loop, op, SOCKET_ERROR, n);
+            } else {
+                xloop_complete(loop, op, op->fd, 0);
+            }
+            return TRY_DONE;
+        }
+        default:
+            n = 0;
+            break;
+        }
+
+        if (n >= 0) {
+            xloop_complete(loop, op, n, 0);
+            return TRY_DONE;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return TRY_BLOCKED;
+        }
+        xloop_complete(loop, op, SOCKET_ERROR, errno);
+        return TRY_DONE;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run the queued operations of one direction until one blocks
+// Return     : zero when the queue is empty or gone, otherwise it blocked
+// Marks      : multishot callbacks may grow the table, so the state is
+//              looked up again after every operation
+// ---------------------------------------------------------------------------
+static int
+ep_drain(xloop *loop, socket_t fd, int is_read)
+{
+    for (;;) {
+        xloop_fd *f = xloop_find_fd(loop, fd);
+        op_queue *q;
+        int r;
+
+        if (f == NULL) {
+            return 0;
+        }
+        q = is_read ? &f->rq : &f->wq;
+        if (q->head == NULL) {
+            return 0;
+        }
+        if ((r = ep_try(loop, q->head)) == TRY_BLOCKED) {
+            return -1;
+        }
+        if (r == TRY_DONE) {
+            f = &loop->fds[fd];     // registered may be cleared by a failed connect
+            queue_pop(is_read ? &f->rq : &f->wq);
+        }
+    }
+}
+
+static void
+ep_kick(xloop *loop, socket_t fd)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+
+    if (ep->nkick == ep->cap_kick) {
+        int32_t  cap  = ep->cap_kick ? ep->cap_kick * 2 : 64;
+        int32_t *kick = (int32_t *)realloc(ep->kick, cap * sizeof(int32_t));
+        if (kick == NULL) {
+            return;                 // the next edge starts it
+        }
+        ep->kick     = kick;
+        ep->cap_kick = cap;
+    }
+    ep->kick[ep->nkick++] = (int32_t)fd;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : queue an operation, trying it at once when the socket is ready
+// Marks      : multishot operations call back per result, so they are only
+//              started from the loop round, never inside the posting call
+// ---------------------------------------------------------------------------
+static int32_t
+ep_submit(xloop *loop, xloop_op *op)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+    xloop_fd *f = &loop->fds[op->fd];
+    int       is_read = op_is_read(op);
+    op_queue *q;
+    uint8_t  *ready;
+
+    if (!f->registered) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events   = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.u64 = (uint64_t)op->fd;
+        if (epoll_ctl(ep->epfd, EPOLL_CTL_ADD, op->fd, &ev) != 0) {
+            return SOCKET_ERROR;
+        }
+        f->registered = 1;
+        f->readable   = 1;
+        f->writable   = op->type != XLOOP_OP_CONNECT;   // a connect waits for EPOLLOUT
+    }
+    q     = is_read ? &f->rq : &f->wq;
+    ready = is_read ? &f->readable : &f->writable;
+
+    if (q->head == NULL && *ready) {
+        if (op->type == XLOOP_OP_RECV_MULTI || op->type == XLOOP_OP_ACCEPT_MULTI) {
+            ep_kick(loop, op->fd);
+        } else if (ep_try(loop, op) == TRY_DONE) {
+            return 0;
+        } else {
+            *ready = 0;
+        }
+    }
+    queue_push(q, op);
+    return 0;
+}
+
+static void
+ep_detach(xloop *loop, socket_t fd)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+
+    epoll_ctl(ep->epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int32_t
+ep_wait(xloop *loop, int32_t ms_timeout)
+{
+    ep_state *ep = (ep_state *)loop->be_data;
+    struct epoll_event ev[MAX_EVENTS];
+    int32_t i, n;
+
+    if (ep->nkick > 0) {
+        ms_timeout = 0;
+    }
+    if ((n = epoll_wait(ep->epfd, ev, MAX_EVENTS, ms_timeout)) < 0) {
+        if (errno != EINTR) {
+            return SOCKET_ERROR;
+        }
+        n = 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        socket_t fd = (socket_t)ev[i].data.u64;
+        uint32_t e  = ev[i].events;
+        xloop_fd *f;
+
+        if (ev[i].data.u64 == WAKE_TAG) {
+            xloop_take_posted(loop);
+            continue;
+        }
+        if (e & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            int blocked = ep_drain(loop, fd, 1);
+            if ((f = xloop_find_fd(loop, fd)) != NULL) {
+                f->readable = !blocked;
+            }
+        }
+        if (e & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            int blocked = ep_drain(loop, fd, 0);
+            if ((f = xloop_find_fd(loop, fd)) != NULL) {
+                f->writable = !blocked;
+            }
+        }
+    }
+
+    // multishot operations posted on a ready socket
+    for (i = 0; i < ep->nkick; i++) {
+        socket_t fd = (socket_t)ep->kick[i];
+        xloop_fd *f;
+        int blocked = ep_drain(loop, fd, 1);
+        if ((f = xloop_find_fd(loop, fd)) != NULL) {
+            f->readable = !blocked;
+        }
+    }
+    ep->nkick = 0;
+    return 0;
+}
+
+static int32_t
+ep_register_buffer(xloop *loop, void *base, size_t len)
+{
+    (void)loop;
+    (void)base;
+    (void)len;
+    return 0;
+}
+
+const xloop_backend xloop_backend_epoll = {
+    "epoll",
+    ep_init,
+    ep_fini,
+    ep_submit,
+    ep_detach,
+    ep_wait,
+    ep_register_buffer
+};
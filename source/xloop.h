@@ -0,0 +1,228 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xloop.h
+ *  @brief    Event loop with completion callbacks for xsocket (Linux)
+ *
+ *  Callers post receive, send, gathered send, accept and connect operations
+ *  with a buffer and a callback; the loop runs them when the socket is ready and calls
+ *  the callback on the loop thread.  One thread can drive thousands of
+ *  sockets this way.
+ *
+ *  Operations are caller-owned xloop_op structures that stay untouched
+ *  until their callback runs, the loop allocates nothing per operation.
+ *  Operations on one socket complete in the order they were posted, per
+ *  direction (receive/accept and send/connect).
+ *
+ *  The loop also owns a timer wheel (xtimer.h): timers started with
+ *  xloop_timer_start fire on the loop thread, and the loop never sleeps
+ *  past the next one.
+ *
+ *  xloop_recv/send/accept/connect/close are called on the loop thread
+ *  (from a callback) or while the loop is not running; other threads hand
+ *  work over with xloop_post.
+ *
+ *  Two backends run the operations, chosen when the loop is created:
+ *      epoll - readiness events plus one syscall per operation
+ *      uring - io_uring: operations are queued as submissions and sent to
+ *              the kernel in one batch per loop round, with registered
+ *              buffers, multishot accept and multishot receive into a
+ *              provided buffer ring (Linux 6.0 or later)
+ *  XLOOP_BACKEND_AUTO takes io_uring when the kernel offers it and falls
+ *  back to epoll otherwise.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XLOOP_H__
+#define __XLOOP_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "xsocket.h"
+#include "xtimer.h"
+#include "xthread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xloop    xloop;
+typedef struct xloop_op xloop_op;
+
+/* completion callback, result is the operation result:
+ *   recv    - bytes received, 0 when the peer closed the connection
+ *   send    - len, the whole buffer has been sent
+ *   sendv   - the total length of the buffers, all have been sent
+ *   accept  - the accepted socket (non-blocking)
+ *   connect - the connected socket (non-blocking)
+ *   post    - 0
+ * or SOCKET_ERROR with the system error code in op->err (ECANCELED when
+ * the socket was closed through the loop; a canceled recv the kernel had
+ * already completed leaves its bytes in buf and their count in op->done)
+ */
+typedef void (*xloop_cb)(xloop_op *op, int32_t result);
+
+typedef enum xloop_op_type {
+    XLOOP_OP_RECV = 0,
+    XLOOP_OP_SEND,
+    XLOOP_OP_ACCEPT,
+    XLOOP_OP_CONNECT,
+    XLOOP_OP_POST,
+    XLOOP_OP_RECV_MULTI,
+    XLOOP_OP_ACCEPT_MULTI,
+    XLOOP_OP_SENDV
+} xloop_op_type;
+
+typedef enum xloop_backend_type {
+    XLOOP_BACKEND_AUTO = 0,         // io_uring when available, else epoll
+    XLOOP_BACKEND_EPOLL,
+    XLOOP_BACKEND_URING
+} xloop_backend_type;
+
+/* loop settings, see xloop_config_init for the defaults */
+typedef struct xloop_config {
+    xloop_backend_type backend;
+    int32_t            entries;     // io_uring submission queue size
+    int32_t            buf_count;   // multishot receive buffers, a power of 2
+    int32_t            buf_size;    // size of one multishot receive buffer
+    int32_t            timer_tick_us; // timer wheel resolution
+    xthread_affinity   affinity;    // placement of the thread that runs the loop
+} xloop_config;
+
+/* an asynchronous operation, the fields are set by the xloop_* calls */
+struct xloop_op {
+    xloop_op_type type;
+    socket_t      fd;
+    void         *buf;              // sendv: the next struct iovec to send
+    int32_t       len;              // sendv: the iovec count left
+    int32_t       done;             // bytes sent so far, or received by a canceled recv
+    int32_t       result;           // held until the callback runs
+    int32_t       err;              // system error code of a failed operation
+    uint32_t      flags;            // loop internal
+    xloop_cb      cb;
+    void         *user;             // caller context, untouched by the loop
+    xloop_op     *next;             // queue link
+};
+
+/* defaults: AUTO backend, 1024 entries, 256 buffers of 16 KB, 1 ms timer
+ * tick, no placement
+ */
+void xloop_config_init(xloop_config *cfg);
+
+/* create an event loop with the default settings, NULL on error
+ */
+xloop *xloop_create(void);
+
+/* create an event loop, cfg NULL for the defaults; NULL on error, including
+ * an explicit XLOOP_BACKEND_URING the kernel does not support
+ */
+xloop *xloop_create_ex(const xloop_config *cfg);
+
+/* name of the backend in use: "epoll" or "uring"
+ */
+const char *xloop_backend_name(xloop *loop);
+
+/* destroy a loop that is not running; sockets and pending operations are
+ * left alone, their callbacks are not called
+ */
+void xloop_destroy(xloop *loop);
+
+/* receive up to len bytes from fd
+ */
+int32_t xloop_recv(xloop *loop, xloop_op *op, socket_t fd, void *buf, int32_t len,
+                   xloop_cb cb, void *user);
+
+/* send all len bytes to fd, short writes are continued by the loop
+ */
+int32_t xloop_send(xloop *loop, xloop_op *op, socket_t fd, const void *buf, int32_t len,
+                   xloop_cb cb, void *user);
+
+/* send the iovcnt buffers of iov in order, one gathered write per try;
+ * short writes are continued by advancing the iov entries in place, so
+ * the array belongs to the loop until the callback
+ */
+int32_t xloop_sendv(xloop *loop, xloop_op *op, socket_t fd, struct iovec *iov, int32_t iovcnt,
+                    xloop_cb cb, void *user);
+
+/* accept one connection on a listening socket
+ */
+int32_t xloop_accept(xloop *loop, xloop_op *op, socket_t listen_fd, xloop_cb cb, void *user);
+
+/* receive until the peer closes or an error: cb runs once per chunk with
+ * op->buf pointing at a loop buffer of up to buf_size bytes, which is only
+ * valid during the callback; the final callback has result 0 or
+ * SOCKET_ERROR.  The operation keeps the receive side of fd to itself
+ */
+int32_t xloop_recv_multi(xloop *loop, xloop_op *op, socket_t fd, xloop_cb cb, void *user);
+
+/* accept until an error or xloop_detach: cb runs once per connection, the
+ * final callback has result SOCKET_ERROR
+ */
+int32_t xloop_accept_multi(xloop *loop, xloop_op *op, socket_t listen_fd, xloop_cb cb, void *user);
+
+/* connect to a TCP server, or a "unix:/path" listener (see xsocket.h),
+ * opts (NULL for none) are applied before connect
+ */
+int32_t xloop_connect(xloop *loop, xloop_op *op, const char *s_server_addr, const uint16_t port,
+                      const socket_opts *opts, xloop_cb cb, void *user);
+
+/* the xloop_recv/send/sendv/accept/connect calls return zero when the operation
+ * is posted, SOCKET_ERROR when it could not be (the callback is not called);
+ * sockets are switched to non-blocking mode when first used
+ */
+
+/* register one memory region with the kernel (io_uring); sends and
+ * receives whose buffer lies inside it skip the page pinning per call.
+ * A second call replaces the region.  Zero on success, a no-op on epoll
+ */
+int32_t xloop_register_buffer(xloop *loop, void *base, size_t len);
+
+/* complete all pending operations of fd with ECANCELED and forget the
+ * socket, without closing it
+ */
+void xloop_detach(xloop *loop, socket_t fd);
+
+/* xloop_detach and socket_close; sockets used with the loop are closed this
+ * way, so a new socket with the same number starts clean
+ */
+void xloop_close(xloop *loop, socket_t fd);
+
+/* start (or re-arm) a timer of the loop, t prepared with xtimer_init; its
+ * callback runs on the loop thread delay_us from the start of the current
+ * loop round, within one timer tick
+ */
+void xloop_timer_start(xloop *loop, xtimer *t, int64_t delay_us);
+
+/* stop a timer of the loop, no-op when it is not pending
+ */
+void xloop_timer_stop(xloop *loop, xtimer *t);
+
+/* call cb(op, 0) on the loop thread; may be called from any thread
+ */
+int32_t xloop_post(xloop *loop, xloop_op *op, xloop_cb cb, void *user);
+
+/* call cb(op, 0) in the next loop round, which does not wait; loop thread
+ * only, costs no system call; for work batched over one round
+ */
+void xloop_defer(xloop *loop, xloop_op *op, xloop_cb cb, void *user);
+
+/* wait up to ms_timeout (-1 for ever) for events or the next timer and run
+ * the callbacks that are due; returns the number of callbacks run,
+ * SOCKET_ERROR on error.  The first call places the calling thread with
+ * the affinity of the config and reports it
+ */
+int32_t xloop_run_once(xloop *loop, int32_t ms_timeout);
+
+/* run until xloop_stop, zero on a normal stop
+ */
+int32_t xloop_run(xloop *loop);
+
+/* make xloop_run return; may be called from any thread
+ */
+void xloop_stop(xloop *loop);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XLOOP_H__
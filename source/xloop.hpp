@@ -0,0 +1,388 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xloop.hpp
+ *  @brief    C++20 coroutines on the xsocket event loop (Linux, header only)
+ *
+ *  async_connect, async_accept, async_recv and async_send are awaitables
+ *  over the xloop operations: the xloop_op lives in the coroutine frame and
+ *  its completion callback resumes the coroutine on the loop thread.
+ *
+ *      xsocket::task<void> echo(xloop *loop, socket_t fd)
+ *      {
+ *          char buf[4096];
+ *          for (;;) {
+ *              xsocket::io_result r = co_await xsocket::async_recv(loop, fd, buf, sizeof(buf));
+ *              if (r.value <= 0 || !co_await xsocket::async_send(loop, fd, buf, r.value)) {
+ *                  break;
+ *              }
+ *          }
+ *          xloop_close(loop, fd);
+ *      }
+ *
+ *      xsocket::spawn(echo(loop, fd));     // runs until its first co_await
+ *      xloop_run(loop);
+ *
+ *  task<T> is lazy: it starts when awaited (or spawned) and resumes its
+ *  awaiter when it returns.  Coroutine frames are taken from a per-thread
+ *  pool of size classes, so after warm-up neither a task nor an operation
+ *  allocates from the heap.
+ *
+ *  A coroutine suspended on an operation must not be destroyed before the
+ *  operation completes; xloop_close on its socket completes the pending
+ *  operations with ECANCELED and resumes it.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XLOOP_HPP__
+#define __XLOOP_HPP__
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <errno.h>
+#include <exception>
+#include <new>
+#include <utility>
+#include "xloop.h"
+
+namespace xsocket {
+
+// ---------------------------------------------------------------------------
+// coroutine frame pool
+
+/* free lists of frames by size class, one set per thread; a frame returns
+ * to the pool of the thread that frees it, and the chunks are never given
+ * back to the heap, so frames may move between threads
+ */
+class frame_pool {
+public:
+    static constexpr std::size_t granule = 64;
+    static constexpr std::size_t classes = 64;      // pooled up to 4 KB
+    static constexpr std::size_t chunk   = 64 << 10;
+
+    static void *alloc(std::size_t size)
+    {
+        std::size_t c = size_class(size);
+        if (c >= classes) {
+            return ::operator new(size);
+        }
+        frame_pool &p = local();
+        if (p.free_[c] == nullptr) {
+            p.refill(c);
+        }
+        node *n = p.free_[c];
+        p.free_[c] = n->next;
+        return n;
+    }
+
+    static void free(void *ptr, std::size_t size) noexcept
+    {
+        std::size_t c = size_class(size);
+        if (c >= classes) {
+            ::operator delete(ptr);
+            return;
+        }
+        frame_pool &p = local();
+        node *n = static_cast<node *>(ptr);
+        n->next = p.free_[c];
+        p.free_[c] = n;
+    }
+
+private:
+    struct node {
+        node *next;
+    };
+
+    node *free_[classes] = {};
+
+    static std::size_t size_class(std::size_t size)
+    {
+        return (size + granule - 1) / granule;
+    }
+
+    static frame_pool &local()
+    {
+        static thread_local frame_pool pool;
+        return pool;
+    }
+
+    // carve one chunk into frames of class c
+    void refill(std::size_t c)
+    {
+        std::size_t bytes = c * granule;
+        char *base = static_cast<char *>(::operator new(chunk));
+
+        for (std::size_t i = 0; i + bytes <= chunk; i += bytes) {
+            node *n = reinterpret_cast<node *>(base + i);
+            n->next = free_[c];
+            free_[c] = n;
+        }
+    }
+};
+
+// ---------------------------------------------------------------------------
+// task
+
+template <class T> class task;
+
+namespace detail {
+
+/* state shared by all task promises */
+struct promise_base {
+    std::coroutine_handle<> continuation;           // the awaiting coroutine
+    std::exception_ptr      error;
+    bool                    detached = false;       // started by spawn
+
+    static void *operator new(std::size_t size)
+    {
+        return frame_pool::alloc(size);
+    }
+
+    static void operator delete(void *ptr, std::size_t size) noexcept
+    {
+        frame_pool::free(ptr, size);
+    }
+
+    /* resume the awaiter, or free a spawned task */
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <class P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            promise_base &p = h.promise();
+            if (p.continuation) {
+                return p.continuation;
+            }
+            if (p.detached) {
+                if (p.error) {
+                    std::terminate();       // nobody to rethrow to
+                }
+                h.destroy();
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { error = std::current_exception(); }
+};
+
+template <class T>
+struct promise : promise_base {
+    T value{};
+
+    task<T> get_return_object() noexcept;
+
+    template <class U>
+    void return_value(U &&v) { value = std::forward<U>(v); }
+
+    T take()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(value);
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void take()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace detail
+
+/* a lazily started coroutine returning T, owned by the task object */
+template <class T = void>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+    using handle_type  = std::coroutine_handle<promise_type>;
+
+    task() noexcept = default;
+    explicit task(handle_type h) noexcept : h_(h) {}
+    task(task &&o) noexcept : h_(std::exchange(o.h_, {})) {}
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    task &operator=(task &&o) noexcept
+    {
+        if (this != &o) {
+            if (h_) {
+                h_.destroy();
+            }
+            h_ = std::exchange(o.h_, {});
+        }
+        return *this;
+    }
+
+    ~task()
+    {
+        if (h_) {
+            h_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return !h_ || h_.done(); }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        h_.promise().continuation = awaiter;
+        return h_;
+    }
+
+    T await_resume() { return h_.promise().take(); }
+
+    /* give up ownership, the frame frees itself when the coroutine returns */
+    handle_type release() noexcept { return std::exchange(h_, {}); }
+
+private:
+    handle_type h_;
+};
+
+namespace detail {
+
+template <class T>
+inline task<T> promise<T>::get_return_object() noexcept
+{
+    return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+}
+
+inline task<void> promise<void>::get_return_object() noexcept
+{
+    return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+}
+
+} // namespace detail
+
+/* start a task without awaiting it; it runs until its first suspension and
+ * frees itself when it returns
+ */
+inline void spawn(task<void> &&t)
+{
+    auto h = t.release();
+    if (h) {
+        h.promise().detached = true;
+        h.resume();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// operations
+
+/* result of an operation: value as passed to the xloop callback, err the
+ * system error code when value is SOCKET_ERROR
+ */
+struct io_result {
+    int32_t value;
+    int32_t err;
+
+    explicit operator bool() const noexcept { return value >= 0; }
+};
+
+namespace detail {
+
+/* posts one xloop operation when the coroutine suspends, the callback
+ * resumes it
+ */
+template <class Start>
+class op_awaiter {
+public:
+    explicit op_awaiter(Start start) noexcept : start_(start) {}
+
+    op_awaiter(const op_awaiter &) = delete;
+    op_awaiter &operator=(const op_awaiter &) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> h) noexcept
+    {
+        h_ = h;
+        if (start_(&op_, on_done, this) != 0) {
+            res_ = io_result{ SOCKET_ERROR, errno };
+            return false;                   // not posted, continue at once
+        }
+        return true;
+    }
+
+    io_result await_resume() const noexcept { return res_; }
+
+private:
+    static void on_done(xloop_op *op, int32_t result)
+    {
+        op_awaiter *self = static_cast<op_awaiter *>(op->user);
+        self->res_ = io_result{ result, result == SOCKET_ERROR ? op->err : 0 };
+        self->h_.resume();
+    }
+
+    Start                   start_;
+    xloop_op                op_{};
+    std::coroutine_handle<> h_;
+    io_result               res_{ 0, 0 };
+};
+
+template <class Start>
+op_awaiter<Start> make_op(Start start) noexcept
+{
+    return op_awaiter<Start>(start);
+}
+
+} // namespace detail
+
+/* connect to a TCP server; value is the connected non-blocking socket */
+inline auto async_connect(xloop *loop, const char *s_server_addr, uint16_t port,
+                          const socket_opts *opts = nullptr)
+{
+    return detail::make_op([=](xloop_op *op, xloop_cb cb, void *user) {
+        return xloop_connect(loop, op, s_server_addr, port, opts, cb, user);
+    });
+}
+
+/* accept one connection; value is the accepted non-blocking socket */
+inline auto async_accept(xloop *loop, socket_t listen_fd)
+{
+    return detail::make_op([=](xloop_op *op, xloop_cb cb, void *user) {
+        return xloop_accept(loop, op, listen_fd, cb, user);
+    });
+}
+
+/* receive up to len bytes; value is the byte count, 0 when the peer closed */
+inline auto async_recv(xloop *loop, socket_t fd, void *buf, int32_t len)
+{
+    return detail::make_op([=](xloop_op *op, xloop_cb cb, void *user) {
+        return xloop_recv(loop, op, fd, buf, len, cb, user);
+    });
+}
+
+/* send all len bytes; value is len */
+inline auto async_send(xloop *loop, socket_t fd, const void *buf, int32_t len)
+{
+    return detail::make_op([=](xloop_op *op, xloop_cb cb, void *user) {
+        return xloop_send(loop, op, fd, buf, len, cb, user);
+    });
+}
+
+/* continue on the loop thread; may be awaited from any thread */
+inline auto async_post(xloop *loop)
+{
+    return detail::make_op([=](xloop_op *op, xloop_cb cb, void *user) {
+        return xloop_post(loop, op, cb, user);
+    });
+}
+
+} // namespace xsocket
+
+#endif // __XLOOP_HPP__
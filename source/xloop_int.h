@@ -0,0 +1,150 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xloop_int.h
+ *  @brief    Internals of the xsocket event loop, shared by its backends
+ *
+ *  The loop core (xloop.c) keeps the per-socket operation queues, the list
+ *  of completed operations and the cross-thread posts; a backend (epoll in
+ *  xloop.c, io_uring in xloop_uring.c) moves operations from the queues to
+ *  the completed list.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XLOOP_INT_H__
+#define __XLOOP_INT_H__
+
+#include <limits.h>
+#include <pthread.h>
+#include "xloop.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX             1024    // iovec entries per sendmsg
+#endif
+
+/* xloop_op.flags */
+#define XLOOP_F_INFLIGHT    0x1     // handed to the kernel (io_uring)
+#define XLOOP_F_CANCELED    0x2     // detached while in flight
+#define XLOOP_F_FIXED       0x4     // in flight from the registered buffer
+
+/* operation queue */
+typedef struct op_queue {
+    xloop_op *head;
+    xloop_op *tail;
+} op_queue;
+
+/* state of a socket known to the loop */
+typedef struct xloop_fd {
+    op_queue rq;                    // recv and accept
+    op_queue wq;                    // send and connect
+    uint8_t  registered;
+    uint8_t  readable;              // no EAGAIN since the last read edge (epoll)
+    uint8_t  writable;              // no EAGAIN since the last write edge (epoll)
+} xloop_fd;
+
+/* backend operations */
+typedef struct xloop_backend {
+    const char *name;
+    int32_t   (*init)(xloop *loop);
+    void      (*fini)(xloop *loop);
+    int32_t   (*submit)(xloop *loop, xloop_op *op);
+    void      (*detach)(xloop *loop, socket_t fd);
+    int32_t   (*wait)(xloop *loop, int32_t ms_timeout);
+    int32_t   (*register_buffer)(xloop *loop, void *base, size_t len);
+} xloop_backend;
+
+struct xloop {
+    const xloop_backend *be;
+    void            *be_data;
+    xloop_config     cfg;
+    int              evfd;          // wakes the loop for posts and stop
+    xloop_fd        *fds;           // indexed by socket
+    int32_t          nfds;
+    op_queue         done;          // completed, callbacks pending
+    pthread_mutex_t  lock;          // protects posted
+    op_queue         posted;
+    xtimer_wheel    *timers;
+    volatile int     stop;
+    int32_t          placed;        // the loop thread has applied cfg.affinity
+    char            *cpus;          // cfg.affinity.cpus, copied
+};
+
+extern const xloop_backend xloop_backend_epoll;
+extern const xloop_backend xloop_backend_uring;
+
+static inline void
+queue_push(op_queue *q, xloop_op *op)
+{
+    op->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = op;
+    } else {
+        q->head = op;
+    }
+    q->tail = op;
+}
+
+static inline xloop_op *
+queue_pop(op_queue *q)
+{
+    xloop_op *op = q->head;
+
+    if (op != NULL && (q->head = op->next) == NULL) {
+        q->tail = NULL;
+    }
+    return op;
+}
+
+/* account n bytes written by a sendv operation: skip the iovec entries
+ * they cover and trim the partial one; non-zero while bytes are left
+ */
+static inline int
+xloop_iov_advance(xloop_op *op, size_t n)
+{
+    struct iovec *iov = (struct iovec *)op->buf;
+
+    op->done += (int32_t)n;
+    while (op->len > 0 && n >= iov->iov_len) {
+        n -= iov->iov_len;
+        iov++;
+        op->len--;
+    }
+    if (op->len > 0) {
+        iov->iov_base = (char *)iov->iov_base + n;
+        iov->iov_len -= n;
+    }
+    op->buf = iov;
+    return op->len > 0;
+}
+
+static inline int
+op_is_read(const xloop_op *op)
+{
+    return op->type == XLOOP_OP_RECV || op->type == XLOOP_OP_ACCEPT
+        || op->type == XLOOP_OP_RECV_MULTI || op->type == XLOOP_OP_ACCEPT_MULTI;
+}
+
+/* move an operation to the completed list, its callback runs at the end of
+ * the loop round
+ */
+static inline void
+xloop_complete(xloop *loop, xloop_op *op, int32_t result, int32_t err)
+{
+    op->result = result;
+    op->err    = err;
+    op->flags  = 0;
+    queue_push(&loop->done, op);
+}
+
+/* the state of fd, the table grows as needed; NULL on error
+ */
+xloop_fd *xloop_get_fd(xloop *loop, socket_t fd);
+
+/* the state of fd if the loop knows it, otherwise NULL
+ */
+xloop_fd *xloop_find_fd(xloop *loop, socket_t fd);
+
+/* drain the wake-up eventfd and complete the posted operations
+ */
+void xloop_take_posted(xloop *loop);
+
+#endif // __XLOOP_INT_H__
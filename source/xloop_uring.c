@@ -0,0 +1,691 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xloop_uring.c
+ *  @brief    io_uring backend of the xsocket event loop (Linux 6.0+)
+ *
+ *  Operations become submission queue entries that are handed to the
+ *  kernel together with the wait of the next loop round, so a round costs
+ *  one io_uring_enter however many operations it starts.  Per socket and
+ *  direction only the head of the queue is in flight, which keeps the
+ *  order of sends on a stream.
+ *
+ *  Sends and receives inside the buffer registered by xloop_register_buffer
+ *  use the fixed buffer variants; multishot receives take their memory
+ *  from a provided buffer ring that is refilled after each callback.
+ *  Gathered sends become IORING_OP_SENDMSG; their msghdr sits in a table
+ *  parallel to the submission entries, the kernel has read it once it has
+ *  taken the entry (IORING_FEAT_SUBMIT_STABLE).
+ *
+ *  The ring is driven through the raw system calls, liburing is not needed.
+ *  Build with XSOCKET_NO_URING to leave the backend out (xloop then always
+ *  uses epoll).
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "xloop_int.h"
+
+#if defined(__linux__) && !defined(XSOCKET_NO_URING)
+
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define TAG_IGNORE  0ull            // user_data of cancel requests
+#define TAG_WAKE    1ull            // user_data of the eventfd poll
+#define BUF_GROUP   0               // provided buffer group of multishot receives
+
+/* state of the io_uring backend */
+typedef struct uring_data {
+    int       ring_fd;
+    // submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned  sq_entries;
+    unsigned  sq_local;             // tail including entries not yet published
+    unsigned  to_submit;
+    struct io_uring_sqe *sqes;
+    struct msghdr *msgs;            // msghdr of a SENDMSG entry, same index
+    // completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    // mappings
+    void     *sq_ring;
+    void     *cq_ring;
+    size_t    sq_ring_len;
+    size_t    cq_ring_len;
+    size_t    sqes_len;
+    // registered buffer
+    char     *reg_base;
+    size_t    reg_len;
+    int       fixed_send;           // IORING_RECVSEND_FIXED_BUF accepted
+    // provided buffer ring
+    struct io_uring_buf_ring *br;
+    size_t    br_len;
+    char     *bufs;
+    size_t    bufs_len;
+    uint16_t  br_tail;
+} uring_data;
+
+static int
+sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+          size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int
+sys_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : hand the published entries to the kernel and optionally wait
+// Return     : zero on success (including a timeout), -1 on error
+// ---------------------------------------------------------------------------
+static int
+ur_enter(uring_data *u, unsigned min_complete, int32_t ms_timeout)
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    void    *argp  = NULL;
+    size_t   argsz = 0;
+    int      n;
+
+    __atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+    if (u->to_submit == 0 && min_complete == 0) {
+        return 0;
+    }
+    if (min_complete && ms_timeout >= 0) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec      = ms_timeout / 1000;
+        ts.tv_nsec     = (ms_timeout % 1000) * 1000000LL;
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts         = (uint64_t)(uintptr_t)&ts;
+        flags         |= IORING_ENTER_EXT_ARG;
+        argp           = &arg;
+        argsz          = sizeof(arg);
+    }
+    if ((n = sys_enter(u->ring_fd, u->to_submit, min_complete, flags, argp, argsz)) >= 0) {
+        u->to_submit -= (unsigned)n;
+        return 0;
+    }
+    return (errno == ETIME || errno == EINTR || errno == EBUSY || errno == EAGAIN) ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : get a cleared submission entry, submitting when the queue is full
+// Return     : the entry, or NULL when the kernel takes none
+// ---------------------------------------------------------------------------
+static struct io_uring_sqe *
+get_sqe(uring_data *u)
+{
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+        if (ur_enter(u, 0, 0) != 0
+            || u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries) {
+            return NULL;
+        }
+    }
+    idx = u->sq_local & *u->sq_mask;
+    sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local++;
+    u->to_submit++;
+    return sqe;
+}
+
+static void
+recycle_buf(xloop *loop, uint16_t bid)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (loop->cfg.buf_count - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)bid * loop->cfg.buf_size);
+    b->len  = (uint32_t)loop->cfg.buf_size;
+    b->bid  = bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+arm_wake(uring_data *u, int evfd)
+{
+    struct io_uring_sqe *sqe = get_sqe(u);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->opcode        = IORING_OP_POLL_ADD;
+    sqe->fd            = evfd;
+    sqe->poll32_events = POLLIN;
+    sqe->len           = IORING_POLL_ADD_MULTI;
+    sqe->user_data     = TAG_WAKE;
+    return 0;
+}
+
+static int
+in_region(uring_data *u, const void *buf, int32_t len)
+{
+    return u->reg_base != NULL && (const char *)buf >= u->reg_base
+        && (const char *)buf + len <= u->reg_base + u->reg_len;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : put the head operation of a queue in flight
+// Return     : zero on success, -1 when the submission queue is stuck
+// ---------------------------------------------------------------------------
+static int
+issue(xloop *loop, xloop_op *op)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+    struct io_uring_sqe *sqe = get_sqe(u);
+
+    if (sqe == NULL) {
+        return -1;
+    }
+    sqe->fd = op->fd;
+    switch (op->type) {
+    case XLOOP_OP_RECV:
+        if (in_region(u, op->buf, op->len)) {
+            sqe->opcode    = IORING_OP_READ_FIXED;
+            sqe->buf_index = 0;
+        } else {
+            sqe->opcode    = IORING_OP_RECV;
+        }
+        sqe->addr = (uint64_t)(uintptr_t)op->buf;
+        sqe->len  = (uint32_t)op->len;
+        break;
+    case XLOOP_OP_SEND:
+        sqe->opcode    = IORING_OP_SEND;
+        sqe->addr      = (uint64_t)(uintptr_t)((char *)op->buf + op->done);
+        sqe->len       = (uint32_t)(op->len - op->done);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        op->flags     &= ~XLOOP_F_FIXED;
+        if (u->fixed_send && in_region(u, op->buf, op->len)) {
+            sqe->ioprio    = IORING_RECVSEND_FIXED_BUF;
+            sqe->buf_index = 0;
+            op->flags     |= XLOOP_F_FIXED;
+        }
+        break;
+    case XLOOP_OP_SENDV: {
+        struct msghdr *msg = &u->msgs[sqe - u->sqes];
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_iov    = (struct iovec *)op->buf;
+        msg->msg_iovlen = op->len < IOV_MAX ? op->len : IOV_MAX;
+        sqe->opcode     = IORING_OP_SENDMSG;
+        sqe->addr       = (uint64_t)(uintptr_t)msg;
+        sqe->msg_flags  = MSG_NOSIGNAL;
+        break;
+    }
+    case XLOOP_OP_ACCEPT:
+    case XLOOP_OP_ACCEPT_MULTI:
+        sqe->opcode       = IORING_OP_ACCEPT;
+        sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+        if (op->type == XLOOP_OP_ACCEPT_MULTI) {
+            sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        }
+        break;
+    case XLOOP_OP_RECV_MULTI:
+        sqe->opcode    = IORING_OP_RECV;
+        sqe->ioprio    = IORING_RECV_MULTISHOT;
+        sqe->flags     = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUF_GROUP;
+        break;
+    case XLOOP_OP_CONNECT:
+        sqe->opcode        = IORING_OP_POLL_ADD;
+        sqe->poll32_events = POLLOUT;
+        break;
+    default:
+        sqe->opcode = IORING_OP_NOP;
+        break;
+    }
+    sqe->user_data = (uint64_t)(uintptr_t)op;
+    op->flags     |= XLOOP_F_INFLIGHT;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : complete the head operation of a queue and start the next
+// ---------------------------------------------------------------------------
+static void
+finish(xloop *loop, xloop_op *op, int32_t res)
+{
+    xloop_fd *f = &loop->fds[op->fd];
+    op_queue *q = op_is_read(op) ? &f->rq : &f->wq;
+
+    queue_pop(q);
+    xloop_complete(loop, op, res >= 0 ? res : SOCKET_ERROR, res >= 0 ? 0 : -res);
+
+    while (q->head != NULL && issue(loop, q->head) != 0) {
+        xloop_complete(loop, queue_pop(q), SOCKET_ERROR, EBUSY);
+    }
+}
+
+static int32_t
+ur_submit(xloop *loop, xloop_op *op)
+{
+    xloop_fd *f = &loop->fds[op->fd];
+    op_queue *q = op_is_read(op) ? &f->rq : &f->wq;
+
+    f->registered = 1;
+    queue_push(q, op);
+    if (q->head == op && issue(loop, op) != 0) {
+        queue_pop(q);
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : ask the kernel to give back the in-flight operations of fd
+// Marks      : the core then drops them from the queues, their completions
+//              arrive flagged XLOOP_F_CANCELED and end with ECANCELED
+// ---------------------------------------------------------------------------
+static void
+ur_detach(xloop *loop, socket_t fd)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+    xloop_fd *f = &loop->fds[fd];
+    xloop_op *heads[2];
+    int i;
+
+    heads[0] = f->rq.head;
+    heads[1] = f->wq.head;
+    for (i = 0; i < 2; i++) {
+        struct io_uring_sqe *sqe;
+        if (heads[i] == NULL || !(heads[i]->flags & XLOOP_F_INFLIGHT)) {
+            continue;
+        }
+        heads[i]->flags |= XLOOP_F_CANCELED;
+        if ((sqe = get_sqe(u)) != NULL) {
+            sqe->opcode    = IORING_OP_ASYNC_CANCEL;
+            sqe->fd        = -1;
+            sqe->addr      = (uint64_t)(uintptr_t)heads[i];
+            sqe->user_data = TAG_IGNORE;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : handle one completion
+// ---------------------------------------------------------------------------
+static void
+on_cqe(xloop *loop, const struct io_uring_cqe *cqe)
+{
+    uring_data *u  = (uring_data *)loop->be_data;
+    xloop_op   *op = (xloop_op *)(uintptr_t)cqe->user_data;
+    int32_t     res  = cqe->res;
+    int         more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (cqe->user_data == TAG_IGNORE) {
+        return;
+    }
+    if (cqe->user_data == TAG_WAKE) {
+        xloop_take_posted(loop);
+        if (!more) {
+            arm_wake(u, loop->evfd);
+        }
+        return;
+    }
+
+    if (op->flags & XLOOP_F_CANCELED) {
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            recycle_buf(loop, (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+        }
+        if ((op->type == XLOOP_OP_ACCEPT || op->type == XLOOP_OP_ACCEPT_MULTI) && res >= 0) {
+            close(res);
+        }
+        if (op->type == XLOOP_OP_RECV && res > 0) {
+            op->done = res;         // the receive won the race with the cancel
+        }
+        if (!more) {
+            xloop_complete(loop, op, SOCKET_ERROR, ECANCELED);
+        }
+        return;
+    }
+
+    switch (op->type) {
+    case XLOOP_OP_SEND:
+        if (res == -EINVAL && (op->flags & XLOOP_F_FIXED)) {
+            u->fixed_send = 0;      // the kernel has no fixed buffer send, use plain send
+            res = 0;
+        }
+        if (res >= 0 && (op->done += res) < op->len) {
+            if (issue(loop, op) != 0) {
+                finish(loop, op, -EBUSY);
+            }
+            return;
+        }
+        finish(loop, op, res >= 0 ? op->len : res);
+        break;
+
+    case XLOOP_OP_SENDV:
+        if (res >= 0 && xloop_iov_advance(op, (size_t)res)) {
+            if (issue(loop, op) != 0) {
+                finish(loop, op, -EBUSY);
+            }
+            return;
+        }
+        finish(loop, op, res >= 0 ? op->done : res);
+        break;
+
+    case XLOOP_OP_CONNECT:
+        if (res >= 0) {
+            socklen_t sl = sizeof(res);
+            if (getsockopt(op->fd, SOL_SOCKET, SO_ERROR, &res, &sl) != 0) {
+                res = errno;
+            }
+            res = -res;
+        }
+        if (res < 0) {
+            xloop_fd *f = &loop->fds[op->fd];
+            queue_pop(&f->wq);
+            memset(f, 0, sizeof(*f));
+            close(op->fd);
+            xloop_complete(loop, op, SOCKET_ERROR, -res);
+        } else {
+            finish(loop, op, op->fd);
+        }
+        break;
+
+    case XLOOP_OP_RECV_MULTI:
+        if (res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+            uint16_t bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+            op->buf = u->bufs + (size_t)bid * loop->cfg.buf_size;
+            op->cb(op, res);
+            recycle_buf(loop, bid);
+        }
+        if (!more && !(op->flags & XLOOP_F_CANCELED)) {
+            // ended by a full buffer ring or a full CQ: start it again
+            if (res > 0 || res == -ENOBUFS) {
+                if (issue(loop, op) != 0) {
+                    finish(loop, op, -EBUSY);
+                }
+            } else {
+                finish(loop, op, res);
+            }
+        } else if (!more) {
+            xloop_complete(loop, op, SOCKET_ERROR, ECANCELED);
+        }
+        break;
+
+    case XLOOP_OP_ACCEPT_MULTI:
+        if (res >= 0) {
+            op->cb(op, res);
+        }
+        if (!more && !(op->flags & XLOOP_F_CANCELED)) {
+            if (res >= 0) {
+                if (issue(loop, op) != 0) {
+                    finish(loop, op, -EBUSY);
+                }
+            } else {
+                finish(loop, op, res);
+            }
+        } else if (!more) {
+            xloop_complete(loop, op, SOCKET_ERROR, ECANCELED);
+        }
+        break;
+
+    default:
+        finish(loop, op, res);
+        break;
+    }
+}
+
+static int32_t
+ur_wait(xloop *loop, int32_t ms_timeout)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+    unsigned head, tail;
+    int has_cqe;
+
+    head    = *u->cq_head;
+    has_cqe = head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    if (ur_enter(u, (has_cqe || ms_timeout == 0) ? 0 : 1, ms_timeout) != 0) {
+        return SOCKET_ERROR;
+    }
+
+    for (;;) {
+        struct io_uring_cqe cqe;
+
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        cqe = u->cqes[head & *u->cq_mask];
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+        on_cqe(loop, &cqe);
+    }
+    return 0;
+}
+
+static int32_t
+ur_register_buffer(xloop *loop, void *base, size_t len)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+    struct iovec iov;
+
+    if (u->reg_base != NULL) {
+        sys_register(u->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+        u->reg_base = NULL;
+        u->reg_len  = 0;
+    }
+    if (base == NULL || len == 0) {
+        return 0;
+    }
+    iov.iov_base = base;
+    iov.iov_len  = len;
+    if (sys_register(u->ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0) {
+        return SOCKET_ERROR;
+    }
+    u->reg_base = (char *)base;
+    u->reg_len  = len;
+    return 0;
+}
+
+static void
+ur_fini(xloop *loop)
+{
+    uring_data *u = (uring_data *)loop->be_data;
+
+    if (u == NULL) {
+        return;
+    }
+    if (u->ring_fd >= 0) {
+        close(u->ring_fd);
+    }
+    if (u->sqes != NULL) {
+        munmap(u->sqes, u->sqes_len);
+    }
+    free(u->msgs);
+    if (u->cq_ring != NULL && u->cq_ring != u->sq_ring) {
+        munmap(u->cq_ring, u->cq_ring_len);
+    }
+    if (u->sq_ring != NULL) {
+        munmap(u->sq_ring, u->sq_ring_len);
+    }
+    if (u->br != NULL) {
+        munmap(u->br, u->br_len);
+    }
+    if (u->bufs != NULL) {
+        munmap(u->bufs, u->bufs_len);
+    }
+    free(u);
+    loop->be_data = NULL;
+}
+
+static void *
+map(size_t len, int fd, off_t off)
+{
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                   fd >= 0 ? MAP_SHARED | MAP_POPULATE : MAP_PRIVATE | MAP_ANONYMOUS, fd, off);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : set up the ring, the provided buffers and the wake-up poll
+// Return     : zero on success, -1 when io_uring is missing or too old
+// ---------------------------------------------------------------------------
+static int32_t
+ur_init(xloop *loop)
+{
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uring_data *u;
+    uint16_t i;
+
+    if ((u = (uring_data *)calloc(1, sizeof(uring_data))) == NULL) {
+        return -1;
+    }
+    loop->be_data = u;
+
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+    if ((u->ring_fd = sys_setup((unsigned)loop->cfg.entries, &p)) < 0) {
+        memset(&p, 0, sizeof(p));
+        u->ring_fd = sys_setup((unsigned)loop->cfg.entries, &p);
+    }
+    if (u->ring_fd < 0 || !(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_EXT_ARG)
+        || !(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_SUBMIT_STABLE)) {
+        goto fail;
+    }
+
+    // one mapping for both rings (IORING_FEAT_SINGLE_MMAP)
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_ring_len > u->sq_ring_len) {
+        u->sq_ring_len = u->cq_ring_len;
+    }
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    if ((u->sq_ring = map(u->sq_ring_len, u->ring_fd, IORING_OFF_SQ_RING)) == NULL
+        || (u->sqes = (struct io_uring_sqe *)map(u->sqes_len, u->ring_fd, IORING_OFF_SQES)) == NULL
+        || (u->msgs = (struct msghdr *)calloc(p.sq_entries, sizeof(struct msghdr))) == NULL) {
+        goto fail;
+    }
+    u->cq_ring    = u->sq_ring;
+    u->sq_head    = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+    u->sq_tail    = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_mask    = (unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_array   = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+    u->sq_local   = *u->sq_tail;
+    u->cq_head    = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail    = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask    = (unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+    u->fixed_send = 1;
+
+    // provided buffer ring for multishot receives (Linux 5.19)
+    u->br_len   = loop->cfg.buf_count * sizeof(struct io_uring_buf);
+    u->bufs_len = (size_t)loop->cfg.buf_count * loop->cfg.buf_size;
+    if ((u->br = (struct io_uring_buf_ring *)map(u->br_len, -1, 0)) == NULL
+        || (u->bufs = (char *)map(u->bufs_len, -1, 0)) == NULL) {
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = (uint32_t)loop->cfg.buf_count;
+    reg.bgid         = BUF_GROUP;
+    if (sys_register(u->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        goto fail;
+    }
+    for (i = 0; i < (uint16_t)loop->cfg.buf_count; i++) {
+        recycle_buf(loop, i);
+    }
+
+    if (arm_wake(u, loop->evfd) != 0 || ur_enter(u, 0, 0) != 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    ur_fini(loop);
+    return -1;
+}
+
+#else
+
+static int32_t
+ur_init(xloop *loop)
+{
+    (void)loop;
+    return -1;                      // built without io_uring
+}
+
+static void
+ur_fini(xloop *loop)
+{
+    (void)loop;
+}
+
+static int32_t
+ur_submit(xloop *loop, xloop_op *op)
+{
+    (void)loop;
+    (void)op;
+    return SOCKET_ERROR;
+}
+
+static void
+ur_detach(xloop *loop, socket_t fd)
+{
+    (void)loop;
+    (void)fd;
+}
+
+static int32_t
+ur_wait(xloop *loop, int32_t ms_timeout)
+{
+    (void)loop;
+    (void)ms_timeout;
+    return SOCKET_ERROR;
+}
+
+static int32_t
+ur_register_buffer(xloop *loop, void *base, size_t len)
+{
+    (void)loop;
+    (void)base;
+    (void)len;
+    return SOCKET_ERROR;
+}
+
+#endif
+
+const xloop_backend xloop_backend_uring = {
+    "uring",
+    ur_init,
+    ur_fini,
+    ur_submit,
+    ur_detach,
+    ur_wait,
+    ur_register_buffer
+};
@@ -0,0 +1,351 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xoutq.c
+ *  @brief    Lock-free outbound queue: many threads sending on one connection (Linux)
+ *
+ *  The queue is a linked list with a sentinel in front: head, owned by
+ *  the I/O thread, is the last message sent (at first a stub), the
+ *  messages to send hang off its next.  A producer exchanges tail with
+ *  its message and then links the message it got back to it; between the
+ *  two the list is cut, and the I/O thread, which sees tail ahead of the
+ *  last message it can reach, waits for the link.  A message sent becomes
+ *  the new sentinel and the old one is freed, so the list never runs
+ *  empty under a producer.
+ *
+ *  Sleeping as in xshm: the I/O thread sets its flag, then looks at tail
+ *  once more; a producer looks at the flag after its exchange.  Both are
+ *  sequentially consistent, so one of them always sees the other.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "xoutq.h"
+#include "xsocket_int.h"
+
+/* a queued message, the data follows */
+typedef struct onode {
+    struct onode *next;
+    int32_t       len;
+    int32_t       reserved;
+} onode;
+
+#define NODE_OF(p)      ((onode *)((char *)(p) - sizeof(onode)))
+
+/* producers write tail and the flag, the I/O thread the rest; each on
+ * its own cache line */
+struct xoutq {
+    onode       *tail __attribute__((aligned(64)));
+    uint32_t     sleeping __attribute__((aligned(64)));
+    int32_t      failed;            // the socket error, producers refuse from then on
+    onode       *head __attribute__((aligned(64)));
+    int32_t      off;               // bytes of head->next already sent
+    int32_t      blocked;
+    socket_t     fd;
+    int          efd;
+    xoutq_config cfg;
+    struct iovec *iov;
+    xoutq_stats  stats;
+    onode        stub;
+};
+
+void
+xoutq_config_init(xoutq_config *cfg)
+{
+    cfg->max_batch = 64;
+    cfg->spin_us   = 20;
+}
+
+xoutq *
+xoutq_create(socket_t fd, const xoutq_config *cfg)
+{
+    xoutq *q;
+
+    if ((q = (xoutq *)aligned_alloc(64, (sizeof(xoutq) + 63) & ~(size_t)63)) == NULL) {
+        return NULL;
+    }
+    memset(q, 0, sizeof(*q));
+    if (cfg != NULL) {
+        q->cfg = *cfg;
+    } else {
+        xoutq_config_init(&q->cfg);
+    }
+    if (q->cfg.max_batch <= 0 || q->cfg.max_batch > IOV_MAX) {
+        q->cfg.max_batch = q->cfg.max_batch <= 0 ? 1 : IOV_MAX;
+    }
+    q->iov = (struct iovec *)malloc((size_t)q->cfg.max_batch * sizeof(struct iovec));
+    if (q->iov == NULL || (q->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        xs_printf("[xoutq] cannot create the queue: %s\n", strerror(errno));
+        free(q->iov);
+        free(q);
+        return NULL;
+    }
+    q->fd   = fd;
+    q->head = &q->stub;
+    q->tail = &q->stub;
+    return q;
+}
+
+// ---------------------------------------------------------------------------
+// producers
+
+// ---------------------------------------------------------------------------
+// Function   : link a message in and wake the I/O thread if it sleeps
+// Marks      : the exchange is the only atomic read-modify-write unless
+//              the I/O thread sleeps
+// ---------------------------------------------------------------------------
+static void
+push(xoutq *q, onode *n)
+{
+    uint64_t one = 1;
+    onode   *prev;
+
+    n->next = NULL;
+    prev = __atomic_exchange_n(&q->tail, n, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+
+    if (__atomic_load_n(&q->sleeping, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&q->sleeping, 0, __ATOMIC_ACQ_REL)) {
+        if (write(q->efd, &one, sizeof(one)) == sizeof(one)) {
+            __atomic_add_fetch(&q->stats.wakeups, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void *
+xoutq_alloc(xoutq *q, int32_t len)
+{
+    onode *n;
+
+    if (len < 0 || __atomic_load_n(&q->failed, __ATOMIC_RELAXED) != 0
+        || (n = (onode *)malloc(sizeof(onode) + (size_t)len)) == NULL) {
+        return NULL;
+    }
+    n->len = len;
+    return n + 1;
+}
+
+int32_t
+xoutq_commit(xoutq *q, void *msg)
+{
+    onode  *n   = NODE_OF(msg);
+    int32_t len = n->len;           // n may be sent and freed once pushed
+
+    push(q, n);
+    return len;
+}
+
+int32_t
+xoutq_send(xoutq *q, const void *data, int32_t len)
+{
+    void *p = xoutq_alloc(q, len);
+
+    if (p == NULL) {
+        return SOCKET_ERROR;
+    }
+    memcpy(p, data, (size_t)len);
+    return xoutq_commit(q, p);
+}
+
+// ---------------------------------------------------------------------------
+// the I/O thread
+
+/* the next message to send, NULL when there is none; waits out a
+ * producer between its exchange and its link */
+static onode *
+first(xoutq *q)
+{
+    onode *n;
+
+    while ((n = __atomic_load_n(&q->head->next, __ATOMIC_ACQUIRE)) == NULL) {
+        if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head) {
+            return NULL;
+        }
+        cpu_relax();
+    }
+    return n;
+}
+
+/* n has been sent: it becomes the sentinel, the old one goes */
+static void
+retire(xoutq *q, onode *n)
+{
+    onode *old = q->head;
+
+    q->head = n;
+    q->off  = 0;
+    if (old != &q->stub) {
+        free(old);
+    }
+    q->stats.msgs++;
+}
+
+int32_t
+xoutq_drain(xoutq *q)
+{
+    struct msghdr msg;
+    int32_t       total = 0, cnt, off;
+    uint64_t      v;
+    onode        *n, *m;
+    ssize_t       rc;
+
+    if (q->failed != 0) {
+        return SOCKET_ERROR;
+    }
+    __atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+    if (read(q->efd, &v, sizeof(v)) < 0) {
+        // nothing counted, the fd was not readable
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = q->iov;
+
+    for (;;) {
+        if ((n = first(q)) == NULL) {
+            // arm, then look once more for a message queued before the flag was seen
+            __atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) == q->head) {
+                break;
+            }
+            __atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        // gather what is linked, the messages after a cut wait for the next write
+        off = q->off;
+        for (cnt = 0, m = n; m != NULL && cnt < q->cfg.max_batch; cnt++) {
+            q->iov[cnt].iov_base = (char *)(m + 1) + off;
+            q->iov[cnt].iov_len  = (size_t)(m->len - off);
+            off = 0;
+            m = __atomic_load_n(&m->next, __ATOMIC_ACQUIRE);
+        }
+        msg.msg_iovlen = (size_t)cnt;
+        q->stats.writes++;
+        if ((rc = sendmsg(q->fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                q->blocked = 1;
+                q->stats.blocked++;
+                break;
+            }
+            xs_printf("[xoutq] send failed: %s\n", strerror(errno));
+            __atomic_store_n(&q->failed, errno, __ATOMIC_RELAXED);
+            return SOCKET_ERROR;
+        }
+        q->blocked = 0;
+        q->stats.bytes += rc;
+        total += (int32_t)rc;
+
+        while (n != NULL && rc >= (ssize_t)(n->len - q->off)) {
+            rc -= n->len - q->off;
+            m = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+            retire(q, n);
+            n = m;
+        }
+        q->off += (int32_t)rc;
+    }
+    return total;
+}
+
+int32_t
+xoutq_wait(xoutq *q, int32_t ms_timeout)
+{
+    struct pollfd p;
+    int64_t       now      = socket_now_ns();
+    int64_t       spin_end = now + (int64_t)q->cfg.spin_us * 1000;
+    int64_t       deadline = ms_timeout < 0 ? INT64_MAX : now + (int64_t)ms_timeout * 1000000;
+    uint64_t      v;
+    int           rc;
+
+    if (q->failed != 0) {
+        return SOCKET_ERROR;
+    }
+    if (q->blocked) {
+        p.fd     = q->fd;
+        p.events = POLLOUT;
+        if ((rc = poll(&p, 1, ms_timeout)) < 0) {
+            return errno == EINTR ? 0 : SOCKET_ERROR;
+        }
+        return rc > 0 ? 0 : 1;
+    }
+
+    while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == q->head) {
+        if (now < spin_end) {
+            cpu_relax();
+            now = socket_now_ns();
+            continue;
+        }
+        __atomic_store_n(&q->sleeping, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&q->tail, __ATOMIC_SEQ_CST) != q->head) {
+            break;
+        }
+        if (now >= deadline) {
+            return 1;
+        }
+        q->stats.sleeps++;
+        p.fd     = q->efd;
+        p.events = POLLIN;
+        if (poll(&p, 1, deadline == INT64_MAX ? -1 : (int32_t)((deadline - now + 999999) / 1000000)) < 0
+            && errno != EINTR) {
+            return SOCKET_ERROR;
+        }
+        if (read(q->efd, &v, sizeof(v)) < 0) {
+            // timed out, or the count was taken by xoutq_drain
+        }
+        now = socket_now_ns();
+    }
+    __atomic_store_n(&q->sleeping, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int32_t
+xoutq_fd(xoutq *q)
+{
+    return q->efd;
+}
+
+int32_t
+xoutq_blocked(xoutq *q)
+{
+    return q->blocked;
+}
+
+void
+xoutq_get_stats(xoutq *q, xoutq_stats *stats)
+{
+    *stats = q->stats;
+    stats->wakeups = __atomic_load_n(&q->stats.wakeups, __ATOMIC_RELAXED);
+}
+
+void
+xoutq_close(xoutq *q)
+{
+    onode *n, *next;
+
+    if (q == NULL) {
+        return;
+    }
+    for (n = q->head; n != NULL; n = next) {
+        next = n->next;
+        if (n != &q->stub) {
+            free(n);
+        }
+    }
+    close(q->efd);
+    free(q->iov);
+    free(q);
+}
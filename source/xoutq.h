@@ -0,0 +1,118 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xoutq.h
+ *  @brief    Lock-free outbound queue: many threads sending on one connection (Linux)
+ *
+ *  Threads that share a TCP connection cannot call socket_send on it
+ *  together, their partial writes interleave; a mutex around it makes
+ *  every sender wait for the system call of the one before.  An xoutq
+ *  takes the messages of any number of producer threads instead and one
+ *  I/O thread writes them: a producer links its message in with one
+ *  atomic exchange and returns, the I/O thread sends all that has come in
+ *  with one gathered write per max_batch messages.  Messages of one
+ *  producer go out in the order it queued them, whole and unmixed.
+ *
+ *  producers, any thread:
+ *      xoutq_send(q, data, len);               // copies
+ *      p = xoutq_alloc(q, len); fill p; xoutq_commit(q, p);
+ *
+ *  the I/O thread:
+ *      for (;;) {
+ *          xoutq_drain(q);                     // sends, arms the wake-up when empty
+ *          xoutq_wait(q, -1);                  // or wait on xoutq_fd, and on the
+ *      }                                       // socket when xoutq_blocked
+ *
+ *  A producer only makes a system call when the I/O thread sleeps: it
+ *  then writes an eventfd once.  There is no bound on the queue: the
+ *  producers are expected to be slower than the connection, as with a
+ *  plain socket_send.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XOUTQ_H__
+#define __XOUTQ_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xoutq xoutq;
+
+/* queue settings, see xoutq_config_init for the defaults */
+typedef struct xoutq_config {
+    int32_t max_batch;              // messages per gathered write, up to IOV_MAX
+    int32_t spin_us;                // xoutq_wait spins this long before sleeping
+} xoutq_config;
+
+/* counters, kept by the I/O thread except wakeups */
+typedef struct xoutq_stats {
+    int64_t msgs;                   // messages sent
+    int64_t bytes;
+    int64_t writes;                 // gathered writes, including EAGAIN
+    int64_t blocked;                // writes that found the socket full
+    int64_t wakeups;                // eventfd writes by producers
+    int64_t sleeps;                 // xoutq_wait sleeps after the spin
+} xoutq_stats;
+
+/* defaults: 64 messages per write, 20 us spin
+ */
+void xoutq_config_init(xoutq_config *cfg);
+
+/* create the queue of a connected socket (owned by the caller, blocking
+ * or not); cfg NULL for the defaults; NULL on error
+ */
+xoutq *xoutq_create(socket_t fd, const xoutq_config *cfg);
+
+/* queue a copy of a message; any thread.  Returns len, SOCKET_ERROR when
+ * the connection has failed
+ */
+int32_t xoutq_send(xoutq *q, const void *data, int32_t len);
+
+/* a message of len bytes to fill in place and pass to xoutq_commit; any
+ * thread.  NULL when out of memory or the connection has failed
+ */
+void *xoutq_alloc(xoutq *q, int32_t len);
+
+/* queue a message from xoutq_alloc, which belongs to the queue from now
+ * on; returns its length
+ */
+int32_t xoutq_commit(xoutq *q, void *msg);
+
+/* I/O thread: send the queued messages until none is left or the socket
+ * is full (see xoutq_blocked); when it leaves the queue empty the wake-up
+ * is armed.  Returns the bytes sent, SOCKET_ERROR when the connection has
+ * failed (the producers fail from then on)
+ */
+int32_t xoutq_drain(xoutq *q);
+
+/* I/O thread: wait up to ms_timeout (-1 forever) for messages, or for
+ * space when the socket was full; zero when xoutq_drain has work, 1 on
+ * timeout, SOCKET_ERROR on error
+ */
+int32_t xoutq_wait(xoutq *q, int32_t ms_timeout);
+
+/* an fd that is readable when messages came after xoutq_drain armed the
+ * wake-up, for epoll or an xloop
+ */
+int32_t xoutq_fd(xoutq *q);
+
+/* non-zero when the last xoutq_drain stopped on a full socket: wait for
+ * the socket to be writable, not for xoutq_fd
+ */
+int32_t xoutq_blocked(xoutq *q);
+
+void xoutq_get_stats(xoutq *q, xoutq_stats *stats);
+
+/* free the queue and the messages it still holds, once the producers are
+ * done with it; the socket is left open
+ */
+void xoutq_close(xoutq *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XOUTQ_H__
@@ -0,0 +1,241 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xpub.c
+ *  @brief    Fan-out publisher over framed TCP connections (Linux)
+ *
+ *  Subscribers are kept in an array.  A subscriber that fails during
+ *  xpub_publish (its connection may report the failure from inside
+ *  xconn_send_msg) only leaves a hole, the array is compacted once the
+ *  loop over it is done.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xpub.h"
+#include "xsocket_int.h"
+
+struct xpub {
+    xloop       *loop;
+    xpub_config  cfg;
+    xconn      **subs;
+    int32_t      nsubs;
+    int32_t      cap;
+    int32_t      holes;             // NULL entries left during a publish
+    int32_t      publishing;
+    int32_t      nblocked;
+    xpub_stats   stats;
+};
+
+void
+xpub_config_init(xpub_config *cfg)
+{
+    xconn_config_init(&cfg->conn);
+    cfg->evict_slow = 0;
+}
+
+xpub *
+xpub_create(xloop *loop, const xpub_config *cfg)
+{
+    xpub *p;
+
+    if ((p = (xpub *)calloc(1, sizeof(xpub))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        p->cfg = *cfg;
+    } else {
+        xpub_config_init(&p->cfg);
+    }
+    p->loop = loop;
+    return p;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : close a subscriber and take it out of the array
+// Marks      : during a publish the entry becomes a hole
+// ---------------------------------------------------------------------------
+static void
+drop(xpub *p, xconn *c)
+{
+    int32_t i;
+
+    for (i = 0; i < p->nsubs; i++) {
+        if (p->subs[i] == c) {
+            break;
+        }
+    }
+    if (i == p->nsubs) {
+        return;
+    }
+    if (xconn_blocked(c)) {
+        p->nblocked--;
+    }
+    xconn_close(c);
+    if (p->publishing) {
+        p->subs[i] = NULL;
+        p->holes++;
+    } else {
+        p->subs[i] = p->subs[--p->nsubs];
+    }
+}
+
+static void
+compact(xpub *p)
+{
+    int32_t i, n = 0;
+
+    for (i = 0; i < p->nsubs; i++) {
+        if (p->subs[i] != NULL) {
+            p->subs[n++] = p->subs[i];
+        }
+    }
+    p->nsubs = n;
+    p->holes = 0;
+}
+
+static void
+on_frame(xconn *c, const void *data, int32_t len)
+{
+    (void)c;
+    (void)data;
+    (void)len;                      // subscribers have nothing to say
+}
+
+static void
+on_event(xconn *c, xconn_event ev, int32_t err)
+{
+    xpub *p = (xpub *)xconn_user(c);
+
+    switch (ev) {
+    case XCONN_EV_BLOCKED:
+        p->nblocked++;
+        break;
+    case XCONN_EV_WRITABLE:
+        p->nblocked--;
+        break;
+    default:
+        xs_printf("[xpub] subscriber lost, error %d\n", err);
+        p->stats.lost++;
+        drop(p, c);
+        break;
+    }
+}
+
+void
+xpub_destroy(xpub *p)
+{
+    int32_t i;
+
+    if (p == NULL) {
+        return;
+    }
+    for (i = 0; i < p->nsubs; i++) {
+        xconn_close(p->subs[i]);
+    }
+    free(p->subs);
+    free(p);
+}
+
+int32_t
+xpub_add(xpub *p, socket_t fd)
+{
+    xconn *c;
+
+    if (p->nsubs == p->cap) {
+        int32_t cap  = p->cap ? p->cap * 2 : 16;
+        xconn **subs = (xconn **)realloc(p->subs, cap * sizeof(xconn *));
+        if (subs == NULL) {
+            return SOCKET_ERROR;
+        }
+        p->subs = subs;
+        p->cap  = cap;
+    }
+    if ((c = xconn_create(p->loop, fd, &p->cfg.conn, on_frame, on_event, p)) == NULL) {
+        return SOCKET_ERROR;
+    }
+    p->subs[p->nsubs++] = c;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : queue one message to every subscriber
+// Parameters :
+//      [in ] : p - the publisher
+//            : m - the message, the caller keeps its reference
+//      [out] : none
+// Return     : the number of subscribers that took it
+// Marks      : a refusing subscriber misses the message, or is disconnected
+//              with evict_slow
+// ---------------------------------------------------------------------------
+int32_t
+xpub_publish(xpub *p, xmsg *m)
+{
+    int32_t i, n = 0;
+
+    p->stats.published++;
+    p->publishing = 1;
+    for (i = 0; i < p->nsubs; i++) {
+        xconn *c = p->subs[i];
+        if (c == NULL) {
+            continue;
+        }
+        if (xconn_send_msg(c, m) == 0) {
+            n++;
+        } else if (errno == ENOBUFS && p->subs[i] != NULL) {
+            p->stats.dropped++;
+            if (p->cfg.evict_slow) {
+                xs_printf("[xpub] evicting slow subscriber %d\n", xconn_fd(c));
+                p->stats.evicted++;
+                drop(p, c);
+            }
+        }
+    }
+    p->publishing = 0;
+    if (p->holes > 0) {
+        compact(p);
+    }
+    p->stats.delivered += n;
+    return n;
+}
+
+int32_t
+xpub_send(xpub *p, const void *data, int32_t len)
+{
+    xmsg   *m;
+    int32_t n;
+
+    if ((m = xmsg_alloc(len)) == NULL) {
+        return SOCKET_ERROR;
+    }
+    if (len > 0) {
+        memcpy(xmsg_data(m), data, len);
+    }
+    n = xpub_publish(p, m);
+    xmsg_unref(m);
+    return n;
+}
+
+int32_t
+xpub_count(xpub *p)
+{
+    return p->nsubs - p->holes;
+}
+
+int32_t
+xpub_blocked(xpub *p)
+{
+    return p->nblocked;
+}
+
+void
+xpub_get_stats(xpub *p, xpub_stats *stats)
+{
+    *stats = p->stats;
+}
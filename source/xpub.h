@@ -0,0 +1,91 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xpub.h
+ *  @brief    Fan-out publisher over framed TCP connections (Linux)
+ *
+ *  A publisher sends the same stream of data frames to every subscriber.
+ *  Subscribers are connected TCP sockets, each wrapped in an xconn on the
+ *  publisher's loop, so they get its framing, heartbeats and send queue
+ *  limits.  A message is one shared frame (xmsg): publishing takes one
+ *  reference per subscriber and no copy, and every subscriber writes its
+ *  queue with one gathered send per round.
+ *
+ *  A subscriber whose queue refuses a message (sndq_max) either misses
+ *  that message or, with evict_slow, is disconnected.  Subscribers that
+ *  fail or close are removed on their own.
+ *
+ *  All calls are made on the loop thread.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XPUB_H__
+#define __XPUB_H__
+
+#include <stdint.h>
+#include "xconn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xpub xpub;
+
+/* publisher settings, see xpub_config_init for the defaults */
+typedef struct xpub_config {
+    xconn_config conn;              // settings of every subscriber connection
+    int32_t      evict_slow;        // disconnect a subscriber that refuses a message
+} xpub_config;
+
+/* counters of a publisher */
+typedef struct xpub_stats {
+    int64_t published;              // messages published
+    int64_t delivered;              // messages queued to a subscriber
+    int64_t dropped;                // messages a subscriber refused
+    int64_t evicted;                // subscribers disconnected as too slow
+    int64_t lost;                   // subscribers that closed or failed
+} xpub_stats;
+
+/* defaults: xconn_config_init, slow subscribers miss messages
+ */
+void xpub_config_init(xpub_config *cfg);
+
+/* create a publisher on loop, cfg NULL for the defaults; NULL on error
+ */
+xpub *xpub_create(xloop *loop, const xpub_config *cfg);
+
+/* close all subscribers and free the publisher
+ */
+void xpub_destroy(xpub *p);
+
+/* add a connected TCP socket as subscriber, the publisher owns it from now
+ * on; zero on success, SOCKET_ERROR on error (the socket is left open)
+ */
+int32_t xpub_add(xpub *p, socket_t fd);
+
+/* queue m to every subscriber, the caller keeps its reference; returns
+ * the number of subscribers that took it
+ */
+int32_t xpub_publish(xpub *p, xmsg *m);
+
+/* copy len bytes into a new message and publish it; returns the number of
+ * subscribers that took it, SOCKET_ERROR when out of memory
+ */
+int32_t xpub_send(xpub *p, const void *data, int32_t len);
+
+/* number of subscribers
+ */
+int32_t xpub_count(xpub *p);
+
+/* number of subscribers whose send queue is over its high watermark
+ */
+int32_t xpub_blocked(xpub *p);
+
+/* a copy of the counters
+ */
+void xpub_get_stats(xpub *p, xpub_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XPUB_H__
@@ -0,0 +1,430 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xrelay.c
+ *  @brief    Multicast to TCP gateway and TCP to multicast relay (Linux)
+ *
+ *  mc_to_tcp: one receive is posted on the multicast socket to wait for
+ *  traffic; when it completes the socket is drained with recvmmsg before
+ *  the receive is posted again, so a burst costs one system call per
+ *  batch.  Each datagram becomes one xmsg for the publisher.
+ *
+ *  tcp_to_mc: frames are copied into the batch as the producers deliver
+ *  them; the first frame of a round defers a flush to the next loop round
+ *  (xloop_defer), a full batch is flushed at once.
+ *
+ *  Like xconn, the relay is freed by the last of its loop operations once
+ *  it is destroyed.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "xrelay.h"
+#include "xsocket_int.h"
+
+#define DRAIN_BATCHES   4           // recvmmsg calls per wake-up, then other sockets get a turn
+
+struct xrelay {
+    xloop          *loop;
+    xrelay_config   cfg;
+    int32_t         to_mc;          // direction, tcp_to_mc when set
+    socket_t        listen_fd;
+    socket_t        mc_fd;
+    xloop_op        aop;            // accept
+    xloop_op        rop;            // mc_to_tcp: waits for a datagram
+    xloop_op        fop;            // tcp_to_mc: deferred flush
+    xpub           *pub;            // mc_to_tcp: the subscribers
+    xconn         **conns;          // tcp_to_mc: the producers
+    int32_t         nconns;
+    int32_t         cap;
+    struct mmsghdr *msgs;           // one per batch slot
+    struct iovec   *iov;
+    char           *bufs;           // batch * slot bytes
+    int32_t         slot;           // max_datagram + 1, a longer datagram shows
+    int32_t         nbatch;         // tcp_to_mc: datagrams waiting
+    int32_t         flushing;
+    int32_t         ops;            // operations held by the loop
+    int32_t         closing;
+    xrelay_stats    stats;
+};
+
+void
+xrelay_config_init(xrelay_config *cfg)
+{
+    xpub_config_init(&cfg->pub);
+    xconn_config_init(&cfg->conn);
+    socket_opts_init(&cfg->tcp_opts, SOCKET_PROFILE_LATENCY);
+    cfg->batch        = 64;
+    cfg->max_datagram = 9216;
+    cfg->rcvbuf       = 0;
+    cfg->ttl          = 1;
+    cfg->mc_loop      = 0;
+}
+
+static void
+maybe_free(xrelay *r)
+{
+    if (!r->closing || r->ops > 0) {
+        return;
+    }
+    free(r->conns);
+    free(r->msgs);
+    free(r->iov);
+    free(r->bufs);
+    free(r);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : allocate a relay with its batch buffers
+// Return     : the relay, NULL on error
+// ---------------------------------------------------------------------------
+static xrelay *
+relay_new(xloop *loop, socket_t listen_fd, const xrelay_config *cfg)
+{
+    xrelay *r;
+    int32_t i;
+
+    if ((r = (xrelay *)calloc(1, sizeof(xrelay))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        r->cfg = *cfg;
+    } else {
+        xrelay_config_init(&r->cfg);
+    }
+    r->loop      = loop;
+    r->listen_fd = listen_fd;
+    r->mc_fd     = INVALID_SOCKET;
+    r->slot      = r->cfg.max_datagram + 1;
+    if (r->cfg.batch <= 0 || r->cfg.max_datagram <= 0 || r->cfg.max_datagram > 65507
+        || (r->msgs = (struct mmsghdr *)calloc(r->cfg.batch, sizeof(struct mmsghdr))) == NULL
+        || (r->iov = (struct iovec *)calloc(r->cfg.batch, sizeof(struct iovec))) == NULL
+        || (r->bufs = (char *)malloc((size_t)r->cfg.batch * r->slot)) == NULL) {
+        r->closing = 1;
+        maybe_free(r);
+        return NULL;
+    }
+    for (i = 0; i < r->cfg.batch; i++) {
+        r->iov[i].iov_base            = r->bufs + (size_t)i * r->slot;
+        r->iov[i].iov_len             = (size_t)r->slot;
+        r->msgs[i].msg_hdr.msg_iov    = &r->iov[i];
+        r->msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return r;
+}
+
+// ---------------------------------------------------------------------------
+// mc_to_tcp
+
+static void
+publish(xrelay *r, const char *data, int32_t len)
+{
+    xmsg *m;
+
+    r->stats.datagrams_in++;
+    if (len > r->cfg.max_datagram) {
+        r->stats.dropped++;
+        return;
+    }
+    if (xpub_count(r->pub) == 0 || (m = xmsg_alloc(len)) == NULL) {
+        return;
+    }
+    memcpy(xmsg_data(m), data, len);
+    r->stats.frames_out += xpub_publish(r->pub, m);
+    xmsg_unref(m);
+}
+
+static void
+rx_cb(xloop_op *op, int32_t result)
+{
+    xrelay *r = (xrelay *)op->user;
+    int32_t b, i, n;
+
+    r->ops--;
+    if (r->closing) {
+        maybe_free(r);
+        return;
+    }
+    if (result >= 0) {
+        r->stats.syscalls++;
+        publish(r, r->bufs, result);
+    } else {
+        xs_printf("[xrelay] multicast receive error %d\n", op->err);
+    }
+
+    // drain what else is queued, a batch per call
+    for (b = 0; b < DRAIN_BATCHES; b++) {
+        for (i = 0; i < r->cfg.batch; i++) {
+            r->iov[i].iov_len = (size_t)r->slot;
+        }
+        if ((n = recvmmsg(r->mc_fd, r->msgs, r->cfg.batch, MSG_DONTWAIT, NULL)) <= 0) {
+            break;
+        }
+        r->stats.syscalls++;
+        for (i = 0; i < n; i++) {
+            int32_t len = (int32_t)r->msgs[i].msg_len;
+            if (r->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) {
+                len = r->slot;      // counted as oversized
+            }
+            publish(r, (const char *)r->iov[i].iov_base, len);
+        }
+        if (n < r->cfg.batch) {
+            break;
+        }
+    }
+
+    if (xloop_recv(r->loop, &r->rop, r->mc_fd, r->bufs, r->slot, rx_cb, r) != 0) {
+        xs_printf("[xrelay] cannot wait on multicast socket %d\n", r->mc_fd);
+        return;
+    }
+    r->ops++;
+}
+
+// ---------------------------------------------------------------------------
+// tcp_to_mc
+
+// ---------------------------------------------------------------------------
+// Function   : send the waiting datagrams
+// Marks      : what the socket refuses is dropped, multicast has no way to
+//              hold a sender back
+// ---------------------------------------------------------------------------
+static void
+flush(xrelay *r)
+{
+    int32_t off = 0, n;
+
+    while (off < r->nbatch) {
+        if ((n = sendmmsg(r->mc_fd, r->msgs + off, r->nbatch - off, 0)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            xs_printf("[xrelay] multicast send error %d\n", errno);
+            r->stats.dropped += r->nbatch - off;
+            break;
+        }
+        r->stats.syscalls++;
+        r->stats.datagrams_out += n;
+        off += n;
+    }
+    r->nbatch = 0;
+}
+
+static void
+flush_cb(xloop_op *op, int32_t result)
+{
+    xrelay *r = (xrelay *)op->user;
+
+    (void)result;
+    r->ops--;
+    r->flushing = 0;
+    if (!r->closing) {
+        flush(r);
+    }
+    maybe_free(r);
+}
+
+static void
+on_frame(xconn *c, const void *data, int32_t len)
+{
+    xrelay *r = (xrelay *)xconn_user(c);
+
+    r->stats.frames_in++;
+    if (len > r->cfg.max_datagram) {
+        r->stats.dropped++;
+        return;
+    }
+    if (r->nbatch == r->cfg.batch) {
+        flush(r);
+    }
+    memcpy(r->iov[r->nbatch].iov_base, data, len);
+    r->iov[r->nbatch].iov_len = (size_t)len;
+    r->nbatch++;
+    if (!r->flushing) {
+        r->flushing = 1;
+        r->ops++;
+        xloop_defer(r->loop, &r->fop, flush_cb, r);
+    }
+}
+
+static void
+on_event(xconn *c, xconn_event ev, int32_t err)
+{
+    xrelay *r = (xrelay *)xconn_user(c);
+    int32_t i;
+
+    if (ev != XCONN_EV_CLOSED && ev != XCONN_EV_DEAD) {
+        return;
+    }
+    xs_printf("[xrelay] producer lost, error %d\n", err);
+    for (i = 0; i < r->nconns; i++) {
+        if (r->conns[i] == c) {
+            r->conns[i] = r->conns[--r->nconns];
+            break;
+        }
+    }
+    xconn_close(c);
+}
+
+// ---------------------------------------------------------------------------
+// both directions
+
+static void
+accept_cb(xloop_op *op, int32_t result)
+{
+    xrelay *r = (xrelay *)op->user;
+    xconn  *c;
+
+    if (result < 0) {
+        r->ops--;                   // the final callback
+        maybe_free(r);
+        return;
+    }
+    if (r->closing || socket_set_opts(result, &r->cfg.tcp_opts) != 0) {
+        socket_close(result);
+        return;
+    }
+    if (!r->to_mc) {
+        if (xpub_add(r->pub, result) != 0) {
+            socket_close(result);
+        }
+        return;
+    }
+    if (r->nconns == r->cap) {
+        int32_t cap    = r->cap ? r->cap * 2 : 16;
+        xconn **conns  = (xconn **)realloc(r->conns, cap * sizeof(xconn *));
+        if (conns == NULL) {
+            socket_close(result);
+            return;
+        }
+        r->conns = conns;
+        r->cap   = cap;
+    }
+    if ((c = xconn_create(r->loop, result, &r->cfg.conn, on_frame, on_event, r)) == NULL) {
+        socket_close(result);
+        return;
+    }
+    r->conns[r->nconns++] = c;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : start a multicast to TCP gateway
+// Parameters :
+//      [in ] : loop      - the event loop
+//            : ip_if     - interface address for the group
+//            : ip_grp    - multicast group
+//            : port      - multicast port
+//            : listen_fd - listening socket for the subscribers
+//            : cfg       - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the relay, NULL on error
+// ---------------------------------------------------------------------------
+xrelay *
+xrelay_mc_to_tcp(xloop *loop, const char *ip_if, const char *ip_grp, uint16_t port,
+                 socket_t listen_fd, const xrelay_config *cfg)
+{
+    xrelay *r;
+
+    if ((r = relay_new(loop, listen_fd, cfg)) == NULL) {
+        return NULL;
+    }
+    if ((r->pub = xpub_create(loop, &r->cfg.pub)) == NULL
+        || (r->mc_fd = socket_add_mc_ex(ip_if, ip_grp, port, r->cfg.rcvbuf)) == INVALID_SOCKET) {
+        goto fail;
+    }
+    if (xloop_recv(loop, &r->rop, r->mc_fd, r->bufs, r->slot, rx_cb, r) != 0) {
+        goto fail;
+    }
+    r->ops++;
+    if (xloop_accept_multi(loop, &r->aop, listen_fd, accept_cb, r) != 0) {
+        xrelay_destroy(r);
+        return NULL;
+    }
+    r->ops++;
+    return r;
+
+fail:
+    xpub_destroy(r->pub);
+    if (r->mc_fd != INVALID_SOCKET) {
+        socket_close(r->mc_fd);
+    }
+    r->closing = 1;
+    maybe_free(r);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : start a TCP to multicast relay
+// Parameters :
+//      [in ] : loop      - the event loop
+//            : listen_fd - listening socket for the producers
+//            : ip_if     - interface address to send from
+//            : ip_grp    - multicast group
+//            : port      - multicast port
+//            : cfg       - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the relay, NULL on error
+// ---------------------------------------------------------------------------
+xrelay *
+xrelay_tcp_to_mc(xloop *loop, socket_t listen_fd, const char *ip_if, const char *ip_grp,
+                 uint16_t port, const xrelay_config *cfg)
+{
+    xrelay *r;
+
+    if ((r = relay_new(loop, listen_fd, cfg)) == NULL) {
+        return NULL;
+    }
+    r->to_mc = 1;
+    if ((r->mc_fd = socket_create_mc_ex(ip_if, ip_grp, port, (char)r->cfg.ttl,
+                                        r->cfg.mc_loop)) == INVALID_SOCKET) {
+        r->closing = 1;
+        maybe_free(r);
+        return NULL;
+    }
+    if (xloop_accept_multi(loop, &r->aop, listen_fd, accept_cb, r) != 0) {
+        socket_close(r->mc_fd);
+        r->closing = 1;
+        maybe_free(r);
+        return NULL;
+    }
+    r->ops++;
+    return r;
+}
+
+void
+xrelay_destroy(xrelay *r)
+{
+    int32_t i;
+
+    if (r == NULL || r->closing) {
+        return;
+    }
+    r->closing = 1;
+    xloop_detach(r->loop, r->listen_fd);
+    if (r->to_mc) {
+        flush(r);
+        for (i = 0; i < r->nconns; i++) {
+            xconn_close(r->conns[i]);
+        }
+        r->nconns = 0;
+        socket_close(r->mc_fd);
+    } else {
+        xpub_destroy(r->pub);
+        xloop_close(r->loop, r->mc_fd);
+    }
+    r->mc_fd = INVALID_SOCKET;
+    maybe_free(r);
+}
+
+void
+xrelay_get_stats(xrelay *r, xrelay_stats *stats)
+{
+    *stats = r->stats;
+    stats->peers = r->to_mc ? r->nconns : xpub_count(r->pub);
+}
@@ -0,0 +1,92 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xrelay.h
+ *  @brief    Multicast to TCP gateway and TCP to multicast relay (Linux)
+ *
+ *  Consumers that cannot receive multicast get the stream over TCP:
+ *
+ *      mc_to_tcp - joins a group and republishes every datagram as one
+ *                  xconn data frame to all TCP subscribers (xpub); the
+ *                  datagrams are taken in batches of up to cfg.batch per
+ *                  system call (recvmmsg)
+ *      tcp_to_mc - accepts TCP producers and sends every data frame they
+ *                  send as one datagram to a group; the frames of one loop
+ *                  round go out together (sendmmsg)
+ *
+ *  Both accept their TCP peers on a listening socket the caller created,
+ *  and run on the caller's loop.  A relay adds one loop round of latency
+ *  per hop at most; the datagrams of a burst share the system calls.
+ *
+ *  All calls are made on the loop thread.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XRELAY_H__
+#define __XRELAY_H__
+
+#include <stdint.h>
+#include "xconn.h"
+#include "xpub.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xrelay xrelay;
+
+/* relay settings, see xrelay_config_init for the defaults */
+typedef struct xrelay_config {
+    xpub_config  pub;               // mc_to_tcp: the subscriber side
+    xconn_config conn;              // tcp_to_mc: the producer connections
+    socket_opts  tcp_opts;          // applied to every accepted TCP peer
+    int32_t      batch;             // datagrams per recvmmsg/sendmmsg
+    int32_t      max_datagram;      // larger datagrams and frames are dropped
+    int32_t      rcvbuf;            // mc_to_tcp: multicast receive buffer, 0 for the default
+    int32_t      ttl;               // tcp_to_mc: multicast time-to-live
+    int32_t      mc_loop;           // tcp_to_mc: deliver to receivers on this host too
+} xrelay_config;
+
+/* counters of a relay */
+typedef struct xrelay_stats {
+    int64_t datagrams_in;           // mc_to_tcp: datagrams received
+    int64_t datagrams_out;          // tcp_to_mc: datagrams sent
+    int64_t frames_in;              // tcp_to_mc: frames received from producers
+    int64_t frames_out;             // mc_to_tcp: frames queued to subscribers
+    int64_t syscalls;               // recvmmsg/sendmmsg calls that moved datagrams
+    int64_t dropped;                // oversized, or refused by the socket
+    int32_t peers;                  // connected subscribers or producers
+} xrelay_stats;
+
+/* defaults: xpub_config_init and xconn_config_init, SOCKET_PROFILE_LATENCY
+ * for the TCP peers, batches of 64, datagrams up to 9216 bytes (jumbo
+ * frames), ttl 1, no loop back
+ */
+void xrelay_config_init(xrelay_config *cfg);
+
+/* join ip_grp:port on interface ip_if and republish to the subscribers
+ * accepted on listen_fd; cfg NULL for the defaults; NULL on error
+ */
+xrelay *xrelay_mc_to_tcp(xloop *loop, const char *ip_if, const char *ip_grp, uint16_t port,
+                         socket_t listen_fd, const xrelay_config *cfg);
+
+/* send the frames of the producers accepted on listen_fd to ip_grp:port
+ * through interface ip_if; cfg NULL for the defaults; NULL on error
+ */
+xrelay *xrelay_tcp_to_mc(xloop *loop, socket_t listen_fd, const char *ip_if, const char *ip_grp,
+                         uint16_t port, const xrelay_config *cfg);
+
+/* stop accepting, close the peers and the multicast socket; listen_fd
+ * stays open.  The memory goes once the loop has given back the pending
+ * operations
+ */
+void xrelay_destroy(xrelay *r);
+
+/* a copy of the counters
+ */
+void xrelay_get_stats(xrelay *r, xrelay_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XRELAY_H__
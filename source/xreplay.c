@@ -0,0 +1,379 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xreplay.c
+ *  @brief    Time-accurate replay of capture journals (Linux)
+ *
+ *  One sender per stream, opened at the first record of the stream with
+ *  the recorded address or the one given to xreplay_map.  A stream whose
+ *  sender cannot be opened is skipped for the rest of the run.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "xconn.h"
+#include "xreplay.h"
+#include "xsocket_int.h"
+
+#define MAX_SLEEP_NS    100000000   // longest sleep between checks of xreplay_stop
+
+/* the sender of one stream */
+typedef struct target {
+    socket_t fd;
+    int32_t  opened;                // tried, fd is INVALID_SOCKET when that failed
+    int32_t  mapped;                // addr/port set by xreplay_map
+    uint16_t port;
+    char     addr[60];
+} target;
+
+struct xreplay {
+    xreplay_config  cfg;
+    xcap_reader    *rd;
+    target         *targets;
+    int32_t         ntargets;
+    int32_t         stop;
+    xreplay_stats   stats;
+};
+
+void
+xreplay_config_init(xreplay_config *cfg)
+{
+    cfg->speed   = 1.0;
+    cfg->spin_us = 50;
+    cfg->ip_if   = "127.0.0.1";
+    cfg->ttl     = 1;
+    cfg->mc_loop = 1;
+    cfg->tcp_raw = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : the sender slot of a stream, grown on demand
+// Return     : the slot, NULL on error
+// ---------------------------------------------------------------------------
+static target *
+get_target(xreplay *rp, int32_t stream)
+{
+    if (stream >= rp->ntargets) {
+        int32_t i, n = stream + 1;
+        target *t = (target *)realloc(rp->targets, n * sizeof(target));
+        if (t == NULL) {
+            return NULL;
+        }
+        memset(t + rp->ntargets, 0, (n - rp->ntargets) * sizeof(target));
+        for (i = rp->ntargets; i < n; i++) {
+            t[i].fd = INVALID_SOCKET;
+        }
+        rp->targets  = t;
+        rp->ntargets = n;
+    }
+    return &rp->targets[stream];
+}
+
+xreplay *
+xreplay_open(const char *prefix, const xreplay_config *cfg)
+{
+    xreplay *rp;
+
+    if ((rp = (xreplay *)calloc(1, sizeof(xreplay))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        rp->cfg = *cfg;
+    } else {
+        xreplay_config_init(&rp->cfg);
+    }
+    if (rp->cfg.speed < 0 || (rp->rd = xcap_reader_open(prefix)) == NULL) {
+        xs_printf("[xreplay] cannot open journal %s\n", prefix);
+        free(rp);
+        return NULL;
+    }
+    return rp;
+}
+
+int32_t
+xreplay_map(xreplay *rp, int32_t stream, const char *addr, uint16_t port)
+{
+    target *t;
+
+    if (stream < 0 || stream >= XCAP_MAX_STREAMS || (t = get_target(rp, stream)) == NULL) {
+        return SOCKET_ERROR;
+    }
+    t->mapped = 1;
+    t->port   = port;
+    snprintf(t->addr, sizeof(t->addr), "%s", addr);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open the sender of a stream
+// Return     : the socket, INVALID_SOCKET when the stream is skipped
+// ---------------------------------------------------------------------------
+static socket_t
+open_target(xreplay *rp, int32_t stream)
+{
+    const xcap_stream_def *def = xcap_reader_stream(rp->rd, stream);
+    target                *t   = get_target(rp, stream);
+
+    if (t == NULL || t->opened) {
+        return t != NULL ? t->fd : INVALID_SOCKET;
+    }
+    t->opened = 1;
+    if (def == NULL) {
+        xs_printf("[xreplay] stream %d has no definition, skipped\n", stream);
+        return INVALID_SOCKET;
+    }
+    if (!t->mapped) {
+        t->port = def->port;
+        snprintf(t->addr, sizeof(t->addr), "%s", def->addr);
+    }
+    if (def->type == XCAP_MC) {
+        t->fd = socket_create_mc_ex(rp->cfg.ip_if, t->addr, t->port, (char)rp->cfg.ttl,
+                                    rp->cfg.mc_loop);
+    } else {
+        socket_opts opts;
+        socket_opts_init(&opts, SOCKET_PROFILE_LATENCY);
+        t->fd = socket_create_tcp_client_ex(t->addr, t->port, &opts);
+    }
+    xs_printf("[xreplay] stream %d to %s %s:%d%s\n", stream, def->type == XCAP_MC ? "mc" : "tcp",
+              t->addr, t->port, t->fd == INVALID_SOCKET ? " failed, skipped" : "");
+    return t->fd;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait for room in the buffer of a full socket
+// Return     : zero when it may be writable, SOCKET_ERROR on error or when
+//              stopped
+// Marks      : wakes up every MAX_SLEEP_NS to check xreplay_stop
+// ---------------------------------------------------------------------------
+static int32_t
+wait_writable(xreplay *rp, socket_t fd)
+{
+    struct pollfd p;
+    int64_t       t0 = socket_now_ns();
+    int           rc;
+
+    rp->stats.blocked++;
+    p.fd     = fd;
+    p.events = POLLOUT;
+    do {
+        if (__atomic_load_n(&rp->stop, __ATOMIC_RELAXED)) {
+            return SOCKET_ERROR;
+        }
+        p.revents = 0;
+        rc = poll(&p, 1, MAX_SLEEP_NS / 1000000);
+    } while (rc == 0 || (rc < 0 && errno == EINTR));
+    rp->stats.blocked_ns += socket_now_ns() - t0;
+    return rc < 0 ? SOCKET_ERROR : 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : send a datagram, waiting while the socket buffer is full
+// Return     : zero on success, SOCKET_ERROR on error or when stopped
+// Marks      : the multicast senders are non-blocking
+// ---------------------------------------------------------------------------
+static int32_t
+send_mc(xreplay *rp, socket_t fd, const char *data, int32_t len)
+{
+    for (;;) {
+        if (socket_send(fd, (char *)data, len) == len) {
+            return 0;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_writable(rp, fd) != 0) {
+            return SOCKET_ERROR;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : send a TCP record, as an xconn data frame unless tcp_raw
+// Return     : zero on success, SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+static int32_t
+send_tcp(xreplay *rp, socket_t fd, const char *data, int32_t len)
+{
+    char          hdr[XCONN_HDR_SIZE] = { 0 };
+    uint32_t      be = htonl((uint32_t)len);
+    struct iovec  iov[2];
+    struct msghdr msg;
+    int32_t       i = 0;
+    ssize_t       n;
+
+    memcpy(hdr, &be, sizeof(be));
+    hdr[4]         = XCONN_FRAME_DATA;
+    iov[0].iov_base = hdr;
+    iov[0].iov_len  = XCONN_HDR_SIZE;
+    iov[1].iov_base = (void *)data;
+    iov[1].iov_len  = (size_t)len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov    = rp->cfg.tcp_raw ? &iov[1] : iov;
+    msg.msg_iovlen = rp->cfg.tcp_raw ? 1 : 2;
+
+    while (msg.msg_iovlen > 0) {
+        if ((n = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if ((errno != EAGAIN && errno != EWOULDBLOCK) || wait_writable(rp, fd) != 0) {
+                return SOCKET_ERROR;
+            }
+            continue;
+        }
+        // step over what went out, a blocking socket may still write short
+        for (i = 0; i < (int32_t)msg.msg_iovlen && (size_t)n >= msg.msg_iov[i].iov_len; i++) {
+            n -= (ssize_t)msg.msg_iov[i].iov_len;
+        }
+        msg.msg_iov    += i;
+        msg.msg_iovlen -= i;
+        if (msg.msg_iovlen > 0) {
+            msg.msg_iov[0].iov_base = (char *)msg.msg_iov[0].iov_base + n;
+            msg.msg_iov[0].iov_len -= (size_t)n;
+        }
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait for the time of the next record
+// Parameters :
+//      [in ] : rp  - the replay
+//            : due - monotonic time to send at, nanoseconds
+//      [out] : none
+// Return     : how late the wait ended in nanoseconds, SOCKET_ERROR when
+//              stopped
+// Marks      : sleeps until spin_us before due, then spins on the clock
+// ---------------------------------------------------------------------------
+static int64_t
+wait_until(xreplay *rp, int64_t due)
+{
+    int64_t spin = (int64_t)rp->cfg.spin_us * 1000;
+    int64_t now  = socket_now_ns();
+
+    while (due - now > spin) {
+        int64_t         wake = due - spin;
+        struct timespec ts;
+
+        if (__atomic_load_n(&rp->stop, __ATOMIC_RELAXED)) {
+            return SOCKET_ERROR;
+        }
+        if (wake - now > MAX_SLEEP_NS) {
+            wake = now + MAX_SLEEP_NS;
+        }
+        ts.tv_sec  = wake / 1000000000;
+        ts.tv_nsec = wake % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = socket_now_ns();
+    }
+    while (now < due) {
+        now = socket_now_ns();
+    }
+    return now - due;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : send the journal
+// Parameters :
+//      [in ] : rp - the replay
+//      [out] : none
+// Return     : zero at the end of the journal, SOCKET_ERROR when stopped
+// Marks      : the first data record is sent at once and sets the origin
+//              of the timing
+// ---------------------------------------------------------------------------
+int32_t
+xreplay_run(xreplay *rp)
+{
+    const xcap_rec *r;
+    int64_t         ts0 = 0, start = 0, late;
+    int32_t         first = 1;
+    socket_t        fd;
+
+    while ((r = xcap_reader_next(rp->rd)) != NULL) {
+        const char *data = (const char *)(r + 1);
+        int32_t     len  = (int32_t)r->len, ok;
+
+        if (r->type == XCAP_STREAM) {
+            continue;
+        }
+        if (__atomic_load_n(&rp->stop, __ATOMIC_RELAXED)) {
+            return SOCKET_ERROR;
+        }
+        if ((fd = open_target(rp, r->stream)) == INVALID_SOCKET) {
+            rp->stats.skipped++;
+            continue;
+        }
+
+        if (first) {
+            ts0   = r->ts_ns;
+            start = socket_now_ns();
+            first = 0;
+        } else if (rp->cfg.speed > 0) {
+            int64_t due = start + (int64_t)((double)(r->ts_ns - ts0) / rp->cfg.speed);
+            if ((late = wait_until(rp, due)) < 0) {
+                return SOCKET_ERROR;
+            }
+            rp->stats.late_sum_ns += late;
+            if (late > rp->stats.late_max_ns) {
+                rp->stats.late_max_ns = late;
+            }
+        }
+
+        if (r->type == XCAP_MC) {
+            ok = send_mc(rp, fd, data, len) == 0;
+        } else {
+            ok = send_tcp(rp, fd, data, len) == 0;
+        }
+        if (!ok) {
+            if (__atomic_load_n(&rp->stop, __ATOMIC_RELAXED)) {
+                return SOCKET_ERROR;
+            }
+            rp->stats.skipped++;
+            continue;
+        }
+        rp->stats.records++;
+        rp->stats.bytes += len;
+    }
+    return 0;
+}
+
+void
+xreplay_stop(xreplay *rp)
+{
+    __atomic_store_n(&rp->stop, 1, __ATOMIC_RELAXED);
+}
+
+void
+xreplay_get_stats(xreplay *rp, xreplay_stats *stats)
+{
+    *stats = rp->stats;
+}
+
+void
+xreplay_close(xreplay *rp)
+{
+    int32_t i;
+
+    if (rp == NULL) {
+        return;
+    }
+    for (i = 0; i < rp->ntargets; i++) {
+        if (rp->targets[i].fd != INVALID_SOCKET) {
+            socket_close(rp->targets[i].fd);
+        }
+    }
+    free(rp->targets);
+    xcap_reader_close(rp->rd);
+    free(rp);
+}
@@ -0,0 +1,95 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xreplay.h
+ *  @brief    Time-accurate replay of capture journals (Linux)
+ *
+ *  A journal written by xcap is read through its mappings and sent again:
+ *  the datagrams of every multicast stream through a socket_create_mc
+ *  sender to the same group and port, the frames of every TCP stream as
+ *  xconn data frames over a connection to the recorded peer.  xreplay_map
+ *  sends a stream somewhere else, so production traffic can be played
+ *  against consumers on a test box.
+ *
+ *  Pacing: each record is sent at (ts - ts_first) / speed after the
+ *  start.  The replayer sleeps until spin_us before that time and spins
+ *  on the monotonic clock for the rest, so the timer slack of the sleep
+ *  does not show in the gaps.  speed 0 sends as fast as the sockets go.
+ *  A record is never dropped for a full socket buffer: the send waits for
+ *  room (counted as blocked), only an error skips it.
+ *
+ *      xreplay *rp = xreplay_open("/data/feed", NULL);
+ *      xreplay_map(rp, 0, "239.1.1.50", 12000);
+ *      xreplay_run(rp);
+ *      xreplay_close(rp);
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XREPLAY_H__
+#define __XREPLAY_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+#include "xcap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xreplay xreplay;
+
+/* replay settings, see xreplay_config_init for the defaults */
+typedef struct xreplay_config {
+    double      speed;              // 1 the recorded timing, 2 twice as fast, 0 no pacing
+    int32_t     spin_us;            // spin this long before each send instead of sleeping
+    const char *ip_if;              // interface of the multicast senders
+    int32_t     ttl;                // multicast time-to-live
+    int32_t     mc_loop;            // deliver to receivers on this host too
+    int32_t     tcp_raw;            // send TCP records as they are, without frame headers
+} xreplay_config;
+
+/* counters of a replay */
+typedef struct xreplay_stats {
+    int64_t records;                // records sent
+    int64_t bytes;                  // data bytes sent
+    int64_t skipped;                // records of streams without a sender, or sends that failed
+    int64_t blocked;                // sends that waited for a full socket buffer
+    int64_t blocked_ns;             // time spent waiting, apart from the timer lateness
+    int64_t late_max_ns;            // the latest a send started after its time
+    int64_t late_sum_ns;            // sum of the lateness, for the mean
+} xreplay_stats;
+
+/* defaults: recorded timing, 50 us spin, interface 127.0.0.1, ttl 1,
+ * loop back on, xconn framing on TCP
+ */
+void xreplay_config_init(xreplay_config *cfg);
+
+/* open the journal written with prefix; cfg NULL for the defaults; NULL
+ * on error
+ */
+xreplay *xreplay_open(const char *prefix, const xreplay_config *cfg);
+
+/* send stream number stream to addr:port instead of where it was
+ * recorded, before xreplay_run; zero on success
+ */
+int32_t xreplay_map(xreplay *rp, int32_t stream, const char *addr, uint16_t port);
+
+/* send the journal, returns at its end or after xreplay_stop; zero on
+ * success, SOCKET_ERROR when stopped
+ */
+int32_t xreplay_run(xreplay *rp);
+
+/* make xreplay_run return, from any thread
+ */
+void xreplay_stop(xreplay *rp);
+
+void xreplay_get_stats(xreplay *rp, xreplay_stats *stats);
+
+/* close the senders and the journal
+ */
+void xreplay_close(xreplay *rp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XREPLAY_H__
@@ -0,0 +1,574 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xshm.c
+ *  @brief    Shared-memory ring connection between processes (Linux)
+ *
+ *  Each ring has one producer and one consumer.  The producer owns head,
+ *  the consumer tail, both count bytes from the start and only grow; a
+ *  frame is an 8-byte header (length, type) and the data, 8-aligned, and
+ *  never wraps: when it does not fit before the end the producer fills the
+ *  rest with a pad frame.  Each side keeps a copy of the other's counter
+ *  and reads the shared one only when the copy says full or empty.
+ *
+ *  Sleeping: a side that finds nothing to do spins for spin_us, then sets
+ *  its flag in the ring, checks once more and sleeps on its eventfd.  The
+ *  other side checks the flag after each publish and writes the eventfd
+ *  only when it is set; both sides fence between the store and the load,
+ *  so one of them always sees the other.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "xshm.h"
+#include "xsocket_int.h"
+
+#define XSHM_MAGIC      0x314d485358ULL     // "XSHM1"
+#define HDR_SIZE        8
+#define FRAME_DATA      0
+#define FRAME_PAD       1
+#define NFDS            5                   // memfd, then the eventfds below
+#define ALIGN8(n)       (((n) + 7) & ~(uint32_t)7)
+
+/* the eventfds, index of ring r: data wakes its consumer, space its producer */
+#define EFD_DATA(r)     (1 + (r))
+#define EFD_SPACE(r)    (3 + (r))
+
+/* one direction, shared; the counters on their own cache lines */
+typedef struct ring {
+    uint64_t head __attribute__((aligned(64)));     // written by the producer
+    uint64_t tail __attribute__((aligned(64)));     // written by the consumer
+    uint32_t rx_sleep __attribute__((aligned(64))); // the consumer sleeps on data
+    uint32_t tx_sleep;                              // the producer sleeps on space
+    uint32_t closed;                                // the producer has closed
+} ring;
+
+/* the start of the memfd, the ring data follows page aligned */
+typedef struct shm_hdr {
+    uint64_t magic;
+    uint32_t ring_size;
+    uint32_t data_off;
+    ring     r[2];                  // 0 is sent by the accepting side
+} shm_hdr;
+
+typedef struct frame {
+    uint32_t len;
+    uint32_t type;
+} frame;
+
+struct xshm {
+    xshm_config cfg;
+    shm_hdr    *hdr;
+    size_t      map_size;
+    uint32_t    mask;
+    ring       *tx, *rx;
+    char       *txd, *rxd;
+    int         tx_data, rx_data;   // eventfds: wake the peer's consumer, ours
+    int         tx_space, rx_space; // wait for space in tx, wake the peer's producer
+    socket_t    sock;               // the setup socket, hangs up when the peer dies
+    int32_t     peer_gone;
+    uint64_t    head, tail_cache;   // producer side of tx
+    uint64_t    tail, head_cache;   // consumer side of rx
+    xshm_stats  stats;
+};
+
+void
+xshm_config_init(xshm_config *cfg)
+{
+    cfg->ring_size = 1 << 20;
+    cfg->spin_us   = 50;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : map the memfd and fault its pages in writable
+// Return     : the mapping, NULL on error
+// ---------------------------------------------------------------------------
+static void *
+map_region(int fd, size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_POPULATE_WRITE
+    madvise(p, size, MADV_POPULATE_WRITE);  // best effort, the first frames fault otherwise
+#endif
+    return p;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : build one side over a mapping and the passed fds
+// Parameters :
+//      [in ] : base - the mapping
+//            : fds  - memfd and the four eventfds, taken over except the memfd
+//            : side - 0 accepting, 1 connecting
+// Return     : the connection, NULL on error
+// ---------------------------------------------------------------------------
+static xshm *
+setup(shm_hdr *base, size_t size, const int *fds, int side, socket_t sock, const xshm_config *cfg)
+{
+    xshm *s;
+    char *data = (char *)base + base->data_off;
+
+    if ((s = (xshm *)calloc(1, sizeof(xshm))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        s->cfg = *cfg;
+    } else {
+        xshm_config_init(&s->cfg);
+    }
+    s->cfg.ring_size = (int32_t)base->ring_size;
+    s->hdr      = base;
+    s->map_size = size;
+    s->mask     = base->ring_size - 1;
+    s->tx       = &base->r[side];
+    s->rx       = &base->r[1 - side];
+    s->txd      = data + (size_t)side * base->ring_size;
+    s->rxd      = data + (size_t)(1 - side) * base->ring_size;
+    s->tx_data  = fds[EFD_DATA(side)];
+    s->rx_data  = fds[EFD_DATA(1 - side)];
+    s->tx_space = fds[EFD_SPACE(side)];
+    s->rx_space = fds[EFD_SPACE(1 - side)];
+    s->sock     = sock;
+    return s;
+}
+
+static void
+close_fds(int *fds, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+xshm *
+xshm_accept(socket_t listen_fd, int32_t ms_timeout, const xshm_config *cfg)
+{
+    xshm_config    c;
+    shm_hdr       *base = NULL;
+    xshm          *s;
+    socket_t       sock;
+    int            fds[NFDS] = { -1, -1, -1, -1, -1 };
+    size_t         size;
+    uint32_t       off = (sizeof(shm_hdr) + 4095) & ~4095u;
+    char           cbuf[CMSG_SPACE(sizeof(fds))], byte = 'X';
+    struct iovec   iov = { &byte, 1 };
+    struct msghdr  msg;
+    struct cmsghdr *cm;
+    int            i;
+
+    if (cfg != NULL) {
+        c = *cfg;
+    } else {
+        xshm_config_init(&c);
+    }
+    if (c.ring_size < 4096 || (c.ring_size & (c.ring_size - 1)) != 0) {
+        xs_printf("[xshm] ring size %d is not a power of two >= 4096\n", c.ring_size);
+        return NULL;
+    }
+    if ((sock = socket_create_tcp_server(listen_fd, ms_timeout)) == INVALID_SOCKET) {
+        return NULL;
+    }
+    size = off + 2 * (size_t)c.ring_size;
+    if ((fds[0] = memfd_create("xshm", MFD_CLOEXEC)) < 0 || ftruncate(fds[0], (off_t)size) != 0
+        || (base = (shm_hdr *)map_region(fds[0], size)) == NULL) {
+        xs_printf("[xshm] cannot create %u bytes of shared memory: %s\n", (unsigned)size, strerror(errno));
+        goto fail;
+    }
+    base->magic     = XSHM_MAGIC;
+    base->ring_size = (uint32_t)c.ring_size;
+    base->data_off  = off;
+    for (i = 1; i < NFDS; i++) {
+        if ((fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            goto fail;
+        }
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    memset(cbuf, 0, sizeof(cbuf));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    cm             = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type  = SCM_RIGHTS;
+    cm->cmsg_len   = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != 1) {
+        xs_printf("[xshm] cannot pass the ring to the peer: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    if ((s = setup(base, size, fds, 0, sock, &c)) == NULL) {
+        goto fail;
+    }
+    close(fds[0]);
+    return s;
+
+fail:
+    if (base != NULL) {
+        munmap(base, size);
+    }
+    close_fds(fds, NFDS);
+    socket_close(sock);
+    return NULL;
+}
+
+xshm *
+xshm_connect(const char *addr, const xshm_config *cfg)
+{
+    shm_hdr       *base = NULL;
+    xshm          *s;
+    socket_t       sock;
+    int            fds[NFDS] = { -1, -1, -1, -1, -1 };
+    struct stat    st;
+    char           cbuf[CMSG_SPACE(sizeof(fds))], byte;
+    struct iovec   iov = { &byte, 1 };
+    struct msghdr  msg;
+    struct cmsghdr *cm;
+    ssize_t        n;
+    size_t         nfds;
+
+    if ((sock = socket_create_tcp_client(addr, 0)) == INVALID_SOCKET) {
+        return NULL;
+    }
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    while ((n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {
+    }
+    cm = n == 1 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cm == NULL || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) {
+        xs_printf("[xshm] %s did not pass a ring\n", addr);
+        socket_close(sock);
+        return NULL;
+    }
+    nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    memcpy(fds, CMSG_DATA(cm), (nfds < NFDS ? nfds : NFDS) * sizeof(int));
+    if (nfds != NFDS || fstat(fds[0], &st) != 0
+        || (size_t)st.st_size < sizeof(shm_hdr)
+        || (base = (shm_hdr *)map_region(fds[0], (size_t)st.st_size)) == NULL) {
+        goto fail;
+    }
+    if (base->magic != XSHM_MAGIC || base->ring_size < 4096
+        || (base->ring_size & (base->ring_size - 1)) != 0
+        || base->data_off + 2 * (uint64_t)base->ring_size > (uint64_t)st.st_size) {
+        xs_printf("[xshm] %s passed a bad ring\n", addr);
+        goto fail;
+    }
+    if ((s = setup(base, (size_t)st.st_size, fds, 1, sock, cfg)) == NULL) {
+        goto fail;
+    }
+    close(fds[0]);
+    return s;
+
+fail:
+    if (base != NULL) {
+        munmap(base, (size_t)st.st_size);
+    }
+    close_fds(fds, NFDS);
+    socket_close(sock);
+    return NULL;
+}
+
+int32_t
+xshm_max_frame(xshm *s)
+{
+    return s->cfg.ring_size / 2 - HDR_SIZE;
+}
+
+// ---------------------------------------------------------------------------
+// waking and waiting
+
+// ---------------------------------------------------------------------------
+// Function   : wake the other side after a publish if it sleeps
+// Parameters :
+//      [in ] : flag - its sleep flag
+//            : efd  - its eventfd
+// Marks      : the flag is taken with an exchange, so one publish wakes it
+// ---------------------------------------------------------------------------
+static void
+wake(xshm *s, uint32_t *flag, int efd)
+{
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(flag, __ATOMIC_RELAXED) && __atomic_exchange_n(flag, 0, __ATOMIC_ACQ_REL)) {
+        if (write(efd, &one, sizeof(one)) == sizeof(one)) {
+            s->stats.wakeups++;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : sleep on an eventfd, or until the peer hangs up
+// Return     : zero when woken or timed out, SOCKET_ERROR when the peer is
+//              gone
+// ---------------------------------------------------------------------------
+static int32_t
+sleep_on(xshm *s, int efd, int32_t ms_timeout)
+{
+    struct pollfd p[2];
+    uint64_t      v;
+
+    p[0].fd     = efd;
+    p[0].events = POLLIN;
+    p[1].fd     = s->sock;
+    p[1].events = POLLIN;
+    if (poll(p, 2, ms_timeout) > 0) {
+        if (p[1].revents != 0) {
+            s->peer_gone = 1;       // nothing is sent on the socket after the setup
+            return SOCKET_ERROR;
+        }
+        if (read(efd, &v, sizeof(v)) < 0) {
+            // the count was taken by a racing read, nothing to do
+        }
+    }
+    return 0;
+}
+
+/* the next data frame of rx, NULL when it is empty; steps over pads */
+static frame *
+peek(xshm *s)
+{
+    frame *f;
+
+    for (;;) {
+        if (s->tail == s->head_cache) {
+            s->head_cache = __atomic_load_n(&s->rx->head, __ATOMIC_ACQUIRE);
+            if (s->tail == s->head_cache) {
+                return NULL;
+            }
+        }
+        f = (frame *)(s->rxd + (s->tail & s->mask));
+        if (f->type != FRAME_PAD) {
+            return f;
+        }
+        s->tail += HDR_SIZE + f->len;
+        __atomic_store_n(&s->rx->tail, s->tail, __ATOMIC_RELEASE);
+    }
+}
+
+static void
+consume(xshm *s, frame *f)
+{
+    s->stats.frames_in++;
+    s->stats.bytes_in += f->len;
+    s->tail += ALIGN8(HDR_SIZE + f->len);
+    __atomic_store_n(&s->rx->tail, s->tail, __ATOMIC_RELEASE);
+    wake(s, &s->rx->tx_sleep, s->rx_space);
+}
+
+static int32_t
+has_frame(xshm *s, uint32_t unused)
+{
+    (void)unused;
+    return peek(s) != NULL || __atomic_load_n(&s->rx->closed, __ATOMIC_ACQUIRE);
+}
+
+static int32_t
+has_space(xshm *s, uint32_t need)
+{
+    s->tail_cache = __atomic_load_n(&s->tx->tail, __ATOMIC_ACQUIRE);
+    return s->head + need - s->tail_cache <= (uint64_t)s->cfg.ring_size;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait until ready(s, arg) holds
+// Parameters :
+//      [in ] : flag       - our sleep flag in the ring
+//            : efd        - our eventfd for it
+//            : ms_timeout - -1 forever
+// Return     : zero when ready, 1 on timeout, SOCKET_ERROR when the peer is
+//              gone
+// Marks      : spins for spin_us, then announces the sleep on the flag and
+//              checks again before sleeping
+// ---------------------------------------------------------------------------
+static int32_t
+wait_for(xshm *s, int32_t (*ready)(xshm *, uint32_t), uint32_t arg, uint32_t *flag, int efd,
+         int32_t ms_timeout)
+{
+    int64_t now      = socket_now_ns();
+    int64_t spin_end = now + (int64_t)s->cfg.spin_us * 1000;
+    int64_t deadline = ms_timeout < 0 ? INT64_MAX : now + (int64_t)ms_timeout * 1000000;
+
+    if (spin_end > deadline) {
+        spin_end = deadline;
+    }
+
+    while (!ready(s, arg)) {
+        if (now < spin_end) {
+            cpu_relax();
+            now = socket_now_ns();
+            continue;
+        }
+        if (s->peer_gone) {
+            return SOCKET_ERROR;
+        }
+        __atomic_store_n(flag, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (ready(s, arg)) {
+            __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+            break;
+        }
+        if (now >= deadline) {
+            __atomic_store_n(flag, 0, __ATOMIC_RELAXED);
+            return 1;
+        }
+        s->stats.sleeps++;
+        if (sleep_on(s, efd, deadline == INT64_MAX ? -1 : (int32_t)((deadline - now + 999999) / 1000000)) != 0) {
+            return SOCKET_ERROR;
+        }
+        now = socket_now_ns();
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// sending and receiving
+
+int32_t
+xshm_send(xshm *s, const void *data, int32_t len)
+{
+    uint32_t size = ALIGN8(HDR_SIZE + (uint32_t)len), off, contig, need;
+    frame   *f;
+
+    if (len <= 0 || len > xshm_max_frame(s) || s->peer_gone) {
+        return SOCKET_ERROR;
+    }
+    off    = (uint32_t)(s->head & s->mask);
+    contig = (uint32_t)s->cfg.ring_size - off;
+    need   = size + (contig < size ? contig : 0);
+    if (s->head + need - s->tail_cache > (uint64_t)s->cfg.ring_size
+        && wait_for(s, has_space, need, &s->tx->tx_sleep, s->tx_space, -1) != 0) {
+        return SOCKET_ERROR;
+    }
+
+    if (contig < size) {
+        f       = (frame *)(s->txd + off);
+        f->len  = contig - HDR_SIZE;
+        f->type = FRAME_PAD;
+        s->head += contig;
+        off      = 0;
+    }
+    f       = (frame *)(s->txd + off);
+    f->len  = (uint32_t)len;
+    f->type = FRAME_DATA;
+    memcpy(f + 1, data, (size_t)len);
+    s->head += size;
+    __atomic_store_n(&s->tx->head, s->head, __ATOMIC_RELEASE);
+    wake(s, &s->tx->rx_sleep, s->tx_data);
+
+    s->stats.frames_out++;
+    s->stats.bytes_out += len;
+    return len;
+}
+
+int32_t
+xshm_recv(xshm *s, void *data, int32_t len, int32_t ms_timeout)
+{
+    frame  *f;
+    int32_t n;
+
+    if ((f = peek(s)) == NULL) {
+        if (wait_for(s, has_frame, 0, &s->rx->rx_sleep, s->rx_data, ms_timeout) == 1) {
+            return SOCKET_ERROR;
+        }
+        if ((f = peek(s)) == NULL) {
+            // closed or gone with nothing left
+            return __atomic_load_n(&s->rx->closed, __ATOMIC_ACQUIRE) || s->peer_gone ? 0 : SOCKET_ERROR;
+        }
+    }
+    n = (int32_t)f->len;
+    if (n > len) {
+        consume(s, f);
+        return SOCKET_ERROR;
+    }
+    memcpy(data, f + 1, (size_t)n);
+    consume(s, f);
+    return n;
+}
+
+int32_t
+xshm_poll(xshm *s, xshm_frame_cb cb, void *user, int32_t max)
+{
+    frame   *f;
+    int32_t  n = 0;
+    uint64_t v;
+
+    if (read(s->rx_data, &v, sizeof(v)) < 0) {
+        // nothing counted, the fd was not readable
+    }
+    while (max <= 0 || n < max) {
+        if ((f = peek(s)) == NULL) {
+            // arm, then look once more for a frame published before the flag was seen
+            __atomic_store_n(&s->rx->rx_sleep, 1, __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if ((f = peek(s)) == NULL) {
+                break;
+            }
+            __atomic_store_n(&s->rx->rx_sleep, 0, __ATOMIC_RELAXED);
+        }
+        cb(user, f + 1, (int32_t)f->len);
+        consume(s, f);
+        n++;
+    }
+    if (n == 0 && (__atomic_load_n(&s->rx->closed, __ATOMIC_ACQUIRE) || s->peer_gone)) {
+        return SOCKET_ERROR;
+    }
+    return n;
+}
+
+int32_t
+xshm_fd(xshm *s)
+{
+    return s->rx_data;
+}
+
+void
+xshm_get_stats(xshm *s, xshm_stats *stats)
+{
+    *stats = s->stats;
+}
+
+void
+xshm_close(xshm *s)
+{
+    uint64_t one = 1;
+
+    if (s == NULL) {
+        return;
+    }
+    __atomic_store_n(&s->tx->closed, 1, __ATOMIC_RELEASE);
+    if (write(s->tx_data, &one, sizeof(one)) < 0) {
+        // the counter is full, the peer is awake anyway
+    }
+    munmap(s->hdr, s->map_size);
+    close(s->tx_data);
+    close(s->rx_data);
+    close(s->tx_space);
+    close(s->rx_space);
+    socket_close(s->sock);
+    free(s);
+}
@@ -0,0 +1,110 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xshm.h
+ *  @brief    Shared-memory ring connection between processes (Linux)
+ *
+ *  A connection between two processes on one host made of two rings, one
+ *  per direction, in a memfd both map.  Frames are written and read
+ *  without system calls: the producer copies a frame in and publishes it
+ *  with one release store, the consumer reads it in place.  An eventfd
+ *  wake-up is only sent when the other side has gone to sleep, a consumer
+ *  that spins (spin_us) sees a frame within a cache-line transfer.
+ *
+ *  The connection is set up over a Unix domain socket: xshm_accept on a
+ *  socket_create_tcp_listen("unix:/path") socket creates the memory and
+ *  the eventfds and hands them to xshm_connect with SCM_RIGHTS.  The
+ *  socket stays open, so the death of the peer process is noticed.
+ *
+ *  Frames are messages as with xconn: xshm_send sends one, xshm_recv
+ *  copies one out, xshm_poll hands the waiting frames to a callback in
+ *  place.  An event loop waits on xshm_fd; xshm_poll leaves the
+ *  connection armed, so the fd becomes readable when the next frame comes.
+ *
+ *  Each side is used by one thread.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XSHM_H__
+#define __XSHM_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xshm xshm;
+
+/* connection settings, see xshm_config_init for the defaults; the
+ * accepting side chooses the ring size */
+typedef struct xshm_config {
+    int32_t ring_size;              // bytes per direction, a power of two
+    int32_t spin_us;                // spin before sleeping on an empty or full ring
+} xshm_config;
+
+/* counters of one side */
+typedef struct xshm_stats {
+    int64_t frames_out;             // frames sent
+    int64_t frames_in;              // frames received
+    int64_t bytes_out;
+    int64_t bytes_in;
+    int64_t wakeups;                // eventfd writes to wake the peer
+    int64_t sleeps;                 // waits on an eventfd after the spin
+} xshm_stats;
+
+/* a frame from xshm_poll, data valid during the call */
+typedef void (*xshm_frame_cb)(void *user, const void *data, int32_t len);
+
+/* defaults: 1 MB rings, 50 us spin
+ */
+void xshm_config_init(xshm_config *cfg);
+
+/* accept a peer on a Unix domain listening socket and set the connection
+ * up; cfg NULL for the defaults; NULL on error or timeout
+ */
+xshm *xshm_accept(socket_t listen_fd, int32_t ms_timeout, const xshm_config *cfg);
+
+/* connect to an xshm_accept peer at addr ("unix:/path"); cfg NULL for the
+ * defaults, only spin_us is used; NULL on error
+ */
+xshm *xshm_connect(const char *addr, const xshm_config *cfg);
+
+/* the largest frame, half a ring less the header
+ */
+int32_t xshm_max_frame(xshm *s);
+
+/* send one frame, waiting while the ring is full; returns len,
+ * SOCKET_ERROR on error or when the peer is gone
+ */
+int32_t xshm_send(xshm *s, const void *data, int32_t len);
+
+/* receive one frame into data, waiting up to ms_timeout (-1 forever);
+ * returns its length, 0 when the peer has closed, SOCKET_ERROR on error,
+ * timeout or a frame larger than len (the frame is dropped)
+ */
+int32_t xshm_recv(xshm *s, void *data, int32_t len, int32_t ms_timeout);
+
+/* hand up to max waiting frames (0 for all) to cb without copying them;
+ * when the ring is left empty the wake-up is armed, after max frames call
+ * it again before waiting on xshm_fd; returns the number of frames,
+ * SOCKET_ERROR when the peer has closed and nothing is left
+ */
+int32_t xshm_poll(xshm *s, xshm_frame_cb cb, void *user, int32_t max);
+
+/* an fd that is readable when xshm_poll has frames after it armed the
+ * wake-up, for epoll or an xloop
+ */
+int32_t xshm_fd(xshm *s);
+
+void xshm_get_stats(xshm *s, xshm_stats *stats);
+
+/* tell the peer and release the connection
+ */
+void xshm_close(xshm *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XSHM_H__
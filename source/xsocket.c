@@ -29,11 +29,21 @@
 
 #ifdef __GNUC__
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
 #endif
 // ---------------------------------------------------------------------------
 // for socket in windows
@@ -58,7 +68,21 @@ struct udpsender {
     int32_t len;
 };
 
-#define MAX_CONN      5               // queue length specifiable by listen
+struct socket_spin {
+    socket_t fd;
+    int64_t  spin_ns;               // budget of one spin phase
+    int32_t  kernel_busy_poll;      // SO_BUSY_POLL accepted by the kernel
+#ifdef __linux__
+    int      epfd;                  // blocking phase
+#endif
+};
+
+/* diagnostics of the library on stdout, switched by socket_set_verbose() */
+static int32_t s_verbose = 1;
+#define xs_printf(...)  do { if (s_verbose) { printf(__VA_ARGS__); } } while (0)
+#define xs_perror(s)    do { if (s_verbose) { perror(s); } } while (0)
+
+#define MAX_CONN      SOMAXCONN       // queue length specifiable by listen
 #define LOCAL_HOST    "127.0.0.1"     // local host
 
 /* ڿϵͳ/ݵĻֵ */
@@ -147,6 +171,25 @@ socket_startup(void)
     return 0;
 }
 
+// ---------------------------------------------------------------------------
+// Function   : switch the diagnostic messages of the library
+// Parameters :
+//      [in ] : on - non-zero to print messages (default), zero to be quiet
+//      [out] : none
+// Return     : none
+// ---------------------------------------------------------------------------
+void
+socket_set_verbose(int32_t on)
+{
+    s_verbose = on;
+}
+
+int32_t
+socket_get_verbose(void)
+{
+    return s_verbose;
+}
+
 // ---------------------------------------------------------------------------
 // Function   :  terminates use of the WinSock 2 DLL (Ws2_32.dll)
 // Parameters :
@@ -162,33 +205,297 @@ socket_cleanup(void)
 #endif
 }
 
+// ---------------------------------------------------------------------------
+// Function   : fill a socket option set with the values of a profile
+// Parameters :
+//      [in ] : profile - SOCKET_PROFILE_xxx
+//      [out] : opts    - the option set
+// Return     : none
+// ---------------------------------------------------------------------------
+void
+socket_opts_init(socket_opts *opts, socket_profile profile)
+{
+    memset(opts, 0, sizeof(socket_opts));
+
+    switch (profile) {
+    case SOCKET_PROFILE_LATENCY:
+        opts->nodelay  = 1;         // no Nagle wait for small messages
+        opts->quickack = 1;         // no delayed ACK on the first reply
+        break;
+    case SOCKET_PROFILE_THROUGHPUT:
+        opts->sndbuf   = 4 << 20;   // room for a full window on fast links
+        opts->rcvbuf   = 4 << 20;
+        break;
+    default:
+        break;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : set an integer socket option
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+static int32_t
+set_opt_int(socket_t fd, int level, int name, int32_t value)
+{
+    return setsockopt(fd, level, name, (const char *)&value, sizeof(value)) == 0 ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : turn an address string into a socket address
+// Parameters :
+//      [in ] : addr - "a.b.c.d", or "unix:/path" (stream) and "unixseq:/path"
+//                     (seqpacket) for a Unix domain socket, "unix:@name" in
+//                     the abstract namespace
+//            : port - TCP port, not used for Unix domain sockets
+//      [out] : ss   - the socket address
+//            : len  - its length
+//            : type - SOCK_STREAM or SOCK_SEQPACKET
+// Return     : the address family, or -1 on error
+// ---------------------------------------------------------------------------
+static int
+parse_addr(const char *addr, uint16_t port, struct sockaddr_storage *ss, socklen_t *len, int *type)
+{
+    struct sockaddr_in *sa = (struct sockaddr_in *)ss;
+
+    memset(ss, 0, sizeof(struct sockaddr_storage));
+    *type = SOCK_STREAM;
+#ifdef __GNUC__
+    if (strncmp(addr, "unix:", 5) == 0 || strncmp(addr, "unixseq:", 8) == 0) {
+        struct sockaddr_un *un   = (struct sockaddr_un *)ss;
+        const char         *path = strchr(addr, ':') + 1;
+        size_t              n    = strlen(path);
+
+        if (n == 0 || n >= sizeof(un->sun_path)) {
+            return -1;
+        }
+        if (addr[4] == 's') {
+            *type = SOCK_SEQPACKET;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, path, n);
+        if (path[0] == '@') {
+            un->sun_path[0] = '\0';     // abstract, the name has no terminator
+            *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n);
+        } else {
+            *len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + n + 1);
+        }
+        return AF_UNIX;
+    }
+#endif
+    sa->sin_family      = AF_INET;
+    sa->sin_port        = htons(port);
+    sa->sin_addr.s_addr = inet_addr(addr);
+    *len = sizeof(struct sockaddr_in);
+    return AF_INET;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : tell whether a socket is a Unix domain socket
+// ---------------------------------------------------------------------------
+static int
+is_unix(socket_t fd)
+{
+#ifdef __GNUC__
+    struct sockaddr_storage ss;
+    socklen_t len = sizeof(ss);
+
+    return getsockname(fd, (struct sockaddr *)&ss, &len) == 0 && ss.ss_family == AF_UNIX;
+#else
+    (void)fd;
+    return 0;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : apply a socket option set to a TCP socket
+// Parameters :
+//      [in ] : fd   - the socket
+//            : opts - the options, fields of zero are left untouched
+//      [out] : none
+// Return     : zero on success, otherwise the number of options that failed
+// Marks      : options the system does not have (TCP_QUICKACK, TCP_CORK and
+//              TCP_USER_TIMEOUT off Linux) are skipped, so a profile works
+//              everywhere; a Unix domain socket only takes the buffer sizes,
+//              the TCP options have no meaning there and are skipped
+// ---------------------------------------------------------------------------
+int32_t
+socket_set_opts(socket_t fd, const socket_opts *opts)
+{
+    int32_t err = 0;
+
+    if (opts == NULL) {
+        return 0;
+    }
+    if (is_unix(fd)) {
+        if (opts->sndbuf > 0) {
+            err -= set_opt_int(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+        }
+        if (opts->rcvbuf > 0) {
+            err -= set_opt_int(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+        }
+        return err;
+    }
+
+    if (opts->nodelay) {
+        err -= set_opt_int(fd, IPPROTO_TCP, TCP_NODELAY, 1);
+    }
+#if defined(TCP_CORK)
+    if (opts->cork) {
+        err -= set_opt_int(fd, IPPROTO_TCP, TCP_CORK, 1);
+    }
+#endif
+#if defined(TCP_QUICKACK)
+    if (opts->quickack) {
+        err -= socket_set_quickack(fd, 1);
+    }
+#endif
+    if (opts->sndbuf > 0) {
+        err -= set_opt_int(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf);
+    }
+    if (opts->rcvbuf > 0) {
+        err -= set_opt_int(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf);
+    }
+    if (opts->keepalive) {
+        err -= set_opt_int(fd, SOL_SOCKET, SO_KEEPALIVE, 1);
+#if defined(TCP_KEEPIDLE)
+        if (opts->keepidle_s > 0) {
+            err -= set_opt_int(fd, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepidle_s);
+        }
+        if (opts->keepintvl_s > 0) {
+            err -= set_opt_int(fd, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepintvl_s);
+        }
+        if (opts->keepcnt > 0) {
+            err -= set_opt_int(fd, IPPROTO_TCP, TCP_KEEPCNT, opts->keepcnt);
+        }
+#endif
+    }
+#if defined(TCP_USER_TIMEOUT)
+    if (opts->user_timeout_ms > 0) {
+        err -= set_opt_int(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, opts->user_timeout_ms);
+    }
+#endif
+
+    return err;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : switch the delayed ACK off (on = 1) or back on (on = 0)
+// Parameters :
+//      [in ] : fd - a TCP socket
+//            : on - on/off
+//      [out] : none
+// Return     : zero on success, otherwise failed
+// Marks      : Linux leaves quick ACK mode on its own, a latency sensitive
+//              receiver calls this again after each socket_recv
+// ---------------------------------------------------------------------------
+int32_t
+socket_set_quickack(socket_t fd, int32_t on)
+{
+#if defined(TCP_QUICKACK)
+    return set_opt_int(fd, IPPROTO_TCP, TCP_QUICKACK, on ? 1 : 0);
+#else
+    (void)fd;
+    (void)on;
+    return -1;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : cork a TCP socket (hold partial frames) or uncork it (flush)
+// Parameters :
+//      [in ] : fd - a TCP socket
+//            : on - cork/uncork
+//      [out] : none
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+int32_t
+socket_set_cork(socket_t fd, int32_t on)
+{
+#if defined(TCP_CORK)
+    return set_opt_int(fd, IPPROTO_TCP, TCP_CORK, on ? 1 : 0);
+#else
+    (void)fd;
+    (void)on;
+    return -1;
+#endif
+}
+
 // ---------------------------------------------------------------------------
 // Function   : create a listening socket (used by SERVER)
 // Parameters :
-//      [in ] : s_if_ip - IP of interface
+//      [in ] : s_if_ip - IP of interface, or "unix:/path" / "unixseq:/path"
 //      [in ] : port    - the port we want to listen to
 //      [out] : none
 // Return     : a descriptor referencing the socket or INVALID_SOCKET on error
 // ---------------------------------------------------------------------------
 socket_t
 socket_create_tcp_listen(const char *s_if_ip, const uint16_t port)
+{
+    return socket_create_tcp_listen_ex(s_if_ip, port, NULL);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a listening socket with options (used by SERVER)
+// Parameters :
+//      [in ] : s_if_ip - IP of interface, or "unix:/path" / "unixseq:/path"
+//      [in ] : port    - the port we want to listen to
+//            : opts    - socket options, NULL for none
+//      [out] : none
+// Return     : a descriptor referencing the socket or INVALID_SOCKET on error
+// Marks      : the options are set before listen, so buffer sizes take part
+//              in the window negotiation; accepted sockets still need them
+//              from socket_create_tcp_server_ex.  A socket file left at a
+//              Unix domain path is removed when a connect to it is refused
+//              (stale); when a server still answers there, the call fails
+//              with EADDRINUSE
+// ---------------------------------------------------------------------------
+socket_t
+socket_create_tcp_listen_ex(const char *s_if_ip, const uint16_t port, const socket_opts *opts)
 {
     socket_t fd;
-    struct sockaddr_in sa;
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+    int family, type;
 
-    // creates a STREAM socket
-    if ((fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET) {
+    if ((family = parse_addr(s_if_ip, port, &sa, &sa_len, &type)) < 0) {
         return INVALID_SOCKET;
     }
 
-    // make a local socket address
-    memset(&sa, 0, sizeof(struct sockaddr_in));
-    sa.sin_family      = AF_INET;
-    sa.sin_addr.s_addr = inet_addr(s_if_ip);
-    sa.sin_port        = htons(port);
+    // creates a STREAM (or SEQPACKET) socket
+    if ((fd = socket(family, type, family == AF_INET ? IPPROTO_TCP : 0)) == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    if (socket_set_opts(fd, opts) != 0) {
+        socket_close(fd);
+        return INVALID_SOCKET;
+    }
+
+#ifdef __GNUC__
+    if (family == AF_UNIX && ((struct sockaddr_un *)&sa)->sun_path[0] != '\0') {
+        struct stat st;
+        const char *path = ((struct sockaddr_un *)&sa)->sun_path;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            int probe = socket(AF_UNIX, type | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            int err   = probe < 0 ? errno
+                      : connect(probe, (struct sockaddr *)&sa, sa_len) != 0 ? errno : 0;
+            if (probe >= 0) {
+                close(probe);
+            }
+            if (err != ECONNREFUSED) {
+                xs_printf("socket file %s is in use!\n", path);
+                socket_close(fd);
+                errno = EADDRINUSE;
+                return INVALID_SOCKET;
+            }
+            unlink(path);
+        }
+    }
+#endif
 
     // associates a local address with the socket
-    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+    if (bind(fd, (struct sockaddr *)&sa, sa_len) != 0) {
         socket_close(fd);
         return INVALID_SOCKET;
     }
@@ -221,8 +528,25 @@ socket_create_tcp_listen(const char *s_if_ip, const uint16_t port)
 socket_t 
 socket_create_tcp_server(socket_t tcp_listen, int32_t ms_timeout)
 {
-    fd_set    fds;
+    return socket_create_tcp_server_ex(tcp_listen, ms_timeout, NULL);
+}
+
+/* ---------------------------------------------------------------------------
+ * Function   : accept a TCP link and apply socket options to it (used by SERVER)
+ * Parameters :
+ *      [in ] : tcp_listen - a listening socket
+ *            : ms_timeout - time to wait for a link, in milliseconds
+ *            : opts       - socket options, NULL for none
+ *      [out] : socket
+ * Return     : a descriptor referencing the socket or INVALID_SOCKET on error
+ * ---------------------------------------------------------------------------
+ */
+socket_t
+socket_create_tcp_server_ex(socket_t tcp_listen, int32_t ms_timeout, const socket_opts *opts)
+{
     int       ret;
+#ifdef WIN32
+    fd_set    fds;
     struct timeval timeout;
 
     FD_ZERO(&fds);
@@ -232,6 +556,16 @@ socket_create_tcp_server(socket_t tcp_listen, int32_t ms_timeout)
     timeout.tv_usec = (ms_timeout % 1000) * 1000;
 
     ret = select(tcp_listen + 1, &fds, NULL, NULL, &timeout);
+#else
+    // poll has no FD_SETSIZE limit on the descriptor value
+    struct pollfd pfd;
+
+    pfd.fd      = tcp_listen;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    ret = poll(&pfd, 1, ms_timeout);
+#endif
 
     switch (ret) {
     case -1:
@@ -239,10 +573,18 @@ socket_create_tcp_server(socket_t tcp_listen, int32_t ms_timeout)
     case 0:
         break;
     default:
+#ifdef WIN32
         if (FD_ISSET(tcp_listen, &fds)) {
+#else
+        if (pfd.revents & POLLIN) {
+#endif
             /* accept a link */
             socket_t s = accept(tcp_listen, NULL, NULL);
             if (s != INVALID_SOCKET && s != SOCKET_ERROR) {
+                if (socket_set_opts(s, opts) != 0) {
+                    socket_close(s);
+                    return INVALID_SOCKET;
+                }
                 return s;
             }
         }
@@ -264,27 +606,53 @@ socket_create_tcp_server(socket_t tcp_listen, int32_t ms_timeout)
  */
 socket_t
 socket_create_tcp_client(const char *s_server_addr, const uint16_t server_port)
+{
+    return socket_create_tcp_client_ex(s_server_addr, server_port, NULL);
+}
+
+/* ---------------------------------------------------------------------------
+ * Function   : create a TCP client socket with options (used by client)
+ * Parameters :
+ *      [in ] : s_server_addr - the IP address of a server
+ *      [in ] : server_port   - the port we want to link to
+ *            : opts          - socket options, NULL for none
+ *      [out] : socket
+ * Return     : a descriptor referencing the socket or INVALID_SOCKET on error
+ * ---------------------------------------------------------------------------
+ */
+socket_t
+socket_create_tcp_client_ex(const char *s_server_addr, const uint16_t server_port,
+                            const socket_opts *opts)
 {
     socket_t sc_client; // ׽
-    struct sockaddr_in sa_server; // ַϢ
+    struct sockaddr_storage sa_server; // ַϢ
+    socklen_t sa_len;
+    int family, type;
     int ret;
 
-    // Socket,ʹTCPЭ
-    sc_client = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if ((family = parse_addr(s_server_addr, server_port, &sa_server, &sa_len, &type)) < 0) {
+        xs_printf("bad address %s!\n", s_server_addr);
+        return INVALID_SOCKET;
+    }
+
+    // Socket,ʹTCPЭ (Unix)
+    sc_client = socket(family, type, family == AF_INET ? IPPROTO_TCP : 0);
     if (sc_client == INVALID_SOCKET) {
-        printf("socket() failed!\n");
+        xs_printf("socket() failed!\n");
         return INVALID_SOCKET;
     }
 
-    // ַϢ  
-    sa_server.sin_family = AF_INET; //ַ  
-    sa_server.sin_port = htons(server_port); //עתΪ  
-    sa_server.sin_addr.s_addr = inet_addr(s_server_addr);
+    // Сǰ
+    if (socket_set_opts(sc_client, opts) != 0) {
+        xs_printf("setsockopt() failed!\n");
+        socket_close(sc_client);
+        return INVALID_SOCKET;
+    }
 
     // ӷ  
-    ret = connect(sc_client, (struct sockaddr *)&sa_server, sizeof(sa_server));
+    ret = connect(sc_client, (struct sockaddr *)&sa_server, sa_len);
     if (ret == SOCKET_ERROR) {
-        printf("connect() failed!\n");
+        xs_printf("connect() failed!\n");
         socket_close(sc_client); // ر׽
         return INVALID_SOCKET;
     }
@@ -292,6 +660,55 @@ socket_create_tcp_client(const char *s_server_addr, const uint16_t server_port)
     return sc_client;
 }
 
+// ---------------------------------------------------------------------------
+// Function   : start a non-blocking connect (used by the event loop)
+// Parameters :
+//      [in ] : s_server_addr - the IP address of a server, or "unix:/path"
+//            : server_port   - the port we want to link to
+//            : opts          - socket options, NULL for none
+//      [out] : err           - 0 while the connect is in progress or done,
+//                              otherwise the error of the connect
+// Return     : the non-blocking socket, INVALID_SOCKET when none was made
+// Marks      : on a connect error the socket is still returned, the caller
+//              closes it
+// ---------------------------------------------------------------------------
+socket_t
+socket_connect_nb(const char *s_server_addr, const uint16_t server_port, const socket_opts *opts,
+                  int32_t *err)
+{
+    struct sockaddr_storage sa;
+    socklen_t sa_len;
+    socket_t fd;
+    int family, type;
+
+    *err = 0;
+    if ((family = parse_addr(s_server_addr, server_port, &sa, &sa_len, &type)) < 0) {
+        return INVALID_SOCKET;
+    }
+#ifdef SOCK_CLOEXEC
+    type |= SOCK_CLOEXEC;
+#endif
+    if ((fd = socket(family, type, family == AF_INET ? IPPROTO_TCP : 0)) == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    if (socket_set_opts(fd, opts) != 0 || set_non_blocking(fd, 1) != 0) {
+        socket_close(fd);
+        return INVALID_SOCKET;
+    }
+    if (connect(fd, (struct sockaddr *)&sa, sa_len) != 0) {
+#ifdef WIN32
+        if (WSAGetLastError() != WSAEWOULDBLOCK) {
+            *err = WSAGetLastError();
+        }
+#else
+        if (errno != EINPROGRESS) {
+            *err = errno;           // a full Unix domain backlog gives EAGAIN
+        }
+#endif
+    }
+    return fd;
+}
+
 // ***************************************************************************
 // udp send
 // ***************************************************************************
@@ -346,6 +763,26 @@ socket_close_udp(udpsender *sender)
 // ---------------------------------------------------------------------------
 socket_t
 socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, const char ttl)
+{
+    return socket_create_mc_ex(ip_if, ip_grp, port, ttl, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a multicast socket (used by data sending SERVER)
+// Parameters :
+//      [in ] : ip_if  - ip address of interface
+//            : ip_grp - ip address of multicast
+//            : port   - the port we want to listen to
+//            : ttl    - the port we want to listen to
+//            : loop   - non-zero to deliver the data to receivers on this host
+//      [out] : none
+// Return     : a descriptor referencing the socket or INVALID_SOCKET on error
+// Marks      : with loop on, the port is shared with local receivers, so the
+//              sending socket itself is kept out of the group traffic
+// ---------------------------------------------------------------------------
+socket_t
+socket_create_mc_ex(const char *ip_if, const char *ip_grp, const uint16_t port, const char ttl,
+                    const int32_t loop)
 {
     struct sockaddr_in  local_addr;
     struct sockaddr_in  group_addr;
@@ -353,28 +790,34 @@ socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, con
     socket_t fd;
     char opt;
     if (!IN_MULTICAST(ntohl(inet_addr(ip_grp)))) {
-        printf("invalid multi-cast address: %s\n", ip_grp);
+        xs_printf("invalid multi-cast address: %s\n", ip_grp);
         return INVALID_SOCKET;            // invalid multicast group address
     }
     // create a DATAGRAMS socket
     if ((fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET) {
-        printf("create datagrams socket error: %s\n", ip_grp);
+        xs_printf("create datagrams socket error: %s\n", ip_grp);
         return INVALID_SOCKET;            // create socket error
     }
 
-#if 0
-    // allow local address reuse
-    opt = 1;
-    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt))) {
-        socket_close(fd);
-        return INVALID_SOCKET;            // set socket option error
-    }
+    if (loop) {
+        // allow local address reuse, a receiver on this host binds the same port
+        int32_t on = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (const char *)&on, sizeof(on))) {
+            xs_printf("set address reuse error: %s\n", ip_grp);
+            socket_close(fd);
+            return INVALID_SOCKET;        // set socket option error
+        }
+#ifdef IP_MULTICAST_ALL
+        // do not queue the looped back data on the sending socket
+        on = 0;
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &on, sizeof(on));
 #endif
+    }
 
-    // disable loop back
-    opt = 0;
+    // enable or disable loop back
+    opt = loop ? 1 : 0;
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &opt, sizeof(opt))) {
-        printf("disable loop back error: %s\n", ip_grp);
+        xs_printf("set loop back error: %s\n", ip_grp);
         socket_close(fd);
         return INVALID_SOCKET;            // set socket option error
     }
@@ -382,7 +825,7 @@ socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, con
     // set time-to-live, controls scope of a multicast session
     opt = ttl;
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &opt, sizeof(opt))) {
-        printf("set time-to-live error: %s\n", ip_grp);
+        xs_printf("set time-to-live error: %s\n", ip_grp);
         socket_close(fd);
         return INVALID_SOCKET;            // set socket option error
     }
@@ -391,13 +834,13 @@ socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, con
     memset(&if_addr, 0, sizeof(if_addr));
     if_addr.s_addr = inet_addr(ip_if);
     if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, (const char *)&if_addr, sizeof(if_addr))) {
-        printf("set interface error: %s\n", ip_if);
+        xs_printf("set interface error: %s\n", ip_if);
         socket_close(fd);
         return INVALID_SOCKET;            // set socket option error
     }
     // mark as non-blocking
     if (set_non_blocking(fd, 1) != 0) {
-        printf("Error marking as non-blocking: %s\n", ip_grp);
+        xs_printf("Error marking as non-blocking: %s\n", ip_grp);
         socket_close(fd);
         return INVALID_SOCKET;
     }
@@ -409,7 +852,7 @@ socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, con
 
     // associates a local address with the socket
     if (bind(fd, (struct sockaddr *)&local_addr, sizeof(local_addr)) != 0) {
-        printf("Error associcates a local address: %d, %d\n", port, INADDR_ANY);
+        xs_printf("Error associcates a local address: %d, %d\n", port, INADDR_ANY);
         socket_close(fd);
         return INVALID_SOCKET;            // bind error
     }
@@ -419,7 +862,7 @@ socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, con
     group_addr.sin_addr.s_addr = inet_addr(ip_grp);
     group_addr.sin_port        = htons(port);
     if (connect(fd, (struct sockaddr *)&group_addr, sizeof(group_addr)) != 0) {
-        printf("Error connecting multicast address: %s\n", ip_grp);
+        xs_printf("Error connecting multicast address: %s\n", ip_grp);
         socket_close(fd);
         return INVALID_SOCKET;            // connect error
     }
@@ -444,6 +887,24 @@ static struct sockaddr_in udp_mc_servaddr;
 // ---------------------------------------------------------------------------
 socket_t
 socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
+{
+    return socket_add_mc_ex(ip_if, ip_grp, port, 0);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a multicast socket and add to a group (used by data receiving)
+// Parameters :
+//      [in ] : ip_if  - ip address of interface
+//            : ip_grp - ip address of multicast
+//            : port   - the multicast port we want to connect to
+//            : rcvbuf - receive buffer size in bytes, 0 for the default
+//                       (16 MB to 128 MB)
+//      [out] : none
+// Return     : a descriptor referencing the socket or INVALID_SOCKET on error
+// Marks      : multicast addresses is from 224.0.0.0 to 239.255.255.255
+// ---------------------------------------------------------------------------
+socket_t
+socket_add_mc_ex(const char *ip_if, const char *ip_grp, const uint16_t port, int32_t rcvbuf)
 {
     socket_t sockfd;
     int rcvbuf_len = 0;
@@ -455,13 +916,13 @@ socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
     // struct in_addr      if_addr;
 
     if (!IN_MULTICAST(ntohl(inet_addr(ip_grp)))) {
-        printf("invalid multi-cast address: %s\n", ip_grp);
+        xs_printf("invalid multi-cast address: %s\n", ip_grp);
         return INVALID_SOCKET;            // invalid multicast group address
     }
 
     // create a DATAGRAMS socket
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == INVALID_SOCKET) {
-        printf("Error creating datagrams socket: %s\n", ip_grp);
+        xs_printf("Error creating datagrams socket: %s\n", ip_grp);
         return INVALID_SOCKET;            // create socket error
     }
 
@@ -473,7 +934,7 @@ socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
 
     // associates a local address with the socket
     if (bind(sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr)) != 0) {
-        printf("Error associates a local address: %s port %d\n", ip_if, port);
+        xs_printf("Error associates a local address: %s port %d\n", ip_if, port);
         socket_close(sockfd);
         return INVALID_SOCKET;            // bind error
     }
@@ -483,29 +944,35 @@ socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
     mreq.imr_interface.s_addr   = inet_addr(ip_if);     //  over this NIC
 
     if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char *)&mreq, sizeof(mreq))) {
-        printf("Error set option over ip: %s port %d\n", ip_if, port);
+        xs_printf("Error set option over ip: %s port %d\n", ip_if, port);
         socket_close(sockfd);
         return INVALID_SOCKET;            // set socket option error
     }
 #else
     struct in_addr ia;
     struct hostent *group;
-
-    printf("Warning: ip_if %s not supported to set on Linux, Please use \"route add -net 224.0.0.0 netmask 224.0.0.0 eth0\"(or similar)\n",
-           ip_if);
+    int32_t on = 1;
 
     /*socketUDPͨѶ*/
     sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
-        printf("socket creating err in udptalk\n");
-        exit(1);
+        xs_printf("socket creating err in udptalk\n");
+        return INVALID_SOCKET;
+    }
+
+    /* several receivers (and a loop back sender) may share the port */
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == -1) {
+        xs_perror("setsockopt");
+        socket_close(sockfd);
+        return INVALID_SOCKET;
     }
 
     /*Ҫ鲥ĵַ*/
     bzero(&mreq, sizeof(struct ip_mreq));
     if ((group = gethostbyname(ip_grp)) == (struct hostent*)0) {
-        perror("gethostbyname");
-        exit(errno);
+        xs_perror("gethostbyname");
+        socket_close(sockfd);
+        return INVALID_SOCKET;
     }
 
     bcopy((void*)group->h_addr, (void*)&ia, group->h_length);
@@ -513,12 +980,13 @@ socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
     bcopy(&ia, &mreq.imr_multiaddr.s_addr, sizeof(struct in_addr));
 
     /*÷鲥ϢԴĵַϢ*/
-    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    mreq.imr_interface.s_addr = (ip_if && *ip_if) ? inet_addr(ip_if) : htonl(INADDR_ANY);
 
     /*ѱ鲥ַ Ϊ鲥Ա ֻҪյ鲥Ϣ*/
     if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(struct ip_mreq)) == -1) {
-        perror("setsockopt");
-        exit(-1);
+        xs_perror("setsockopt");
+        socket_close(sockfd);
+        return INVALID_SOCKET;
     }
 
     memset(&udp_mc_servaddr, 0, sizeof(struct sockaddr_in));
@@ -527,41 +995,51 @@ socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port)
     /*鲥˿ں*/
     udp_mc_servaddr.sin_port = htons(port);
 
-    if (inet_pton(AF_INET, ip_grp, &udp_mc_servaddr.sin_addr) < 0) {
-        printf("Wrong dest IP address!\n");
-        exit(0);
+    if (inet_pton(AF_INET, ip_grp, &udp_mc_servaddr.sin_addr) <= 0) {
+        xs_printf("Wrong dest IP address!\n");
+        socket_close(sockfd);
+        return INVALID_SOCKET;
     }
 
     /*ԼĶ˿ںIPϢsocket*/
     if (bind(sockfd, (struct sockaddr*)&udp_mc_servaddr, sizeof(struct sockaddr_in)) == -1) {
-        printf("Bind error\n");
-        exit(0);
+        xs_printf("Bind error\n");
+        socket_close(sockfd);
+        return INVALID_SOCKET;
     }
 #endif
 
     if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (void *)&rcvbuf_len, &len) < 0) {
-        perror("getsockopt: ");
+        xs_perror("getsockopt: ");
         socket_close(sockfd);
         return INVALID_SOCKET;
     }
 
-    printf("[xsocket] the receive buf old len: %d KB\n", ((rcvbuf_len + 512) >> 10));
+    xs_printf("[xsocket] the receive buf old len: %d KB\n", ((rcvbuf_len + 512) >> 10));
 
-    rcvbuf_len *= 1024;
-    if (rcvbuf_len < size_flush_buf_min) {
-        rcvbuf_len = size_flush_buf_min;
-    } else if (rcvbuf_len > size_flush_buf_max) {
-        rcvbuf_len = size_flush_buf_max;
+    if (rcvbuf > 0) {
+        rcvbuf_len = rcvbuf;
+    } else {
+        rcvbuf_len *= 1024;
+        if (rcvbuf_len < size_flush_buf_min) {
+            rcvbuf_len = size_flush_buf_min;
+        } else if (rcvbuf_len > size_flush_buf_max) {
+            rcvbuf_len = size_flush_buf_max;
+        }
     }
 
     len = sizeof(rcvbuf_len);
+#ifdef SO_RCVBUFFORCE
+    // SO_RCVBUF is silently capped by net.core.rmem_max, try to go beyond it
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, (void *)&rcvbuf_len, len) < 0)
+#endif
     if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, (void *)&rcvbuf_len, len) < 0) {
-        perror("setsockopt: ");
+        xs_perror("setsockopt: ");
         socket_close(sockfd);
         return INVALID_SOCKET;
     }
 
-    printf("[xsocket] the receive buf new len: %d KB\n", ((rcvbuf_len + 512) >> 10));
+    xs_printf("[xsocket] the receive buf new len: %d KB\n", ((socket_get_rcvbuf(sockfd) + 512) >> 10));
     // mark as non-blocking
     if (set_non_blocking(sockfd, 1) != 0) {
         socket_close(sockfd);
@@ -641,3 +1119,326 @@ socket_recv_from(socket_t fd, void *data, int32_t len)
     return recvfrom(fd, data, len, 0, (struct sockaddr *)&in_addr, &in_addr_len);
 }
 
+
+// ---------------------------------------------------------------------------
+// Function   : get the receive buffer size the kernel actually granted
+// Parameters :
+//      [in ] : fd - the socket
+// Return     : size in bytes, or -1 on error
+// Marks      : Linux reports twice the requested size (bookkeeping overhead)
+//              and caps SO_RCVBUF at net.core.rmem_max
+// ---------------------------------------------------------------------------
+int32_t
+socket_get_rcvbuf(socket_t fd)
+{
+    int32_t   rcvbuf_len = 0;
+    socklen_t len        = sizeof(rcvbuf_len);
+
+    if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *)&rcvbuf_len, &len) < 0) {
+        return -1;
+    }
+    return rcvbuf_len;
+}
+
+
+// ***************************************************************************
+// * kernel receive timestamps
+// ***************************************************************************
+
+// ---------------------------------------------------------------------------
+// Function   : let the kernel stamp every received packet with its arrival
+//              time (SO_TIMESTAMPNS)
+// Parameters :
+//      [in ] : fd - the socket
+//            : on - 1 to stamp, 0 to stop
+//      [out] : none
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+int32_t
+socket_set_rx_timestamp(socket_t fd, int32_t on)
+{
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+    return set_opt_int(fd, SOL_SOCKET, SO_TIMESTAMPNS, on ? 1 : 0);
+#else
+    (void)fd;
+    (void)on;
+    return -1;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : receive data with the time the kernel received it
+// Parameters :
+//      [in ] : fd    - a connected TCP socket or a multicast receiving socket
+//            : len   - the maximum length of the buffer
+//      [out] : data  - the received data
+//            : ts_ns - the receive time in CLOCK_REALTIME nanoseconds, 0 when
+//                      the socket carries no timestamp
+// Return     : received data length, or SOCKET_ERROR on error
+// Marks      : socket_set_rx_timestamp enables the timestamps; for TCP the
+//              time is that of the last segment the data came from
+// ---------------------------------------------------------------------------
+int32_t
+socket_recv_ts(socket_t fd, void *data, int32_t len, int64_t *ts_ns)
+{
+#if defined(__linux__) && defined(SO_TIMESTAMPNS)
+    char            ctrl[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec    iov;
+    struct msghdr   msg;
+    struct cmsghdr *cm;
+    int32_t         n;
+
+    iov.iov_base       = data;
+    iov.iov_len        = (size_t)len;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov        = &iov;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    *ts_ns = 0;
+    if ((n = (int32_t)recvmsg(fd, &msg, 0)) < 0) {
+        return SOCKET_ERROR;
+    }
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            *ts_ns = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+        }
+    }
+    return n;
+#else
+    *ts_ns = 0;
+    return socket_recv(fd, data, len);
+#endif
+}
+
+
+// ***************************************************************************
+// * busy-poll receiving
+// ***************************************************************************
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL            46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL     69
+#endif
+
+// ---------------------------------------------------------------------------
+// Function   : current time of a monotonic clock
+// Return     : nanoseconds since an unspecified starting point
+// ---------------------------------------------------------------------------
+int64_t
+socket_now_ns(void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (int64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : tell whether the last socket call failed only because a
+//              non-blocking socket was not ready (or was interrupted)
+// Return     : non-zero when the call can be retried
+// ---------------------------------------------------------------------------
+int32_t
+socket_would_block(void)
+{
+#ifdef WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : let the kernel busy poll the device queue of a socket
+// Parameters :
+//      [in ] : fd      - the socket
+//            : usec    - busy poll time of a blocking receive, 0 for off
+//      [out] : none
+// Return     : zero on success, otherwise failed
+// Marks      : raising the value above net.core.busy_read needs CAP_NET_ADMIN;
+//              SO_PREFER_BUSY_POLL (Linux 5.11) is set when available
+// ---------------------------------------------------------------------------
+int32_t
+socket_set_busy_poll(socket_t fd, int32_t usec)
+{
+#ifdef __linux__
+    if (set_opt_int(fd, SOL_SOCKET, SO_BUSY_POLL, usec) != 0) {
+        return -1;
+    }
+    set_opt_int(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, usec > 0 ? 1 : 0);
+    return 0;
+#else
+    (void)fd;
+    (void)usec;
+    return -1;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a spin receiver on a socket
+// Parameters :
+//      [in ] : fd      - a connected TCP socket or a multicast receiving socket
+//            : spin_us - how long a receive spins before it blocks
+//      [out] : none
+// Return     : the spin receiver, or NULL on error
+// Marks      : the kernel busy polls for SOCKET_BUSY_POLL_US, see
+//              socket_spin_create_ex
+// ---------------------------------------------------------------------------
+socket_spin *
+socket_spin_create(socket_t fd, int32_t spin_us)
+{
+    return socket_spin_create_ex(fd, spin_us, SOCKET_BUSY_POLL_US);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a spin receiver on a socket
+// Parameters :
+//      [in ] : fd           - a connected TCP socket or a multicast receiving socket
+//            : spin_us      - how long a receive spins before it blocks
+//            : busy_poll_us - SO_BUSY_POLL, how long the kernel polls the
+//                             device queue in one receive, 0 for off
+//      [out] : none
+// Return     : the spin receiver, or NULL on error
+// Marks      : the socket is switched to non-blocking mode and stays owned
+//              by the caller.  The two budgets are apart: the kernel one
+//              runs inside each receive call, tens of microseconds at most,
+//              the user space one spans many calls
+// ---------------------------------------------------------------------------
+socket_spin *
+socket_spin_create_ex(socket_t fd, int32_t spin_us, int32_t busy_poll_us)
+{
+    socket_spin *sp = (socket_spin *)calloc(1, sizeof(socket_spin));
+#ifdef __linux__
+    struct epoll_event ev;
+#endif
+
+    if (sp == NULL) {
+        return NULL;
+    }
+    sp->fd      = fd;
+    sp->spin_ns = (int64_t)(spin_us > 0 ? spin_us : 0) * 1000;
+
+    if (set_non_blocking(fd, 1) != 0) {
+        free(sp);
+        return NULL;
+    }
+    sp->kernel_busy_poll = busy_poll_us > 0 && socket_set_busy_poll(fd, busy_poll_us) == 0;
+
+#ifdef __linux__
+    if ((sp->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        free(sp);
+        return NULL;
+    }
+    ev.events  = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(sp->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        close(sp->epfd);
+        free(sp);
+        return NULL;
+    }
+#endif
+    xs_printf("[xsocket] spin receiver on %d: %d us, kernel busy poll %d us %s\n",
+              fd, spin_us, busy_poll_us, sp->kernel_busy_poll ? "on" : "off");
+    return sp;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait until the socket of a spin receiver is readable
+// Return     : 1 when readable, 0 on timeout, -1 on error
+// ---------------------------------------------------------------------------
+static int32_t
+spin_wait(socket_spin *sp, int32_t ms_timeout)
+{
+#ifdef __linux__
+    struct epoll_event ev;
+    int ret = epoll_wait(sp->epfd, &ev, 1, ms_timeout);
+    if (ret < 0 && errno == EINTR) {
+        return 1;                   // let the caller retry
+    }
+    return ret;
+#else
+    fd_set fds;
+    struct timeval timeout, *pt = NULL;
+
+    FD_ZERO(&fds);
+    FD_SET(sp->fd, &fds);
+    if (ms_timeout >= 0) {
+        timeout.tv_sec  = ms_timeout / 1000;
+        timeout.tv_usec = (ms_timeout % 1000) * 1000;
+        pt = &timeout;
+    }
+    return select(sp->fd + 1, &fds, NULL, NULL, pt);
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : receive data, spinning before blocking
+// Parameters :
+//      [in ] : sp         - the spin receiver
+//            : len        - the maximum length of the buffer
+//            : ms_timeout - blocking time after the spin, -1 for infinite
+//      [out] : data       - the received data
+// Return     : received data length (0 when a TCP peer closed), or
+//              SOCKET_ERROR on error and on timeout
+// Marks      : the socket is read with non-blocking receives for the spin
+//              budget, then the thread sleeps in epoll until data arrives
+// ---------------------------------------------------------------------------
+int32_t
+socket_spin_recv(socket_spin *sp, void *data, int32_t len, int32_t ms_timeout)
+{
+    int64_t deadline = 0;
+    int32_t n, ret;
+
+    for (;;) {
+        n = recv(sp->fd, data, len, 0);
+        if (n >= 0) {
+            return n;
+        }
+        if (!socket_would_block()) {
+            return SOCKET_ERROR;
+        }
+        if (deadline == 0) {
+            deadline = socket_now_ns() + sp->spin_ns;
+        }
+        if (socket_now_ns() < deadline) {
+            continue;               // spin
+        }
+
+        if ((ret = spin_wait(sp, ms_timeout)) <= 0) {
+            return SOCKET_ERROR;    // error or timeout
+        }
+        deadline = 0;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : destroy a spin receiver, the socket itself is not closed
+// ---------------------------------------------------------------------------
+void
+socket_spin_close(socket_spin *sp)
+{
+    if (sp == NULL) {
+        return;
+    }
+#ifdef __linux__
+    close(sp->epfd);
+#endif
+    free(sp);
+}
@@ -41,6 +41,7 @@ extern "C" {
 
 typedef int     socket_t;
 typedef struct  udpsender udpsender;
+typedef struct  socket_spin socket_spin;
 
 // this is used instead of -1, since the socket_t type is unsigned
 #ifndef INVALID_SOCKET
@@ -51,6 +52,28 @@ typedef struct  udpsender udpsender;
 #define SOCKET_ERROR            (-1)  // socket error
 #endif
 
+/* presets for socket_opts_init */
+typedef enum socket_profile {
+    SOCKET_PROFILE_DEFAULT = 0,     // leave everything to the system
+    SOCKET_PROFILE_LATENCY,         // small request/response: TCP_NODELAY, TCP_QUICKACK
+    SOCKET_PROFILE_THROUGHPUT       // bulk transfer: large SO_SNDBUF/SO_RCVBUF
+} socket_profile;
+
+/* TCP socket options, a field of zero leaves the system default untouched */
+typedef struct socket_opts {
+    int32_t nodelay;                // TCP_NODELAY: disable Nagle's algorithm
+    int32_t quickack;               // TCP_QUICKACK: disable delayed ACK (Linux only)
+    int32_t cork;                   // TCP_CORK: hold partial frames until uncorked (Linux only)
+    int32_t sndbuf;                 // SO_SNDBUF in bytes
+    int32_t rcvbuf;                 // SO_RCVBUF in bytes
+    int32_t keepalive;              // SO_KEEPALIVE
+    int32_t keepidle_s;             // TCP_KEEPIDLE: idle seconds before the first probe
+    int32_t keepintvl_s;            // TCP_KEEPINTVL: seconds between probes
+    int32_t keepcnt;                // TCP_KEEPCNT: failed probes before the link is dropped
+    int32_t user_timeout_ms;        // TCP_USER_TIMEOUT: drop the link when sent data stays
+                                    // unacknowledged this long (Linux only)
+} socket_opts;
+
 // ---------------------------------------------------------------------------
 // function declares
 
@@ -62,6 +85,11 @@ int32_t socket_startup();
  */
 void socket_cleanup();
 
+/* print (on != 0, default) or suppress the diagnostic messages of the library
+ */
+void socket_set_verbose(int32_t on);
+int32_t socket_get_verbose(void);
+
 /* send data with a socket
  */
 int32_t socket_send(socket_t fd, char *data, int32_t len);
@@ -74,10 +102,32 @@ void socket_close(socket_t fd);
  */
 socket_t socket_create_mc(const char *ip_if, const char *ip_grp, const uint16_t port, const char ttl);
 
+/* same as socket_create_mc, loop != 0 also delivers the data to receivers
+ * on this host (IP_MULTICAST_LOOP)
+ */
+socket_t socket_create_mc_ex(const char *ip_if, const char *ip_grp, const uint16_t port, const char ttl,
+                             const int32_t loop);
+
 /* used for a client, obtain a socket to receive data from a multi-cast address
  */
 socket_t socket_add_mc(const char *ip_if, const char *ip_grp, const uint16_t port);
 
+/* same as socket_add_mc with an explicit receive buffer size in bytes,
+ * rcvbuf = 0 selects the default (16 MB to 128 MB)
+ */
+socket_t socket_add_mc_ex(const char *ip_if, const char *ip_grp, const uint16_t port, int32_t rcvbuf);
+
+/* get the receive buffer size granted by the system, -1 on error
+ */
+int32_t socket_get_rcvbuf(socket_t fd);
+
+/* Unix domain sockets: the TCP functions also take "unix:/path" (stream)
+ * and "unixseq:/path" (seqpacket, one message per send) as the address,
+ * the port is not used then; "unix:@name" is in the abstract namespace.
+ * Only the buffer sizes of socket_opts apply to them.  Same-host peers
+ * switch over by changing the address alone (Linux)
+ */
+
 /* used for a server, obtain a socket to accept link with TCP
  */
 socket_t socket_create_tcp_listen(const char *s_if_addr, const uint16_t port);
@@ -90,6 +140,37 @@ socket_t socket_create_tcp_server(socket_t tcp_listen, int32_t ms_timeout);
  */
 socket_t socket_create_tcp_client(const char *s_server_addr, const uint16_t port);
 
+/* same as the three functions above, the options (NULL for none) are applied
+ * to the listening, accepted or connecting socket
+ */
+socket_t socket_create_tcp_listen_ex(const char *s_if_addr, const uint16_t port, const socket_opts *opts);
+socket_t socket_create_tcp_server_ex(socket_t tcp_listen, int32_t ms_timeout, const socket_opts *opts);
+socket_t socket_create_tcp_client_ex(const char *s_server_addr, const uint16_t port, const socket_opts *opts);
+
+/* start a non-blocking connect, for event loops: returns the socket or
+ * INVALID_SOCKET; err is 0 while the connect is in progress or done,
+ * otherwise the connect failed and the caller closes the socket
+ */
+socket_t socket_connect_nb(const char *s_server_addr, const uint16_t port, const socket_opts *opts,
+                           int32_t *err);
+
+/* fill opts with a preset profile
+ */
+void socket_opts_init(socket_opts *opts, socket_profile profile);
+
+/* apply options to a TCP socket, zero on success; options the system
+ * does not have (the Linux only ones) are skipped
+ */
+int32_t socket_set_opts(socket_t fd, const socket_opts *opts);
+
+/* re-arm TCP_QUICKACK, which Linux clears by itself, zero on success
+ */
+int32_t socket_set_quickack(socket_t fd, int32_t on);
+
+/* cork (on = 1) or uncork and flush (on = 0) a TCP socket, zero on success
+ */
+int32_t socket_set_cork(socket_t fd, int32_t on);
+
 /* used for a server, can receive data for TCP
  */
 int32_t socket_recv(socket_t fd, void *data, int32_t len);
@@ -98,6 +179,47 @@ int32_t socket_recv(socket_t fd, void *data, int32_t len);
  */
 int32_t socket_udp_mc_recv(socket_t fd, void *data, int len);
 
+/* stamp received packets with their kernel arrival time (SO_TIMESTAMPNS,
+ * Linux), zero on success
+ */
+int32_t socket_set_rx_timestamp(socket_t fd, int32_t on);
+
+/* receive like socket_recv, ts_ns gets the kernel receive time in
+ * CLOCK_REALTIME nanoseconds, 0 when the socket has no timestamps
+ */
+int32_t socket_recv_ts(socket_t fd, void *data, int32_t len, int64_t *ts_ns);
+
+/* monotonic clock in nanoseconds, for deadlines and latency measurements
+ */
+int64_t socket_now_ns(void);
+
+/* non-zero when the last socket call failed only because a non-blocking
+ * socket was not ready (EAGAIN/EWOULDBLOCK) or it was interrupted (EINTR)
+ */
+int32_t socket_would_block(void);
+
+/* let the kernel busy poll the device queue in blocking receives (Linux),
+ * zero on success
+ */
+int32_t socket_set_busy_poll(socket_t fd, int32_t usec);
+
+/* kernel busy poll of a spin receiver created with socket_spin_create */
+#define SOCKET_BUSY_POLL_US     50
+
+/* spin receiver for latency critical sockets: a receive spins on the
+ * non-blocking socket for spin_us, then sleeps in epoll until data arrives;
+ * SO_BUSY_POLL/SO_PREFER_BUSY_POLL are set to SOCKET_BUSY_POLL_US where the
+ * system allows it
+ */
+socket_spin *socket_spin_create(socket_t fd, int32_t spin_us);
+
+/* same as socket_spin_create with the kernel busy poll of each receive in
+ * busy_poll_us, 0 for none
+ */
+socket_spin *socket_spin_create_ex(socket_t fd, int32_t spin_us, int32_t busy_poll_us);
+int32_t socket_spin_recv(socket_spin *sp, void *data, int32_t len, int32_t ms_timeout);
+void socket_spin_close(socket_spin *sp);
+
 /* unused functions */
 int32_t socket_recv_from(socket_t fd, void *data, int32_t len);
 
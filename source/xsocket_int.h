@@ -0,0 +1,31 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xsocket_int.h
+ *  @brief    Internals shared by the xsocket modules
+ *
+ *  Not installed with the library: the diagnostic print and the spin loop
+ *  pause used by the modules around xsocket.c.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XSOCKET_INT_H__
+#define __XSOCKET_INT_H__
+
+#include <stdio.h>
+#include "xsocket.h"
+
+/* print a diagnostic message while socket_set_verbose is on */
+#define xs_printf(...)  do { if (socket_get_verbose()) { printf(__VA_ARGS__); } } while (0)
+
+/* pause in a spin loop, so the sibling hyper-thread gets the core */
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax()     __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define cpu_relax()     __asm__ __volatile__("yield")
+#elif defined(_MSC_VER)
+#define cpu_relax()     YieldProcessor()
+#else
+#define cpu_relax()     do { } while (0)
+#endif
+
+#endif // __XSOCKET_INT_H__
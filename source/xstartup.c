@@ -0,0 +1,247 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xstartup.c
+ *  @brief    Bulk startup: join many groups and connect many upstreams at once (Linux)
+ *
+ *  The connects are started first with socket_connect_nb, up to
+ *  max_inflight of them, then the joins are made while the handshakes
+ *  run.  One poll over all connects in progress waits for them; a
+ *  finished one makes room for the next in line, a refused one is parked
+ *  until its retry time.  Nothing blocks but the poll, whose timeout is
+ *  the earlier of the deadline and the next retry.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include "xstartup.h"
+#include "xsocket_int.h"
+
+enum { ST_QUEUED = 0, ST_CONNECTING, ST_PARKED, ST_DONE };
+
+/* the progress of one upstream */
+typedef struct slot {
+    int32_t idx;                    // in items
+    int32_t state;
+    int64_t retry_at;               // ST_PARKED: when to connect again
+} slot;
+
+void
+xstartup_config_init(xstartup_config *cfg)
+{
+    cfg->max_inflight = 256;
+    cfg->retry_ms     = 100;
+    cfg->blocking     = 1;
+    cfg->opts         = NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : whether a connect error means "not there yet"
+// ---------------------------------------------------------------------------
+static int
+retryable(int32_t err)
+{
+    return err == ECONNREFUSED || err == ECONNRESET || err == ENOENT || err == EAGAIN;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : settle an item
+// Parameters :
+//      [in ] : err - 0 when it is ready, its socket is kept then
+// ---------------------------------------------------------------------------
+static void
+settle(xstartup_item *it, slot *s, int32_t err, int64_t t0, const xstartup_config *cfg)
+{
+    if (err == 0 && cfg->blocking) {
+        int fl = fcntl(it->fd, F_GETFL);
+        if (fl < 0 || fcntl(it->fd, F_SETFL, fl & ~O_NONBLOCK) != 0) {
+            err = errno;
+        }
+    }
+    if (err != 0 && it->fd != INVALID_SOCKET) {
+        socket_close(it->fd);
+        it->fd = INVALID_SOCKET;
+    }
+    it->err        = err;
+    it->elapsed_ns = socket_now_ns() - t0;
+    if (s != NULL) {
+        s->state = ST_DONE;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : start the connect of an upstream
+// Return     : non-zero when it is in progress
+// ---------------------------------------------------------------------------
+static int
+start(xstartup_item *it, slot *s, int64_t t0, const xstartup_config *cfg)
+{
+    int32_t err = 0;
+
+    it->attempts++;
+    if ((it->fd = socket_connect_nb(it->addr, it->port, cfg->opts, &err)) == INVALID_SOCKET) {
+        settle(it, s, errno != 0 ? errno : EINVAL, t0, cfg);
+        return 0;
+    }
+    if (err != 0) {
+        socket_close(it->fd);
+        it->fd = INVALID_SOCKET;
+        if (cfg->retry_ms > 0 && retryable(err)) {
+            s->state    = ST_PARKED;
+            s->retry_at = socket_now_ns() + (int64_t)cfg->retry_ms * 1000000;
+        } else {
+            settle(it, s, err, t0, cfg);
+        }
+        return 0;
+    }
+    s->state = ST_CONNECTING;
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : join the groups and connect the upstreams together
+// Parameters :
+//      [in ] : items      - the groups and upstreams
+//            : n          - their number
+//            : ms_timeout - for all of them, -1 for ever
+//            : cfg        - the settings, NULL for the defaults
+//      [out] : items      - fd, err, attempts and elapsed_ns of each
+// Return     : the number of items ready, SOCKET_ERROR when out of memory
+// ---------------------------------------------------------------------------
+int32_t
+xstartup_run(xstartup_item *items, int32_t n, int32_t ms_timeout, const xstartup_config *cfg)
+{
+    xstartup_config c;
+    slot           *slots;
+    struct pollfd  *pfd;
+    int32_t        *map;
+    int64_t         t0 = socket_now_ns(), deadline, now;
+    int32_t         i, nslots = 0, inflight = 0, left = 0, ready = 0;
+
+    if (cfg != NULL) {
+        c = *cfg;
+    } else {
+        xstartup_config_init(&c);
+    }
+    if (c.max_inflight <= 0) {
+        c.max_inflight = 1;
+    }
+    deadline = ms_timeout < 0 ? INT64_MAX : t0 + (int64_t)ms_timeout * 1000000;
+    slots = (slot *)malloc((n > 0 ? n : 1) * sizeof(slot));
+    pfd   = (struct pollfd *)malloc((n > 0 ? n : 1) * sizeof(struct pollfd));
+    map   = (int32_t *)malloc((n > 0 ? n : 1) * sizeof(int32_t));
+    if (slots == NULL || pfd == NULL || map == NULL) {
+        free(slots);
+        free(pfd);
+        free(map);
+        return SOCKET_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        items[i].fd         = INVALID_SOCKET;
+        items[i].err        = EINPROGRESS;
+        items[i].attempts   = 0;
+        items[i].elapsed_ns = 0;
+        if (items[i].kind == XSTARTUP_UPSTREAM) {
+            slots[nslots].idx   = i;
+            slots[nslots].state = ST_QUEUED;
+            nslots++;
+            left++;
+        }
+    }
+
+    // connects first, their handshakes run while the groups are joined
+    for (i = 0; i < nslots && inflight < c.max_inflight; i++) {
+        inflight += start(&items[slots[i].idx], &slots[i], t0, &c);
+    }
+    for (i = 0; i < n; i++) {
+        xstartup_item *it = &items[i];
+        if (it->kind != XSTARTUP_GROUP) {
+            continue;
+        }
+        errno  = 0;
+        it->fd = socket_add_mc_ex(it->ip_if, it->addr, it->port, it->rcvbuf);
+        settle(it, NULL, it->fd != INVALID_SOCKET ? 0 : (errno != 0 ? errno : EINVAL), t0, &c);
+    }
+
+    for (;;) {
+        int64_t wake = deadline;
+        int32_t np = 0, k;
+
+        left = 0;
+        now  = socket_now_ns();
+        for (i = 0; i < nslots; i++) {
+            slot *s = &slots[i];
+            if (s->state == ST_PARKED && s->retry_at <= now && inflight < c.max_inflight) {
+                inflight += start(&items[s->idx], s, t0, &c);
+            } else if (s->state == ST_QUEUED && inflight < c.max_inflight) {
+                inflight += start(&items[s->idx], s, t0, &c);
+            }
+            if (s->state == ST_CONNECTING) {
+                pfd[np].fd     = items[s->idx].fd;
+                pfd[np].events = POLLOUT;
+                map[np++]      = i;
+            } else if (s->state == ST_PARKED && inflight < c.max_inflight && s->retry_at < wake) {
+                wake = s->retry_at;         // a full window waits for a handshake instead
+            }
+            left += s->state != ST_DONE;
+        }
+        if (left == 0 || now >= deadline) {
+            break;
+        }
+
+        k = wake == INT64_MAX ? -1 : (int32_t)((wake - now + 999999) / 1000000);
+        if (wake != INT64_MAX && k < 0) {
+            k = 0;                          // never block for good on a passed time
+        }
+        if ((k = poll(pfd, (nfds_t)np, k)) < 0 && errno != EINTR) {
+            break;
+        }
+        for (i = 0; k > 0 && i < np; i++) {
+            slot          *s  = &slots[map[i]];
+            xstartup_item *it = &items[s->idx];
+            socklen_t      sl = sizeof(int32_t);
+            int32_t        err = 0;
+
+            if (pfd[i].revents == 0) {
+                continue;
+            }
+            inflight--;
+            if (getsockopt(it->fd, SOL_SOCKET, SO_ERROR, &err, &sl) != 0) {
+                err = errno;
+            }
+            if (err != 0 && c.retry_ms > 0 && retryable(err)) {
+                socket_close(it->fd);
+                it->fd      = INVALID_SOCKET;
+                s->state    = ST_PARKED;
+                s->retry_at = socket_now_ns() + (int64_t)c.retry_ms * 1000000;
+            } else {
+                settle(it, s, err, t0, &c);
+            }
+        }
+    }
+
+    // whatever is left missed the deadline
+    for (i = 0; i < nslots; i++) {
+        if (slots[i].state != ST_DONE) {
+            settle(&items[slots[i].idx], &slots[i], ETIMEDOUT, t0, &c);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        ready += items[i].err == 0;
+    }
+    xs_printf("[xstartup] %d of %d ready in %.1f ms\n", ready, n, (double)(socket_now_ns() - t0) / 1e6);
+    free(slots);
+    free(pfd);
+    free(map);
+    return ready;
+}
@@ -0,0 +1,81 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xstartup.h
+ *  @brief    Bulk startup: join many groups and connect many upstreams at once (Linux)
+ *
+ *  Calling socket_add_mc and socket_create_tcp_client one after another
+ *  makes startup as slow as the sum of all connects, and an upstream that
+ *  is down costs its whole timeout before the next one is tried.
+ *  xstartup_run takes a list of groups and upstreams, starts every
+ *  connect without blocking, makes the joins while the handshakes are on
+ *  the wire and waits for all of them together, until all are ready or
+ *  the deadline passes.  Each item reports its own result and the time it
+ *  took, so a slow upstream shows by name.
+ *
+ *  Upstreams that refuse (not started yet) are tried again every retry_ms
+ *  until the deadline, so services may come up in any order.
+ *
+ *      xstartup_item it[2] = {
+ *          { XSTARTUP_GROUP,    "10.0.0.5", "239.1.1.50", 12000 },
+ *          { XSTARTUP_UPSTREAM, NULL,       "10.0.0.9",   9000 },
+ *      };
+ *      n = xstartup_run(it, 2, 3000, NULL);
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XSTARTUP_H__
+#define __XSTARTUP_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum xstartup_kind {
+    XSTARTUP_GROUP = 0,             // socket_add_mc_ex(ip_if, addr, port, rcvbuf)
+    XSTARTUP_UPSTREAM               // TCP (or "unix:") connect to addr:port
+} xstartup_kind;
+
+/* one group or upstream: the first fields are set by the caller, the rest
+ * by xstartup_run
+ */
+typedef struct xstartup_item {
+    xstartup_kind kind;
+    const char   *ip_if;            // group: interface address
+    const char   *addr;             // group address, or server address
+    uint16_t      port;
+    int32_t       rcvbuf;           // group: receive buffer, 0 for the default
+
+    socket_t      fd;               // the socket, INVALID_SOCKET when not ready
+    int32_t       err;              // 0 when ready, else the error (ETIMEDOUT at the deadline)
+    int32_t       attempts;         // connects started
+    int64_t       elapsed_ns;       // from the start of the run to ready or failed
+} xstartup_item;
+
+/* run settings, see xstartup_config_init for the defaults */
+typedef struct xstartup_config {
+    int32_t            max_inflight;    // connects in progress at once
+    int32_t            retry_ms;        // pause before connecting again after a refusal, 0 for no retry
+    int32_t            blocking;        // hand the upstream sockets back in blocking mode
+    const socket_opts *opts;            // for the upstream sockets, NULL for none
+} xstartup_config;
+
+/* defaults: 256 connects at once, retry every 100 ms, blocking sockets as
+ * socket_create_tcp_client returns them, no options
+ */
+void xstartup_config_init(xstartup_config *cfg);
+
+/* join the groups and connect the upstreams of items, waiting up to
+ * ms_timeout (-1 for ever) for all of them; cfg NULL for the defaults.
+ * Returns the number of items ready, SOCKET_ERROR on error (no memory);
+ * the sockets of the ready items belong to the caller
+ */
+int32_t xstartup_run(xstartup_item *items, int32_t n, int32_t ms_timeout, const xstartup_config *cfg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XSTARTUP_H__
@@ -0,0 +1,330 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xthread.c
+ *  @brief    Thread placement for xsocket I/O threads
+ *
+ *  Linux uses sched_setaffinity/pthread_setschedparam and reads the NUMA
+ *  topology from sysfs, Windows maps the CPU list onto a thread affinity
+ *  mask and the priority onto THREAD_PRIORITY_TIME_CRITICAL.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef __GNUC__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _MSC_VER
+#include <windows.h>
+#define snprintf    _snprintf
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xsocket.h"
+#include "xthread.h"
+#include "xsocket_int.h"
+
+#define MAX_CPUS    1024            // highest CPU number we handle
+
+/* start parameters of xthread_create */
+typedef struct xthread_start {
+    xthread_affinity aff;
+    char             name[32];
+    void          *(*fn)(void *);
+    void            *arg;
+    char             cpus[1];       // the CPU list, as long as it is
+} xthread_start;
+
+// ---------------------------------------------------------------------------
+// Function   : parse a CPU list ("0-3,8,10-11") into a flag array
+// Parameters :
+//      [in ] : s    - the list
+//      [out] : cpus - cpus[i] = 1 for every listed CPU i < MAX_CPUS
+// Return     : number of CPUs listed, or -1 on a malformed list
+// ---------------------------------------------------------------------------
+static int32_t
+parse_cpu_list(const char *s, uint8_t *cpus)
+{
+    int32_t count = 0;
+
+    memset(cpus, 0, MAX_CPUS);
+    while (*s) {
+        char *end;
+        long first = strtol(s, &end, 10), last = first;
+
+        if (end == s || first < 0 || first >= MAX_CPUS) {
+            return -1;
+        }
+        s = end;
+        if (*s == '-') {
+            last = strtol(s + 1, &end, 10);
+            if (end == s + 1 || last < first || last >= MAX_CPUS) {
+                return -1;
+            }
+            s = end;
+        }
+        for (; first <= last; first++) {
+            count += !cpus[first];
+            cpus[first] = 1;
+        }
+        if (*s == ',') {
+            s++;
+        } else if (*s == '\n' || *s == '\0') {
+            break;
+        } else {
+            return -1;
+        }
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : format a flag array as a CPU list ("0-3,8")
+// ---------------------------------------------------------------------------
+static void
+format_cpu_list(const uint8_t *cpus, char *buf, int32_t len)
+{
+    int32_t i = 0, pos = 0;
+
+    buf[0] = '\0';
+    while (i < MAX_CPUS && pos < len) {
+        int32_t j;
+        if (!cpus[i]) {
+            i++;
+            continue;
+        }
+        for (j = i; j + 1 < MAX_CPUS && cpus[j + 1]; j++) {
+        }
+        pos += (j == i) ? snprintf(buf + pos, len - pos, "%s%d", pos ? "," : "", i)
+                        : snprintf(buf + pos, len - pos, "%s%d-%d", pos ? "," : "", i, j);
+        i = j + 1;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : get the CPUs of a NUMA node
+// Return     : number of CPUs, or -1 when the node is unknown
+// ---------------------------------------------------------------------------
+static int32_t
+numa_node_cpus(int32_t node, uint8_t *cpus)
+{
+#ifdef __linux__
+    char path[96], list[1024];
+    FILE *fp;
+    int32_t n = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if ((fp = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    if (fgets(list, sizeof(list), fp) != NULL) {
+        n = parse_cpu_list(list, cpus);
+    }
+    fclose(fp);
+    return n;
+#else
+    (void)node;
+    (void)cpus;
+    return -1;
+#endif
+}
+
+void
+xthread_affinity_init(xthread_affinity *aff)
+{
+    aff->cpus      = NULL;
+    aff->numa_node = -1;
+    aff->fifo_prio = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : describe the placement of the calling thread
+// Parameters :
+//      [in ] : len - size of buf
+//      [out] : buf - the description
+// Return     : buf
+// ---------------------------------------------------------------------------
+char *
+xthread_placement(char *buf, int32_t len)
+{
+#ifdef __linux__
+    uint8_t   cpus[MAX_CPUS];
+    char      list[256];
+    cpu_set_t set;
+    unsigned  cpu = 0, node = 0;
+    struct sched_param sp;
+    int       policy, i;
+
+    memset(cpus, 0, sizeof(cpus));
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (i = 0; i < MAX_CPUS && i < CPU_SETSIZE; i++) {
+            cpus[i] = CPU_ISSET(i, &set) ? 1 : 0;
+        }
+    }
+    format_cpu_list(cpus, list, sizeof(list));
+    syscall(SYS_getcpu, &cpu, &node, NULL);
+
+    if (pthread_getschedparam(pthread_self(), &policy, &sp) != 0) {
+        policy = SCHED_OTHER;
+    }
+    if (policy == SCHED_FIFO) {
+        snprintf(buf, len, "cpus %s, on cpu %u, node %u, SCHED_FIFO %d", list, cpu, node,
+                 sp.sched_priority);
+    } else {
+        snprintf(buf, len, "cpus %s, on cpu %u, node %u, SCHED_OTHER", list, cpu, node);
+    }
+#elif defined(_MSC_VER)
+    snprintf(buf, len, "on cpu %lu, priority %d", GetCurrentProcessorNumber(),
+             GetThreadPriority(GetCurrentThread()));
+#else
+    snprintf(buf, len, "unknown");
+#endif
+    return buf;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : place the calling thread
+// Parameters :
+//      [in ] : aff  - the placement, NULL for none
+//            : name - thread name for the report
+//      [out] : none
+// Return     : zero on success, otherwise failed
+// Marks      : every part is tried, a failed part does not stop the others;
+//              SCHED_FIFO needs CAP_SYS_NICE (or an RLIMIT_RTPRIO)
+// ---------------------------------------------------------------------------
+int32_t
+xthread_apply(const xthread_affinity *aff, const char *name)
+{
+    uint8_t cpus[MAX_CPUS], node_cpus[MAX_CPUS];
+    char    report[320];
+    int32_t i, n = 0, ret = 0;
+
+    if (aff == NULL) {
+        return 0;
+    }
+
+    // the allowed CPUs: the list, restricted to the node when both are given
+    memset(cpus, 1, sizeof(cpus));
+    if (aff->cpus != NULL && aff->cpus[0] != '\0' && parse_cpu_list(aff->cpus, cpus) <= 0) {
+        xs_printf("[xthread] %s: invalid cpu list \"%s\"\n", name, aff->cpus);
+        return -1;
+    }
+    if (aff->numa_node >= 0) {
+        if (numa_node_cpus(aff->numa_node, node_cpus) <= 0) {
+            xs_printf("[xthread] %s: unknown numa node %d\n", name, aff->numa_node);
+            ret = -1;
+        } else {
+            for (i = 0; i < MAX_CPUS; i++) {
+                cpus[i] &= node_cpus[i];
+            }
+        }
+    }
+    for (i = 0; i < MAX_CPUS; i++) {
+        n += cpus[i];
+    }
+
+#ifdef __linux__
+    if (n > 0 && n < MAX_CPUS) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (i = 0; i < MAX_CPUS && i < CPU_SETSIZE; i++) {
+            if (cpus[i]) {
+                CPU_SET(i, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            xs_printf("[xthread] %s: cannot set the cpu affinity\n", name);
+            ret = -1;
+        }
+    } else if (n == 0) {
+        xs_printf("[xthread] %s: no cpu left in the list and numa node\n", name);
+        ret = -1;
+    }
+    if (aff->fifo_prio > 0) {
+        struct sched_param sp;
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = aff->fifo_prio;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0) {
+            xs_printf("[xthread] %s: cannot set SCHED_FIFO %d\n", name, aff->fifo_prio);
+            ret = -1;
+        }
+    }
+#elif defined(_MSC_VER)
+    if (n > 0 && n < MAX_CPUS) {
+        DWORD_PTR mask = 0;
+        for (i = 0; i < (int32_t)(sizeof(mask) * 8); i++) {
+            if (cpus[i]) {
+                mask |= (DWORD_PTR)1 << i;
+            }
+        }
+        if (SetThreadAffinityMask(GetCurrentThread(), mask) == 0) {
+            ret = -1;
+        }
+    }
+    if (aff->fifo_prio > 0 && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        ret = -1;
+    }
+#endif
+
+#ifdef __linux__
+    sched_yield();                  // move onto an allowed CPU before reporting
+#endif
+    xs_printf("[xthread] %s: %s\n", name, xthread_placement(report, sizeof(report)));
+    return ret;
+}
+
+static void *
+xthread_entry(void *arg)
+{
+    xthread_start *st = (xthread_start *)arg;
+    void        *(*fn)(void *) = st->fn;
+    void          *fn_arg = st->arg;
+
+    st->aff.cpus = st->cpus;
+    xthread_apply(&st->aff, st->name);
+    free(st);
+    return fn(fn_arg);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a thread placed by an affinity spec
+// Parameters :
+//      [in ] : aff  - the placement, NULL for none
+//            : name - thread name for the report
+//            : fn   - thread function
+//            : arg  - argument of fn
+//      [out] : tid  - the thread
+// Return     : zero on success, otherwise failed
+// ---------------------------------------------------------------------------
+int32_t
+xthread_create(pthread_t *tid, const xthread_affinity *aff, const char *name,
+               void *(*fn)(void *), void *arg)
+{
+    xthread_start *st;
+    size_t         clen;
+
+    if (aff == NULL) {
+        return pthread_create(tid, NULL, fn, arg) == 0 ? 0 : -1;
+    }
+    clen = aff->cpus != NULL ? strlen(aff->cpus) : 0;
+    if ((st = (xthread_start *)calloc(1, sizeof(xthread_start) + clen)) == NULL) {
+        return -1;
+    }
+    st->aff = *aff;
+    st->fn  = fn;
+    st->arg = arg;
+    memcpy(st->cpus, aff->cpus != NULL ? aff->cpus : "", clen);
+    snprintf(st->name, sizeof(st->name), "%s", name ? name : "thread");
+
+    if (pthread_create(tid, NULL, xthread_entry, st) != 0) {
+        free(st);
+        return -1;
+    }
+    return 0;
+}
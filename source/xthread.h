@@ -0,0 +1,53 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xthread.h
+ *  @brief    Thread placement for xsocket I/O threads
+ *
+ *  CPU affinity, NUMA node and real-time priority of the threads that
+ *  drive sockets, with a report of where a thread actually runs.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XTHREAD_H__
+#define __XTHREAD_H__
+
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* where and how an I/O thread runs */
+typedef struct xthread_affinity {
+    const char *cpus;               // CPU list such as "2,4-7", NULL or "" for any
+    int32_t     numa_node;          // only the CPUs of this node, -1 for any
+    int32_t     fifo_prio;          // SCHED_FIFO priority 1..99, 0 keeps the default policy
+} xthread_affinity;
+
+/* no restriction: any CPU, any node, default scheduling
+ */
+void xthread_affinity_init(xthread_affinity *aff);
+
+/* place the calling thread and report the placement, name is used in the
+ * report; zero on success, otherwise failed (the thread keeps running where
+ * it was)
+ */
+int32_t xthread_apply(const xthread_affinity *aff, const char *name);
+
+/* create a thread that places itself with aff (NULL for none) before fn
+ * runs; zero on success, otherwise failed
+ */
+int32_t xthread_create(pthread_t *tid, const xthread_affinity *aff, const char *name,
+                       void *(*fn)(void *), void *arg);
+
+/* describe the placement of the calling thread ("cpus 2-3, on cpu 2, node 0,
+ * SCHED_FIFO 50"), returns buf
+ */
+char *xthread_placement(char *buf, int32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XTHREAD_H__
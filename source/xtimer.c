@@ -0,0 +1,341 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xtimer.c
+ *  @brief    Hierarchical timer wheel for connection deadlines and timeouts
+ *
+ *  Level n holds the timers due within 256^(n+1) ticks, in the slot given
+ *  by bits 8n..8n+7 of the due tick.  When the level 0 index wraps, the
+ *  current slot of level 1 is spread over level 0, and so on up.  A bitmap
+ *  per level lets advance and next_us skip empty slots, so a quiet wheel
+ *  costs nothing per tick.
+ *
+ *----------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "xtimer.h"
+
+#define LEVELS      4
+#define SLOT_BITS   8
+#define SLOTS       (1 << SLOT_BITS)
+#define SLOT_MASK   (SLOTS - 1)
+#define MAX_DELTA   (((uint64_t)1 << (LEVELS * SLOT_BITS)) - 1)
+
+struct xtimer_wheel {
+    int64_t     t0_ns;              // time of tick 0
+    int64_t     tick_ns;
+    uint64_t    now;                // last tick processed
+    int64_t     count;              // pending timers
+    uint64_t    used[LEVELS][SLOTS / 64];
+    xtimer_link slot[LEVELS][SLOTS];
+};
+
+static void
+list_init(xtimer_link *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static void
+list_unlink(xtimer_link *l)
+{
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->next = NULL;
+    l->prev = NULL;
+}
+
+static void
+list_push(xtimer_link *head, xtimer_link *l)
+{
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+static int
+lowest_bit(uint64_t v)
+{
+#ifdef __GNUC__
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    while (!(v & 1)) {
+        v >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Function   : find the first used slot of a level at or after index from
+// Return     : the slot index, or -1 when none up to the end of the level
+// ---------------------------------------------------------------------------
+static int
+next_used(const xtimer_wheel *w, int level, int from)
+{
+    int word = from >> 6;
+    uint64_t bits;
+
+    if (from >= SLOTS) {
+        return -1;
+    }
+    bits = w->used[level][word] & (~(uint64_t)0 << (from & 63));
+    for (;;) {
+        if (bits != 0) {
+            return (word << 6) + lowest_bit(bits);
+        }
+        if (++word == SLOTS / 64) {
+            return -1;
+        }
+        bits = w->used[level][word];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : link a timer into the slot for its due tick
+// Marks      : due ticks beyond the top level are placed at its far end and
+//              placed again when they come down
+// ---------------------------------------------------------------------------
+static void
+place(xtimer_wheel *w, xtimer *t)
+{
+    uint64_t delta = t->expires - w->now;
+    uint64_t due   = t->expires;
+    int level, idx;
+
+    if (delta > MAX_DELTA) {
+        due = w->now + MAX_DELTA;
+    }
+    for (level = 0; level < LEVELS - 1; level++) {
+        if (due - w->now < ((uint64_t)1 << ((level + 1) * SLOT_BITS))) {
+            break;
+        }
+    }
+    idx = (int)((due >> (level * SLOT_BITS)) & SLOT_MASK);
+    list_push(&w->slot[level][idx], &t->link);
+    w->used[level][idx >> 6] |= (uint64_t)1 << (idx & 63);
+}
+
+static void
+mark_empty(xtimer_wheel *w, int level, int idx)
+{
+    if (w->slot[level][idx].next == &w->slot[level][idx]) {
+        w->used[level][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+    }
+}
+
+xtimer_wheel *
+xtimer_wheel_create(int32_t tick_us, int64_t now_ns)
+{
+    xtimer_wheel *w;
+    int level, idx;
+
+    if (tick_us <= 0 || (w = (xtimer_wheel *)calloc(1, sizeof(xtimer_wheel))) == NULL) {
+        return NULL;
+    }
+    w->t0_ns   = now_ns;
+    w->tick_ns = (int64_t)tick_us * 1000;
+    for (level = 0; level < LEVELS; level++) {
+        for (idx = 0; idx < SLOTS; idx++) {
+            list_init(&w->slot[level][idx]);
+        }
+    }
+    return w;
+}
+
+void
+xtimer_wheel_destroy(xtimer_wheel *w)
+{
+    free(w);
+}
+
+void
+xtimer_init(xtimer *t, xtimer_cb cb, void *user)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb   = cb;
+    t->user = user;
+}
+
+void
+xtimer_start(xtimer_wheel *w, xtimer *t, int64_t delay_us)
+{
+    uint64_t ticks = 1;
+
+    if (delay_us > 0) {
+        ticks = (uint64_t)((delay_us * 1000 + w->tick_ns - 1) / w->tick_ns);
+    }
+    if (t->link.next != NULL) {
+        list_unlink(&t->link);      // the slot bit is cleared lazily
+    } else {
+        w->count++;
+    }
+    t->expires = w->now + ticks;
+    place(w, t);
+}
+
+void
+xtimer_stop(xtimer_wheel *w, xtimer *t)
+{
+    if (t->link.next != NULL) {
+        list_unlink(&t->link);
+        w->count--;
+    }
+}
+
+int32_t
+xtimer_pending(const xtimer *t)
+{
+    return t->link.next != NULL;
+}
+
+int64_t
+xtimer_count(xtimer_wheel *w)
+{
+    return w->count;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : spread one slot of a level over the lower levels
+// ---------------------------------------------------------------------------
+static void
+cascade(xtimer_wheel *w, int level, int idx)
+{
+    xtimer_link  list;
+    xtimer_link *head = &w->slot[level][idx];
+
+    if (head->next == head) {
+        mark_empty(w, level, idx);
+        return;
+    }
+    // take the whole slot first, place() may link into it again
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+    w->used[level][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+
+    while (list.next != &list) {
+        xtimer_link *l = list.next;
+        list_unlink(l);
+        place(w, (xtimer *)l);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Function   : run the timers of the level 0 slot of the current tick
+// Return     : number of callbacks run
+// Marks      : the slot is moved to a local list first; a callback that
+//              stops a timer still on it simply unlinks it from there
+// ---------------------------------------------------------------------------
+static int32_t
+expire(xtimer_wheel *w, int idx)
+{
+    xtimer_link  list;
+    xtimer_link *head = &w->slot[0][idx];
+    int32_t      count = 0;
+
+    if (head->next == head) {
+        mark_empty(w, 0, idx);
+        return 0;
+    }
+    list.next = head->next;
+    list.prev = head->prev;
+    list.next->prev = &list;
+    list.prev->next = &list;
+    list_init(head);
+    w->used[0][idx >> 6] &= ~((uint64_t)1 << (idx & 63));
+
+    while (list.next != &list) {
+        xtimer *t = (xtimer *)list.next;
+        list_unlink(&t->link);
+        if (t->expires > w->now) {
+            place(w, t);            // not due yet
+            continue;
+        }
+        w->count--;
+        t->cb(t);
+        count++;
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : move the wheel forward to now_ns, running the due timers
+// Parameters :
+//      [in ] : w      - the wheel
+//            : now_ns - the current time
+//      [out] : none
+// Return     : number of callbacks run
+// Marks      : jumps straight to the next used level 0 slot or the next
+//              wrap of level 0, whichever comes first
+// ---------------------------------------------------------------------------
+int32_t
+xtimer_advance(xtimer_wheel *w, int64_t now_ns)
+{
+    uint64_t target;
+    int32_t  count = 0;
+
+    if (now_ns <= w->t0_ns) {
+        return 0;
+    }
+    target = (uint64_t)((now_ns - w->t0_ns) / w->tick_ns);
+
+    while (w->now < target) {
+        uint64_t next;
+        int      idx, level;
+
+        if (w->count == 0) {
+            w->now = target;
+            break;
+        }
+        idx  = next_used(w, 0, (int)(w->now & SLOT_MASK) + 1);
+        next = idx >= 0 ? (w->now & ~(uint64_t)SLOT_MASK) + idx
+                        : (w->now | SLOT_MASK) + 1;
+        if (next > target) {
+            w->now = target;
+            break;
+        }
+        w->now = next;
+
+        // level 0 wrapped: bring down the slots that are now in range
+        for (level = 1; level < LEVELS && (next & SLOT_MASK) == 0; level++) {
+            int li = (int)((next >> (level * SLOT_BITS)) & SLOT_MASK);
+            cascade(w, level, li);
+            if (li != 0) {
+                break;
+            }
+        }
+        count += expire(w, (int)(next & SLOT_MASK));
+    }
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : time until the next used level 0 slot or level 0 wrap
+// Return     : microseconds, zero when overdue, -1 without pending timers
+// ---------------------------------------------------------------------------
+int64_t
+xtimer_next_us(xtimer_wheel *w, int64_t now_ns)
+{
+    uint64_t next;
+    int64_t  due_ns;
+    int      idx;
+
+    if (w->count == 0) {
+        return -1;
+    }
+    idx  = next_used(w, 0, (int)(w->now & SLOT_MASK) + 1);
+    next = idx >= 0 ? (w->now & ~(uint64_t)SLOT_MASK) + idx : (w->now | SLOT_MASK) + 1;
+
+    due_ns = w->t0_ns + (int64_t)next * w->tick_ns;
+    if (due_ns <= now_ns) {
+        return 0;
+    }
+    return (due_ns - now_ns + 999) / 1000;
+}
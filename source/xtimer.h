@@ -0,0 +1,98 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xtimer.h
+ *  @brief    Hierarchical timer wheel for connection deadlines and timeouts
+ *
+ *  Four levels of 256 slots each cover 2^32 ticks (49 days at the default
+ *  1 ms tick).  Timers are caller-owned xtimer structures linked into a
+ *  slot, so starting, re-arming and stopping a timer are O(1) list
+ *  operations without allocation or a clock read, and a wheel holds any
+ *  number of timers.  A timer moves down one level at most three times
+ *  before it expires.
+ *
+ *  The wheel keeps its own notion of now, moved forward by xtimer_advance;
+ *  delays are counted from the last advance and rounded up to whole
+ *  ticks, so a timer fires within one tick of its due time.  The event
+ *  loop owns a wheel (xloop_timer_start), a wheel can also be driven by
+ *  hand from any single thread.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XTIMER_H__
+#define __XTIMER_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xtimer       xtimer;
+typedef struct xtimer_wheel xtimer_wheel;
+
+/* expiry callback, runs inside xtimer_advance; it may start or stop any
+ * timer, including its own
+ */
+typedef void (*xtimer_cb)(xtimer *t);
+
+/* slot list link */
+typedef struct xtimer_link {
+    struct xtimer_link *next;       // NULL while the timer is not pending
+    struct xtimer_link *prev;
+} xtimer_link;
+
+/* a timer, the fields are set by xtimer_init and xtimer_start */
+struct xtimer {
+    xtimer_link link;
+    uint64_t    expires;            // due tick
+    xtimer_cb   cb;
+    void       *user;               // caller context, untouched by the wheel
+};
+
+/* create a wheel with a tick of tick_us microseconds, now_ns being the
+ * current time on the clock later passed to xtimer_advance (socket_now_ns);
+ * NULL on error
+ */
+xtimer_wheel *xtimer_wheel_create(int32_t tick_us, int64_t now_ns);
+
+/* destroy a wheel, pending timers are dropped without their callbacks
+ */
+void xtimer_wheel_destroy(xtimer_wheel *w);
+
+/* prepare a timer before its first start
+ */
+void xtimer_init(xtimer *t, xtimer_cb cb, void *user);
+
+/* start t to fire delay_us from the last advance; a pending timer is
+ * moved to the new due time
+ */
+void xtimer_start(xtimer_wheel *w, xtimer *t, int64_t delay_us);
+
+/* stop a pending timer, no-op when it is not pending
+ */
+void xtimer_stop(xtimer_wheel *w, xtimer *t);
+
+/* non-zero while t is started and has not fired
+ */
+int32_t xtimer_pending(const xtimer *t);
+
+/* move the wheel to now_ns and run the callbacks of the timers that are
+ * due; returns the number of callbacks run
+ */
+int32_t xtimer_advance(xtimer_wheel *w, int64_t now_ns);
+
+/* microseconds from now_ns until the wheel has work to do, -1 when no
+ * timer is pending; may be earlier than the next expiry when timers have
+ * to move down a level
+ */
+int64_t xtimer_next_us(xtimer_wheel *w, int64_t now_ns);
+
+/* number of pending timers
+ */
+int64_t xtimer_count(xtimer_wheel *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XTIMER_H__
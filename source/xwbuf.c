@@ -0,0 +1,344 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xwbuf.c
+ *  @brief    Write coalescing buffer for a TCP connection
+ *
+ *  The buffer is a flat byte array: data is appended at tail and written
+ *  from head, the pending bytes are moved to the front when the free space
+ *  at the end runs out.
+ *
+ *----------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _MSC_VER
+#include <winsock2.h>
+#else
+#include <poll.h>
+#endif
+#include "xwbuf.h"
+
+struct xwbuf {
+    socket_t    fd;
+    char       *buf;
+    int32_t     capacity;
+    int32_t     threshold;
+    int64_t     deadline_ns;
+    int32_t     send_timeout_ms;
+    int32_t     head;               // first pending byte
+    int32_t     tail;               // end of the pending bytes
+    int64_t     first_ns;           // time the oldest pending byte was buffered
+    xwbuf_stats stats;
+};
+
+void
+xwbuf_config_init(xwbuf_config *cfg)
+{
+    cfg->capacity        = 64 << 10;
+    cfg->threshold       = 16 << 10;
+    cfg->deadline_us     = 50;
+    cfg->send_timeout_ms = 5000;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a write buffer
+// Parameters :
+//      [in ] : fd          - a connected TCP socket
+//            : capacity    - buffer size in bytes
+//            : threshold   - flush size in bytes, clamped to capacity
+//            : deadline_us - maximum age of buffered data
+//      [out] : none
+// Return     : the buffer, or NULL on error
+// ---------------------------------------------------------------------------
+xwbuf *
+xwbuf_create(socket_t fd, int32_t capacity, int32_t threshold, int32_t deadline_us)
+{
+    xwbuf_config cfg;
+
+    xwbuf_config_init(&cfg);
+    cfg.capacity    = capacity;
+    cfg.threshold   = threshold;
+    cfg.deadline_us = deadline_us;
+    return xwbuf_create_ex(fd, &cfg);
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create a write buffer with all settings
+// Parameters :
+//      [in ] : fd  - a connected TCP socket
+//            : cfg - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the buffer, or NULL on error
+// ---------------------------------------------------------------------------
+xwbuf *
+xwbuf_create_ex(socket_t fd, const xwbuf_config *cfg)
+{
+    xwbuf_config c;
+    xwbuf       *wb;
+
+    if (cfg != NULL) {
+        c = *cfg;
+    } else {
+        xwbuf_config_init(&c);
+    }
+    if (c.capacity <= 0) {
+        return NULL;
+    }
+    if ((wb = (xwbuf *)calloc(1, sizeof(xwbuf))) == NULL) {
+        return NULL;
+    }
+    if ((wb->buf = (char *)malloc(c.capacity)) == NULL) {
+        free(wb);
+        return NULL;
+    }
+    wb->fd              = fd;
+    wb->capacity        = c.capacity;
+    wb->threshold       = (c.threshold > 0 && c.threshold < c.capacity) ? c.threshold : c.capacity;
+    wb->deadline_ns     = (int64_t)(c.deadline_us > 0 ? c.deadline_us : 0) * 1000;
+    wb->send_timeout_ms = c.send_timeout_ms;
+    return wb;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : write from a memory block until done or the socket is full
+// Return     : bytes written, or SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+static int32_t
+write_some(xwbuf *wb, const char *data, int32_t len)
+{
+    int32_t done = 0;
+
+    while (done < len) {
+        int32_t n = socket_send(wb->fd, (char *)data + done, len - done);
+        wb->stats.syscalls++;
+        if (n > 0) {
+            done += n;
+            wb->stats.bytes += n;
+        } else if (n < 0 && !socket_would_block()) {
+            return SOCKET_ERROR;
+        } else {
+            break;                  // socket buffer full
+        }
+    }
+    return done;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : wait until a full socket takes data again
+// Parameters :
+//      [in ] : wb     - the write buffer
+//            : end_ns - give up at this socket_now_ns time, 0 for never
+//      [out] : none
+// Return     : zero when writable (or interrupted), SOCKET_ERROR on error
+//              or with ETIMEDOUT at end_ns
+// Marks      : poll has no FD_SETSIZE limit on the descriptor value, select
+//              is left to Windows
+// ---------------------------------------------------------------------------
+static int32_t
+wait_writable(xwbuf *wb, int64_t end_ns)
+{
+    int32_t ms = -1;
+    int     rc;
+
+    if (end_ns != 0) {
+        int64_t left = end_ns - socket_now_ns();
+        ms = left > 0 ? (int32_t)((left + 999999) / 1000000) : 0;
+    }
+#ifdef _MSC_VER
+    {
+        fd_set         fds;
+        struct timeval tv;
+
+        FD_ZERO(&fds);
+        FD_SET(wb->fd, &fds);
+        tv.tv_sec  = ms / 1000;
+        tv.tv_usec = (ms % 1000) * 1000;
+        rc = select(0, NULL, &fds, NULL, ms < 0 ? NULL : &tv);
+    }
+#else
+    {
+        struct pollfd p;
+
+        p.fd      = wb->fd;
+        p.events  = POLLOUT;
+        p.revents = 0;
+        rc = poll(&p, 1, ms);
+    }
+#endif
+    if (rc < 0) {
+        return socket_would_block() ? 0 : SOCKET_ERROR;
+    }
+    if (rc == 0) {
+#ifdef _MSC_VER
+        WSASetLastError(WSAETIMEDOUT);
+#endif
+        errno = ETIMEDOUT;
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : write the pending bytes
+// Return     : bytes still pending, or SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+static int32_t
+flush_pending(xwbuf *wb)
+{
+    int32_t n;
+
+    if (wb->tail == wb->head) {
+        return 0;
+    }
+    if ((n = write_some(wb, wb->buf + wb->head, wb->tail - wb->head)) < 0) {
+        return SOCKET_ERROR;
+    }
+    wb->head += n;
+    if (wb->head == wb->tail) {
+        wb->head = wb->tail = 0;
+        return 0;
+    }
+    return wb->tail - wb->head;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : buffer a message, flushing on the threshold or the deadline
+// Parameters :
+//      [in ] : wb   - the write buffer
+//            : data - the message
+//            : len  - the length of the message
+//      [out] : none
+// Return     : len when accepted, 0 when a non-blocking socket is full,
+//              SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+int32_t
+xwbuf_send(xwbuf *wb, const void *data, int32_t len)
+{
+    int64_t now;
+
+    wb->stats.msgs++;
+
+    // too large to be buffered: pending data first, then straight out,
+    // waiting for room once it has started, a message is never cut
+    if (len > wb->capacity) {
+        int64_t end_ns = 0;
+        int32_t done, n = flush_pending(wb);
+        if (n != 0) {
+            wb->stats.msgs--;
+            return n < 0 ? SOCKET_ERROR : 0;
+        }
+        for (done = 0; done < len; done += n) {
+            if ((n = write_some(wb, (const char *)data + done, len - done)) < 0) {
+                return SOCKET_ERROR;
+            }
+            if (done + n == len) {
+                break;
+            }
+            if (end_ns == 0 && wb->send_timeout_ms >= 0) {
+                end_ns = socket_now_ns() + (int64_t)wb->send_timeout_ms * 1000000;
+            }
+            if (wait_writable(wb, end_ns) != 0) {
+                return SOCKET_ERROR;
+            }
+        }
+        return len;
+    }
+
+    // make room: compact, then flush if that is not enough
+    if (wb->capacity - wb->tail < len && wb->head > 0) {
+        memmove(wb->buf, wb->buf + wb->head, wb->tail - wb->head);
+        wb->tail -= wb->head;
+        wb->head  = 0;
+    }
+    if (wb->capacity - wb->tail < len) {
+        if (flush_pending(wb) < 0) {
+            return SOCKET_ERROR;
+        }
+        if (wb->head > 0) {
+            memmove(wb->buf, wb->buf + wb->head, wb->tail - wb->head);
+            wb->tail -= wb->head;
+            wb->head  = 0;
+        }
+        if (wb->capacity - wb->tail < len) {
+            wb->stats.msgs--;
+            return 0;               // non-blocking socket is full
+        }
+    }
+
+    now = socket_now_ns();
+    if (wb->tail == wb->head) {
+        wb->first_ns = now;
+    }
+    memcpy(wb->buf + wb->tail, data, len);
+    wb->tail += len;
+
+    if (wb->tail - wb->head >= wb->threshold) {
+        wb->stats.flush_size++;
+        if (flush_pending(wb) < 0) {
+            return SOCKET_ERROR;
+        }
+    } else if (now - wb->first_ns >= wb->deadline_ns) {
+        wb->stats.flush_deadline++;
+        if (flush_pending(wb) < 0) {
+            return SOCKET_ERROR;
+        }
+    }
+    return len;
+}
+
+int32_t
+xwbuf_flush(xwbuf *wb)
+{
+    if (wb->tail != wb->head) {
+        wb->stats.flush_explicit++;
+    }
+    return flush_pending(wb);
+}
+
+int32_t
+xwbuf_poll(xwbuf *wb)
+{
+    if (wb->tail == wb->head) {
+        return 0;
+    }
+    if (socket_now_ns() - wb->first_ns < wb->deadline_ns) {
+        return wb->tail - wb->head;
+    }
+    wb->stats.flush_deadline++;
+    return flush_pending(wb);
+}
+
+int32_t
+xwbuf_timeout_us(xwbuf *wb)
+{
+    int64_t left;
+
+    if (wb->tail == wb->head) {
+        return -1;
+    }
+    left = wb->first_ns + wb->deadline_ns - socket_now_ns();
+    return left <= 0 ? 0 : (int32_t)((left + 999) / 1000);
+}
+
+int32_t
+xwbuf_pending(xwbuf *wb)
+{
+    return wb->tail - wb->head;
+}
+
+void
+xwbuf_get_stats(xwbuf *wb, xwbuf_stats *stats)
+{
+    *stats = wb->stats;
+}
+
+void
+xwbuf_destroy(xwbuf *wb)
+{
+    if (wb == NULL) {
+        return;
+    }
+    free(wb->buf);
+    free(wb);
+}
@@ -0,0 +1,102 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xwbuf.h
+ *  @brief    Write coalescing buffer for a TCP connection
+ *
+ *  Small messages are collected in user space and written with one
+ *  send() when the buffered size reaches a threshold or the oldest
+ *  buffered byte reaches a deadline, or on an explicit flush.  Use it
+ *  with TCP_NODELAY: the batching replaces Nagle's algorithm and the
+ *  deadline bounds the added delay.
+ *
+ *  The deadline is only checked inside xwbuf_send and xwbuf_poll; a
+ *  producer that may go quiet calls xwbuf_poll from its wait loop, using
+ *  xwbuf_timeout_us as the wait time.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XWBUF_H__
+#define __XWBUF_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xwbuf xwbuf;
+
+/* counters of a write buffer */
+typedef struct xwbuf_stats {
+    int64_t msgs;                   // messages passed to xwbuf_send
+    int64_t bytes;                  // bytes written to the socket
+    int64_t syscalls;               // send() calls, including EAGAIN
+    int64_t flush_size;             // flushes triggered by the threshold
+    int64_t flush_deadline;         // flushes triggered by the deadline
+    int64_t flush_explicit;         // xwbuf_flush calls with data pending
+} xwbuf_stats;
+
+/* buffer settings, see xwbuf_config_init for the defaults */
+typedef struct xwbuf_config {
+    int32_t capacity;               // buffer size in bytes
+    int32_t threshold;              // flush once this many bytes are buffered (<= capacity)
+    int32_t deadline_us;            // flush once the oldest buffered byte is this old
+    int32_t send_timeout_ms;        // longest wait for a message larger than the buffer, -1 for ever
+} xwbuf_config;
+
+/* defaults: 64 KB buffer, flush at 16 KB or after 50 us, 5 s for a large
+ * message
+ */
+void xwbuf_config_init(xwbuf_config *cfg);
+
+/* create a write buffer on a connected TCP socket (owned by the caller)
+ *   capacity    - buffer size in bytes
+ *   threshold   - flush once this many bytes are buffered (<= capacity)
+ *   deadline_us - flush once the oldest buffered byte is this old
+ * returns NULL on error
+ */
+xwbuf *xwbuf_create(socket_t fd, int32_t capacity, int32_t threshold, int32_t deadline_us);
+
+/* same as xwbuf_create with all the settings; cfg NULL for the defaults
+ */
+xwbuf *xwbuf_create_ex(socket_t fd, const xwbuf_config *cfg);
+
+/* buffer a message; returns len when accepted, 0 when the socket is
+ * non-blocking and the buffer has no room (retry after it is writable),
+ * SOCKET_ERROR on error.  A message larger than the buffer is written
+ * directly once the pending data is out: 0 when that data cannot be
+ * written, otherwise the call waits for the socket until the whole message
+ * is sent, even on a non-blocking socket.  After send_timeout_ms it fails
+ * with ETIMEDOUT; part of the message may be out then, close the socket
+ */
+int32_t xwbuf_send(xwbuf *wb, const void *data, int32_t len);
+
+/* write all buffered data; returns the number of bytes still pending (only
+ * non-zero on a non-blocking socket), SOCKET_ERROR on error
+ */
+int32_t xwbuf_flush(xwbuf *wb);
+
+/* flush when the deadline has passed; same return values as xwbuf_flush
+ */
+int32_t xwbuf_poll(xwbuf *wb);
+
+/* microseconds until the deadline of the buffered data, -1 when empty
+ */
+int32_t xwbuf_timeout_us(xwbuf *wb);
+
+/* bytes waiting in the buffer
+ */
+int32_t xwbuf_pending(xwbuf *wb);
+
+void xwbuf_get_stats(xwbuf *wb, xwbuf_stats *stats);
+
+/* free the buffer without flushing, the socket stays open
+ */
+void xwbuf_destroy(xwbuf *wb);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XWBUF_H__
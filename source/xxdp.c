@@ -0,0 +1,604 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xxdp.c
+ *  @brief    AF_XDP receive path for multicast feeds (Linux)
+ *
+ *  Kernel objects of an engine, all through the bpf() system call, without
+ *  libbpf:
+ *      filter - hash map, key destination address and port, the groups
+ *      xsks   - XSKMAP, the AF_XDP socket at its queue number
+ *      prog   - the XDP program below, attached with a bpf link, so it
+ *               goes away with the link fd even if the process dies
+ *
+ *  UMEM: frames of frame_size bytes.  Every frame is either in the fill
+ *  ring (free for the kernel), or in the rx ring (received), or being
+ *  read; a frame goes back to the fill ring as soon as its payload is
+ *  read, so the fill ring never overflows with frames == its size.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <ifaddrs.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "xxdp.h"
+#include "xsocket_int.h"
+
+#ifndef SOL_XDP
+#define SOL_XDP         283
+#endif
+#ifndef AF_XDP
+#define AF_XDP          44
+#endif
+
+#define HDR_LEN         42          // Ethernet, IPv4 without options, UDP
+#define MAX_GROUPS      256
+#define MAX_QUEUES      64
+#define PROG_MAX        40
+#define BIND_RETRIES    100         // of 10 ms while the queue is still busy
+
+/* filter map key, the bytes as they are in the packet */
+typedef struct mc_key {
+    uint32_t grp;
+    uint16_t port;
+    uint16_t pad;
+} mc_key;
+
+/* a producer/consumer ring shared with the kernel */
+typedef struct xring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void     *desc;
+    uint32_t  mask;
+    void     *map;
+    size_t    map_len;
+} xring;
+
+struct xxdp {
+    xxdp_config cfg;
+    int         ifindex;
+    int         fd;                 // the AF_XDP socket
+    char       *umem;
+    size_t      umem_len;
+    xring       rx;
+    xring       fill;
+    xring       comp;               // required by bind, unused on receive
+    uint32_t    rx_cons;            // local copy of the rx consumer
+    uint32_t    fill_prod;          // local copy of the fill producer
+    int         filter_fd;
+    int         xsks_fd;
+    int         prog_fd;
+    int         link_fd;
+    socket_t    joins[MAX_GROUPS];  // sockets that hold the group memberships
+    int32_t     njoins;
+    xxdp_stats  stats;
+};
+
+void
+xxdp_config_init(xxdp_config *cfg)
+{
+    cfg->queue      = 0;
+    cfg->frames     = 4096;
+    cfg->frame_size = 2048;
+    cfg->ring_size  = 2048;
+    cfg->native     = 0;
+}
+
+static int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return (int)syscall(SYS_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int
+map_create(uint32_t type, uint32_t key_size, uint32_t value_size, uint32_t max_entries)
+{
+    union bpf_attr a;
+
+    memset(&a, 0, sizeof(a));
+    a.map_type    = type;
+    a.key_size    = key_size;
+    a.value_size  = value_size;
+    a.max_entries = max_entries;
+    return sys_bpf(BPF_MAP_CREATE, &a);
+}
+
+static int
+map_update(int fd, const void *key, const void *value)
+{
+    union bpf_attr a;
+
+    memset(&a, 0, sizeof(a));
+    a.map_fd = (uint32_t)fd;
+    a.key    = (uint64_t)(uintptr_t)key;
+    a.value  = (uint64_t)(uintptr_t)value;
+    a.flags  = BPF_ANY;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &a);
+}
+
+#define INSN(c, d, s, o, i)     (struct bpf_insn){ (uint8_t)(c), (d), (s), (int16_t)(o), (int32_t)(i) }
+#define LDX(sz, d, s, o)        INSN(BPF_LDX | (sz) | BPF_MEM, d, s, o, 0)
+#define STX(sz, d, s, o)        INSN(BPF_STX | (sz) | BPF_MEM, d, s, o, 0)
+#define ST(sz, d, o, i)         INSN(BPF_ST | (sz) | BPF_MEM, d, 0, o, i)
+#define MOV_X(d, s)             INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define MOV_K(d, i)             INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define ADD_K(d, i)             INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define AND_K(d, i)             INSN(BPF_ALU64 | BPF_AND | BPF_K, d, 0, 0, i)
+#define CALL(f)                 INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define EXIT()                  INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+
+// ---------------------------------------------------------------------------
+// Function   : assemble the XDP program
+// Parameters :
+//      [out] : p - the instructions, PROG_MAX at least
+// Return     : the number of instructions
+// Marks      : in C:
+//                  if (eth + ip + udp > end || eth.proto != IPv4
+//                      || ip.ihl != 5 || ip.proto != UDP || ip.frag)
+//                      return XDP_PASS;
+//                  if (!lookup(filter, {ip.daddr, udp.dport}))
+//                      return XDP_PASS;
+//                  return redirect_map(xsks, rx_queue_index, XDP_PASS);
+//              a queue without a socket passes the packet on as well
+// ---------------------------------------------------------------------------
+static int
+build_prog(struct bpf_insn *p, int filter_fd, int xsks_fd)
+{
+    int jumps[8], nj = 0, n = 0, i;
+
+#define JPASS(op, d, i)         do { jumps[nj++] = n; p[n++] = INSN(BPF_JMP | (op) | BPF_K, d, 0, 0, i); } while (0)
+
+    p[n++] = MOV_X(6, 1);                                   // r6 = ctx
+    p[n++] = LDX(BPF_W, 2, 6, offsetof(struct xdp_md, data));
+    p[n++] = LDX(BPF_W, 3, 6, offsetof(struct xdp_md, data_end));
+    p[n++] = MOV_X(4, 2);
+    p[n++] = ADD_K(4, HDR_LEN);
+    jumps[nj++] = n;                                        // short packet
+    p[n++] = INSN(BPF_JMP | BPF_JGT | BPF_X, 4, 3, 0, 0);
+    p[n++] = LDX(BPF_H, 5, 2, 12);
+    JPASS(BPF_JNE, 5, htons(0x0800));                       // not IPv4
+    p[n++] = LDX(BPF_B, 5, 2, 14);
+    JPASS(BPF_JNE, 5, 0x45);                                // options
+    p[n++] = LDX(BPF_B, 5, 2, 23);
+    JPASS(BPF_JNE, 5, IPPROTO_UDP);
+    p[n++] = LDX(BPF_H, 5, 2, 20);
+    p[n++] = AND_K(5, htons(0x3fff));
+    JPASS(BPF_JNE, 5, 0);                                   // fragment
+    p[n++] = LDX(BPF_W, 5, 2, 30);                          // key on the stack
+    p[n++] = STX(BPF_W, 10, 5, -8);
+    p[n++] = LDX(BPF_H, 5, 2, 36);
+    p[n++] = STX(BPF_H, 10, 5, -4);
+    p[n++] = ST(BPF_H, 10, -2, 0);
+    p[n++] = INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, filter_fd);
+    p[n++] = INSN(0, 0, 0, 0, 0);
+    p[n++] = MOV_X(2, 10);
+    p[n++] = ADD_K(2, -8);
+    p[n++] = CALL(BPF_FUNC_map_lookup_elem);
+    JPASS(BPF_JEQ, 0, 0);                                   // not subscribed
+    p[n++] = LDX(BPF_W, 2, 6, offsetof(struct xdp_md, rx_queue_index));
+    p[n++] = INSN(BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, xsks_fd);
+    p[n++] = INSN(0, 0, 0, 0, 0);
+    p[n++] = MOV_K(3, XDP_PASS);
+    p[n++] = CALL(BPF_FUNC_redirect_map);
+    p[n++] = EXIT();
+    for (i = 0; i < nj; i++) {
+        p[jumps[i]].off = (int16_t)(n - jumps[i] - 1);
+    }
+    p[n++] = MOV_K(0, XDP_PASS);
+    p[n++] = EXIT();
+
+#undef JPASS
+    return n;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : create the maps, load the program and attach it
+// Return     : zero on success, SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+static int32_t
+load_prog(xxdp *x)
+{
+    struct bpf_insn insns[PROG_MAX];
+    union bpf_attr  a;
+    char            log[4096] = "";
+    uint32_t        key = (uint32_t)x->cfg.queue;
+
+    if ((x->filter_fd = map_create(BPF_MAP_TYPE_HASH, sizeof(mc_key), sizeof(uint32_t), MAX_GROUPS)) < 0
+        || (x->xsks_fd = map_create(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), MAX_QUEUES)) < 0) {
+        xs_printf("[xxdp] cannot create maps: %s\n", strerror(errno));
+        return SOCKET_ERROR;
+    }
+    memset(&a, 0, sizeof(a));
+    a.prog_type = BPF_PROG_TYPE_XDP;
+    a.insn_cnt  = (uint32_t)build_prog(insns, x->filter_fd, x->xsks_fd);
+    a.insns     = (uint64_t)(uintptr_t)insns;
+    a.license   = (uint64_t)(uintptr_t)"GPL";
+    a.log_buf   = (uint64_t)(uintptr_t)log;
+    a.log_size  = sizeof(log);
+    a.log_level = 1;
+    if ((x->prog_fd = sys_bpf(BPF_PROG_LOAD, &a)) < 0) {
+        xs_printf("[xxdp] cannot load the program: %s\n%s\n", strerror(errno), log);
+        return SOCKET_ERROR;
+    }
+    if (map_update(x->xsks_fd, &key, &x->fd) != 0) {
+        xs_printf("[xxdp] cannot add the socket to the map: %s\n", strerror(errno));
+        return SOCKET_ERROR;
+    }
+    memset(&a, 0, sizeof(a));
+    a.link_create.prog_fd        = (uint32_t)x->prog_fd;
+    a.link_create.target_ifindex = (uint32_t)x->ifindex;
+    a.link_create.attach_type    = BPF_XDP;
+    a.link_create.flags          = x->cfg.native ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+    if ((x->link_fd = sys_bpf(BPF_LINK_CREATE, &a)) < 0) {
+        xs_printf("[xxdp] cannot attach to interface %d: %s\n", x->ifindex, strerror(errno));
+        return SOCKET_ERROR;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : map one ring of the socket
+// Parameters :
+//      [in ] : off     - its offsets from XDP_MMAP_OFFSETS
+//            : entries - its size
+//            : esize   - bytes per entry
+//            : pgoff   - its mmap offset
+// Return     : zero on success, SOCKET_ERROR on error
+// ---------------------------------------------------------------------------
+static int32_t
+map_ring(xxdp *x, xring *r, const struct xdp_ring_offset *off, uint32_t entries, size_t esize,
+         off_t pgoff)
+{
+    char *p;
+
+    r->map_len = off->desc + entries * esize;
+    if ((p = (char *)mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, x->fd,
+                          pgoff)) == MAP_FAILED) {
+        r->map = NULL;
+        return SOCKET_ERROR;
+    }
+    r->map      = p;
+    r->producer = (uint32_t *)(p + off->producer);
+    r->consumer = (uint32_t *)(p + off->consumer);
+    r->desc     = p + off->desc;
+    r->mask     = entries - 1;
+    return 0;
+}
+
+/* the interface index of an address or a name */
+static int
+find_ifindex(const char *ip_if)
+{
+    struct in_addr  a;
+    struct ifaddrs *ifs, *i;
+    int             idx = 0;
+
+    if (inet_pton(AF_INET, ip_if, &a) != 1) {
+        return (int)if_nametoindex(ip_if);
+    }
+    if (getifaddrs(&ifs) != 0) {
+        return 0;
+    }
+    for (i = ifs; i != NULL && idx == 0; i = i->ifa_next) {
+        if (i->ifa_addr != NULL && i->ifa_addr->sa_family == AF_INET
+            && ((struct sockaddr_in *)i->ifa_addr)->sin_addr.s_addr == a.s_addr) {
+            idx = (int)if_nametoindex(i->ifa_name);
+        }
+    }
+    freeifaddrs(ifs);
+    return idx;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : open an engine on an interface
+// Parameters :
+//      [in ] : ip_if - interface address or name
+//            : cfg   - the settings, NULL for the defaults
+//      [out] : none
+// Return     : the engine, NULL on error
+// Marks      : the socket is bound before the program is attached, so no
+//              redirected packet finds the map empty
+// ---------------------------------------------------------------------------
+xxdp *
+xxdp_open(const char *ip_if, const xxdp_config *cfg)
+{
+    struct xdp_umem_reg     reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp     sa;
+    socklen_t               optlen = sizeof(off);
+    xxdp                   *x;
+    uint32_t                i, nfill;
+    int                     rc;
+
+    if ((x = (xxdp *)calloc(1, sizeof(xxdp))) == NULL) {
+        return NULL;
+    }
+    if (cfg != NULL) {
+        x->cfg = *cfg;
+    } else {
+        xxdp_config_init(&x->cfg);
+    }
+    x->fd = x->filter_fd = x->xsks_fd = x->prog_fd = x->link_fd = -1;
+    if (x->cfg.frames <= 0 || (x->cfg.frames & (x->cfg.frames - 1)) != 0
+        || (x->cfg.frame_size != 2048 && x->cfg.frame_size != 4096)
+        || x->cfg.ring_size <= 0 || (x->cfg.ring_size & (x->cfg.ring_size - 1)) != 0
+        || x->cfg.queue < 0 || x->cfg.queue >= MAX_QUEUES) {
+        xs_printf("[xxdp] bad settings\n");
+        free(x);
+        return NULL;
+    }
+    if ((x->ifindex = find_ifindex(ip_if)) == 0) {
+        xs_printf("[xxdp] no interface %s\n", ip_if);
+        free(x);
+        return NULL;
+    }
+
+    x->umem_len = (size_t)x->cfg.frames * x->cfg.frame_size;
+    if ((x->umem = (char *)mmap(NULL, x->umem_len, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0)) == MAP_FAILED) {
+        x->umem = NULL;
+        goto fail;
+    }
+    if ((x->fd = socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0) {
+        xs_printf("[xxdp] cannot create an AF_XDP socket: %s\n", strerror(errno));
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.addr       = (uint64_t)(uintptr_t)x->umem;
+    reg.len        = x->umem_len;
+    reg.chunk_size = (uint32_t)x->cfg.frame_size;
+    nfill          = (uint32_t)x->cfg.frames;
+    i              = 1;                 // the completion ring is not used, keep it small
+    if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0
+        || setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &nfill, sizeof(nfill)) != 0
+        || setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &i, sizeof(i)) != 0
+        || setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &x->cfg.ring_size, sizeof(x->cfg.ring_size)) != 0
+        || getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+        xs_printf("[xxdp] cannot set up the UMEM: %s\n", strerror(errno));
+        goto fail;
+    }
+    if (map_ring(x, &x->rx, &off.rx, (uint32_t)x->cfg.ring_size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) != 0
+        || map_ring(x, &x->fill, &off.fr, nfill, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) != 0
+        || map_ring(x, &x->comp, &off.cr, 1, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING) != 0) {
+        xs_printf("[xxdp] cannot map the rings: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    // every frame starts out free for the kernel
+    for (i = 0; i < nfill; i++) {
+        ((uint64_t *)x->fill.desc)[i] = (uint64_t)i * x->cfg.frame_size;
+    }
+    x->fill_prod = nfill;
+    __atomic_store_n(x->fill.producer, x->fill_prod, __ATOMIC_RELEASE);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sxdp_family   = AF_XDP;
+    sa.sxdp_ifindex  = (uint32_t)x->ifindex;
+    sa.sxdp_queue_id = (uint32_t)x->cfg.queue;
+    sa.sxdp_flags    = x->cfg.native ? 0 : XDP_COPY;
+    // the kernel lets go of a queue some time after its last socket was
+    // closed, so a quick reopen finds it busy for a moment
+    for (i = 0; (rc = bind(x->fd, (struct sockaddr *)&sa, sizeof(sa))) != 0 && errno == EBUSY
+                && i < BIND_RETRIES; i++) {
+        usleep(10000);
+    }
+    if (rc != 0) {
+        xs_printf("[xxdp] cannot bind to queue %d of %s: %s\n", x->cfg.queue, ip_if, strerror(errno));
+        goto fail;
+    }
+    if (load_prog(x) != 0) {
+        goto fail;
+    }
+    xs_printf("[xxdp] receiving on %s queue %d, %s mode\n", ip_if, x->cfg.queue,
+              x->cfg.native ? "native" : "generic");
+    return x;
+
+fail:
+    xxdp_close(x);
+    return NULL;
+}
+
+int32_t
+xxdp_add_mc(xxdp *x, const char *ip_if, const char *ip_grp, uint16_t port)
+{
+    mc_key   key;
+    uint32_t one = 1;
+    socket_t fd;
+
+    memset(&key, 0, sizeof(key));
+    if (x->njoins >= MAX_GROUPS || inet_pton(AF_INET, ip_grp, &key.grp) != 1) {
+        return SOCKET_ERROR;
+    }
+    key.port = htons(port);
+    // the membership only, the datagrams never reach this socket
+    if ((fd = socket_add_mc_ex(ip_if, ip_grp, port, 65536)) == INVALID_SOCKET) {
+        return SOCKET_ERROR;
+    }
+    if (map_update(x->filter_fd, &key, &one) != 0) {
+        xs_printf("[xxdp] cannot add %s:%d to the filter: %s\n", ip_grp, port, strerror(errno));
+        socket_close(fd);
+        return SOCKET_ERROR;
+    }
+    x->joins[x->njoins++] = fd;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Function   : the payload of an rx descriptor
+// Parameters :
+//      [in ] : d    - the descriptor
+//      [out] : len  - payload length
+//            : grp  - destination group, network order
+//            : port - destination port, network order
+// Return     : the payload
+// ---------------------------------------------------------------------------
+static const char *
+payload(xxdp *x, const struct xdp_desc *d, int32_t *len, uint32_t *grp, uint16_t *port)
+{
+    const char *pkt = x->umem + d->addr;
+    uint16_t    ulen;
+
+    memcpy(grp, pkt + 30, sizeof(*grp));
+    memcpy(port, pkt + 36, sizeof(*port));
+    memcpy(&ulen, pkt + 38, sizeof(ulen));
+    ulen = ntohs(ulen);
+    *len = (int32_t)d->len - HDR_LEN;
+    if (ulen >= 8 && (int32_t)ulen - 8 < *len) {
+        *len = (int32_t)ulen - 8;       // Ethernet padding of short frames
+    }
+    return pkt + HDR_LEN;
+}
+
+/* give the frames of the read descriptors back to the kernel */
+static void
+release(xxdp *x, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        const struct xdp_desc *d = (const struct xdp_desc *)x->rx.desc + ((x->rx_cons + i) & x->rx.mask);
+        ((uint64_t *)x->fill.desc)[(x->fill_prod + i) & x->fill.mask] =
+            d->addr - d->addr % (uint64_t)x->cfg.frame_size;
+    }
+    x->rx_cons   += n;
+    x->fill_prod += n;
+    __atomic_store_n(x->rx.consumer, x->rx_cons, __ATOMIC_RELEASE);
+    __atomic_store_n(x->fill.producer, x->fill_prod, __ATOMIC_RELEASE);
+}
+
+int32_t
+xxdp_poll(xxdp *x, xxdp_frame_cb cb, void *user, int32_t max)
+{
+    uint32_t avail = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE) - x->rx_cons, i;
+
+    if (max > 0 && avail > (uint32_t)max) {
+        avail = (uint32_t)max;
+    }
+    for (i = 0; i < avail; i++) {
+        const struct xdp_desc *d = (const struct xdp_desc *)x->rx.desc + ((x->rx_cons + i) & x->rx.mask);
+        const char            *data;
+        int32_t                len;
+        uint32_t               grp;
+        uint16_t               port;
+
+        data = payload(x, d, &len, &grp, &port);
+        x->stats.packets++;
+        x->stats.bytes += len;
+        cb(user, data, len, grp, port);
+    }
+    if (avail > 0) {
+        release(x, avail);
+    }
+    return (int32_t)avail;
+}
+
+int32_t
+xxdp_recv(xxdp *x, void *data, int32_t len)
+{
+    struct pollfd p;
+
+    p.fd     = x->fd;
+    p.events = POLLIN;
+    while (__atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE) == x->rx_cons) {
+        if (poll(&p, 1, -1) < 0 && errno != EINTR) {
+            return SOCKET_ERROR;
+        }
+    }
+    {
+        const struct xdp_desc *d = (const struct xdp_desc *)x->rx.desc + (x->rx_cons & x->rx.mask);
+        const char            *src;
+        int32_t                n;
+        uint32_t               grp;
+        uint16_t               port;
+
+        src = payload(x, d, &n, &grp, &port);
+        x->stats.packets++;
+        x->stats.bytes += n;
+        if (n > len) {
+            x->stats.truncated++;
+            n = len;
+        }
+        memcpy(data, src, (size_t)n);
+        release(x, 1);
+        return n;
+    }
+}
+
+socket_t
+xxdp_fd(xxdp *x)
+{
+    return x->fd;
+}
+
+void
+xxdp_get_stats(xxdp *x, xxdp_stats *stats)
+{
+    struct xdp_statistics ks;
+    socklen_t             optlen = sizeof(ks);
+
+    *stats = x->stats;
+    memset(&ks, 0, sizeof(ks));
+    if (getsockopt(x->fd, SOL_XDP, XDP_STATISTICS, &ks, &optlen) == 0) {
+        stats->rx_dropped   = (int64_t)ks.rx_dropped;
+        stats->rx_ring_full = (int64_t)ks.rx_ring_full;
+        stats->fill_empty   = (int64_t)ks.rx_fill_ring_empty_descs;
+    }
+}
+
+void
+xxdp_close(xxdp *x)
+{
+    int32_t i;
+
+    if (x == NULL) {
+        return;
+    }
+    // the link first, so the program stops redirecting to the socket
+    if (x->link_fd >= 0) {
+        close(x->link_fd);
+    }
+    if (x->prog_fd >= 0) {
+        close(x->prog_fd);
+    }
+    if (x->xsks_fd >= 0) {
+        close(x->xsks_fd);
+    }
+    if (x->filter_fd >= 0) {
+        close(x->filter_fd);
+    }
+    for (i = 0; i < x->njoins; i++) {
+        socket_close(x->joins[i]);
+    }
+    if (x->rx.map != NULL) {
+        munmap(x->rx.map, x->rx.map_len);
+    }
+    if (x->fill.map != NULL) {
+        munmap(x->fill.map, x->fill.map_len);
+    }
+    if (x->comp.map != NULL) {
+        munmap(x->comp.map, x->comp.map_len);
+    }
+    if (x->fd >= 0) {
+        close(x->fd);
+    }
+    if (x->umem != NULL) {
+        munmap(x->umem, x->umem_len);
+    }
+    free(x);
+}
@@ -0,0 +1,101 @@
+/*----------------------------------------------------------------------------
+ *
+ *  @file     xxdp.h
+ *  @brief    AF_XDP receive path for multicast feeds (Linux)
+ *
+ *  Datagrams of the subscribed groups are taken off the interface before
+ *  the IP stack: a small XDP program matches IPv4 UDP packets on their
+ *  destination address and port and redirects them to an AF_XDP socket,
+ *  whose frames land in a UMEM area of this process.  Other traffic goes
+ *  on to the stack as before; the matched datagrams no longer reach
+ *  ordinary sockets of the same groups on this interface.
+ *
+ *  xxdp_recv receives one payload like socket_udp_mc_recv; xxdp_poll hands
+ *  a batch to a callback without copying.  xxdp_add_mc also joins the
+ *  group with a normal socket, so the interface and the switch deliver it.
+ *
+ *  By default the program runs in generic (SKB) mode with copied frames,
+ *  which works on any interface, veth and loopback included, and needs no
+ *  driver support; native sets driver mode and lets the kernel use zero
+ *  copy where the driver has it.  One engine serves one receive queue; on
+ *  a multi-queue NIC steer the groups to it or open one per queue.
+ *  Needs CAP_NET_ADMIN and CAP_BPF (or root).  IP options, VLAN tags and
+ *  fragments are left to the stack.
+ *
+ *----------------------------------------------------------------------------*/
+
+#ifndef __XXDP_H__
+#define __XXDP_H__
+
+#include <stdint.h>
+#include "xsocket.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xxdp xxdp;
+
+/* engine settings, see xxdp_config_init for the defaults */
+typedef struct xxdp_config {
+    int32_t queue;                  // receive queue of the interface
+    int32_t frames;                 // UMEM frames, a power of two
+    int32_t frame_size;             // 2048 or 4096
+    int32_t ring_size;              // rx ring entries, a power of two
+    int32_t native;                 // driver mode instead of generic (SKB) mode
+} xxdp_config;
+
+/* counters of an engine, the kernel's included */
+typedef struct xxdp_stats {
+    int64_t packets;                // payloads delivered
+    int64_t bytes;
+    int64_t truncated;              // longer than the caller's buffer
+    int64_t rx_dropped;             // kernel: dropped, e.g. frame too small
+    int64_t rx_ring_full;           // kernel: the rx ring was full
+    int64_t fill_empty;             // kernel: no free frame in the fill ring
+} xxdp_stats;
+
+/* a payload from xxdp_poll, data valid during the call; grp and port in
+ * network byte order
+ */
+typedef void (*xxdp_frame_cb)(void *user, const void *data, int32_t len, uint32_t grp, uint16_t port);
+
+/* defaults: queue 0, 4096 frames of 2048 bytes, rx ring 2048, generic mode
+ */
+void xxdp_config_init(xxdp_config *cfg);
+
+/* attach to the interface with address ip_if (or named ip_if, "eth0");
+ * cfg NULL for the defaults; NULL on error
+ */
+xxdp *xxdp_open(const char *ip_if, const xxdp_config *cfg);
+
+/* join ip_grp:port on interface ip_if and take its datagrams; zero on
+ * success, SOCKET_ERROR on error
+ */
+int32_t xxdp_add_mc(xxdp *x, const char *ip_if, const char *ip_grp, uint16_t port);
+
+/* receive one payload like socket_udp_mc_recv, waiting for it; returns its
+ * length (cut to len), SOCKET_ERROR on error
+ */
+int32_t xxdp_recv(xxdp *x, void *data, int32_t len);
+
+/* hand up to max waiting payloads (0 for all in the ring) to cb without
+ * copying; returns the number of payloads, does not wait
+ */
+int32_t xxdp_poll(xxdp *x, xxdp_frame_cb cb, void *user, int32_t max);
+
+/* the AF_XDP socket, readable when payloads wait, for epoll or an xloop
+ */
+socket_t xxdp_fd(xxdp *x);
+
+void xxdp_get_stats(xxdp *x, xxdp_stats *stats);
+
+/* detach the program and release the socket and memory
+ */
+void xxdp_close(xxdp *x);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // __XXDP_H__